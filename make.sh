@@ -13,7 +13,18 @@ ELYSIA_SOURCES_BACKEND_NASM=(
     "./src/elysia_types.c"
     "./src/elysia_lexer.c"
     "./src/elysia_compiler.c"
+    "./src/elysia_optimizer.c"
+    "./src/elysia_comptime.c"
+    "./src/elysia_emitter.c"
     "./src/elysia_compiler_backend_x86_64_nasm.c"
+    "./src/elysia_x86_64_encoder.c"
+    "./src/elysia_elf.c"
+    "./src/elysia_linker.c"
+    "./src/elysia_jit.c"
+    "./src/elysia_compiler_backend_bytecode.c"
+    "./src/elysia_vm.c"
+    "./src/elysia_compiler_backend_baseline.c"
+    "./src/elysia_compiler_backend_c.c"
 
     "./src/main.c"
 )
@@ -60,7 +71,18 @@ ELYSIA_SOURCES_BACKEND_QBE=(
     "./src/elysia_types.c"
     "./src/elysia_lexer.c"
     "./src/elysia_compiler.c"
+    "./src/elysia_optimizer.c"
+    "./src/elysia_comptime.c"
+    "./src/elysia_emitter.c"
     "./src/elysia_compiler_backend_qbe.c"
+    "./src/elysia_compiler_backend_bytecode.c"
+    "./src/elysia_vm.c"
+    "./src/elysia_compiler_backend_baseline.c"
+    "./src/elysia_compiler_backend_c.c"
+    "./src/elysia_x86_64_encoder.c"
+    "./src/elysia_elf.c"
+    "./src/elysia_linker.c"
+    "./src/elysia_jit.c"
     "./src/main.c"
 )
 
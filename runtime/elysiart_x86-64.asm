@@ -14,7 +14,8 @@ exit:
     ret
 
 _start:
-    mov rdi, 0
+    mov edi, [rsp]
+    lea rsi, [rsp+8]
     call main
     mov rdi, rax
     call exit
@@ -16,6 +16,7 @@ static const Stmt_Info stmt_infos[COUNT_STMTS] = {
     [STMT_EXPR] = { .name = "Expression Statement", .type = STMT_EXPR },
     [STMT_IF] = { .name = "If Statement", .type = STMT_IF }, 
     [STMT_WHILE] = { .name = "While Block", .type = STMT_WHILE },
+    [STMT_SWITCH] = { .name = "Switch Statement", .type = STMT_SWITCH },
 };
 
 typedef struct Expr_Info {
@@ -117,6 +118,36 @@ void push_fdef_to_module(Arena *arena, Module *module, Func_Def fdef)
     module->functions.data[module->functions.count++] = fdef;
 }
 
+void push_range_to_case_range_list(Arena *arena, Case_Range_List *list, Case_Range range)
+{
+    if(list->count >= list->capacity) {
+        size_t new_capacity = list->capacity * 2;
+        if(new_capacity == 0) new_capacity = 32;
+        void *new_data = arena_alloc(arena, new_capacity * sizeof(*list->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, list->data, list->count * sizeof(*list->data));
+        list->data = new_data;
+        list->capacity = new_capacity;
+    }
+
+    list->data[list->count++] = range;
+}
+
+void push_case_to_switch_case_list(Arena *arena, Switch_Case_List *list, Switch_Case _case)
+{
+    if(list->count >= list->capacity) {
+        size_t new_capacity = list->capacity * 2;
+        if(new_capacity == 0) new_capacity = 32;
+        void *new_data = arena_alloc(arena, new_capacity * sizeof(*list->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, list->data, list->count * sizeof(*list->data));
+        list->data = new_data;
+        list->capacity = new_capacity;
+    }
+
+    list->data[list->count++] = _case;
+}
+
 #define DUMP_PREFIX ' '
 #define DUMP(depth, ...) prefix_print(DUMP_PREFIX, depth, __VA_ARGS__)
 
@@ -124,6 +155,17 @@ void push_fdef_to_module(Arena *arena, Module *module, Func_Def fdef)
 void dump_func_def(const Func_Def *func_def, size_t depth)
 {
     DUMP(depth, "Function Definition: "SV_FMT"\n", SV_ARGV(func_def->name));
+    if(func_def->is_pub) {
+        DUMP(depth + 1, "Public\n");
+    }
+    if(func_def->inline_hint == FUNC_INLINE_ALWAYS) {
+        DUMP(depth + 1, "Inline: always\n");
+    } else if(func_def->inline_hint == FUNC_INLINE_NEVER) {
+        DUMP(depth + 1, "Inline: never\n");
+    }
+    if(func_def->is_comptime) {
+        DUMP(depth + 1, "Comptime\n");
+    }
     DUMP(depth + 1, "Return type: ");
     dump_parsed_type(&func_def->return_type);
     putchar('\n');
@@ -210,6 +252,29 @@ void dump_stmt(const Stmt *stmt, size_t depth)
                     dump_stmt(&stmt, depth + 2);
                 }
             } break;
+        case STMT_SWITCH:
+            {
+                const Stmt_Switch *_switch = &stmt->as._switch;
+                for(size_t i = 0; i < _switch->cases.count; ++i) {
+                    const Switch_Case *_case = &_switch->cases.data[i];
+                    DUMP(depth + 1, "Case:");
+                    for(size_t j = 0; j < _case->ranges.count; ++j) {
+                        if(_case->ranges.data[j].low == _case->ranges.data[j].high) {
+                            printf(" %ld", _case->ranges.data[j].low);
+                        } else {
+                            printf(" %ld..%ld", _case->ranges.data[j].low, _case->ranges.data[j].high);
+                        }
+                    }
+                    putchar('\n');
+                    for(size_t j = 0; j < _case->todo.count; ++j)
+                        dump_stmt(&_case->todo.data[j], depth + 2);
+                }
+                if(_switch->_default.count > 0) {
+                    DUMP(depth + 1, "Default:\n");
+                    for(size_t j = 0; j < _switch->_default.count; ++j)
+                        dump_stmt(&_switch->_default.data[j], depth + 2);
+                }
+            } break;
         default:
             {
 
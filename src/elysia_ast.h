@@ -70,7 +70,7 @@ struct Expr_Binary_Op {
 typedef enum {
     STMT_UNKNOWN = 0,
     STMT_RETURN, STMT_VAR_ASSIGN, STMT_VAR_DEF, STMT_VAR_INIT, STMT_EXPR,
-    STMT_IF, STMT_WHILE,
+    STMT_IF, STMT_WHILE, STMT_SWITCH,
 
     COUNT_STMTS,
 } Stmt_Type;
@@ -82,6 +82,7 @@ typedef struct Stmt_Var_Init Stmt_Var_Init;
 typedef struct Stmt_Var_Assign Stmt_Var_Assign;
 typedef struct Stmt_While Stmt_While;
 typedef struct Stmt_If Stmt_If;
+typedef struct Stmt_Switch Stmt_Switch;
 
 typedef union Stmt_As Stmt_As;
 typedef struct {
@@ -125,6 +126,37 @@ struct Stmt_If {
     Block _else;
 };
 
+// Inclusive range of values matched by a case, a single value `case 3` has `low == high`
+typedef struct {
+    int64_t low;
+    int64_t high;
+} Case_Range;
+
+typedef struct {
+    Case_Range *data;
+    size_t count, capacity;
+} Case_Range_List;
+
+typedef struct {
+    Location loc;
+    Case_Range_List ranges;
+    Block todo;
+} Switch_Case;
+
+typedef struct {
+    Switch_Case *data;
+    size_t count, capacity;
+} Switch_Case_List;
+
+// switch value { case 1, 2 { ... } case 10..20 { ... } else { ... } }
+// The cases never overlap so the order they are tested in doesn't matter
+struct Stmt_Switch {
+    Location loc;
+    Expr value;
+    Switch_Case_List cases;
+    Block _default;
+};
+
 union Stmt_As {
     Stmt_Return _return;
     Stmt_Var_Def var_def;
@@ -132,6 +164,7 @@ union Stmt_As {
     Stmt_Var_Init var_init;
     Stmt_While _while;
     Stmt_If _if;
+    Stmt_Switch _switch;
     Expr expr;
 };
 
@@ -152,12 +185,25 @@ typedef struct {
     size_t count, capacity;
 } Func_Param_List;
 
+typedef enum {
+    FUNC_INLINE_DEFAULT = 0,
+    FUNC_INLINE_ALWAYS,
+    FUNC_INLINE_NEVER,
+} Func_Inline_Hint;
+
 typedef struct {
     Location loc;
     String_View name;
     Func_Param_List params;
     Data_Type return_type;
     Block body;
+    Func_Inline_Hint inline_hint;
+    // Visible outside of the module, always called with the System V ABI
+    bool is_pub;
+    // Calls with constant arguments must be evaluated at compile time
+    bool is_comptime;
+    // Bytes of source from the start of the definition to the next one
+    size_t source_size;
 } Func_Def;
 
 typedef struct {
@@ -173,6 +219,8 @@ void push_param_to_param_list(Arena *arena, Func_Param_List *params, Func_Param
 void push_expr_to_expr_list(Arena *arena, Expr_List *list, Expr expr);
 void push_stmt_to_block(Arena *arena, Block *block, Stmt stmt);
 void push_fdef_to_module(Arena *arena, Module *module, Func_Def fdef);
+void push_range_to_case_range_list(Arena *arena, Case_Range_List *list, Case_Range range);
+void push_case_to_switch_case_list(Arena *arena, Switch_Case_List *list, Switch_Case _case);
 Binary_Op_Type binary_op_type_from_token_type(Token_Type type);
 
 void dump_func_def(const Func_Def *func_def, size_t depth);
@@ -0,0 +1,127 @@
+#ifndef ELYSIA_BYTECODE_H_
+#define ELYSIA_BYTECODE_H_
+
+#include "elysia.h"
+#include "elysia_compiler.h"
+
+// Registers of every active frame and the frames themselves, running out of either is a stack overflow
+#define ELYSIA_VM_STACK_REGISTERS (1024*1024)
+#define ELYSIA_VM_MAX_FRAMES (64*1024)
+// Registers are addressed with 16 bits
+#define ELYSIA_BYTECODE_MAX_REGISTERS 65536
+
+// `a`, `b` and `c` are registers of the current frame unless said otherwise. Scalars take a register
+// each, values narrower than 64 bits are kept sign-extended from 32 bits like the x86-64 backend keeps
+// them in eax and 8 and 16 bit values are only truncated when stored into variables. Vectors take
+// `size / 8` registers in a row, their shape `lane size | lanes << 8` is in `imm`
+typedef enum {
+    BYTECODE_OP_MOVI = 0,   // a = imm
+    BYTECODE_OP_MOV,        // a = b
+    BYTECODE_OP_MOVV,       // c registers from b to a
+    BYTECODE_OP_TRUNC_U8,   // a = b truncated to 8 or 16 bits, zero or sign extended back
+    BYTECODE_OP_TRUNC_I8,
+    BYTECODE_OP_TRUNC_U16,
+    BYTECODE_OP_TRUNC_I16,
+    BYTECODE_OP_ADD32,      // a = b op c, wrapping at 32 or 64 bits
+    BYTECODE_OP_SUB32,
+    BYTECODE_OP_MUL32,
+    BYTECODE_OP_ADD64,
+    BYTECODE_OP_SUB64,
+    BYTECODE_OP_MUL64,
+    BYTECODE_OP_ADDI32,     // a = b + imm, increments of variables become a single instruction
+    BYTECODE_OP_ADDI64,
+    BYTECODE_OP_EQ,         // a = b op c as a boolean, `>` and `>=` swap their operands
+    BYTECODE_OP_NE,
+    BYTECODE_OP_LT,
+    BYTECODE_OP_LE,
+    BYTECODE_OP_LTU32,
+    BYTECODE_OP_LEU32,
+    BYTECODE_OP_LTU64,
+    BYTECODE_OP_LEU64,
+    BYTECODE_OP_VADD,       // a = b op c lane-wise, comparisons set every bit of the lanes where they hold
+    BYTECODE_OP_VSUB,
+    BYTECODE_OP_VMUL,
+    BYTECODE_OP_VCMPEQ,
+    BYTECODE_OP_VCMPGT,
+    BYTECODE_OP_VSPLAT,     // Every lane of a = scalar b
+    BYTECODE_OP_VINSERT,    // a = b with lane `imm >> 16` replaced by scalar c
+    BYTECODE_OP_VLANE,      // Lane `imm >> 16` of a = lane `imm >> 24` of b
+    BYTECODE_OP_VEXTRACT,   // Scalar a = lane `imm >> 16` of b
+    BYTECODE_OP_VREDUCE,    // Scalar a = wrapping sum of the lanes of b
+    BYTECODE_OP_CALL,       // Function `imm` with its frame starting at register c, the result goes into a
+    BYTECODE_OP_TAILCALL,   // Function `imm` in place of the current one, its c parameter registers are moved from b
+    BYTECODE_OP_RET,        // Returns c registers starting at a
+    BYTECODE_OP_SWITCH,     // Jumps to the case of a in the switch table `imm`
+    // Every jump goes `offset` instructions forward from itself
+    BYTECODE_OP_JMP,
+    BYTECODE_OP_JZ,
+    BYTECODE_OP_JNZ,
+    BYTECODE_OP_JEQ,        // Jumps when a op b, compare and branch in a single instruction
+    BYTECODE_OP_JNE,
+    BYTECODE_OP_JLT,
+    BYTECODE_OP_JLE,
+    BYTECODE_OP_JLTU32,
+    BYTECODE_OP_JLEU32,
+    BYTECODE_OP_JLTU64,
+    BYTECODE_OP_JLEU64,
+    BYTECODE_OP_JEQI,       // Jumps when a op imm, signed
+    BYTECODE_OP_JNEI,
+    BYTECODE_OP_JLTI,
+    BYTECODE_OP_JLEI,
+    BYTECODE_OP_JGTI,
+    BYTECODE_OP_JGEI,
+    COUNT_BYTECODE_OPS,
+} Bytecode_Op;
+
+typedef struct {
+    uint16_t op;
+    uint16_t a, b, c;
+    int32_t imm;
+    int32_t offset;
+} Bytecode_Inst;
+
+// Ranges of a switch sorted by value, dense switches also get a table of the case of every value
+// from the low end of the first range
+typedef struct {
+    Switch_Range *ranges;
+    size_t ranges_count;
+    // Jump of every case from the SWITCH instruction followed by the one of the default
+    int32_t *offsets;
+    size_t cases_count;
+    // Case index of every value, `cases_count` for the values going to the default
+    uint16_t *table;
+    size_t table_count;
+    // 32-bit unsigned values are compared zero-extended
+    bool is_unsigned;
+} Bytecode_Switch;
+
+typedef struct {
+    String_View name;
+    struct {
+        Bytecode_Inst *data;
+        size_t count, capacity;
+    } code;
+    // Parameters come first so the arguments of a call are the first registers of the callee's frame
+    size_t params_count;
+    size_t registers_count;
+} Bytecode_Fn;
+
+typedef struct {
+    Arena *arena;
+    // Indexed like the functions of the evaluated module
+    struct {
+        Bytecode_Fn *data;
+        size_t count;
+    } functions;
+    struct {
+        Bytecode_Switch *data;
+        size_t count, capacity;
+    } switches;
+} Bytecode_Module;
+
+// Only `tail_calls` of the options applies to bytecode
+void compile_module_to_bytecode(Bytecode_Module *bytecode, Evaluated_Module *module, const Compile_Options *options);
+// Calls `main` with the arguments, returns what it returned
+int interpret_bytecode_module(const Bytecode_Module *bytecode, int argc, char **argv);
+
+#endif // ELYSIA_BYTECODE_H_
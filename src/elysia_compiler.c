@@ -4,6 +4,52 @@
 #include "sv.h"
 #include "elysia_compiler.h"
 #include <stdio.h>
+#include <stdlib.h>
+
+static Data_Type native_data_type(Native_Type type, Location loc)
+{
+    Native_Type_Info info = get_native_type_info(type);
+    Data_Type result = {0};
+    result.name = info.name;
+    result.loc = loc;
+    result.is_ptr = false;
+    result.is_array = false;
+    result.array_len = 0;
+    result.is_native = true;
+    result.as.native = type;
+    result.bytesize = 0;
+    return result;
+}
+
+static const String_View builtin_fn_names[COUNT_BUILTINS] = {
+    [BUILTIN_VEXTRACT] = SV_STATIC("vextract"),
+    [BUILTIN_VINSERT] = SV_STATIC("vinsert"),
+    [BUILTIN_VSHUFFLE] = SV_STATIC("vshuffle"),
+    [BUILTIN_VCMPEQ] = SV_STATIC("vcmpeq"),
+    [BUILTIN_VCMPGT] = SV_STATIC("vcmpgt"),
+    [BUILTIN_VREDUCE_ADD] = SV_STATIC("vreduce_add"),
+};
+
+Builtin_Fn find_builtin_fn(String_View name)
+{
+    for(Builtin_Fn builtin = BUILTIN_UNKNOWN + 1; builtin < COUNT_BUILTINS; ++builtin) {
+        if(sv_eq(name, builtin_fn_names[builtin])) {
+            return builtin;
+        }
+    }
+    return BUILTIN_UNKNOWN;
+}
+
+const Func_Def *find_func_def(const Evaluated_Module *module, String_View name)
+{
+    for(size_t i = 0; i < module->source->functions.count; ++i) {
+        const Func_Def *fdef = &module->source->functions.data[i];
+        if(sv_eq(name, fdef->name)) {
+            return fdef;
+        }
+    }
+    return NULL;
+}
 
 const Evaluated_Var *get_var_from_scope(const Scope *scope, String_View name)
 {
@@ -51,6 +97,51 @@ bool emplace_fn_to_module(Evaluated_Module *module, const Func_Def def)
     return true;
 }
 
+static int compare_switch_ranges(const void *a, const void *b)
+{
+    const Switch_Range *x = a;
+    const Switch_Range *y = b;
+    if(x->low != y->low) return x->low < y->low ? -1 : 1;
+    return 0;
+}
+
+void lower_switch(const Stmt_Switch *_switch, Switch_Lowering *result)
+{
+    result->count = 0;
+    for(size_t i = 0; i < _switch->cases.count; ++i) {
+        const Switch_Case *_case = &_switch->cases.data[i];
+        for(size_t j = 0; j < _case->ranges.count; ++j) {
+            if(result->count >= ELYSIA_SWITCH_RANGES_CAPACITY) {
+                compilation_error(_case->loc, "A switch can't have more than %d cases\n", ELYSIA_SWITCH_RANGES_CAPACITY);
+                compilation_failure();
+            }
+            result->ranges[result->count].low = _case->ranges.data[j].low;
+            result->ranges[result->count].high = _case->ranges.data[j].high;
+            result->ranges[result->count].target = i;
+            result->count += 1;
+        }
+    }
+    qsort(result->ranges, result->count, sizeof(result->ranges[0]), compare_switch_ranges);
+
+    size_t count = 0;
+    for(size_t i = 0; i < result->count; ++i) {
+        Switch_Range *prev = count > 0 ? &result->ranges[count - 1] : NULL;
+        if(prev && prev->target == result->ranges[i].target && prev->high + 1 == result->ranges[i].low) {
+            prev->high = result->ranges[i].high;
+        } else {
+            result->ranges[count++] = result->ranges[i];
+        }
+    }
+    result->count = count;
+
+    result->use_jump_table = false;
+    if(result->count >= ELYSIA_JUMP_TABLE_MIN_RANGES) {
+        uint64_t entries = (uint64_t)(result->ranges[result->count - 1].high - result->ranges[0].low) + 1;
+        result->use_jump_table = entries <= ELYSIA_JUMP_TABLE_MAX_ENTRIES
+            && entries <= (uint64_t)result->count * ELYSIA_JUMP_TABLE_MAX_ENTRIES_PER_RANGE;
+    }
+}
+
 void eval_stmt(Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Stmt stmt)
 {
     switch(stmt.type) {
@@ -81,15 +172,74 @@ void eval_stmt(Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const S
         case STMT_VAR_ASSIGN:
             {
                 const Evaluated_Var *var = get_var_from_scope(scope, stmt.as.var_assign.name);
+                if(var == NULL) {
+                    compilation_error(stmt.loc, "Assigning value to unknown variable `"SV_FMT"`\n", 
+                            SV_ARGV(stmt.as.var_assign.name));
+                }
                 Data_Type variable_type = eval_expr(module, scope, &stmt.as.var_assign.value);
-                if(compare_data_type(&variable_type, &stmt.as.var_init.type) != DATA_TYPE_CMP_EQUAL) {
+                if(compare_data_type(&variable_type, &var->type) != DATA_TYPE_CMP_EQUAL) {
                     compilation_type_error(stmt.loc, &variable_type, &var->type, " while assigning value to variable "SV_FMT, 
                             SV_ARGV(stmt.as.var_assign.name));
                 }
             } break;
         case STMT_WHILE:
             {
+                eval_expr(module, scope, &stmt.as._while.condition);
+                for(size_t i = 0; i < stmt.as._while.todo.count; ++i) 
+                    eval_stmt(module, fn, scope, stmt.as._while.todo.data[i]);
+            } break;
+        case STMT_IF:
+            {
+                for(const Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif) {
+                    eval_expr(module, scope, &branch->condition);
+                    for(size_t i = 0; i < branch->todo.count; ++i)
+                        eval_stmt(module, fn, scope, branch->todo.data[i]);
+                }
+                for(size_t i = 0; i < stmt.as._if._else.count; ++i)
+                    eval_stmt(module, fn, scope, stmt.as._if._else.data[i]);
+            } break;
+        case STMT_SWITCH:
+            {
+                const Stmt_Switch *_switch = &stmt.as._switch;
+                Data_Type value_type = eval_expr(module, scope, &_switch->value);
+                if(!value_type.is_native || value_type.is_ptr || is_vector_data_type(&value_type)
+                        || value_type.as.native == NATIVE_TYPE_VOID) {
+                    compilation_error(_switch->value.loc, "Can't switch over a value of type `"SV_FMT"`\n", SV_ARGV(value_type.name));
+                    compilation_failure();
+                }
+                for(size_t i = 0; i < _switch->cases.count; ++i) {
+                    const Switch_Case *_case = &_switch->cases.data[i];
+                    for(size_t j = 0; j < _case->ranges.count; ++j) {
+                        const Case_Range *range = &_case->ranges.data[j];
+                        if(range->low > range->high) {
+                            compilation_error(_case->loc, "Empty case range %ld..%ld\n", range->low, range->high);
+                            compilation_failure();
+                        }
+                        // Case values are encoded as 32-bit immediates
+                        if(range->low < INT32_MIN || range->high > INT32_MAX) {
+                            compilation_error(_case->loc, "Case value doesn't fit into 32 bits\n");
+                            compilation_failure();
+                        }
+                    }
+                    for(size_t j = 0; j < _case->todo.count; ++j)
+                        eval_stmt(module, fn, scope, _case->todo.data[j]);
+                }
+                for(size_t i = 0; i < _switch->_default.count; ++i)
+                    eval_stmt(module, fn, scope, _switch->_default.data[i]);
 
+                Switch_Lowering lowering;
+                lower_switch(_switch, &lowering);
+                for(size_t i = 1; i < lowering.count; ++i) {
+                    if(lowering.ranges[i].low <= lowering.ranges[i - 1].high) {
+                        compilation_error(_switch->cases.data[lowering.ranges[i].target].loc,
+                                "Case value %ld is already handled by another case\n", lowering.ranges[i].low);
+                        compilation_failure();
+                    }
+                }
+            } break;
+        case STMT_EXPR:
+            {
+                eval_expr(module, scope, &stmt.as.expr);
             } break;
         case STMT_RETURN:
             {
@@ -113,10 +263,17 @@ void eval_func_def(Evaluated_Module *module, const Func_Def fdef)
 {
     Evaluated_Fn result;
     result.has_return_stmt = false;
+    result.labels_count = 0;
+    result.temps_count = 0;
     result.def = fdef;
     result.scope.vars.count = 0;
     result.scope.stack_usage = 0;
     result.scope.parent = &module->global;
+    for(size_t i = 0; i < fdef.params.count; ++i) {
+        Data_Type param_type = fdef.params.data[i].type;
+        emplace_var_to_scope(&result.scope, fdef.params.data[i].name, param_type, result.scope.stack_usage);
+        result.scope.stack_usage += get_data_type_size(&param_type);
+    }
     for(size_t i = 0; i < fdef.body.count; ++i) 
         eval_stmt(module, &result, &result.scope, fdef.body.data[i]);
     if(!result.has_return_stmt) {
@@ -128,28 +285,163 @@ void eval_func_def(Evaluated_Module *module, const Func_Def fdef)
     push_fn_to_module(module, result);
 }
 
+static void expect_args_count(const Expr *expr, size_t count)
+{
+    if(expr->as.func_call.args.count != count) {
+        compilation_error(expr->loc, "Function `"SV_FMT"` expects %zu arguments but got %zu\n",
+                SV_ARGV(expr->as.func_call.name), count, expr->as.func_call.args.count);
+        compilation_failure();
+    }
+}
+
+static Data_Type eval_vector_expr(Evaluated_Module *module, const Scope *scope, const Expr *expr)
+{
+    Data_Type result = eval_expr(module, scope, expr);
+    if(!is_vector_data_type(&result)) {
+        compilation_error(expr->loc, "Expecting a vector but found `"SV_FMT"`\n", SV_ARGV(result.name));
+        compilation_failure();
+    }
+    return result;
+}
+
+static void eval_lane_index(const Expr *expr, Native_Type_Info info)
+{
+    if(expr->type != EXPR_INTEGER_LITERAL || expr->as.literal_int < 0 || (size_t)expr->as.literal_int >= info.lanes) {
+        compilation_error(expr->loc, "Lane index of `"SV_FMT"` must be an integer literal between 0 and %zu\n",
+                SV_ARGV(info.name), info.lanes - 1);
+        compilation_failure();
+    }
+}
+
+static void eval_lane_value(Evaluated_Module *module, const Scope *scope, const Expr *expr, Native_Type_Info info)
+{
+    // Integer literals are truncated to the lane type
+    if(expr->type == EXPR_INTEGER_LITERAL) return;
+    Data_Type lane_type = native_data_type(info.lane_type, expr->loc);
+    Data_Type value_type = eval_expr(module, scope, expr);
+    if(compare_data_type(&lane_type, &value_type) != DATA_TYPE_CMP_EQUAL) {
+        compilation_type_error(expr->loc, &lane_type, &value_type, "for a lane of `"SV_FMT"`\n", SV_ARGV(info.name));
+    }
+}
+
+static Data_Type eval_func_call(Evaluated_Module *module, const Scope *scope, const Expr *expr)
+{
+    const Expr_Func_Call *call = &expr->as.func_call;
+    Native_Type_Info *vector = find_native_type_info_by_name(call->name);
+    if(vector && vector->lanes > 0) {
+        if(call->args.count != 1 && call->args.count != vector->lanes) {
+            compilation_error(expr->loc, "Vector `"SV_FMT"` is constructed from 1 or %zu lanes but got %zu\n",
+                    SV_ARGV(vector->name), vector->lanes, call->args.count);
+            compilation_failure();
+        }
+        for(size_t i = 0; i < call->args.count; ++i)
+            eval_lane_value(module, scope, &call->args.data[i], *vector);
+        return native_data_type(vector->type, expr->loc);
+    }
+
+    Data_Type result = {0};
+    switch(find_builtin_fn(call->name)) {
+        case BUILTIN_VEXTRACT:
+            {
+                expect_args_count(expr, 2);
+                Data_Type vector_type = eval_vector_expr(module, scope, &call->args.data[0]);
+                Native_Type_Info info = get_native_type_info(vector_type.as.native);
+                eval_lane_index(&call->args.data[1], info);
+                result = native_data_type(info.lane_type, expr->loc);
+            } break;
+        case BUILTIN_VINSERT:
+            {
+                expect_args_count(expr, 3);
+                result = eval_vector_expr(module, scope, &call->args.data[0]);
+                Native_Type_Info info = get_native_type_info(result.as.native);
+                eval_lane_index(&call->args.data[1], info);
+                eval_lane_value(module, scope, &call->args.data[2], info);
+            } break;
+        case BUILTIN_VSHUFFLE:
+            {
+                if(call->args.count < 1) expect_args_count(expr, 1);
+                result = eval_vector_expr(module, scope, &call->args.data[0]);
+                Native_Type_Info info = get_native_type_info(result.as.native);
+                expect_args_count(expr, info.lanes + 1);
+                for(size_t i = 1; i < call->args.count; ++i)
+                    eval_lane_index(&call->args.data[i], info);
+            } break;
+        case BUILTIN_VCMPEQ:
+        case BUILTIN_VCMPGT:
+            {
+                expect_args_count(expr, 2);
+                result = eval_vector_expr(module, scope, &call->args.data[0]);
+                Data_Type other = eval_vector_expr(module, scope, &call->args.data[1]);
+                if(compare_data_type(&result, &other) != DATA_TYPE_CMP_EQUAL) {
+                    compilation_type_error(call->args.data[1].loc, &result, &other, "while comparing vectors\n");
+                }
+            } break;
+        case BUILTIN_VREDUCE_ADD:
+            {
+                expect_args_count(expr, 1);
+                Data_Type vector_type = eval_vector_expr(module, scope, &call->args.data[0]);
+                result = native_data_type(get_native_type_info(vector_type.as.native).lane_type, expr->loc);
+            } break;
+        default:
+            {
+                const Func_Def *fdef = find_func_def(module, call->name);
+                if(fdef == NULL) {
+                    compilation_error(expr->loc, "Calling unknown function `"SV_FMT"`\n", SV_ARGV(call->name));
+                    compilation_failure();
+                }
+                expect_args_count(expr, fdef->params.count);
+                for(size_t i = 0; i < call->args.count; ++i) {
+                    Data_Type arg_type = eval_expr(module, scope, &call->args.data[i]);
+                    if(compare_data_type(&fdef->params.data[i].type, &arg_type) != DATA_TYPE_CMP_EQUAL) {
+                        compilation_type_error(call->args.data[i].loc, &fdef->params.data[i].type, &arg_type,
+                                "for the argument `"SV_FMT"` of function `"SV_FMT"`\n",
+                                SV_ARGV(fdef->params.data[i].name), SV_ARGV(fdef->name));
+                    }
+                }
+                result = fdef->return_type;
+            } break;
+    }
+    return result;
+}
+
 Data_Type eval_expr(Evaluated_Module *module, const Scope *scope, const Expr *expr)
 {
     Data_Type result = {0};
     switch(expr->type) {
         case EXPR_INTEGER_LITERAL:
             {
-                Native_Type_Info info = get_native_type_info(NATIVE_TYPE_I32);
-                result.name = info.name;
-                result.loc = expr->loc;
-                result.is_ptr = false;
-                result.is_array = false;
-                result.array_len = 0;
-                result.is_native = true;
-                result.as.native = NATIVE_TYPE_I32;
-                result.bytesize = 0;
+                result = native_data_type(NATIVE_TYPE_I32, expr->loc);
+            } break;
+        case EXPR_BOOL_LITERAL:
+            {
+                result = native_data_type(NATIVE_TYPE_BOOL, expr->loc);
             } break;
         case EXPR_BINARY_OP:
             {
                 Data_Type leftdt = eval_expr(module, scope, &expr->as.binop->left);
                 // Data_Type rightdt = eval_expr(module, scope, &expr->as.binop->right);
+                result = leftdt;
+                if(is_vector_data_type(&leftdt)) {
+                    Data_Type rightdt = eval_expr(module, scope, &expr->as.binop->right);
+                    if(compare_data_type(&leftdt, &rightdt) != DATA_TYPE_CMP_EQUAL) {
+                        compilation_type_error(expr->loc, &leftdt, &rightdt, "for the right operand of a vector operation\n");
+                    }
+                    Binary_Op_Type type = expr->as.binop->type;
+                    if(type != BINARY_OP_ADD && type != BINARY_OP_SUB && type != BINARY_OP_MUL) {
+                        compilation_error(expr->loc, "Vectors only support `+`, `-` and `*`, use vcmpeq/vcmpgt to compare them\n");
+                        compilation_failure();
+                    }
+                    // There is no lane-wise 8-bit or 64-bit multiplication on x86-64 before AVX-512
+                    if(type == BINARY_OP_MUL && leftdt.as.native != NATIVE_TYPE_V4I32 && leftdt.as.native != NATIVE_TYPE_V8I32) {
+                        compilation_error(expr->loc, "Multiplication of `"SV_FMT"` is not supported\n", SV_ARGV(leftdt.name));
+                        compilation_failure();
+                    }
+                    break;
+                }
                 switch(expr->as.binop->type) {
                     case BINARY_OP_ADD:
+                    case BINARY_OP_SUB:
+                    case BINARY_OP_MUL:
                         {
                             if(leftdt.is_ptr) {
                                 compilation_error(expr->loc, 
@@ -158,12 +450,35 @@ Data_Type eval_expr(Evaluated_Module *module, const Scope *scope, const Expr *ex
                                 compilation_failure();
                             }
                         } break;
+                    case BINARY_OP_EQ:
+                    case BINARY_OP_NE:
+                    case BINARY_OP_LT:
+                    case BINARY_OP_LE:
+                    case BINARY_OP_GT:
+                    case BINARY_OP_GE:
+                        {
+                            result = native_data_type(NATIVE_TYPE_BOOL, expr->loc);
+                        } break;
+                    case BINARY_OP_AND:
+                    case BINARY_OP_OR:
+                        {
+                            // Both operands are tested for truth, the right one only when the left
+                            // one didn't decide the result already
+                            Data_Type bool_type = native_data_type(NATIVE_TYPE_BOOL, expr->loc);
+                            Data_Type rightdt = eval_expr(module, scope, &expr->as.binop->right);
+                            if(compare_data_type(&bool_type, &leftdt) != DATA_TYPE_CMP_EQUAL) {
+                                compilation_type_error(expr->as.binop->left.loc, &bool_type, &leftdt, "for the left operand of a logical operation\n");
+                            }
+                            if(compare_data_type(&bool_type, &rightdt) != DATA_TYPE_CMP_EQUAL) {
+                                compilation_type_error(expr->as.binop->right.loc, &bool_type, &rightdt, "for the right operand of a logical operation\n");
+                            }
+                            result = bool_type;
+                        } break;
                     default:
                         {
                             compilation_error(expr->loc, "Failed to evaluate expression's result data type\n");
                             compilation_failure();
                         } break;
-                result = leftdt;
                 }
             } break;
         case EXPR_VAR_READ:
@@ -175,6 +490,10 @@ Data_Type eval_expr(Evaluated_Module *module, const Scope *scope, const Expr *ex
                 }
                 result = var->type;
             } break;
+        case EXPR_FUNCALL:
+            {
+                result = eval_func_call(module, scope, expr);
+            } break;
         default:
             {
                 compilation_error(expr->loc, "Unevaluated expression\n");
@@ -186,6 +505,8 @@ Data_Type eval_expr(Evaluated_Module *module, const Scope *scope, const Expr *ex
 
 bool eval_module(Evaluated_Module *result, const Module *module)
 {
+    result->source = module;
+    result->functions.count = 0;
     for(size_t i = 0; i < module->functions.count; ++i) 
         eval_func_def(result, module->functions.data[i]);
     return true;
@@ -6,6 +6,115 @@
 
 #define ELYSIA_SCOPE_VARS_CAPACITY 1024
 #define ELYSIA_MODULE_FUNCTIONS_CAPACITY 1024
+#define ELYSIA_SWITCH_RANGES_CAPACITY 1024
+// A switch needs at least this many ranges before a jump table pays for its bounds check and the
+// indirect jump, and the table may have at most this many entries per range
+#define ELYSIA_JUMP_TABLE_MIN_RANGES 4
+#define ELYSIA_JUMP_TABLE_MAX_ENTRIES_PER_RANGE 3
+#define ELYSIA_JUMP_TABLE_MAX_ENTRIES 4096
+// Leaves of the binary search over the ranges of a sparse switch test this many ranges in a row
+#define ELYSIA_SWITCH_LINEAR_RANGES 3
+
+typedef enum {
+    TARGET_FEATURES_SCALAR = 0,
+    TARGET_FEATURES_SSE2,
+    TARGET_FEATURES_AVX2,
+    COUNT_TARGET_FEATURES,
+} Target_Features;
+
+typedef enum {
+    // The backend's own output: QBE IR or NASM assembly
+    OUTPUT_KIND_IR = 0,
+    // Assembly, produced by QBE in the same invocation for the QBE backend
+    OUTPUT_KIND_ASM,
+    // ELF object file, the QBE backend pipes its assembly through the assembler while the
+    // x86-64 backend encodes the instructions itself
+    OUTPUT_KIND_OBJ,
+    // Static executable, the x86-64 backend links it with the embedded runtime itself while
+    // the QBE backend leaves it to the assembler driver and the system C library
+    OUTPUT_KIND_EXE,
+    COUNT_OUTPUT_KINDS,
+} Output_Kind;
+
+typedef enum {
+    // The backend the compiler was built with: QBE or x86-64
+    BACKEND_KIND_NATIVE = 0,
+    // Copies machine code stencils of the bytecode instructions and patches their operands in,
+    // compiles the fastest and optimizes nothing (x86-64 only)
+    BACKEND_KIND_BASELINE,
+    // Portable C left to the system C compiler and its optimizer, the IR is the C source
+    BACKEND_KIND_C,
+    COUNT_BACKEND_KINDS,
+} Backend_Kind;
+
+#define ELYSIA_VERSION "0.1.0"
+
+#define ELYSIA_DEFAULT_QBE_PATH "qbe"
+#define ELYSIA_DEFAULT_ASSEMBLER "cc"
+// Hides the private symbols of partially linked objects
+#define ELYSIA_OBJCOPY "objcopy"
+#define ELYSIA_DEFAULT_C_OPTIMIZATION "-O2"
+// QBE processes compiling shards of a module at once
+#define ELYSIA_QBE_MAX_JOBS 64
+
+typedef struct {
+    Backend_Kind backend;
+    Output_Kind output_kind;
+    // QBE and the assembler driver the IR is piped through when something else than IR is wanted
+    const char *qbe_path;
+    const char *assembler;
+    // Optimization flag the assembler driver compiles the output of the C backend with
+    const char *c_optimization;
+    // Highest x86-64 vector extension the generated code may use
+    Target_Features target_features;
+    // Rewrite the emitted instructions with the peephole optimizer (x86-64 backend only)
+    bool peephole;
+    // Lower calls in tail position into jumps (x86-64 backend only)
+    bool tail_calls;
+    // Let variables with disjoint live ranges share stack slots (x86-64 backend only)
+    bool color_stack_slots;
+    // Report how many functions `run` compiled and how many were never called (x86-64 backend only)
+    bool report_jit;
+    // End the lines of the IR with the place in the compiler they were emitted from (QBE backend only)
+    bool annotate_ir;
+    // Objects and executables are compiled by this many QBE processes at once, each one getting a
+    // shard of the functions (QBE backend only)
+    size_t jobs;
+    // Objects and executables are linked out of an object per function kept in this directory, only
+    // functions whose IR changed since they were cached are compiled again (QBE backend only)
+    const char *cache_dir;
+    // Report how many functions were reused from the cache
+    bool report_cache;
+} Compile_Options;
+
+// Compiler provided functions operating on SIMD vector types. Vector values are constructed by
+// calling the vector type itself e.g. `v4i32(1, 2, 3, 4)` or `v4i32(x)` to splat a scalar
+typedef enum {
+    BUILTIN_UNKNOWN = 0,
+    BUILTIN_VEXTRACT,    // vextract(v, lane): Read a single lane
+    BUILTIN_VINSERT,     // vinsert(v, lane, x): Copy of `v` with a single lane replaced
+    BUILTIN_VSHUFFLE,    // vshuffle(v, i0, i1, ...): Lane k of the result is lane ik of `v`
+    BUILTIN_VCMPEQ,      // vcmpeq(a, b): All bits of a lane are set where the lanes are equal
+    BUILTIN_VCMPGT,      // vcmpgt(a, b): All bits of a lane are set where a's lane is greater
+    BUILTIN_VREDUCE_ADD, // vreduce_add(v): Wrapping sum of every lane
+    COUNT_BUILTINS,
+} Builtin_Fn;
+
+typedef struct {
+    int64_t low;
+    int64_t high;
+    // Index of the case taken for values in [low, high]
+    size_t target;
+} Switch_Range;
+
+// Every range of a switch sorted by value, ranges of the same case next to each other are merged.
+// Dense switches are dispatched through a table indexed by `value - ranges[0].low`, sparse ones
+// with a binary search over the ranges
+typedef struct {
+    Switch_Range ranges[ELYSIA_SWITCH_RANGES_CAPACITY];
+    size_t count;
+    bool use_jump_table;
+} Switch_Lowering;
 
 typedef struct Jump_Target Jump_Target;
 struct Jump_Target {
@@ -36,6 +145,8 @@ typedef struct Evaluated_Fn {
     Func_Def def;
     Scope scope;
     bool has_return_stmt;
+    size_t labels_count;
+    size_t temps_count;
     struct {
         Jump_Target *items;
         size_t count;
@@ -44,6 +155,8 @@ typedef struct Evaluated_Fn {
 } Evaluated_Fn;
 
 typedef struct Evaluated_Module {
+    // Every function definition of the module, used to check calls to functions not evaluated yet
+    const Module *source;
     Scope global;
     struct {
         Evaluated_Fn data[ELYSIA_MODULE_FUNCTIONS_CAPACITY];
@@ -58,11 +171,23 @@ bool push_var_to_scope(Scope *scope, const Evaluated_Var var);
 bool push_fn_to_module(Evaluated_Module *module, const Evaluated_Fn fn);
 bool emplace_fn_to_module(Evaluated_Module *module, const Func_Def def);
 
+Builtin_Fn find_builtin_fn(String_View name);
+const Func_Def *find_func_def(const Evaluated_Module *module, String_View name);
+
+void lower_switch(const Stmt_Switch *_switch, Switch_Lowering *result);
+
 Data_Type eval_expr(Evaluated_Module *module, const Scope *scope, const Expr *expr);
 void eval_stmt(Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Stmt stmt);
 void eval_func_def(Evaluated_Module *module, const Func_Def fdef);
 bool eval_module(Evaluated_Module *result, const Module *module);
 
-void compile_module_to_file(const char *file_path, Evaluated_Module *module);
+void compile_module_to_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options);
+// Compiles the module into memory and calls its `main` in-process, returns what `main` returned
+int run_module(Evaluated_Module *module, const Compile_Options *options, int argc, char **argv);
+// Same as above for the baseline backend, available in every build
+void compile_module_to_baseline_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options);
+int run_module_baseline(Evaluated_Module *module, const Compile_Options *options, int argc, char **argv);
+// Emits C for the assembler driver, available in every build
+void compile_module_to_c_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options);
 
 #endif // ELYSIA_COMPILER_H_
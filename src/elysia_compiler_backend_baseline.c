@@ -0,0 +1,635 @@
+#include "elysia.h"
+#include "elysia_bytecode.h"
+#include "elysia_compiler.h"
+#include "elysia_x86_64.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Results of calls come back in rax, rdx, rcx and rsi, enough for the 32 bytes of the widest vector
+#define BASELINE_RESULT_REGISTERS 4
+// Tail calls leave the arguments below the stack pointer for the callee, within the 128 bytes of the
+// red zone nothing else writes to. Calls with more arguments stay regular calls
+#define BASELINE_TAIL_CALL_MAX_REGISTERS 15
+
+// Machine code of a bytecode instruction with holes for its operands. Registers of the bytecode live
+// in the frame, register i at [rbp - 8*(i+1)], so register holes take rbp displacements. Holes are
+// 32 bits wide and sit at the given offsets, 0 when the stencil has no such hole
+typedef struct {
+    const uint8_t *code;
+    size_t size;
+    uint8_t a, b, c, imm;
+    // rel32 of a jump to another bytecode instruction
+    uint8_t target;
+} Baseline_Stencil;
+
+#define BASELINE_STENCIL(...) .code = (const uint8_t[]){ __VA_ARGS__ }, .size = sizeof((const uint8_t[]){ __VA_ARGS__ })
+#define HOLE 0x00, 0x00, 0x00, 0x00
+
+// `cc` of setcc and jcc
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_BE 0x6
+#define CC_L  0xC
+#define CC_LE 0xE
+#define CC_G  0xF
+#define CC_GE 0xD
+
+#define COMPARE64(cc) { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x3B, 0x85, HOLE, 0x0F, 0x90 | cc, 0xC0, 0x0F, 0xB6, 0xC0, 0x48, 0x89, 0x85, HOLE), .b = 3, .c = 10, .a = 23 }
+#define COMPARE32(cc) { BASELINE_STENCIL(0x8B, 0x85, HOLE, 0x3B, 0x85, HOLE, 0x0F, 0x90 | cc, 0xC0, 0x0F, 0xB6, 0xC0, 0x48, 0x89, 0x85, HOLE), .b = 2, .c = 8, .a = 21 }
+#define JUMP64(cc) { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x3B, 0x85, HOLE, 0x0F, 0x80 | cc, HOLE), .a = 3, .b = 10, .target = 16 }
+#define JUMP32(cc) { BASELINE_STENCIL(0x8B, 0x85, HOLE, 0x3B, 0x85, HOLE, 0x0F, 0x80 | cc, HOLE), .a = 2, .b = 8, .target = 14 }
+#define JUMP_IMM(cc) { BASELINE_STENCIL(0x48, 0x81, 0xBD, HOLE, HOLE, 0x0F, 0x80 | cc, HOLE), .a = 3, .imm = 7, .target = 13 }
+#define JUMP_ZERO(cc) { BASELINE_STENCIL(0x48, 0x83, 0xBD, HOLE, 0x00, 0x0F, 0x80 | cc, HOLE), .a = 3, .target = 10 }
+
+// Instructions of a fixed shape, the others are put together from the smaller stencils below
+static const Baseline_Stencil baseline_stencils[COUNT_BYTECODE_OPS] = {
+    [BYTECODE_OP_MOVI] = { BASELINE_STENCIL(0x48, 0xC7, 0x85, HOLE, HOLE), .a = 3, .imm = 7 },
+    [BYTECODE_OP_MOV] = { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .a = 10 },
+    [BYTECODE_OP_TRUNC_U8] = { BASELINE_STENCIL(0x0F, 0xB6, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .a = 10 },
+    [BYTECODE_OP_TRUNC_I8] = { BASELINE_STENCIL(0x48, 0x0F, 0xBE, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 4, .a = 11 },
+    [BYTECODE_OP_TRUNC_U16] = { BASELINE_STENCIL(0x0F, 0xB7, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .a = 10 },
+    [BYTECODE_OP_TRUNC_I16] = { BASELINE_STENCIL(0x48, 0x0F, 0xBF, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 4, .a = 11 },
+    [BYTECODE_OP_ADD32] = { BASELINE_STENCIL(0x8B, 0x85, HOLE, 0x03, 0x85, HOLE, 0x48, 0x63, 0xC0, 0x48, 0x89, 0x85, HOLE), .b = 2, .c = 8, .a = 18 },
+    [BYTECODE_OP_SUB32] = { BASELINE_STENCIL(0x8B, 0x85, HOLE, 0x2B, 0x85, HOLE, 0x48, 0x63, 0xC0, 0x48, 0x89, 0x85, HOLE), .b = 2, .c = 8, .a = 18 },
+    [BYTECODE_OP_MUL32] = { BASELINE_STENCIL(0x8B, 0x85, HOLE, 0x0F, 0xAF, 0x85, HOLE, 0x48, 0x63, 0xC0, 0x48, 0x89, 0x85, HOLE), .b = 2, .c = 9, .a = 19 },
+    [BYTECODE_OP_ADD64] = { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x03, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .c = 10, .a = 17 },
+    [BYTECODE_OP_SUB64] = { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x2B, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .c = 10, .a = 17 },
+    [BYTECODE_OP_MUL64] = { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x0F, 0xAF, 0x85, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .c = 11, .a = 18 },
+    [BYTECODE_OP_ADDI32] = { BASELINE_STENCIL(0x8B, 0x85, HOLE, 0x05, HOLE, 0x48, 0x63, 0xC0, 0x48, 0x89, 0x85, HOLE), .b = 2, .imm = 7, .a = 17 },
+    [BYTECODE_OP_ADDI64] = { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE, 0x48, 0x05, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .imm = 9, .a = 16 },
+    [BYTECODE_OP_EQ] = COMPARE64(CC_E),
+    [BYTECODE_OP_NE] = COMPARE64(CC_NE),
+    [BYTECODE_OP_LT] = COMPARE64(CC_L),
+    [BYTECODE_OP_LE] = COMPARE64(CC_LE),
+    [BYTECODE_OP_LTU32] = COMPARE32(CC_B),
+    [BYTECODE_OP_LEU32] = COMPARE32(CC_BE),
+    [BYTECODE_OP_LTU64] = COMPARE64(CC_B),
+    [BYTECODE_OP_LEU64] = COMPARE64(CC_BE),
+    [BYTECODE_OP_JMP] = { BASELINE_STENCIL(0xE9, HOLE), .target = 1 },
+    [BYTECODE_OP_JZ] = JUMP_ZERO(CC_E),
+    [BYTECODE_OP_JNZ] = JUMP_ZERO(CC_NE),
+    [BYTECODE_OP_JEQ] = JUMP64(CC_E),
+    [BYTECODE_OP_JNE] = JUMP64(CC_NE),
+    [BYTECODE_OP_JLT] = JUMP64(CC_L),
+    [BYTECODE_OP_JLE] = JUMP64(CC_LE),
+    [BYTECODE_OP_JLTU32] = JUMP32(CC_B),
+    [BYTECODE_OP_JLEU32] = JUMP32(CC_BE),
+    [BYTECODE_OP_JLTU64] = JUMP64(CC_B),
+    [BYTECODE_OP_JLEU64] = JUMP64(CC_BE),
+    [BYTECODE_OP_JEQI] = JUMP_IMM(CC_E),
+    [BYTECODE_OP_JNEI] = JUMP_IMM(CC_NE),
+    [BYTECODE_OP_JLTI] = JUMP_IMM(CC_L),
+    [BYTECODE_OP_JLEI] = JUMP_IMM(CC_LE),
+    [BYTECODE_OP_JGTI] = JUMP_IMM(CC_G),
+    [BYTECODE_OP_JGEI] = JUMP_IMM(CC_GE),
+};
+
+// push rbp; mov rbp, rsp; sub rsp, imm32
+static const Baseline_Stencil baseline_prologue = { BASELINE_STENCIL(0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC, HOLE), .imm = 7 };
+// Parameters are copied from the caller's frame, rdi points at the first one and the others follow downwards
+static const Baseline_Stencil baseline_param = { BASELINE_STENCIL(0x48, 0x8B, 0x87, HOLE, 0x48, 0x89, 0x85, HOLE), .b = 3, .a = 10 };
+// `main` is called by the C runtime with argc in edi and argv in rsi
+static const Baseline_Stencil baseline_main_argc = { BASELINE_STENCIL(0x48, 0x63, 0xC7, 0x48, 0x89, 0x85, HOLE), .a = 6 };
+static const Baseline_Stencil baseline_main_argv = { BASELINE_STENCIL(0x48, 0x89, 0xB5, HOLE), .a = 3 };
+// lea rdi, [rbp+b]; call rel32
+static const Baseline_Stencil baseline_call = { BASELINE_STENCIL(0x48, 0x8D, 0xBD, HOLE, 0xE8, HOLE), .b = 3, .imm = 8 };
+// lea rdi, [rbp-8]; leave; jmp rel32. The callee pushes rbp where it was, so its parameters are
+// already where it copies them to
+static const Baseline_Stencil baseline_tail_call = { BASELINE_STENCIL(0x48, 0x8D, 0x7D, 0xF8, 0xC9, 0xE9, HOLE), .imm = 6 };
+static const Baseline_Stencil baseline_leave = { BASELINE_STENCIL(0xC9, 0xC3) };
+// mov reg, [rbp+a] and mov [rbp+a], reg for rax, rdx, rcx and rsi
+static const Baseline_Stencil baseline_loads[BASELINE_RESULT_REGISTERS] = {
+    { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x48, 0x8B, 0x95, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x48, 0x8B, 0x8D, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x48, 0x8B, 0xB5, HOLE), .a = 3 },
+};
+static const Baseline_Stencil baseline_stores[BASELINE_RESULT_REGISTERS] = {
+    { BASELINE_STENCIL(0x48, 0x89, 0x85, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x48, 0x89, 0x95, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x48, 0x89, 0x8D, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x48, 0x89, 0xB5, HOLE), .a = 3 },
+};
+
+// Lanes of vectors are loaded into rax or rcx extended like the bytecode interpreter extends them,
+// indexed by log2 of the lane size
+static const Baseline_Stencil baseline_lane_loads[2][4] = {
+    {
+        { BASELINE_STENCIL(0x0F, 0xB6, 0x85, HOLE), .a = 3 },
+        { BASELINE_STENCIL(0x48, 0x0F, 0xBF, 0x85, HOLE), .a = 4 },
+        { BASELINE_STENCIL(0x48, 0x63, 0x85, HOLE), .a = 3 },
+        { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE), .a = 3 },
+    },
+    {
+        { BASELINE_STENCIL(0x0F, 0xB6, 0x8D, HOLE), .a = 3 },
+        { BASELINE_STENCIL(0x48, 0x0F, 0xBF, 0x8D, HOLE), .a = 4 },
+        { BASELINE_STENCIL(0x48, 0x63, 0x8D, HOLE), .a = 3 },
+        { BASELINE_STENCIL(0x48, 0x8B, 0x8D, HOLE), .a = 3 },
+    },
+};
+static const Baseline_Stencil baseline_lane_stores[4] = {
+    { BASELINE_STENCIL(0x88, 0x85, HOLE), .a = 2 },
+    { BASELINE_STENCIL(0x66, 0x89, 0x85, HOLE), .a = 3 },
+    { BASELINE_STENCIL(0x89, 0x85, HOLE), .a = 2 },
+    { BASELINE_STENCIL(0x48, 0x89, 0x85, HOLE), .a = 3 },
+};
+// Lane-wise operations on rax and rcx
+static const Baseline_Stencil baseline_lane_add = { BASELINE_STENCIL(0x48, 0x01, 0xC8) };
+static const Baseline_Stencil baseline_lane_sub = { BASELINE_STENCIL(0x48, 0x29, 0xC8) };
+static const Baseline_Stencil baseline_lane_mul = { BASELINE_STENCIL(0x48, 0x0F, 0xAF, 0xC1) };
+static const Baseline_Stencil baseline_lane_cmpeq = { BASELINE_STENCIL(0x48, 0x39, 0xC8, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0, 0x48, 0xF7, 0xD8) };
+static const Baseline_Stencil baseline_lane_cmpgt = { BASELINE_STENCIL(0x48, 0x39, 0xC8, 0x0F, 0x9F, 0xC0, 0x0F, 0xB6, 0xC0, 0x48, 0xF7, 0xD8) };
+// xor edx, edx; add rdx, rax; mov rax, rdx
+static const Baseline_Stencil baseline_sum_begin = { BASELINE_STENCIL(0x31, 0xD2) };
+static const Baseline_Stencil baseline_sum_add = { BASELINE_STENCIL(0x48, 0x01, 0xC2) };
+static const Baseline_Stencil baseline_sum_end = { BASELINE_STENCIL(0x48, 0x89, 0xD0) };
+// rax truncated to a lane and extended back, indexed by log2 of the lane size
+static const Baseline_Stencil baseline_lane_extends[4] = {
+    { BASELINE_STENCIL(0x0F, 0xB6, 0xC0) },
+    { BASELINE_STENCIL(0x48, 0x0F, 0xBF, 0xC0) },
+    { BASELINE_STENCIL(0x48, 0x63, 0xC0) },
+    { 0 },
+};
+
+// Switches: the value is loaded into rax, 32-bit unsigned ones zero-extended
+static const Baseline_Stencil baseline_switch_value = { BASELINE_STENCIL(0x48, 0x8B, 0x85, HOLE), .a = 3 };
+static const Baseline_Stencil baseline_switch_value_u32 = { BASELINE_STENCIL(0x8B, 0x85, HOLE), .a = 2 };
+// mov rcx, imm64; cmp rax, rcx. The 64-bit immediate follows the opcode at offset 2
+static const Baseline_Stencil baseline_switch_compare = { BASELINE_STENCIL(0x48, 0xB9, HOLE, HOLE, 0x48, 0x39, 0xC8) };
+// mov rcx, imm64; sub rax, rcx
+static const Baseline_Stencil baseline_switch_rebase = { BASELINE_STENCIL(0x48, 0xB9, HOLE, HOLE, 0x48, 0x29, 0xC8) };
+// lea rcx, [rip+table]; movsxd rax, [rcx+rax*4]; add rax, rcx; jmp rax. Entries are relative to the table
+static const Baseline_Stencil baseline_switch_dispatch = { BASELINE_STENCIL(0x48, 0x8D, 0x0D, HOLE, 0x48, 0x63, 0x04, 0x81, 0x48, 0x01, 0xC8, 0xFF, 0xE0), .imm = 3 };
+static const Baseline_Stencil baseline_jcc = { BASELINE_STENCIL(0x0F, 0x80, HOLE), .target = 2 };
+
+typedef struct {
+    // Where the 32-bit field is and what its value is relative to
+    size_t at;
+    size_t base;
+    size_t inst;
+} Baseline_Fixup;
+
+typedef struct {
+    Arena *arena;
+    const Bytecode_Module *bytecode;
+    Evaluated_Module *module;
+    // NUL-terminated names of the functions, the targets of call relocations
+    const char **names;
+    struct {
+        uint8_t *data;
+        size_t count, capacity;
+    } code;
+    struct {
+        X86_64_Relocation *data;
+        size_t count, capacity;
+    } relocations;
+    // Fields holding the distance to a bytecode instruction, resolved once the function is done
+    struct {
+        Baseline_Fixup *data;
+        size_t count, capacity;
+    } fixups;
+    // Code offset of every bytecode instruction
+    size_t *offsets;
+} Baseline_Compiler;
+
+static void *grow_baseline_items(Arena *arena, void *data, size_t count, size_t *capacity, size_t item_size)
+{
+    if(count < *capacity) return data;
+    size_t new_capacity = *capacity * 2;
+    if(new_capacity == 0) new_capacity = 64;
+    void *new_data = arena_alloc(arena, new_capacity * item_size);
+    assert(new_data && "buy more ram lol!");
+    if(count > 0) memcpy(new_data, data, count * item_size);
+    *capacity = new_capacity;
+    return new_data;
+}
+
+static void put_baseline_field(Baseline_Compiler *c, size_t at, int32_t value)
+{
+    memcpy(c->code.data + at, &value, sizeof(value));
+}
+
+static size_t put_baseline_bytes(Baseline_Compiler *c, const void *data, size_t size)
+{
+    if(c->code.count + size > c->code.capacity) {
+        size_t new_capacity = c->code.capacity * 2;
+        if(new_capacity < c->code.count + size) new_capacity = c->code.count + size + 256;
+        void *new_data = arena_alloc(c->arena, new_capacity);
+        assert(new_data && "buy more ram lol!");
+        if(c->code.count > 0) memcpy(new_data, c->code.data, c->code.count);
+        c->code.data = new_data;
+        c->code.capacity = new_capacity;
+    }
+    size_t at = c->code.count;
+    memcpy(c->code.data + at, data, size);
+    c->code.count += size;
+    return at;
+}
+
+static void push_baseline_fixup(Baseline_Compiler *c, size_t at, size_t base, size_t inst)
+{
+    c->fixups.data = grow_baseline_items(c->arena, c->fixups.data, c->fixups.count, &c->fixups.capacity, sizeof(Baseline_Fixup));
+    c->fixups.data[c->fixups.count++] = (Baseline_Fixup){ .at = at, .base = base, .inst = inst };
+}
+
+static void push_baseline_relocation(Baseline_Compiler *c, size_t at, size_t function)
+{
+    c->relocations.data = grow_baseline_items(c->arena, c->relocations.data, c->relocations.count, &c->relocations.capacity, sizeof(X86_64_Relocation));
+    c->relocations.data[c->relocations.count++] = (X86_64_Relocation){ .offset = at, .symbol = c->names[function], .addend = -4 };
+}
+
+static int32_t get_register_displacement(size_t reg)
+{
+    return -8*(int32_t)(reg + 1);
+}
+
+// Copies the stencil and fills the holes with raw values, returns where the copy starts
+static size_t put_baseline_stencil(Baseline_Compiler *c, const Baseline_Stencil *stencil, int32_t a, int32_t b, int32_t regc, int32_t imm)
+{
+    size_t at = put_baseline_bytes(c, stencil->code, stencil->size);
+    if(stencil->a) put_baseline_field(c, at + stencil->a, a);
+    if(stencil->b) put_baseline_field(c, at + stencil->b, b);
+    if(stencil->c) put_baseline_field(c, at + stencil->c, regc);
+    if(stencil->imm) put_baseline_field(c, at + stencil->imm, imm);
+    return at;
+}
+
+static void put_baseline_jump(Baseline_Compiler *c, const Baseline_Stencil *stencil, int32_t a, int32_t b, int32_t imm, size_t inst)
+{
+    size_t at = put_baseline_stencil(c, stencil, a, b, 0, imm);
+    push_baseline_fixup(c, at + stencil->target, at + stencil->target + 4, inst);
+}
+
+static void put_baseline_imm64(Baseline_Compiler *c, const Baseline_Stencil *stencil, int64_t value)
+{
+    size_t at = put_baseline_stencil(c, stencil, 0, 0, 0, 0);
+    memcpy(c->code.data + at + 2, &value, sizeof(value));
+}
+
+static size_t get_log2(size_t size)
+{
+    size_t result = 0;
+    while(((size_t)1 << result) < size) result += 1;
+    return result;
+}
+
+// Displacement of a lane of the vector starting at register `reg`: its registers go downwards so
+// the bytes of the vector start at its last register
+static int32_t get_lane_displacement(const Bytecode_Inst *inst, size_t reg, size_t lane)
+{
+    size_t lane_size = inst->imm & 0xFF;
+    size_t lanes = (inst->imm >> 8) & 0xFF;
+    size_t registers = lane_size*lanes/8;
+    return get_register_displacement(reg + registers - 1) + (int32_t)(lane*lane_size);
+}
+
+static void compile_baseline_vector_inst(Baseline_Compiler *c, const Bytecode_Inst *inst)
+{
+    size_t lane_size = inst->imm & 0xFF;
+    size_t lanes = (inst->imm >> 8) & 0xFF;
+    size_t size = get_log2(lane_size);
+    switch(inst->op) {
+        case BYTECODE_OP_VADD:
+        case BYTECODE_OP_VSUB:
+        case BYTECODE_OP_VMUL:
+        case BYTECODE_OP_VCMPEQ:
+        case BYTECODE_OP_VCMPGT:
+            {
+                const Baseline_Stencil *op = inst->op == BYTECODE_OP_VADD ? &baseline_lane_add :
+                    inst->op == BYTECODE_OP_VSUB ? &baseline_lane_sub :
+                    inst->op == BYTECODE_OP_VMUL ? &baseline_lane_mul :
+                    inst->op == BYTECODE_OP_VCMPEQ ? &baseline_lane_cmpeq : &baseline_lane_cmpgt;
+                // Every lane of the result only depends on the same lane of the operands
+                for(size_t lane = 0; lane < lanes; ++lane) {
+                    put_baseline_stencil(c, &baseline_lane_loads[0][size], get_lane_displacement(inst, inst->b, lane), 0, 0, 0);
+                    put_baseline_stencil(c, &baseline_lane_loads[1][size], get_lane_displacement(inst, inst->c, lane), 0, 0, 0);
+                    put_baseline_stencil(c, op, 0, 0, 0, 0);
+                    put_baseline_stencil(c, &baseline_lane_stores[size], get_lane_displacement(inst, inst->a, lane), 0, 0, 0);
+                }
+            } break;
+        case BYTECODE_OP_VSPLAT:
+            {
+                put_baseline_stencil(c, &baseline_loads[0], get_register_displacement(inst->b), 0, 0, 0);
+                for(size_t lane = 0; lane < lanes; ++lane)
+                    put_baseline_stencil(c, &baseline_lane_stores[size], get_lane_displacement(inst, inst->a, lane), 0, 0, 0);
+            } break;
+        case BYTECODE_OP_VINSERT:
+            {
+                if(inst->a != inst->b) {
+                    for(size_t i = 0; i < lane_size*lanes/8; ++i) {
+                        put_baseline_stencil(c, &baseline_stencils[BYTECODE_OP_MOV], get_register_displacement(inst->a + i),
+                                get_register_displacement(inst->b + i), 0, 0);
+                    }
+                }
+                put_baseline_stencil(c, &baseline_loads[0], get_register_displacement(inst->c), 0, 0, 0);
+                put_baseline_stencil(c, &baseline_lane_stores[size], get_lane_displacement(inst, inst->a, (inst->imm >> 16) & 0xFF), 0, 0, 0);
+            } break;
+        case BYTECODE_OP_VLANE:
+            {
+                put_baseline_stencil(c, &baseline_lane_loads[0][size], get_lane_displacement(inst, inst->b, (inst->imm >> 24) & 0xFF), 0, 0, 0);
+                put_baseline_stencil(c, &baseline_lane_stores[size], get_lane_displacement(inst, inst->a, (inst->imm >> 16) & 0xFF), 0, 0, 0);
+            } break;
+        case BYTECODE_OP_VEXTRACT:
+            {
+                put_baseline_stencil(c, &baseline_lane_loads[0][size], get_lane_displacement(inst, inst->b, (inst->imm >> 16) & 0xFF), 0, 0, 0);
+                put_baseline_stencil(c, &baseline_stores[0], get_register_displacement(inst->a), 0, 0, 0);
+            } break;
+        case BYTECODE_OP_VREDUCE:
+            {
+                put_baseline_stencil(c, &baseline_sum_begin, 0, 0, 0, 0);
+                for(size_t lane = 0; lane < lanes; ++lane) {
+                    put_baseline_stencil(c, &baseline_lane_loads[0][size], get_lane_displacement(inst, inst->b, lane), 0, 0, 0);
+                    put_baseline_stencil(c, &baseline_sum_add, 0, 0, 0, 0);
+                }
+                put_baseline_stencil(c, &baseline_sum_end, 0, 0, 0, 0);
+                put_baseline_stencil(c, &baseline_lane_extends[size], 0, 0, 0, 0);
+                put_baseline_stencil(c, &baseline_stores[0], get_register_displacement(inst->a), 0, 0, 0);
+            } break;
+        default:
+            {
+                fatal("Unreachable");
+            } break;
+    }
+}
+
+static void put_baseline_switch_jump(Baseline_Compiler *c, uint8_t cc, size_t inst)
+{
+    Baseline_Stencil stencil = baseline_jcc;
+    uint8_t code[6];
+    memcpy(code, stencil.code, sizeof(code));
+    code[1] = 0x80 | cc;
+    stencil.code = code;
+    put_baseline_jump(c, &stencil, 0, 0, 0, inst);
+}
+
+// Returns where the rel32 of a jump to code not emitted yet is
+static size_t put_baseline_forward_jump(Baseline_Compiler *c, uint8_t cc)
+{
+    uint8_t code[6] = { 0x0F, 0x80 | cc, HOLE };
+    return put_baseline_bytes(c, code, sizeof(code)) + 2;
+}
+
+static void place_baseline_forward_jump(Baseline_Compiler *c, size_t at)
+{
+    put_baseline_field(c, at, (int32_t)(c->code.count - (at + 4)));
+}
+
+// Binary search over the ranges like the x86-64 backend, with the value in rax
+static void compile_baseline_switch_search(Baseline_Compiler *c, const Bytecode_Switch *_switch, size_t begin, size_t end, size_t inst)
+{
+    size_t _default = inst + _switch->offsets[_switch->cases_count];
+    if(end - begin <= ELYSIA_SWITCH_LINEAR_RANGES) {
+        for(size_t i = begin; i < end; ++i) {
+            const Switch_Range *range = &_switch->ranges[i];
+            size_t target = inst + _switch->offsets[range->target];
+            put_baseline_imm64(c, &baseline_switch_compare, range->low);
+            if(range->low == range->high) {
+                put_baseline_switch_jump(c, CC_E, target);
+                continue;
+            }
+            size_t below = put_baseline_forward_jump(c, CC_L);
+            put_baseline_imm64(c, &baseline_switch_compare, range->high);
+            put_baseline_switch_jump(c, CC_LE, target);
+            place_baseline_forward_jump(c, below);
+        }
+        put_baseline_jump(c, &baseline_stencils[BYTECODE_OP_JMP], 0, 0, 0, _default);
+        return;
+    }
+    size_t middle = begin + (end - begin)/2;
+    put_baseline_imm64(c, &baseline_switch_compare, _switch->ranges[middle].low);
+    size_t below = put_baseline_forward_jump(c, CC_L);
+    compile_baseline_switch_search(c, _switch, middle, end, inst);
+    place_baseline_forward_jump(c, below);
+    compile_baseline_switch_search(c, _switch, begin, middle, inst);
+}
+
+static void compile_baseline_switch(Baseline_Compiler *c, const Bytecode_Inst *inst, size_t index)
+{
+    const Bytecode_Switch *_switch = &c->bytecode->switches.data[inst->imm];
+    const Baseline_Stencil *load = _switch->is_unsigned ? &baseline_switch_value_u32 : &baseline_switch_value;
+    put_baseline_stencil(c, load, get_register_displacement(inst->a), 0, 0, 0);
+    if(!_switch->table) {
+        compile_baseline_switch_search(c, _switch, 0, _switch->ranges_count, index);
+        return;
+    }
+
+    put_baseline_imm64(c, &baseline_switch_rebase, _switch->ranges[0].low);
+    put_baseline_imm64(c, &baseline_switch_compare, (int64_t)_switch->table_count);
+    put_baseline_switch_jump(c, CC_AE, index + _switch->offsets[_switch->cases_count]);
+    size_t dispatch = put_baseline_stencil(c, &baseline_switch_dispatch, 0, 0, 0, 0);
+    size_t table = c->code.count;
+    put_baseline_field(c, dispatch + baseline_switch_dispatch.imm, (int32_t)(table - (dispatch + baseline_switch_dispatch.imm + 4)));
+    for(size_t i = 0; i < _switch->table_count; ++i) {
+        uint8_t entry[4] = { HOLE };
+        size_t at = put_baseline_bytes(c, entry, sizeof(entry));
+        push_baseline_fixup(c, at, table, index + _switch->offsets[_switch->table[i]]);
+    }
+}
+
+static size_t get_result_registers(const Func_Def *fdef)
+{
+    Data_Type type = fdef->return_type;
+    if(type.is_native && type.as.native == NATIVE_TYPE_VOID) return 0;
+    if(is_vector_data_type(&type)) return get_data_type_size(&type) / 8;
+    return 1;
+}
+
+static void compile_baseline_inst(Baseline_Compiler *c, const Bytecode_Inst *inst, size_t index)
+{
+    int32_t a = get_register_displacement(inst->a);
+    int32_t b = get_register_displacement(inst->b);
+    int32_t regc = get_register_displacement(inst->c);
+    switch(inst->op) {
+        case BYTECODE_OP_MOVV:
+            {
+                for(size_t i = 0; i < inst->c; ++i) {
+                    put_baseline_stencil(c, &baseline_stencils[BYTECODE_OP_MOV], get_register_displacement(inst->a + i),
+                            get_register_displacement(inst->b + i), 0, 0);
+                }
+            } break;
+        case BYTECODE_OP_VADD:
+        case BYTECODE_OP_VSUB:
+        case BYTECODE_OP_VMUL:
+        case BYTECODE_OP_VCMPEQ:
+        case BYTECODE_OP_VCMPGT:
+        case BYTECODE_OP_VSPLAT:
+        case BYTECODE_OP_VINSERT:
+        case BYTECODE_OP_VLANE:
+        case BYTECODE_OP_VEXTRACT:
+        case BYTECODE_OP_VREDUCE:
+            {
+                compile_baseline_vector_inst(c, inst);
+            } break;
+        case BYTECODE_OP_CALL:
+            {
+                size_t at = put_baseline_stencil(c, &baseline_call, 0, regc, 0, 0);
+                push_baseline_relocation(c, at + baseline_call.imm, inst->imm);
+                size_t results = get_result_registers(&c->module->functions.data[inst->imm].def);
+                for(size_t i = 0; i < results; ++i)
+                    put_baseline_stencil(c, &baseline_stores[i], get_register_displacement(inst->a + i), 0, 0, 0);
+            } break;
+        case BYTECODE_OP_TAILCALL:
+            {
+                if(inst->c > BASELINE_TAIL_CALL_MAX_REGISTERS) {
+                    size_t at = put_baseline_stencil(c, &baseline_call, 0, b, 0, 0);
+                    push_baseline_relocation(c, at + baseline_call.imm, inst->imm);
+                    put_baseline_stencil(c, &baseline_leave, 0, 0, 0, 0);
+                    break;
+                }
+                for(size_t i = 0; i < inst->c; ++i) {
+                    put_baseline_stencil(c, &baseline_stencils[BYTECODE_OP_MOV], get_register_displacement(i),
+                            get_register_displacement(inst->b + i), 0, 0);
+                }
+                size_t at = put_baseline_stencil(c, &baseline_tail_call, 0, 0, 0, 0);
+                push_baseline_relocation(c, at + baseline_tail_call.imm, inst->imm);
+            } break;
+        case BYTECODE_OP_RET:
+            {
+                assert(inst->c <= BASELINE_RESULT_REGISTERS);
+                for(size_t i = 0; i < inst->c; ++i)
+                    put_baseline_stencil(c, &baseline_loads[i], get_register_displacement(inst->a + i), 0, 0, 0);
+                put_baseline_stencil(c, &baseline_leave, 0, 0, 0, 0);
+            } break;
+        case BYTECODE_OP_SWITCH:
+            {
+                compile_baseline_switch(c, inst, index);
+            } break;
+        default:
+            {
+                const Baseline_Stencil *stencil = &baseline_stencils[inst->op];
+                assert(stencil->size > 0);
+                if(stencil->target) put_baseline_jump(c, stencil, a, b, inst->imm, index + inst->offset);
+                else put_baseline_stencil(c, stencil, a, b, regc, inst->imm);
+            } break;
+    }
+}
+
+static bool is_baseline_exported(const Func_Def *fdef)
+{
+    return fdef->is_pub || sv_eq(fdef->name, SV("main"));
+}
+
+static void compile_baseline_function(Baseline_Compiler *c, size_t index, X86_64_Object *object)
+{
+    const Bytecode_Fn *fn = &c->bytecode->functions.data[index];
+    const Func_Def *fdef = &c->module->functions.data[index].def;
+    c->code.count = 0;
+    c->relocations.count = 0;
+    c->fixups.count = 0;
+    c->offsets = arena_alloc(c->arena, (fn->code.count + 1)*sizeof(size_t));
+    assert(c->offsets && "buy more ram lol!");
+
+    // rsp stays aligned to 16 bytes for the calls
+    size_t frame_size = (fn->registers_count*8 + 15) & ~(size_t)15;
+    put_baseline_stencil(c, &baseline_prologue, 0, 0, 0, (int32_t)frame_size);
+    if(sv_eq(fdef->name, SV("main"))) {
+        if(fn->params_count > 0) put_baseline_stencil(c, &baseline_main_argc, get_register_displacement(0), 0, 0, 0);
+        if(fn->params_count > 1) put_baseline_stencil(c, &baseline_main_argv, get_register_displacement(1), 0, 0, 0);
+    } else {
+        for(size_t i = 0; i < fn->params_count; ++i)
+            put_baseline_stencil(c, &baseline_param, get_register_displacement(i), -8*(int32_t)i, 0, 0);
+    }
+
+    for(size_t i = 0; i < fn->code.count; ++i) {
+        c->offsets[i] = c->code.count;
+        compile_baseline_inst(c, &fn->code.data[i], i);
+    }
+    for(size_t i = 0; i < c->fixups.count; ++i) {
+        const Baseline_Fixup *fixup = &c->fixups.data[i];
+        put_baseline_field(c, fixup->at, (int32_t)(c->offsets[fixup->inst] - fixup->base));
+    }
+    add_x86_64_function(object, c->names[index], is_baseline_exported(fdef), c->code.data, c->code.count,
+            c->relocations.data, c->relocations.count);
+}
+
+static void init_baseline_compiler(Baseline_Compiler *c, Arena *arena, Bytecode_Module *bytecode, Evaluated_Module *module,
+        const Compile_Options *options)
+{
+    memset(c, 0, sizeof(*c));
+    c->arena = arena;
+    c->bytecode = bytecode;
+    c->module = module;
+    bytecode->arena = arena;
+    compile_module_to_bytecode(bytecode, module, options);
+    c->names = arena_alloc(arena, (module->functions.count + 1)*sizeof(const char *));
+    assert(c->names && "buy more ram lol!");
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        String_View name = module->functions.data[i].def.name;
+        char *data = arena_alloc(arena, name.count + 1);
+        assert(data && "buy more ram lol!");
+        memcpy(data, name.data, name.count);
+        data[name.count] = '\0';
+        c->names[i] = data;
+    }
+}
+
+void compile_module_to_baseline_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options)
+{
+    if(options->output_kind != OUTPUT_KIND_OBJ && options->output_kind != OUTPUT_KIND_EXE) {
+        fatal("The baseline backend only emits machine code, use `--emit obj` or `--emit exe`");
+    }
+    Arena arena = {0};
+    Bytecode_Module bytecode = {0};
+    Baseline_Compiler compiler;
+    init_baseline_compiler(&compiler, &arena, &bytecode, module, options);
+    X86_64_Object objects[2] = {0};
+    objects[0].arena = &arena;
+    objects[1].arena = &arena;
+    for(size_t i = 0; i < bytecode.functions.count; ++i) compile_baseline_function(&compiler, i, &objects[0]);
+    if(options->output_kind == OUTPUT_KIND_OBJ) {
+        write_elf64_object(file_path, &objects[0]);
+    } else {
+        add_x86_64_runtime(&objects[1]);
+        link_x86_64_executable(file_path, objects, 2, X86_64_ENTRY_SYMBOL);
+    }
+    arena_free(&arena);
+}
+
+static void compile_baseline_jit_function(void *context, size_t index, X86_64_Object *object)
+{
+    compile_baseline_function(context, index, object);
+}
+
+int run_module_baseline(Evaluated_Module *module, const Compile_Options *options, int argc, char **argv)
+{
+    Arena arena = {0};
+    Bytecode_Module bytecode = {0};
+    Baseline_Compiler compiler;
+    init_baseline_compiler(&compiler, &arena, &bytecode, module, options);
+
+    X86_64_Host_Symbol host_symbols[] = {
+        { "write", (void (*)(void))write },
+        { "exit", (void (*)(void))exit },
+    };
+    X86_64_Jit_Program program = {
+        .names = compiler.names,
+        .functions_count = module->functions.count,
+        .compile = compile_baseline_jit_function,
+        .context = &compiler,
+        .host_symbols = host_symbols,
+        .host_symbols_count = sizeof(host_symbols)/sizeof(host_symbols[0]),
+        .preserve_ymm = false,
+    };
+    X86_64_Jit jit;
+    load_x86_64_jit(&jit, &arena, &program);
+    void *address = find_x86_64_jit_function(&jit, "main");
+    if(address == NULL) {
+        fatal("The program has no `main` function");
+    }
+    int (*entry)(int, char **);
+    memcpy(&entry, &address, sizeof(entry));
+    int result = entry(argc, argv);
+
+    if(options->report_jit) {
+        fprintf(stderr, "Compiled %zu of %zu functions, %zu never called\n", jit.compiled_count,
+                program.functions_count, program.functions_count - jit.compiled_count);
+    }
+    unload_x86_64_jit(&jit);
+    arena_free(&arena);
+    return result;
+}
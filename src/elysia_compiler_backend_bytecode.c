@@ -0,0 +1,695 @@
+#include "elysia.h"
+#include "elysia_ast.h"
+#include "elysia_bytecode.h"
+#include "elysia_compiler.h"
+#include "elysia_types.h"
+#include <assert.h>
+#include <string.h>
+
+typedef struct {
+    Bytecode_Module *bytecode;
+    Evaluated_Module *module;
+    const Compile_Options *options;
+    Evaluated_Fn *fn;
+    Bytecode_Fn *out;
+    // Register of every variable, indexed like the variables of the function's scope
+    size_t *var_registers;
+    // Variables live below `locals_count`, temporaries are allocated from `top` up and dropped
+    // at the end of every statement
+    size_t locals_count;
+    size_t top;
+    // Instruction index of every label, jumps refer to labels until the function is done
+    struct {
+        size_t *data;
+        size_t count, capacity;
+    } labels;
+} Bytecode_Compiler;
+
+static void compile_expr_into_bytecode(Bytecode_Compiler *c, const Expr *expr, size_t dst);
+static void compile_cond_into_bytecode(Bytecode_Compiler *c, const Expr *expr, bool jump_if, size_t label);
+
+static Bytecode_Inst *emit_bytecode(Bytecode_Compiler *c, Bytecode_Op op, size_t a, size_t b, size_t regc, int32_t imm)
+{
+    Bytecode_Fn *out = c->out;
+    if(out->code.count >= out->code.capacity) {
+        size_t new_capacity = out->code.capacity * 2;
+        if(new_capacity == 0) new_capacity = 64;
+        void *new_data = arena_alloc(c->bytecode->arena, new_capacity * sizeof(*out->code.data));
+        assert(new_data && "buy more ram lol!");
+        if(out->code.count > 0) memcpy(new_data, out->code.data, out->code.count * sizeof(*out->code.data));
+        out->code.data = new_data;
+        out->code.capacity = new_capacity;
+    }
+    Bytecode_Inst *inst = &out->code.data[out->code.count++];
+    inst->op = op;
+    inst->a = a;
+    inst->b = b;
+    inst->c = regc;
+    inst->imm = imm;
+    inst->offset = 0;
+    return inst;
+}
+
+static size_t new_bytecode_label(Bytecode_Compiler *c)
+{
+    if(c->labels.count >= c->labels.capacity) {
+        size_t new_capacity = c->labels.capacity * 2;
+        if(new_capacity == 0) new_capacity = 64;
+        void *new_data = arena_alloc(c->bytecode->arena, new_capacity * sizeof(*c->labels.data));
+        assert(new_data && "buy more ram lol!");
+        if(c->labels.count > 0) memcpy(new_data, c->labels.data, c->labels.count * sizeof(*c->labels.data));
+        c->labels.data = new_data;
+        c->labels.capacity = new_capacity;
+    }
+    c->labels.data[c->labels.count] = 0;
+    return c->labels.count++;
+}
+
+static void place_bytecode_label(Bytecode_Compiler *c, size_t label)
+{
+    c->labels.data[label] = c->out->code.count;
+}
+
+static void emit_bytecode_jump(Bytecode_Compiler *c, Bytecode_Op op, size_t a, size_t b, int32_t imm, size_t label)
+{
+    emit_bytecode(c, op, a, b, 0, imm)->offset = label;
+}
+
+static size_t alloc_registers(Bytecode_Compiler *c, size_t count)
+{
+    size_t result = c->top;
+    c->top += count;
+    if(c->top > ELYSIA_BYTECODE_MAX_REGISTERS) {
+        compilation_error(c->fn->def.loc, "Function `"SV_FMT"` needs more than %d registers\n",
+                SV_ARGV(c->fn->def.name), ELYSIA_BYTECODE_MAX_REGISTERS);
+        compilation_failure();
+    }
+    if(c->top > c->out->registers_count) c->out->registers_count = c->top;
+    return result;
+}
+
+static size_t get_register_count(Data_Type *type)
+{
+    if(is_vector_data_type(type)) return get_data_type_size(type) / 8;
+    return 1;
+}
+
+
+typedef struct {
+    Binary_Op_Type op;
+    Binary_Op_Type inverse;
+    // Same comparison with the operands swapped
+    Binary_Op_Type swapped;
+} Bytecode_Condition;
+
+static const Bytecode_Condition bytecode_conditions[] = {
+    { BINARY_OP_EQ, BINARY_OP_NE, BINARY_OP_EQ },
+    { BINARY_OP_NE, BINARY_OP_EQ, BINARY_OP_NE },
+    { BINARY_OP_LT, BINARY_OP_GE, BINARY_OP_GT },
+    { BINARY_OP_LE, BINARY_OP_GT, BINARY_OP_GE },
+    { BINARY_OP_GT, BINARY_OP_LE, BINARY_OP_LT },
+    { BINARY_OP_GE, BINARY_OP_LT, BINARY_OP_LE },
+};
+
+static const Bytecode_Condition *find_bytecode_condition(Binary_Op_Type op)
+{
+    for(size_t i = 0; i < sizeof(bytecode_conditions)/sizeof(bytecode_conditions[0]); ++i) {
+        if(bytecode_conditions[i].op == op) return &bytecode_conditions[i];
+    }
+    return NULL;
+}
+
+// Type of an expression the evaluator already accepted. Calls take the return type of the callee
+// without checking their arguments again, the evaluator doesn't look at every operand
+static Data_Type eval_bytecode_expr(Bytecode_Compiler *c, const Expr *expr)
+{
+    if(expr->type == EXPR_FUNCALL) {
+        const Func_Def *fdef = find_func_def(c->module, expr->as.func_call.name);
+        if(fdef) return fdef->return_type;
+    } else if(expr->type == EXPR_BINARY_OP && !find_bytecode_condition(expr->as.binop->type)
+            && expr->as.binop->type != BINARY_OP_AND && expr->as.binop->type != BINARY_OP_OR) {
+        return eval_bytecode_expr(c, &expr->as.binop->left);
+    }
+    return eval_expr(c->module, &c->fn->scope, expr);
+}
+
+static bool is_signed_data_type(const Data_Type *type)
+{
+    if(!type->is_native) return true;
+    Native_Type native = type->as.native;
+    return native == NATIVE_TYPE_I8 || native == NATIVE_TYPE_I16 || native == NATIVE_TYPE_I32 || native == NATIVE_TYPE_I64;
+}
+
+static size_t get_var_register(Bytecode_Compiler *c, String_View name)
+{
+    const Evaluated_Var *var = get_var_from_scope(&c->fn->scope, name);
+    return c->var_registers[var - c->fn->scope.vars.data];
+}
+
+static bool fits_i32(int64_t value)
+{
+    return value == (int32_t)value;
+}
+
+// Registers holding the value of `expr`, variables are read in place
+static size_t compile_bytecode_operand(Bytecode_Compiler *c, const Expr *expr)
+{
+    if(expr->type == EXPR_VAR_READ) return get_var_register(c, expr->as.var_read.name);
+    Data_Type type = eval_bytecode_expr(c, expr);
+    size_t dst = alloc_registers(c, get_register_count(&type));
+    compile_expr_into_bytecode(c, expr, dst);
+    return dst;
+}
+
+// 8 and 16 bit values are truncated whenever they are stored
+static void compile_bytecode_narrowing(Bytecode_Compiler *c, size_t dst, size_t src, Data_Type *type)
+{
+    if(!type->is_native || type->is_ptr || type->as.native == NATIVE_TYPE_BOOL) {
+        if(dst != src) emit_bytecode(c, BYTECODE_OP_MOV, dst, src, 0, 0);
+        return;
+    }
+    size_t size = get_data_type_size(type);
+    bool is_signed = is_signed_data_type(type);
+    if(size == 1) {
+        emit_bytecode(c, is_signed ? BYTECODE_OP_TRUNC_I8 : BYTECODE_OP_TRUNC_U8, dst, src, 0, 0);
+    } else if(size == 2) {
+        emit_bytecode(c, is_signed ? BYTECODE_OP_TRUNC_I16 : BYTECODE_OP_TRUNC_U16, dst, src, 0, 0);
+    } else if(dst != src) {
+        emit_bytecode(c, BYTECODE_OP_MOV, dst, src, 0, 0);
+    }
+}
+
+static int32_t get_vector_shape(Native_Type_Info info)
+{
+    return (int32_t)(get_native_type_info(info.lane_type).size | info.lanes << 8);
+}
+
+static size_t find_function_index(Bytecode_Compiler *c, String_View name)
+{
+    for(size_t i = 0; i < c->module->functions.count; ++i) {
+        if(sv_eq(c->module->functions.data[i].def.name, name)) return i;
+    }
+    fatal("Unreachable: function `"SV_FMT"` was never evaluated", SV_ARGV(name));
+    return 0;
+}
+
+static void compile_vector_call_into_bytecode(Bytecode_Compiler *c, const Expr *expr, size_t dst)
+{
+    const Expr_Func_Call *call = &expr->as.func_call;
+    const Expr *args = call->args.data;
+    Data_Type type = eval_bytecode_expr(c, expr);
+    switch(find_builtin_fn(call->name)) {
+        case BUILTIN_VEXTRACT:
+            {
+                Data_Type vector = eval_bytecode_expr(c, &args[0]);
+                Native_Type_Info info = get_native_type_info(vector.as.native);
+                size_t src = compile_bytecode_operand(c, &args[0]);
+                emit_bytecode(c, BYTECODE_OP_VEXTRACT, dst, src, 0, get_vector_shape(info) | (int32_t)args[1].as.literal_int << 16);
+            } break;
+        case BUILTIN_VREDUCE_ADD:
+            {
+                Data_Type vector = eval_bytecode_expr(c, &args[0]);
+                size_t src = compile_bytecode_operand(c, &args[0]);
+                emit_bytecode(c, BYTECODE_OP_VREDUCE, dst, src, 0, get_vector_shape(get_native_type_info(vector.as.native)));
+            } break;
+        case BUILTIN_VINSERT:
+            {
+                Native_Type_Info info = get_native_type_info(type.as.native);
+                size_t src = compile_bytecode_operand(c, &args[0]);
+                size_t value = compile_bytecode_operand(c, &args[2]);
+                emit_bytecode(c, BYTECODE_OP_VINSERT, dst, src, value, get_vector_shape(info) | (int32_t)args[1].as.literal_int << 16);
+            } break;
+        case BUILTIN_VCMPEQ:
+        case BUILTIN_VCMPGT:
+            {
+                Native_Type_Info info = get_native_type_info(type.as.native);
+                size_t left = compile_bytecode_operand(c, &args[0]);
+                size_t right = compile_bytecode_operand(c, &args[1]);
+                Bytecode_Op op = find_builtin_fn(call->name) == BUILTIN_VCMPEQ ? BYTECODE_OP_VCMPEQ : BYTECODE_OP_VCMPGT;
+                emit_bytecode(c, op, dst, left, right, get_vector_shape(info));
+            } break;
+        case BUILTIN_VSHUFFLE:
+        case BUILTIN_UNKNOWN:
+            {
+                // Built lane by lane, so into a temporary when the destination is a variable the
+                // expression may still read
+                Native_Type_Info info = get_native_type_info(type.as.native);
+                int32_t shape = get_vector_shape(info);
+                size_t result = dst >= c->locals_count ? dst : alloc_registers(c, get_register_count(&type));
+                if(find_builtin_fn(call->name) == BUILTIN_VSHUFFLE) {
+                    size_t src = compile_bytecode_operand(c, &args[0]);
+                    for(size_t lane = 0; lane < info.lanes; ++lane) {
+                        emit_bytecode(c, BYTECODE_OP_VLANE, result, src, 0, shape | (int32_t)lane << 16 | (int32_t)args[lane + 1].as.literal_int << 24);
+                    }
+                } else {
+                    for(size_t lane = 0; lane < call->args.count; ++lane) {
+                        size_t mark = c->top;
+                        size_t value = compile_bytecode_operand(c, &args[lane]);
+                        if(lane == 0) emit_bytecode(c, BYTECODE_OP_VSPLAT, result, value, 0, shape);
+                        else emit_bytecode(c, BYTECODE_OP_VINSERT, result, result, value, shape | (int32_t)lane << 16);
+                        c->top = mark;
+                    }
+                }
+                if(result != dst) emit_bytecode(c, BYTECODE_OP_MOVV, dst, result, get_register_count(&type), 0);
+            } break;
+        default:
+            {
+                compilation_error(expr->loc, "Unreachable builtin function");
+                compilation_failure();
+            } break;
+    }
+}
+
+// The arguments are evaluated right into the registers that become the callee's parameters
+static size_t compile_call_arguments_into_bytecode(Bytecode_Compiler *c, const Expr_Func_Call *call, size_t *slots_count)
+{
+    const Func_Def *fdef = find_func_def(c->module, call->name);
+    size_t slots = 0;
+    for(size_t i = 0; i < fdef->params.count; ++i) {
+        Data_Type param_type = fdef->params.data[i].type;
+        slots += get_register_count(&param_type);
+    }
+    size_t base = alloc_registers(c, slots);
+    size_t offset = 0;
+    for(size_t i = 0; i < call->args.count; ++i) {
+        Data_Type param_type = fdef->params.data[i].type;
+        compile_expr_into_bytecode(c, &call->args.data[i], base + offset);
+        if(!is_vector_data_type(&param_type)) compile_bytecode_narrowing(c, base + offset, base + offset, &param_type);
+        offset += get_register_count(&param_type);
+    }
+    if(slots_count) *slots_count = slots;
+    return base;
+}
+
+static void compile_call_into_bytecode(Bytecode_Compiler *c, const Expr *expr, size_t dst)
+{
+    const Expr_Func_Call *call = &expr->as.func_call;
+    Native_Type_Info *constructor = find_native_type_info_by_name(call->name);
+    if(find_builtin_fn(call->name) != BUILTIN_UNKNOWN || (constructor && constructor->lanes > 0)) {
+        compile_vector_call_into_bytecode(c, expr, dst);
+        return;
+    }
+
+    size_t base = compile_call_arguments_into_bytecode(c, call, NULL);
+    emit_bytecode(c, BYTECODE_OP_CALL, dst, 0, base, (int32_t)find_function_index(c, call->name));
+}
+
+
+// `first` is the signed `==` of either the comparisons or the compare-and-branch instructions, the
+// others follow it in the order of Bytecode_Op. `>` and `>=` swap their operands into `<` and `<=`
+static Bytecode_Op get_compare_op(Bytecode_Op first, Binary_Op_Type op, const Data_Type *type, bool *swap)
+{
+    Data_Type operand = *type;
+    bool is_unsigned = !is_signed_data_type(type);
+    bool wide = get_data_type_size(&operand) == 8;
+    *swap = op == BINARY_OP_GT || op == BINARY_OP_GE;
+    switch(op) {
+        case BINARY_OP_EQ: return first;
+        case BINARY_OP_NE: return first + 1;
+        case BINARY_OP_LT:
+        case BINARY_OP_GT:
+            return first + (is_unsigned ? (wide ? 6 : 4) : 2);
+        default:
+            return first + (is_unsigned ? (wide ? 7 : 5) : 3);
+    }
+}
+
+static void compile_compare_into_bytecode(Bytecode_Compiler *c, const Expr_Binary_Op *binop, size_t dst)
+{
+    Data_Type type = eval_bytecode_expr(c, &binop->left);
+    size_t left = compile_bytecode_operand(c, &binop->left);
+    size_t right = compile_bytecode_operand(c, &binop->right);
+    bool swap = false;
+    Bytecode_Op op = get_compare_op(BYTECODE_OP_EQ, binop->type, &type, &swap);
+    if(swap) SWAP(size_t, left, right);
+    emit_bytecode(c, op, dst, left, right, 0);
+}
+
+// `&&` and `||` used as values
+static void compile_logical_into_bytecode(Bytecode_Compiler *c, const Expr *expr, size_t dst)
+{
+    size_t on_false = new_bytecode_label(c);
+    size_t end = new_bytecode_label(c);
+    compile_cond_into_bytecode(c, expr, false, on_false);
+    emit_bytecode(c, BYTECODE_OP_MOVI, dst, 0, 0, 1);
+    emit_bytecode_jump(c, BYTECODE_OP_JMP, 0, 0, 0, end);
+    place_bytecode_label(c, on_false);
+    emit_bytecode(c, BYTECODE_OP_MOVI, dst, 0, 0, 0);
+    place_bytecode_label(c, end);
+}
+
+static void compile_binop_into_bytecode(Bytecode_Compiler *c, const Expr *expr, size_t dst)
+{
+    const Expr_Binary_Op *binop = expr->as.binop;
+    Data_Type type = eval_bytecode_expr(c, &binop->left);
+    if(is_vector_data_type(&type)) {
+        Native_Type_Info info = get_native_type_info(type.as.native);
+        size_t left = compile_bytecode_operand(c, &binop->left);
+        size_t right = compile_bytecode_operand(c, &binop->right);
+        Bytecode_Op op = binop->type == BINARY_OP_ADD ? BYTECODE_OP_VADD : binop->type == BINARY_OP_SUB ? BYTECODE_OP_VSUB : BYTECODE_OP_VMUL;
+        emit_bytecode(c, op, dst, left, right, get_vector_shape(info));
+        return;
+    }
+    if(find_bytecode_condition(binop->type)) {
+        compile_compare_into_bytecode(c, binop, dst);
+        return;
+    }
+    if(binop->type == BINARY_OP_AND || binop->type == BINARY_OP_OR) {
+        compile_logical_into_bytecode(c, expr, dst);
+        return;
+    }
+
+    bool wide = get_data_type_size(&type) == 8;
+    const Expr *left = &binop->left;
+    const Expr *right = &binop->right;
+    if(binop->type == BINARY_OP_ADD && left->type == EXPR_INTEGER_LITERAL) SWAP(const Expr *, left, right);
+    if((binop->type == BINARY_OP_ADD || binop->type == BINARY_OP_SUB) && right->type == EXPR_INTEGER_LITERAL) {
+        int64_t value = binop->type == BINARY_OP_ADD ? right->as.literal_int : -right->as.literal_int;
+        if(fits_i32(value)) {
+            size_t src = compile_bytecode_operand(c, left);
+            emit_bytecode(c, wide ? BYTECODE_OP_ADDI64 : BYTECODE_OP_ADDI32, dst, src, 0, (int32_t)value);
+            return;
+        }
+    }
+
+    Bytecode_Op op = BYTECODE_OP_ADD32;
+    switch(binop->type) {
+        case BINARY_OP_ADD: op = wide ? BYTECODE_OP_ADD64 : BYTECODE_OP_ADD32; break;
+        case BINARY_OP_SUB: op = wide ? BYTECODE_OP_SUB64 : BYTECODE_OP_SUB32; break;
+        case BINARY_OP_MUL: op = wide ? BYTECODE_OP_MUL64 : BYTECODE_OP_MUL32; break;
+        default:
+            {
+                compilation_error(expr->loc, "Parsed but not implemented expression\n");
+                compilation_failure();
+            } break;
+    }
+    size_t a = compile_bytecode_operand(c, &binop->left);
+    size_t b = compile_bytecode_operand(c, &binop->right);
+    emit_bytecode(c, op, dst, a, b, 0);
+}
+
+static void compile_expr_into_bytecode(Bytecode_Compiler *c, const Expr *expr, size_t dst)
+{
+    size_t mark = c->top;
+    switch(expr->type) {
+        case EXPR_INTEGER_LITERAL:
+            {
+                emit_bytecode(c, BYTECODE_OP_MOVI, dst, 0, 0, (int32_t)expr->as.literal_int);
+            } break;
+        case EXPR_BOOL_LITERAL:
+            {
+                emit_bytecode(c, BYTECODE_OP_MOVI, dst, 0, 0, expr->as.literal_bool ? 1 : 0);
+            } break;
+        case EXPR_VAR_READ:
+            {
+                const Evaluated_Var *var = get_var_from_scope(&c->fn->scope, expr->as.var_read.name);
+                Data_Type type = var->type;
+                size_t src = get_var_register(c, expr->as.var_read.name);
+                if(src == dst) break;
+                if(is_vector_data_type(&type)) emit_bytecode(c, BYTECODE_OP_MOVV, dst, src, get_register_count(&type), 0);
+                else emit_bytecode(c, BYTECODE_OP_MOV, dst, src, 0, 0);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                compile_call_into_bytecode(c, expr, dst);
+            } break;
+        case EXPR_BINARY_OP:
+            {
+                compile_binop_into_bytecode(c, expr, dst);
+            } break;
+        default:
+            {
+                compilation_error(expr->loc, "Unreachable expression type");
+                compilation_failure();
+            } break;
+    }
+    c->top = mark;
+}
+
+// Jumps to `label` when `expr` is `jump_if` and falls through otherwise. Comparisons become a single
+// compare-and-branch, against an immediate when one side is an integer literal
+static void compile_cond_into_bytecode(Bytecode_Compiler *c, const Expr *expr, bool jump_if, size_t label)
+{
+    size_t mark = c->top;
+    if(expr->type == EXPR_BOOL_LITERAL) {
+        if(expr->as.literal_bool == jump_if) emit_bytecode_jump(c, BYTECODE_OP_JMP, 0, 0, 0, label);
+        return;
+    }
+
+    if(expr->type == EXPR_BINARY_OP && (expr->as.binop->type == BINARY_OP_AND || expr->as.binop->type == BINARY_OP_OR)) {
+        bool is_and = expr->as.binop->type == BINARY_OP_AND;
+        if(is_and != jump_if) {
+            compile_cond_into_bytecode(c, &expr->as.binop->left, jump_if, label);
+            compile_cond_into_bytecode(c, &expr->as.binop->right, jump_if, label);
+        } else {
+            size_t skip = new_bytecode_label(c);
+            compile_cond_into_bytecode(c, &expr->as.binop->left, !jump_if, skip);
+            compile_cond_into_bytecode(c, &expr->as.binop->right, jump_if, label);
+            place_bytecode_label(c, skip);
+        }
+        return;
+    }
+
+    const Bytecode_Condition *condition = expr->type == EXPR_BINARY_OP ? find_bytecode_condition(expr->as.binop->type) : NULL;
+    if(condition) {
+        const Expr *left = &expr->as.binop->left;
+        const Expr *right = &expr->as.binop->right;
+        Data_Type type = eval_bytecode_expr(c, left);
+        Binary_Op_Type op = jump_if ? condition->op : condition->inverse;
+        if(left->type == EXPR_INTEGER_LITERAL && right->type != EXPR_INTEGER_LITERAL) {
+            SWAP(const Expr *, left, right);
+            op = find_bytecode_condition(op)->swapped;
+        }
+        // Immediates are sign-extended, ordering them only works for signed values
+        bool equality = op == BINARY_OP_EQ || op == BINARY_OP_NE;
+        if(right->type == EXPR_INTEGER_LITERAL && (equality || is_signed_data_type(&type))) {
+            static const Bytecode_Op immediate_ops[] = {
+                [BINARY_OP_EQ] = BYTECODE_OP_JEQI, [BINARY_OP_NE] = BYTECODE_OP_JNEI,
+                [BINARY_OP_LT] = BYTECODE_OP_JLTI, [BINARY_OP_LE] = BYTECODE_OP_JLEI,
+                [BINARY_OP_GT] = BYTECODE_OP_JGTI, [BINARY_OP_GE] = BYTECODE_OP_JGEI,
+            };
+            size_t src = compile_bytecode_operand(c, left);
+            emit_bytecode_jump(c, immediate_ops[op], src, 0, (int32_t)right->as.literal_int, label);
+        } else {
+            size_t a = compile_bytecode_operand(c, left);
+            size_t b = compile_bytecode_operand(c, right);
+            bool swap = false;
+            Bytecode_Op jump = get_compare_op(BYTECODE_OP_JEQ, op, &type, &swap);
+            if(swap) SWAP(size_t, a, b);
+            emit_bytecode_jump(c, jump, a, b, 0, label);
+        }
+        c->top = mark;
+        return;
+    }
+
+    size_t src = compile_bytecode_operand(c, expr);
+    emit_bytecode_jump(c, jump_if ? BYTECODE_OP_JNZ : BYTECODE_OP_JZ, src, 0, 0, label);
+    c->top = mark;
+}
+
+static void compile_block_into_bytecode(Bytecode_Compiler *c, const Block *block);
+
+static void compile_switch_into_bytecode(Bytecode_Compiler *c, const Stmt_Switch *_switch)
+{
+    Bytecode_Module *bytecode = c->bytecode;
+    Data_Type type = eval_bytecode_expr(c, &_switch->value);
+    Switch_Lowering lowering;
+    lower_switch(_switch, &lowering);
+
+    if(bytecode->switches.count >= bytecode->switches.capacity) {
+        size_t new_capacity = bytecode->switches.capacity * 2;
+        if(new_capacity == 0) new_capacity = 16;
+        void *new_data = arena_alloc(bytecode->arena, new_capacity * sizeof(*bytecode->switches.data));
+        assert(new_data && "buy more ram lol!");
+        if(bytecode->switches.count > 0) memcpy(new_data, bytecode->switches.data, bytecode->switches.count * sizeof(*bytecode->switches.data));
+        bytecode->switches.data = new_data;
+        bytecode->switches.capacity = new_capacity;
+    }
+    size_t index = bytecode->switches.count++;
+    Bytecode_Switch *table = &bytecode->switches.data[index];
+    memset(table, 0, sizeof(*table));
+    table->ranges_count = lowering.count;
+    table->ranges = arena_alloc(bytecode->arena, (lowering.count + 1)*sizeof(Switch_Range));
+    table->cases_count = _switch->cases.count;
+    table->offsets = arena_alloc(bytecode->arena, (_switch->cases.count + 1)*sizeof(int32_t));
+    assert(table->ranges && table->offsets && "buy more ram lol!");
+    memcpy(table->ranges, lowering.ranges, lowering.count*sizeof(Switch_Range));
+    Data_Type value_type = type;
+    table->is_unsigned = !is_signed_data_type(&type) && get_data_type_size(&value_type) == 4;
+    if(lowering.use_jump_table) {
+        int64_t low = lowering.ranges[0].low;
+        table->table_count = (size_t)(lowering.ranges[lowering.count - 1].high - low) + 1;
+        table->table = arena_alloc(bytecode->arena, table->table_count*sizeof(uint16_t));
+        assert(table->table && "buy more ram lol!");
+        for(size_t i = 0; i < table->table_count; ++i) table->table[i] = (uint16_t)table->cases_count;
+        for(size_t i = 0; i < lowering.count; ++i) {
+            for(int64_t value = lowering.ranges[i].low; value <= lowering.ranges[i].high; ++value)
+                table->table[value - low] = (uint16_t)lowering.ranges[i].target;
+        }
+    }
+
+    // The offsets hold labels until the function is done
+    size_t value = compile_bytecode_operand(c, &_switch->value);
+    emit_bytecode(c, BYTECODE_OP_SWITCH, value, 0, 0, (int32_t)index);
+    size_t end = new_bytecode_label(c);
+    for(size_t i = 0; i <= _switch->cases.count; ++i) {
+        size_t label = new_bytecode_label(c);
+        table->offsets[i] = (int32_t)label;
+        place_bytecode_label(c, label);
+        compile_block_into_bytecode(c, i < _switch->cases.count ? &_switch->cases.data[i].todo : &_switch->_default);
+        if(i < _switch->cases.count) emit_bytecode_jump(c, BYTECODE_OP_JMP, 0, 0, 0, end);
+    }
+    place_bytecode_label(c, end);
+}
+
+static void compile_stmt_into_bytecode(Bytecode_Compiler *c, const Stmt *stmt)
+{
+    c->top = c->locals_count;
+    switch(stmt->type) {
+        case STMT_VAR_DEF:
+            {
+            } break;
+        case STMT_VAR_INIT:
+        case STMT_VAR_ASSIGN:
+            {
+                String_View name = stmt->type == STMT_VAR_INIT ? stmt->as.var_init.name : stmt->as.var_assign.name;
+                const Expr *value = stmt->type == STMT_VAR_INIT ? &stmt->as.var_init.value : &stmt->as.var_assign.value;
+                const Evaluated_Var *var = get_var_from_scope(&c->fn->scope, name);
+                Data_Type type = var->type;
+                size_t dst = get_var_register(c, name);
+                compile_expr_into_bytecode(c, value, dst);
+                if(!is_vector_data_type(&type)) compile_bytecode_narrowing(c, dst, dst, &type);
+            } break;
+        case STMT_RETURN:
+            {
+                Data_Type type = c->fn->def.return_type;
+                // The callee takes over the frame, its parameters are moved over the caller's ones
+                const Expr *value = &stmt->as._return.value;
+                if(c->options->tail_calls && value->type == EXPR_FUNCALL && find_builtin_fn(value->as.func_call.name) == BUILTIN_UNKNOWN
+                        && find_func_def(c->module, value->as.func_call.name) != NULL) {
+                    size_t slots = 0;
+                    size_t base = compile_call_arguments_into_bytecode(c, &value->as.func_call, &slots);
+                    emit_bytecode(c, BYTECODE_OP_TAILCALL, 0, base, slots, (int32_t)find_function_index(c, value->as.func_call.name));
+                    break;
+                }
+                size_t src = compile_bytecode_operand(c, &stmt->as._return.value);
+                if(!is_vector_data_type(&type) && get_data_type_size(&type) < 4) {
+                    size_t narrowed = alloc_registers(c, 1);
+                    compile_bytecode_narrowing(c, narrowed, src, &type);
+                    src = narrowed;
+                }
+                emit_bytecode(c, BYTECODE_OP_RET, src, 0, get_register_count(&type), 0);
+            } break;
+        case STMT_WHILE:
+            {
+                // Rotated like the native backends do, every iteration is a single compare-and-branch
+                size_t body = new_bytecode_label(c);
+                size_t end = new_bytecode_label(c);
+                compile_cond_into_bytecode(c, &stmt->as._while.condition, false, end);
+                place_bytecode_label(c, body);
+                compile_block_into_bytecode(c, &stmt->as._while.todo);
+                c->top = c->locals_count;
+                compile_cond_into_bytecode(c, &stmt->as._while.condition, true, body);
+                place_bytecode_label(c, end);
+            } break;
+        case STMT_IF:
+            {
+                size_t end = new_bytecode_label(c);
+                for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                    size_t next = new_bytecode_label(c);
+                    c->top = c->locals_count;
+                    compile_cond_into_bytecode(c, &branch->condition, false, next);
+                    compile_block_into_bytecode(c, &branch->todo);
+                    emit_bytecode_jump(c, BYTECODE_OP_JMP, 0, 0, 0, end);
+                    place_bytecode_label(c, next);
+                }
+                compile_block_into_bytecode(c, &stmt->as._if._else);
+                place_bytecode_label(c, end);
+            } break;
+        case STMT_SWITCH:
+            {
+                compile_switch_into_bytecode(c, &stmt->as._switch);
+            } break;
+        case STMT_EXPR:
+            {
+                Data_Type type = eval_bytecode_expr(c, &stmt->as.expr);
+                compile_expr_into_bytecode(c, &stmt->as.expr, alloc_registers(c, get_register_count(&type)));
+            } break;
+        default:
+            {
+                fatal("Unreachable");
+            } break;
+    }
+    c->top = c->locals_count;
+}
+
+static void compile_block_into_bytecode(Bytecode_Compiler *c, const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i)
+        compile_stmt_into_bytecode(c, &block->data[i]);
+}
+
+static bool is_bytecode_jump(Bytecode_Op op)
+{
+    return op >= BYTECODE_OP_JMP && op <= BYTECODE_OP_JGEI;
+}
+
+static void compile_func_def_into_bytecode(Bytecode_Module *bytecode, Evaluated_Module *module, const Compile_Options *options,
+        Evaluated_Fn *fn, Bytecode_Fn *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->name = fn->def.name;
+    Bytecode_Compiler c = {0};
+    c.bytecode = bytecode;
+    c.module = module;
+    c.options = options;
+    c.fn = fn;
+    c.out = out;
+    c.var_registers = arena_alloc(bytecode->arena, (fn->scope.vars.count + 1)*sizeof(size_t));
+    assert(c.var_registers && "buy more ram lol!");
+    // Parameters are the first variables of the scope
+    for(size_t i = 0; i < fn->scope.vars.count; ++i) {
+        Data_Type type = fn->scope.vars.data[i].type;
+        c.var_registers[i] = alloc_registers(&c, get_register_count(&type));
+    }
+    c.locals_count = c.top;
+    for(size_t i = 0; i < fn->def.params.count; ++i) {
+        Data_Type type = fn->def.params.data[i].type;
+        out->params_count += get_register_count(&type);
+    }
+
+    compile_block_into_bytecode(&c, &fn->def.body);
+    Data_Type return_type = fn->def.return_type;
+    if(return_type.is_native && return_type.as.native == NATIVE_TYPE_VOID) {
+        emit_bytecode(&c, BYTECODE_OP_RET, 0, 0, 0, 0);
+    } else {
+        // Only reachable by falling off a function that returned on every path
+        size_t count = get_register_count(&return_type);
+        size_t zero = alloc_registers(&c, count);
+        for(size_t i = 0; i < count; ++i) emit_bytecode(&c, BYTECODE_OP_MOVI, zero + i, 0, 0, 0);
+        emit_bytecode(&c, BYTECODE_OP_RET, zero, 0, count, 0);
+    }
+
+    // Labels become offsets from the jumps
+    for(size_t i = 0; i < out->code.count; ++i) {
+        Bytecode_Inst *inst = &out->code.data[i];
+        if(is_bytecode_jump(inst->op)) {
+            inst->offset = (int32_t)(c.labels.data[inst->offset] - i);
+        } else if(inst->op == BYTECODE_OP_SWITCH) {
+            Bytecode_Switch *table = &bytecode->switches.data[inst->imm];
+            for(size_t j = 0; j <= table->cases_count; ++j)
+                table->offsets[j] = (int32_t)(c.labels.data[table->offsets[j]] - i);
+        }
+    }
+}
+
+void compile_module_to_bytecode(Bytecode_Module *bytecode, Evaluated_Module *module, const Compile_Options *options)
+{
+    assert(bytecode->arena);
+    bytecode->functions.count = module->functions.count;
+    bytecode->functions.data = arena_alloc(bytecode->arena, (module->functions.count + 1)*sizeof(Bytecode_Fn));
+    assert(bytecode->functions.data && "buy more ram lol!");
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        compile_func_def_into_bytecode(bytecode, module, options, &module->functions.data[i], &bytecode->functions.data[i]);
+    }
+}
@@ -0,0 +1,611 @@
+#include "elysia.h"
+#include "elysia_ast.h"
+#include "elysia_compiler.h"
+#include "elysia_types.h"
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Ranges of a switch spanning at most this many values become C case labels, wider ones are
+// tested by an if/else chain in the default case so the output doesn't depend on GNU case ranges
+#define ELYSIA_C_SWITCH_MAX_CASE_LABELS 64
+#define ELYSIA_C_STRUCT_DECLS_CAPACITY 256
+
+static void compile_expr_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Expr *expr);
+
+static bool is_comparison_binary_op(Binary_Op_Type type)
+{
+    return type == BINARY_OP_EQ || type == BINARY_OP_NE || type == BINARY_OP_LT || type == BINARY_OP_LE
+        || type == BINARY_OP_GT || type == BINARY_OP_GE || type == BINARY_OP_AND || type == BINARY_OP_OR;
+}
+
+// Like `eval_expr` without checking the operands again. The evaluator already did and only looked at
+// the left operand of arithmetic, so the right one may not match its type
+static Data_Type eval_c_expr(Evaluated_Module *module, Evaluated_Fn *fn, const Expr *expr)
+{
+    if(expr->type == EXPR_FUNCALL) {
+        const Func_Def *fdef = find_func_def(module, expr->as.func_call.name);
+        if(fdef) return fdef->return_type;
+    } else if(expr->type == EXPR_BINARY_OP && !is_comparison_binary_op(expr->as.binop->type)) {
+        return eval_c_expr(module, fn, &expr->as.binop->left);
+    }
+    return eval_expr(module, &fn->scope, expr);
+}
+
+static bool is_unsigned_data_type(const Data_Type *type)
+{
+    if(!type->is_native || type->is_ptr) return false;
+    Native_Type native = type->as.native;
+    return native == NATIVE_TYPE_U8 || native == NATIVE_TYPE_U16 || native == NATIVE_TYPE_U32 || native == NATIVE_TYPE_U64;
+}
+
+static bool is_void_data_type(const Data_Type *type)
+{
+    return type->is_native && !type->is_ptr && !type->is_array && type->as.native == NATIVE_TYPE_VOID;
+}
+
+static const char *get_c_native_type_name(Native_Type type)
+{
+    switch(type) {
+        case NATIVE_TYPE_VOID: return "void";
+        case NATIVE_TYPE_U8: return "uint8_t";
+        case NATIVE_TYPE_U16: return "uint16_t";
+        case NATIVE_TYPE_U32: return "uint32_t";
+        case NATIVE_TYPE_U64: return "uint64_t";
+        case NATIVE_TYPE_I8: return "int8_t";
+        case NATIVE_TYPE_I16: return "int16_t";
+        case NATIVE_TYPE_I32: return "int32_t";
+        case NATIVE_TYPE_I64: return "int64_t";
+        case NATIVE_TYPE_BOOL: return "bool";
+        case NATIVE_TYPE_CHAR: return "char";
+        // Vector types keep their names, they are declared by the prelude
+        case NATIVE_TYPE_V4I32: return "v4i32";
+        case NATIVE_TYPE_V8I32: return "v8i32";
+        case NATIVE_TYPE_V16U8: return "v16u8";
+        case NATIVE_TYPE_V2I64: return "v2i64";
+        default:
+            {
+                fatal("Unreachable native type %d", type);
+            } break;
+    }
+    return NULL;
+}
+
+// Arrays decay into pointers, only variables keep their length
+static void compile_type_into_c(FILE *f, const Data_Type *type)
+{
+    if(type->is_native) {
+        fprintf(f, "%s", get_c_native_type_name(type->as.native));
+    } else {
+        fprintf(f, "struct "SV_FMT, SV_ARGV(type->name));
+    }
+    if(type->is_ptr) fprintf(f, " *");
+    if(type->is_array && type->array_len == 0) fprintf(f, type->is_ptr ? "*" : " *");
+}
+
+// Scalars are computed as 32 or 64-bit unsigned integers so overflowing wraps instead of being
+// undefined, the result is converted back to the signedness of the operands
+static const char *get_c_arithmetic_type_name(const Data_Type *type, bool is_unsigned_result)
+{
+    bool wide = !type->is_native || type->is_ptr || get_native_type_info(type->as.native).size > 4;
+    if(is_unsigned_result) return wide ? "uint64_t" : "uint32_t";
+    return wide ? "int64_t" : "int32_t";
+}
+
+static void compile_int_literal_into_c(FILE *f, int64_t value)
+{
+    // Integer literals are 32-bit like everywhere else in the compiler
+    if(value == (int32_t)value) fprintf(f, "%ld", value);
+    else fprintf(f, "(int32_t)%ldLL", value);
+}
+
+static void compile_args_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Expr *args, size_t count)
+{
+    for(size_t i = 0; i < count; ++i) {
+        if(i > 0) fprintf(f, ", ");
+        compile_expr_into_c(f, module, fn, &args[i]);
+    }
+}
+
+static void compile_vector_func_call_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Expr *expr)
+{
+    const Expr *args = expr->as.func_call.args.data;
+    size_t args_count = expr->as.func_call.args.count;
+    Builtin_Fn builtin = find_builtin_fn(expr->as.func_call.name);
+    if(builtin == BUILTIN_UNKNOWN) {
+        // Vector constructor, a single argument is splat into every lane
+        Native_Type_Info *info = find_native_type_info_by_name(expr->as.func_call.name);
+        if(args_count == 1) {
+            fprintf(f, "elysia_"SV_FMT"_splat(", SV_ARGV(info->name));
+            compile_expr_into_c(f, module, fn, &args[0]);
+            fprintf(f, ")");
+            return;
+        }
+        fprintf(f, "("SV_FMT"){ ", SV_ARGV(info->name));
+        for(size_t i = 0; i < args_count; ++i) {
+            fprintf(f, "%s(%s)(", i == 0 ? "" : ", ", get_c_native_type_name(info->lane_type));
+            compile_expr_into_c(f, module, fn, &args[i]);
+            fprintf(f, ")");
+        }
+        fprintf(f, " }");
+        return;
+    }
+
+    Data_Type type = eval_c_expr(module, fn, &args[0]);
+    const char *name = get_c_native_type_name(type.as.native);
+    switch(builtin) {
+        case BUILTIN_VEXTRACT:
+        case BUILTIN_VINSERT:
+        case BUILTIN_VREDUCE_ADD:
+            {
+                const char *suffix = builtin == BUILTIN_VEXTRACT ? "extract" : builtin == BUILTIN_VINSERT ? "insert" : "reduce_add";
+                fprintf(f, "elysia_%s_%s(", name, suffix);
+                compile_args_into_c(f, module, fn, args, args_count);
+                fprintf(f, ")");
+            } break;
+        case BUILTIN_VSHUFFLE:
+            {
+                fprintf(f, "elysia_%s_shuffle(", name);
+                compile_expr_into_c(f, module, fn, &args[0]);
+                fprintf(f, ", (const int[]){ ");
+                for(size_t i = 1; i < args_count; ++i)
+                    fprintf(f, "%s%ld", i == 1 ? "" : ", ", args[i].as.literal_int);
+                fprintf(f, " })");
+            } break;
+        case BUILTIN_VCMPEQ:
+        case BUILTIN_VCMPGT:
+            {
+                // Vector comparisons already set every bit of the lanes where they hold
+                fprintf(f, "(%s)((", name);
+                compile_expr_into_c(f, module, fn, &args[0]);
+                fprintf(f, ") %s (", builtin == BUILTIN_VCMPEQ ? "==" : ">");
+                compile_expr_into_c(f, module, fn, &args[1]);
+                fprintf(f, "))");
+            } break;
+        default:
+            {
+                compilation_error(expr->loc, "Unknown builtin function\n");
+                compilation_failure();
+            } break;
+    }
+}
+
+static void compile_expr_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_INTEGER_LITERAL:
+            {
+                compile_int_literal_into_c(f, expr->as.literal_int);
+            } break;
+        case EXPR_BOOL_LITERAL:
+            {
+                fprintf(f, "%s", expr->as.literal_bool ? "true" : "false");
+            } break;
+        case EXPR_FUNCALL:
+            {
+                Native_Type_Info *info = find_native_type_info_by_name(expr->as.func_call.name);
+                if(find_builtin_fn(expr->as.func_call.name) != BUILTIN_UNKNOWN || (info && info->lanes > 0)) {
+                    compile_vector_func_call_into_c(f, module, fn, expr);
+                    break;
+                }
+                fprintf(f, SV_FMT"(", SV_ARGV(expr->as.func_call.name));
+                compile_args_into_c(f, module, fn, expr->as.func_call.args.data, expr->as.func_call.args.count);
+                fprintf(f, ")");
+            } break;
+        case EXPR_VAR_READ:
+            {
+                fprintf(f, SV_FMT, SV_ARGV(expr->as.var_read.name));
+            } break;
+        case EXPR_BINARY_OP:
+            {
+                const Expr_Binary_Op *binop = expr->as.binop;
+                const char *op = NULL;
+                switch(binop->type) {
+                    case BINARY_OP_ADD: op = "+"; break;
+                    case BINARY_OP_SUB: op = "-"; break;
+                    case BINARY_OP_MUL: op = "*"; break;
+                    case BINARY_OP_EQ: op = "=="; break;
+                    case BINARY_OP_NE: op = "!="; break;
+                    case BINARY_OP_LT: op = "<"; break;
+                    case BINARY_OP_LE: op = "<="; break;
+                    case BINARY_OP_GT: op = ">"; break;
+                    case BINARY_OP_GE: op = ">="; break;
+                    case BINARY_OP_AND: op = "&&"; break;
+                    case BINARY_OP_OR: op = "||"; break;
+                    default:
+                        {
+                            compilation_error(expr->loc, "Parsed but not implemented expression\n");
+                            compilation_failure();
+                        } break;
+                }
+
+                if(is_comparison_binary_op(binop->type)) {
+                    fprintf(f, "(");
+                    compile_expr_into_c(f, module, fn, &binop->left);
+                    fprintf(f, " %s ", op);
+                    compile_expr_into_c(f, module, fn, &binop->right);
+                    fprintf(f, ")");
+                    break;
+                }
+
+                Data_Type type = eval_c_expr(module, fn, &binop->left);
+                const char *result_type = NULL;
+                const char *operand_type = NULL;
+                if(is_vector_data_type(&type)) {
+                    // Lanes wrap the same way through the unsigned vector type of the same shape
+                    result_type = get_c_native_type_name(type.as.native);
+                    fprintf(f, "(%s)((elysia_%s_bits)(", result_type, result_type);
+                    compile_expr_into_c(f, module, fn, &binop->left);
+                    fprintf(f, ") %s (elysia_%s_bits)(", op, result_type);
+                    compile_expr_into_c(f, module, fn, &binop->right);
+                    fprintf(f, "))");
+                    break;
+                }
+                result_type = get_c_arithmetic_type_name(&type, is_unsigned_data_type(&type));
+                operand_type = get_c_arithmetic_type_name(&type, true);
+                fprintf(f, "(%s)((%s)(", result_type, operand_type);
+                compile_expr_into_c(f, module, fn, &binop->left);
+                fprintf(f, ") %s (%s)(", op, operand_type);
+                compile_expr_into_c(f, module, fn, &binop->right);
+                fprintf(f, "))");
+            } break;
+        default:
+            {
+                compilation_error(expr->loc, "Unreachable expression type");
+                compilation_failure();
+            } break;
+    }
+}
+
+// Narrowing to the type of the destination happens through the conversion of the cast
+static void compile_value_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Data_Type *type,
+        const Expr *value)
+{
+    if(is_vector_data_type(type)) {
+        compile_expr_into_c(f, module, fn, value);
+        return;
+    }
+    fprintf(f, "(");
+    compile_type_into_c(f, type);
+    fprintf(f, ")(");
+    compile_expr_into_c(f, module, fn, value);
+    fprintf(f, ")");
+}
+
+static void compile_block_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Block *block, size_t depth);
+
+static void compile_switch_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Stmt_Switch *_switch,
+        size_t depth)
+{
+    // The value gets a variable of its own, wide ranges test it again in the default case
+    size_t value = fn->temps_count++;
+    Data_Type type = eval_c_expr(module, fn, &_switch->value);
+    fprintf(f, "%*s{\n", (int)depth*4, "");
+    fprintf(f, "%*s", (int)(depth + 1)*4, "");
+    compile_type_into_c(f, &type);
+    fprintf(f, " _switch%zu = ", value);
+    compile_expr_into_c(f, module, fn, &_switch->value);
+    fprintf(f, ";\n");
+    fprintf(f, "%*sswitch(_switch%zu) {\n", (int)(depth + 1)*4, "", value);
+
+    bool has_wide_ranges = false;
+    for(size_t i = 0; i < _switch->cases.count; ++i) {
+        const Switch_Case *_case = &_switch->cases.data[i];
+        bool has_labels = false;
+        for(size_t j = 0; j < _case->ranges.count; ++j) {
+            const Case_Range *range = &_case->ranges.data[j];
+            if(range->high - range->low >= ELYSIA_C_SWITCH_MAX_CASE_LABELS) {
+                has_wide_ranges = true;
+                continue;
+            }
+            for(int64_t v = range->low; v <= range->high; ++v) {
+                fprintf(f, "%*scase %ld:\n", (int)(depth + 2)*4, "", v);
+            }
+            has_labels = true;
+        }
+        if(!has_labels) continue;
+        fprintf(f, "%*s{\n", (int)(depth + 2)*4, "");
+        compile_block_into_c(f, module, fn, &_case->todo, depth + 3);
+        fprintf(f, "%*s} break;\n", (int)(depth + 2)*4, "");
+    }
+
+    fprintf(f, "%*sdefault:\n", (int)(depth + 2)*4, "");
+    fprintf(f, "%*s{\n", (int)(depth + 2)*4, "");
+    size_t inner = depth + 3;
+    if(has_wide_ranges) {
+        bool first = true;
+        for(size_t i = 0; i < _switch->cases.count; ++i) {
+            const Switch_Case *_case = &_switch->cases.data[i];
+            bool has_wide = false;
+            for(size_t j = 0; j < _case->ranges.count; ++j) {
+                const Case_Range *range = &_case->ranges.data[j];
+                if(range->high - range->low < ELYSIA_C_SWITCH_MAX_CASE_LABELS) continue;
+                fprintf(f, has_wide ? " || " : first ? "%*sif(" : " else if(", (int)inner*4, "");
+                fprintf(f, "(_switch%zu >= %ld && _switch%zu <= %ld)", value, range->low, value, range->high);
+                has_wide = true;
+            }
+            if(!has_wide) continue;
+            fprintf(f, ") {\n");
+            compile_block_into_c(f, module, fn, &_case->todo, inner + 1);
+            fprintf(f, "%*s}", (int)inner*4, "");
+            first = false;
+        }
+        fprintf(f, " else {\n");
+        inner += 1;
+    }
+    compile_block_into_c(f, module, fn, &_switch->_default, inner);
+    if(has_wide_ranges) fprintf(f, "%*s}\n", (int)(depth + 3)*4, "");
+    fprintf(f, "%*s} break;\n", (int)(depth + 2)*4, "");
+    fprintf(f, "%*s}\n", (int)(depth + 1)*4, "");
+    fprintf(f, "%*s}\n", (int)depth*4, "");
+}
+
+static void compile_stmt_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Stmt *stmt, size_t depth)
+{
+    switch(stmt->type) {
+        case STMT_VAR_DEF:
+            {
+            } break;
+        case STMT_VAR_INIT:
+        case STMT_VAR_ASSIGN:
+            {
+                String_View name = stmt->type == STMT_VAR_INIT ? stmt->as.var_init.name : stmt->as.var_assign.name;
+                const Expr *value = stmt->type == STMT_VAR_INIT ? &stmt->as.var_init.value : &stmt->as.var_assign.value;
+                const Evaluated_Var *var = get_var_from_scope(&fn->scope, name);
+                fprintf(f, "%*s"SV_FMT" = ", (int)depth*4, "", SV_ARGV(name));
+                compile_value_into_c(f, module, fn, &var->type, value);
+                fprintf(f, ";\n");
+            } break;
+        case STMT_RETURN:
+            {
+                if(is_void_data_type(&fn->def.return_type)) {
+                    fprintf(f, "%*sreturn;\n", (int)depth*4, "");
+                    break;
+                }
+                fprintf(f, "%*sreturn ", (int)depth*4, "");
+                compile_value_into_c(f, module, fn, &fn->def.return_type, &stmt->as._return.value);
+                fprintf(f, ";\n");
+            } break;
+        case STMT_WHILE:
+            {
+                fprintf(f, "%*swhile(", (int)depth*4, "");
+                compile_expr_into_c(f, module, fn, &stmt->as._while.condition);
+                fprintf(f, ") {\n");
+                compile_block_into_c(f, module, fn, &stmt->as._while.todo, depth + 1);
+                fprintf(f, "%*s}\n", (int)depth*4, "");
+            } break;
+        case STMT_IF:
+            {
+                fprintf(f, "%*s", (int)depth*4, "");
+                for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                    fprintf(f, "if(");
+                    compile_expr_into_c(f, module, fn, &branch->condition);
+                    fprintf(f, ") {\n");
+                    compile_block_into_c(f, module, fn, &branch->todo, depth + 1);
+                    fprintf(f, "%*s}", (int)depth*4, "");
+                    if(branch->elif) fprintf(f, " else ");
+                }
+                if(stmt->as._if._else.count > 0) {
+                    fprintf(f, " else {\n");
+                    compile_block_into_c(f, module, fn, &stmt->as._if._else, depth + 1);
+                    fprintf(f, "%*s}", (int)depth*4, "");
+                }
+                fprintf(f, "\n");
+            } break;
+        case STMT_EXPR:
+            {
+                fprintf(f, "%*s(void)", (int)depth*4, "");
+                compile_expr_into_c(f, module, fn, &stmt->as.expr);
+                fprintf(f, ";\n");
+            } break;
+        case STMT_SWITCH:
+            {
+                compile_switch_into_c(f, module, fn, &stmt->as._switch, depth);
+            } break;
+        default:
+            {
+                fatal("Unreachable");
+            } break;
+    }
+}
+
+static void compile_block_into_c(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, const Block *block, size_t depth)
+{
+    for(size_t i = 0; i < block->count; ++i)
+        compile_stmt_into_c(f, module, fn, &block->data[i], depth);
+}
+
+static void compile_func_signature_into_c(FILE *f, const Func_Def *def)
+{
+    // Functions that aren't `pub` stay private to the translation unit
+    bool exported = def->is_pub || sv_eq(def->name, SV("main"));
+    if(!exported) fprintf(f, "static ");
+    compile_type_into_c(f, &def->return_type);
+    fprintf(f, " "SV_FMT"(", SV_ARGV(def->name));
+    if(def->params.count == 0) fprintf(f, "void");
+    for(size_t i = 0; i < def->params.count; ++i) {
+        if(i > 0) fprintf(f, ", ");
+        compile_type_into_c(f, &def->params.data[i].type);
+        fprintf(f, " "SV_FMT, SV_ARGV(def->params.data[i].name));
+    }
+    fprintf(f, ")");
+}
+
+static bool is_param_name(const Func_Def *def, String_View name)
+{
+    for(size_t i = 0; i < def->params.count; ++i) {
+        if(sv_eq(def->params.data[i].name, name)) return true;
+    }
+    return false;
+}
+
+static void compile_func_def_into_c(Evaluated_Module *module, FILE *f, Evaluated_Fn *fn)
+{
+    compile_func_signature_into_c(f, &fn->def);
+    fprintf(f, "\n{\n");
+    // Every variable is declared up front and starts zeroed
+    for(uint32_t i = 0; i < fn->scope.vars.count; ++i) {
+        const Evaluated_Var *var = &fn->scope.vars.data[i];
+        if(is_param_name(&fn->def, var->name)) continue;
+        // Shadowed by an earlier variable of the same name, every use resolves to that one
+        if(get_var_from_scope(&fn->scope, var->name) != var) continue;
+        fprintf(f, "    ");
+        compile_type_into_c(f, &var->type);
+        fprintf(f, " "SV_FMT, SV_ARGV(var->name));
+        if(var->type.is_array && var->type.array_len > 0) fprintf(f, "[%zu]", var->type.array_len);
+        fprintf(f, " = {0};\n");
+    }
+    compile_block_into_c(f, module, fn, &fn->def.body, 1);
+    if(!is_void_data_type(&fn->def.return_type)) {
+        // Only reachable by falling off a function that returned on every path
+        fprintf(f, "    return (");
+        compile_type_into_c(f, &fn->def.return_type);
+        fprintf(f, "){0};\n");
+    }
+    fprintf(f, "}\n\n");
+}
+
+// Vector types use the GNU C vector extension understood by GCC and Clang, anything they can't do
+// directly goes through a small helper the C compiler inlines
+static void compile_vector_prelude_into_c(FILE *f)
+{
+    fprintf(f, "#ifdef __GNUC__\n");
+    // The helpers are inlined so passing wide vectors without AVX enabled never crosses an ABI boundary
+    fprintf(f, "#pragma GCC diagnostic ignored \"-Wpsabi\"\n");
+    for(Native_Type type = NATIVE_TYPE_VOID; type < COUNT_NATIVE_TYPES; ++type) {
+        Native_Type_Info info = get_native_type_info(type);
+        if(info.lanes == 0) continue;
+        const char *name = get_c_native_type_name(type);
+        const char *lane = get_c_native_type_name(info.lane_type);
+        const char *bits = info.lane_type == NATIVE_TYPE_I64 ? "uint64_t" : info.lane_type == NATIVE_TYPE_U8 ? "uint8_t" : "uint32_t";
+        const char *sum = info.lane_type == NATIVE_TYPE_I64 ? "uint64_t" : "uint32_t";
+        fprintf(f, "typedef %s %s __attribute__((vector_size(%zu)));\n", lane, name, info.size);
+        fprintf(f, "typedef %s elysia_%s_bits __attribute__((vector_size(%zu)));\n", bits, name, info.size);
+        fprintf(f, "static inline %s elysia_%s_splat(%s x) { %s v = {0}; for(int i = 0; i < %zu; ++i) v[i] = x; return v; }\n",
+                name, name, lane, name, info.lanes);
+        fprintf(f, "static inline %s elysia_%s_extract(%s v, int lane) { return v[lane]; }\n", lane, name, name);
+        fprintf(f, "static inline %s elysia_%s_insert(%s v, int lane, %s x) { v[lane] = x; return v; }\n",
+                name, name, name, lane);
+        fprintf(f, "static inline %s elysia_%s_shuffle(%s v, const int *lanes) { %s r = {0}; for(int i = 0; i < %zu; ++i) r[i] = v[lanes[i]]; return r; }\n",
+                name, name, name, name, info.lanes);
+        fprintf(f, "static inline %s elysia_%s_reduce_add(%s v) { %s sum = 0; for(int i = 0; i < %zu; ++i) sum += (%s)v[i]; return (%s)sum; }\n",
+                lane, name, name, sum, info.lanes, sum, lane);
+    }
+    fprintf(f, "#endif // __GNUC__\n\n");
+}
+
+static void compile_struct_decl_into_c(FILE *f, String_View *declared, size_t *declared_count, const Data_Type *type)
+{
+    if(type->is_native) return;
+    for(size_t i = 0; i < *declared_count; ++i) {
+        if(sv_eq(declared[i], type->name)) return;
+    }
+    assert(*declared_count < ELYSIA_C_STRUCT_DECLS_CAPACITY && "buy more ram lol!");
+    declared[(*declared_count)++] = type->name;
+    fprintf(f, "struct "SV_FMT";\n", SV_ARGV(type->name));
+}
+
+static void compile_module_to_c(FILE *f, Evaluated_Module *module)
+{
+    fprintf(f, "#include <stdbool.h>\n");
+    fprintf(f, "#include <stdint.h>\n\n");
+    compile_vector_prelude_into_c(f);
+
+    // Struct types are only ever used through pointers, their declarations are enough
+    String_View declared[ELYSIA_C_STRUCT_DECLS_CAPACITY];
+    size_t declared_count = 0;
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        const Evaluated_Fn *fn = &module->functions.data[i];
+        compile_struct_decl_into_c(f, declared, &declared_count, &fn->def.return_type);
+        for(uint32_t j = 0; j < fn->scope.vars.count; ++j)
+            compile_struct_decl_into_c(f, declared, &declared_count, &fn->scope.vars.data[j].type);
+    }
+    if(declared_count > 0) fprintf(f, "\n");
+
+    // Functions may call each other in any order
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        compile_func_signature_into_c(f, &module->functions.data[i].def);
+        fprintf(f, ";\n");
+    }
+    fprintf(f, "\n");
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        compile_func_def_into_c(module, f, &module->functions.data[i]);
+    }
+}
+
+// The C source is streamed into the C compiler's standard input like the QBE backend streams its IR
+typedef struct {
+    FILE *input;
+    pid_t pid;
+} C_Compiler_Process;
+
+static void open_c_compiler(C_Compiler_Process *process, const char *file_path, const Compile_Options *options)
+{
+    int pipes[2];
+    if(pipe(pipes) != 0) {
+        fatal("Failed to create a pipe: %s", strerror(errno));
+    }
+    // Functions taking or returning wide vectors make GCC note that their ABI changed in GCC 4.6, a
+    // note the pragma of the prelude doesn't silence
+    const char *argv[] = { options->assembler, options->c_optimization, "-Wno-psabi", "-x", "c", "-o", file_path, "-", NULL, NULL };
+    if(options->output_kind == OUTPUT_KIND_ASM) argv[8] = "-S";
+    // Without `-c` the driver links the program against the system C library
+    if(options->output_kind == OUTPUT_KIND_OBJ) argv[8] = "-c";
+
+    process->pid = fork();
+    if(process->pid < 0) {
+        fatal("Failed to start %s: %s", argv[0], strerror(errno));
+    }
+    if(process->pid == 0) {
+        dup2(pipes[0], STDIN_FILENO);
+        close(pipes[0]);
+        close(pipes[1]);
+        execvp(argv[0], (char *const *)argv);
+        fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(pipes[0]);
+
+    // The C compiler dying early shows up in its exit status, not as SIGPIPE killing the compiler
+    signal(SIGPIPE, SIG_IGN);
+    process->input = fdopen(pipes[1], "w");
+    if(!process->input) {
+        fatal("Failed to open the pipe into %s: %s", options->assembler, strerror(errno));
+    }
+}
+
+static bool close_c_compiler(C_Compiler_Process *process)
+{
+    bool ok = fclose(process->input) == 0;
+    int status = 0;
+    if(waitpid(process->pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    return ok;
+}
+
+void compile_module_to_c_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options)
+{
+    C_Compiler_Process process = {0};
+    bool piped = options->output_kind != OUTPUT_KIND_IR;
+    if(piped) {
+        open_c_compiler(&process, file_path, options);
+    }
+    FILE *f = piped ? process.input : fopen(file_path, "w");
+    if(!f) {
+        fatal("Failed to open file file %s", file_path);
+    }
+
+    compile_module_to_c(f, module);
+
+    if(piped) {
+        if(!close_c_compiler(&process)) {
+            fatal("Failed to compile the module into %s", file_path);
+        }
+    } else {
+        fclose(f);
+    }
+}
@@ -1,47 +1,319 @@
 #include "elysia.h"
 #include "elysia_ast.h"
 #include "elysia_compiler.h"
+#include "elysia_emitter.h"
 #include "elysia_types.h"
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-static void compile_expr_into_qbe(FILE *f, Evaluated_Module *module, Scope *scope, const Expr expr)
+static void compile_vector_func_call_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope,
+        const Expr expr);
+
+static void compile_cond_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Expr expr,
+        size_t on_true, size_t on_false);
+
+// Instructions that used to be hard to trace back end with where they were emitted from when
+// `--annotate-ir` is given
+#define QBE_LINE_END(e) emit_line_end(e, "#", __FILE__, __LINE__)
+
+static void emit_qbe_label(Emitter *e, size_t label)
+{
+    emit_symbol(e, "@L", label);
+    emit_char(e, '\n');
+}
+
+static void emit_qbe_jmp(Emitter *e, size_t label)
+{
+    emit_symbol(e, "    jmp @L", label);
+    emit_char(e, '\n');
+}
+
+// Ends a `jnz` whose value was already emitted
+static void emit_qbe_jnz_targets(Emitter *e, size_t on_true, size_t on_false)
+{
+    emit_symbol(e, ", @L", on_true);
+    emit_symbol(e, ", @L", on_false);
+    emit_char(e, '\n');
+}
+
+// `%_v<vector>.<lane>`
+static void emit_qbe_lane(Emitter *e, size_t vector, size_t lane)
+{
+    emit_symbol(e, "%_v", vector);
+    emit_symbol(e, ".", lane);
+}
+
+// Starts `    %_v<vector>.<lane> =<k> <instruction>`, the operands follow
+static void emit_qbe_lane_inst(Emitter *e, size_t vector, size_t lane, char k, const char *instruction)
+{
+    emit_literal(e, "    ");
+    emit_qbe_lane(e, vector, lane);
+    emit_literal(e, " =");
+    emit_char(e, k);
+    emit_char(e, ' ');
+    emit_cstr(e, instruction);
+}
+
+// Byte lanes wrap around after every operation
+static void emit_qbe_lane_wrap(Emitter *e, size_t vector, size_t lane)
+{
+    emit_qbe_lane_inst(e, vector, lane, 'w', "and ");
+    emit_qbe_lane(e, vector, lane);
+    emit_literal(e, ", 255\n");
+}
+
+// Stores the scalar in `%_1` into a lane, 64-bit lanes are sign extended
+static void emit_qbe_lane_store(Emitter *e, size_t vector, size_t lane, Native_Type_Info info)
+{
+    if(info.lane_type == NATIVE_TYPE_I64) emit_qbe_lane_inst(e, vector, lane, 'l', "extsw %_1\n");
+    else if(info.lane_type == NATIVE_TYPE_U8) emit_qbe_lane_inst(e, vector, lane, 'w', "and %_1, 255\n");
+    else emit_qbe_lane_inst(e, vector, lane, 'w', "copy %_1\n");
+}
+
+static bool is_logical_binary_op(const Expr *expr)
+{
+    return expr->type == EXPR_BINARY_OP && (expr->as.binop->type == BINARY_OP_AND || expr->as.binop->type == BINARY_OP_OR);
+}
+
+static void compile_expr_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Expr expr)
 {
     switch(expr.type) {
         case EXPR_INTEGER_LITERAL:
             {
-                fprintf(f, "    %%_1 =w copy %ld # %s:%d\n", expr.as.literal_int, __FILE__, __LINE__);
+                emit_literal(e, "    %_1 =w copy ");
+                emit_int(e, expr.as.literal_int);
+                QBE_LINE_END(e);
+            } break;
+        case EXPR_BOOL_LITERAL:
+            {
+                emit_literal(e, "    %_1 =w copy ");
+                emit_int(e, expr.as.literal_bool ? 1 : 0);
+                QBE_LINE_END(e);
             } break;
         case EXPR_FUNCALL:
             {
-                fprintf(f, "    call "SV_FMT"()\n", SV_ARGV(expr.as.func_call.name));
+                if(find_builtin_fn(expr.as.func_call.name) != BUILTIN_UNKNOWN) {
+                    compile_vector_func_call_into_qbe(e, module, fn, scope, expr);
+                    break;
+                }
+                // Arguments are evaluated into their own temporaries before the call
+                size_t first_arg = fn->temps_count;
+                fn->temps_count += expr.as.func_call.args.count;
+                for(size_t i = 0; i < expr.as.func_call.args.count; ++i) {
+                    compile_expr_into_qbe(e, module, fn, scope, expr.as.func_call.args.data[i]);
+                    emit_symbol(e, "    %_t", first_arg + i);
+                    emit_literal(e, " =w copy %_1\n");
+                }
+                emit_literal(e, "    %_1 =w call $");
+                emit_sv(e, expr.as.func_call.name);
+                emit_literal(e, "(");
+                for(size_t i = 0; i < expr.as.func_call.args.count; ++i) {
+                    emit_cstr(e, i == 0 ? "" : ", ");
+                    emit_symbol(e, "w %_t", first_arg + i);
+                }
+                emit_literal(e, ")\n");
             } break;
         case EXPR_VAR_READ:
             {
                 const Evaluated_Var *var = get_var_from_scope(scope, expr.as.var_read.name);
-                fprintf(f, "    %%_1 =w copy %%"SV_FMT" # %s:%d\n", SV_ARGV(var->name), __FILE__, __LINE__);
+                emit_literal(e, "    %_1 =w copy %");
+                emit_sv(e, var->name);
+                QBE_LINE_END(e);
             } break;
         case EXPR_BINARY_OP:
             {
-                compile_expr_into_qbe(f, module, scope, expr.as.binop->right);
-                fprintf(f, "    %%_2 =w copy %%_1 # %s:%d\n", __FILE__, __LINE__);
-                compile_expr_into_qbe(f, module, scope, expr.as.binop->left);
+                if(is_logical_binary_op(&expr)) {
+                    // Only materialized when used as a value, both paths join with the boolean in `%_1`
+                    size_t on_true = fn->labels_count++;
+                    size_t on_false = fn->labels_count++;
+                    size_t end = fn->labels_count++;
+                    compile_cond_into_qbe(e, module, fn, scope, expr, on_true, on_false);
+                    emit_qbe_label(e, on_true);
+                    emit_literal(e, "    %_1 =w copy 1\n");
+                    emit_qbe_jmp(e, end);
+                    emit_qbe_label(e, on_false);
+                    emit_literal(e, "    %_1 =w copy 0\n");
+                    emit_qbe_label(e, end);
+                    break;
+                }
+
+                // The right operand is kept in its own temporary so nested operations can't clobber it
+                compile_expr_into_qbe(e, module, fn, scope, expr.as.binop->right);
+                size_t rhs = fn->temps_count++;
+                emit_symbol(e, "    %_t", rhs);
+                emit_literal(e, " =w copy %_1");
+                QBE_LINE_END(e);
+                compile_expr_into_qbe(e, module, fn, scope, expr.as.binop->left);
+                const char *instruction = NULL;
                 switch(expr.as.binop->type) {
-                    case BINARY_OP_ADD:
+                    case BINARY_OP_ADD: instruction = "add"; break;
+                    case BINARY_OP_SUB: instruction = "sub"; break;
+                    case BINARY_OP_MUL: instruction = "mul"; break;
+                    case BINARY_OP_EQ: instruction = "ceqw"; break;
+                    case BINARY_OP_NE: instruction = "cnew"; break;
+                    case BINARY_OP_LT: instruction = "csltw"; break;
+                    case BINARY_OP_LE: instruction = "cslew"; break;
+                    case BINARY_OP_GT: instruction = "csgtw"; break;
+                    case BINARY_OP_GE: instruction = "csgew"; break;
+                    default:
                         {
-                            fprintf(f, "    %%_1 =w add %%_1, %%_2 # %s:%d\n", __FILE__, __LINE__);
+                            compilation_error(expr.loc, "Parsed but not implemented expression\n");
+                            compilation_failure();
                         } break;
-                    case BINARY_OP_SUB:
+                }
+                emit_literal(e, "    %_1 =w ");
+                emit_cstr(e, instruction);
+                emit_symbol(e, " %_1, %_t", rhs);
+                QBE_LINE_END(e);
+            } break;
+        default:
+            {
+                compilation_error(expr.loc, "Unreachable expression type");
+                compilation_failure();
+            } break;
+    }
+}
+
+// Conditions jump straight to `on_true` or `on_false`. `&&` and `||` never materialize a boolean,
+// the right operand is only evaluated on the path where the left one didn't decide the result
+static void compile_cond_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Expr expr,
+        size_t on_true, size_t on_false)
+{
+    if(expr.type == EXPR_BOOL_LITERAL) {
+        emit_qbe_jmp(e, expr.as.literal_bool ? on_true : on_false);
+        return;
+    }
+    if(!is_logical_binary_op(&expr)) {
+        compile_expr_into_qbe(e, module, fn, scope, expr);
+        emit_literal(e, "    jnz %_1");
+        emit_qbe_jnz_targets(e, on_true, on_false);
+        return;
+    }
+
+    size_t right = fn->labels_count++;
+    if(expr.as.binop->type == BINARY_OP_AND) {
+        compile_cond_into_qbe(e, module, fn, scope, expr.as.binop->left, right, on_false);
+    } else {
+        compile_cond_into_qbe(e, module, fn, scope, expr.as.binop->left, on_true, right);
+    }
+    emit_qbe_label(e, right);
+    compile_cond_into_qbe(e, module, fn, scope, expr.as.binop->right, on_true, on_false);
+}
+
+static char get_qbe_lane_class(Native_Type_Info info)
+{
+    return info.lane_type == NATIVE_TYPE_I64 ? 'l' : 'w';
+}
+
+// QBE has no vector types, every lane of a vector is its own temporary named `%<vector>.<lane>`.
+// Vector expressions are compiled into the lanes of `%_v<dst>`
+static void compile_vector_expr_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope,
+        const Expr expr, size_t dst)
+{
+    Data_Type type = eval_expr(module, scope, &expr);
+    Native_Type_Info info = get_native_type_info(type.as.native);
+    char k = get_qbe_lane_class(info);
+    switch(expr.type) {
+        case EXPR_VAR_READ:
+            {
+                for(size_t lane = 0; lane < info.lanes; ++lane) {
+                    emit_qbe_lane_inst(e, dst, lane, k, "copy %");
+                    emit_sv(e, expr.as.var_read.name);
+                    emit_symbol(e, ".", lane);
+                    emit_char(e, '\n');
+                }
+            } break;
+        case EXPR_BINARY_OP:
+            {
+                size_t rhs = fn->temps_count++;
+                compile_vector_expr_into_qbe(e, module, fn, scope, expr.as.binop->left, dst);
+                compile_vector_expr_into_qbe(e, module, fn, scope, expr.as.binop->right, rhs);
+                const char *instruction = NULL;
+                switch(expr.as.binop->type) {
+                    case BINARY_OP_ADD: instruction = "add"; break;
+                    case BINARY_OP_SUB: instruction = "sub"; break;
+                    case BINARY_OP_MUL: instruction = "mul"; break;
+                    default:
+                        {
+                            compilation_error(expr.loc, "Parsed but not implemented expression\n");
+                            compilation_failure();
+                        } break;
+                }
+                for(size_t lane = 0; lane < info.lanes; ++lane) {
+                    emit_qbe_lane_inst(e, dst, lane, k, instruction);
+                    emit_char(e, ' ');
+                    emit_qbe_lane(e, dst, lane);
+                    emit_literal(e, ", ");
+                    emit_qbe_lane(e, rhs, lane);
+                    emit_char(e, '\n');
+                    if(info.lane_type == NATIVE_TYPE_U8) emit_qbe_lane_wrap(e, dst, lane);
+                }
+            } break;
+        case EXPR_FUNCALL:
+            {
+                const Expr *args = expr.as.func_call.args.data;
+                switch(find_builtin_fn(expr.as.func_call.name)) {
+                    case BUILTIN_UNKNOWN:
                         {
-                            fprintf(f, "    %%_1 =w sub %%_1, %%_2 # %s:%d\n", __FILE__, __LINE__);
+                            // Vector constructor, a single argument is splat into every lane
+                            for(size_t lane = 0; lane < info.lanes; ++lane) {
+                                const Expr *arg = &args[expr.as.func_call.args.count == 1 ? 0 : lane];
+                                if(lane == 0 || expr.as.func_call.args.count > 1)
+                                    compile_expr_into_qbe(e, module, fn, scope, *arg);
+                                emit_qbe_lane_store(e, dst, lane, info);
+                            }
                         } break;
-                    case BINARY_OP_MUL:
+                    case BUILTIN_VINSERT:
                         {
-                            fprintf(f, "    %%_1 =w mul %%_1, %%_2 # %s:%d\n", __FILE__, __LINE__);
+                            size_t lane = args[1].as.literal_int;
+                            compile_vector_expr_into_qbe(e, module, fn, scope, args[0], dst);
+                            compile_expr_into_qbe(e, module, fn, scope, args[2]);
+                            emit_qbe_lane_store(e, dst, lane, info);
+                        } break;
+                    case BUILTIN_VSHUFFLE:
+                        {
+                            size_t src = fn->temps_count++;
+                            compile_vector_expr_into_qbe(e, module, fn, scope, args[0], src);
+                            for(size_t lane = 0; lane < info.lanes; ++lane) {
+                                emit_qbe_lane_inst(e, dst, lane, k, "copy ");
+                                emit_qbe_lane(e, src, args[lane + 1].as.literal_int);
+                                emit_char(e, '\n');
+                            }
+                        } break;
+                    case BUILTIN_VCMPEQ:
+                    case BUILTIN_VCMPGT:
+                        {
+                            bool eq = find_builtin_fn(expr.as.func_call.name) == BUILTIN_VCMPEQ;
+                            size_t rhs = fn->temps_count++;
+                            compile_vector_expr_into_qbe(e, module, fn, scope, args[0], dst);
+                            compile_vector_expr_into_qbe(e, module, fn, scope, args[1], rhs);
+                            const char *instruction = eq ? "ceq" : info.lane_type == NATIVE_TYPE_U8 ? "cugt" : "csgt";
+                            for(size_t lane = 0; lane < info.lanes; ++lane) {
+                                // Comparisons give 0 or 1, lanes of a mask have all of their bits set
+                                // The class of the comparison is part of its name e.g. `csgtw`
+                                emit_qbe_lane_inst(e, dst, lane, k, instruction);
+                                emit_char(e, k);
+                                emit_char(e, ' ');
+                                emit_qbe_lane(e, dst, lane);
+                                emit_literal(e, ", ");
+                                emit_qbe_lane(e, rhs, lane);
+                                emit_char(e, '\n');
+                                emit_qbe_lane_inst(e, dst, lane, k, "sub 0, ");
+                                emit_qbe_lane(e, dst, lane);
+                                emit_char(e, '\n');
+                                if(info.lane_type == NATIVE_TYPE_U8) emit_qbe_lane_wrap(e, dst, lane);
+                            }
                         } break;
                     default:
                         {
-                            compilation_error(expr.loc, "Parsed but not implemented expression\n");
+                            compilation_error(expr.loc, "Expecting a vector expression\n");
                             compilation_failure();
                         } break;
                 }
@@ -54,7 +326,128 @@ static void compile_expr_into_qbe(FILE *f, Evaluated_Module *module, Scope *scop
     }
 }
 
-static void compile_stmt_into_qbe(FILE *f, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Stmt stmt)
+// Builtins that produce a scalar out of a vector, the result goes into `%_1` like any other scalar
+static void compile_vector_func_call_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope,
+        const Expr expr)
+{
+    const Expr *args = expr.as.func_call.args.data;
+    Data_Type type = eval_expr(module, scope, &args[0]);
+    Native_Type_Info info = get_native_type_info(type.as.native);
+    char k = get_qbe_lane_class(info);
+    size_t src = fn->temps_count++;
+    compile_vector_expr_into_qbe(e, module, fn, scope, args[0], src);
+    switch(find_builtin_fn(expr.as.func_call.name)) {
+        case BUILTIN_VEXTRACT:
+            {
+                emit_literal(e, "    %_1 =w copy ");
+                emit_qbe_lane(e, src, args[1].as.literal_int);
+                emit_char(e, '\n');
+            } break;
+        case BUILTIN_VREDUCE_ADD:
+            {
+                size_t sum = fn->temps_count++;
+                for(size_t lane = 0; lane < info.lanes; ++lane) {
+                    emit_symbol(e, "    %_t", sum);
+                    emit_literal(e, " =");
+                    emit_char(e, k);
+                    if(lane == 0) {
+                        emit_literal(e, " copy ");
+                    } else {
+                        emit_symbol(e, " add %_t", sum);
+                        emit_literal(e, ", ");
+                    }
+                    emit_qbe_lane(e, src, lane);
+                    emit_char(e, '\n');
+                }
+                emit_symbol(e, info.lane_type == NATIVE_TYPE_U8 ? "    %_1 =w and %_t" : "    %_1 =w copy %_t", sum);
+                emit_cstr(e, info.lane_type == NATIVE_TYPE_U8 ? ", 255\n" : "\n");
+            } break;
+        default:
+            {
+                compilation_error(expr.loc, "Expecting a scalar expression\n");
+                compilation_failure();
+            } break;
+    }
+}
+
+static void compile_vector_var_store_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope,
+        const Evaluated_Var *var, const Expr value)
+{
+    Native_Type_Info info = get_native_type_info(var->type.as.native);
+    size_t src = fn->temps_count++;
+    compile_vector_expr_into_qbe(e, module, fn, scope, value, src);
+    for(size_t lane = 0; lane < info.lanes; ++lane) {
+        emit_literal(e, "    %");
+        emit_sv(e, var->name);
+        emit_symbol(e, ".", lane);
+        emit_literal(e, " =");
+        emit_char(e, get_qbe_lane_class(info));
+        emit_literal(e, " copy ");
+        emit_qbe_lane(e, src, lane);
+        emit_char(e, '\n');
+    }
+}
+
+static bool is_unsigned_data_type(const Data_Type *type)
+{
+    if(!type->is_native) return false;
+    Native_Type native = type->as.native;
+    return native == NATIVE_TYPE_U8 || native == NATIVE_TYPE_U16 || native == NATIVE_TYPE_U32 || native == NATIVE_TYPE_U64;
+}
+
+// QBE has no indirect jumps so every switch becomes a binary search over its sorted ranges, a
+// handful of ranges at the leaves are tested one after another before giving up to the default
+static void compile_switch_search_into_qbe(Emitter *e, Evaluated_Fn *fn, const Switch_Lowering *lowering, size_t begin,
+        size_t end, size_t value, const size_t *cases, size_t _default, bool is_unsigned)
+{
+    if(end - begin <= ELYSIA_SWITCH_LINEAR_RANGES) {
+        for(size_t i = begin; i < end; ++i) {
+            const Switch_Range *range = &lowering->ranges[i];
+            size_t next = fn->labels_count++;
+            size_t test = fn->temps_count++;
+            if(range->low == range->high) {
+                emit_symbol(e, "    %_t", test);
+                emit_symbol(e, " =w ceqw %_t", value);
+                emit_literal(e, ", ");
+                emit_int(e, range->low);
+                emit_char(e, '\n');
+            } else {
+                // A single unsigned comparison checks both bounds of the range
+                emit_symbol(e, "    %_t", test);
+                emit_symbol(e, " =w sub %_t", value);
+                emit_literal(e, ", ");
+                emit_int(e, range->low);
+                emit_symbol(e, "\n    %_t", test);
+                emit_symbol(e, " =w culew %_t", test);
+                emit_literal(e, ", ");
+                emit_int(e, range->high - range->low);
+                emit_char(e, '\n');
+            }
+            emit_symbol(e, "    jnz %_t", test);
+            emit_qbe_jnz_targets(e, cases[range->target], next);
+            emit_qbe_label(e, next);
+        }
+        emit_qbe_jmp(e, _default);
+        return;
+    }
+
+    size_t mid = begin + (end - begin)/2;
+    size_t left = fn->labels_count++;
+    size_t right = fn->labels_count++;
+    size_t test = fn->temps_count++;
+    emit_symbol(e, "    %_t", test);
+    emit_symbol(e, is_unsigned ? " =w cultw %_t" : " =w csltw %_t", value);
+    emit_literal(e, ", ");
+    emit_int(e, lowering->ranges[mid].low);
+    emit_symbol(e, "\n    jnz %_t", test);
+    emit_qbe_jnz_targets(e, left, right);
+    emit_qbe_label(e, left);
+    compile_switch_search_into_qbe(e, fn, lowering, begin, mid, value, cases, _default, is_unsigned);
+    emit_qbe_label(e, right);
+    compile_switch_search_into_qbe(e, fn, lowering, mid, end, value, cases, _default, is_unsigned);
+}
+
+static void compile_stmt_into_qbe(Emitter *e, Evaluated_Module *module, Evaluated_Fn *fn, Scope *scope, const Stmt stmt)
 {
     switch(stmt.type) {
         case STMT_VAR_DEF:
@@ -62,27 +455,100 @@ static void compile_stmt_into_qbe(FILE *f, Evaluated_Module *module, Evaluated_F
             } break;
         case STMT_VAR_INIT:
             {
-                compile_expr_into_qbe(f, module, scope, stmt.as.var_init.value);
-                fprintf(f, "    %%"SV_FMT" =w copy %%_1 # %s:%d\n", SV_ARGV(stmt.as.var_init.name), __FILE__, __LINE__);
+                const Evaluated_Var *var = get_var_from_scope(scope, stmt.as.var_init.name);
+                if(is_vector_data_type(&var->type)) {
+                    compile_vector_var_store_into_qbe(e, module, fn, scope, var, stmt.as.var_init.value);
+                    break;
+                }
+                compile_expr_into_qbe(e, module, fn, scope, stmt.as.var_init.value);
+                emit_literal(e, "    %");
+                emit_sv(e, stmt.as.var_init.name);
+                emit_literal(e, " =w copy %_1");
+                QBE_LINE_END(e);
             } break;
         case STMT_VAR_ASSIGN:
             {
-                compile_expr_into_qbe(f, module, scope, stmt.as.var_assign.value);
-                fprintf(f, "    %%"SV_FMT" =w copy %%_1 # %s:%d\n", SV_ARGV(stmt.as.var_init.name), __FILE__, __LINE__);
+                const Evaluated_Var *var = get_var_from_scope(scope, stmt.as.var_assign.name);
+                if(is_vector_data_type(&var->type)) {
+                    compile_vector_var_store_into_qbe(e, module, fn, scope, var, stmt.as.var_assign.value);
+                    break;
+                }
+                compile_expr_into_qbe(e, module, fn, scope, stmt.as.var_assign.value);
+                emit_literal(e, "    %");
+                emit_sv(e, stmt.as.var_init.name);
+                emit_literal(e, " =w copy %_1");
+                QBE_LINE_END(e);
             } break;
         case STMT_RETURN:
             {
-                compile_expr_into_qbe(f, module, scope, stmt.as._return.value);
-                fprintf(f, "    ret %%_1\n}\n");
+                compile_expr_into_qbe(e, module, fn, scope, stmt.as._return.value);
+                emit_literal(e, "    ret %_1\n");
+                // Anything following a return still needs a block to live in
+                emit_qbe_label(e, fn->labels_count++);
             } break;
         case STMT_WHILE:
             {
-                fprintf(f, "@L1b");
-                compile_expr_into_qbe(f, module, scope, stmt.as._while.condition);
-                fprintf(f, "jz %%_1, @L1b, @L1e");
+                // Rotated into a guarded do-while loop, the condition is tested once before entering
+                // and then at the bottom so every iteration only takes a single conditional jump
+                size_t body = fn->labels_count++;
+                size_t end = fn->labels_count++;
+                compile_cond_into_qbe(e, module, fn, scope, stmt.as._while.condition, body, end);
+                emit_qbe_label(e, body);
                 for(size_t i = 0; i < stmt.as._while.todo.count; ++i) 
-                    compile_stmt_into_qbe(f, module, fn, &fn->scope, stmt.as._while.todo.data[i]);
-                fprintf(f, "@L1e");
+                    compile_stmt_into_qbe(e, module, fn, scope, stmt.as._while.todo.data[i]);
+                compile_cond_into_qbe(e, module, fn, scope, stmt.as._while.condition, body, end);
+                emit_qbe_label(e, end);
+            } break;
+        case STMT_IF:
+            {
+                size_t end = fn->labels_count++;
+                for(const Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif) {
+                    size_t body = fn->labels_count++;
+                    size_t next = fn->labels_count++;
+                    compile_cond_into_qbe(e, module, fn, scope, branch->condition, body, next);
+                    emit_qbe_label(e, body);
+                    for(size_t i = 0; i < branch->todo.count; ++i)
+                        compile_stmt_into_qbe(e, module, fn, scope, branch->todo.data[i]);
+                    emit_qbe_jmp(e, end);
+                    emit_qbe_label(e, next);
+                }
+                for(size_t i = 0; i < stmt.as._if._else.count; ++i)
+                    compile_stmt_into_qbe(e, module, fn, scope, stmt.as._if._else.data[i]);
+                emit_qbe_label(e, end);
+            } break;
+        case STMT_EXPR:
+            {
+                compile_expr_into_qbe(e, module, fn, scope, stmt.as.expr);
+            } break;
+        case STMT_SWITCH:
+            {
+                const Stmt_Switch *_switch = &stmt.as._switch;
+                Data_Type type = eval_expr(module, scope, &_switch->value);
+                Switch_Lowering lowering;
+                lower_switch(_switch, &lowering);
+
+                size_t value = fn->temps_count++;
+                compile_expr_into_qbe(e, module, fn, scope, _switch->value);
+                emit_symbol(e, "    %_t", value);
+                emit_literal(e, " =w copy %_1\n");
+
+                size_t cases[ELYSIA_SWITCH_RANGES_CAPACITY];
+                for(size_t i = 0; i < _switch->cases.count; ++i) cases[i] = fn->labels_count++;
+                size_t _default = fn->labels_count++;
+                size_t end = fn->labels_count++;
+                compile_switch_search_into_qbe(e, fn, &lowering, 0, lowering.count, value, cases, _default,
+                        is_unsigned_data_type(&type));
+
+                for(size_t i = 0; i < _switch->cases.count; ++i) {
+                    emit_qbe_label(e, cases[i]);
+                    for(size_t j = 0; j < _switch->cases.data[i].todo.count; ++j)
+                        compile_stmt_into_qbe(e, module, fn, scope, _switch->cases.data[i].todo.data[j]);
+                    emit_qbe_jmp(e, end);
+                }
+                emit_qbe_label(e, _default);
+                for(size_t i = 0; i < _switch->_default.count; ++i)
+                    compile_stmt_into_qbe(e, module, fn, scope, _switch->_default.data[i]);
+                emit_qbe_label(e, end);
             } break;
         default:
             {
@@ -91,24 +557,353 @@ static void compile_stmt_into_qbe(FILE *f, Evaluated_Module *module, Evaluated_F
     }
 }
 
-static void compile_func_def_into_qbe(Evaluated_Module *module, FILE *f, Evaluated_Fn *fn)
+static void compile_func_def_into_qbe(Evaluated_Module *module, Emitter *e, Evaluated_Fn *fn, bool exported)
 {
-    fprintf(f, "export function w $"SV_FMT"() {\n", SV_ARGV(fn->def.name));
-    fprintf(f, "@start\n");
+    emit_cstr(e, exported ? "export function w $" : "function w $");
+    emit_sv(e, fn->def.name);
+    emit_literal(e, "(");
+    for(size_t i = 0; i < fn->def.params.count; ++i) {
+        emit_cstr(e, i == 0 ? "w %" : ", w %");
+        emit_sv(e, fn->def.params.data[i].name);
+    }
+    emit_literal(e, ") {\n");
+    emit_literal(e, "@start\n");
     for(size_t i = 0; i < fn->def.body.count; ++i) 
-        compile_stmt_into_qbe(f, module, fn, &fn->scope, fn->def.body.data[i]);
-    if(!fn->has_return_stmt) 
-        fprintf(f, "   ret\n}\n");
+        compile_stmt_into_qbe(e, module, fn, &fn->scope, fn->def.body.data[i]);
+    if(fn->def.return_type.is_native && fn->def.return_type.as.native == NATIVE_TYPE_VOID) {
+        emit_literal(e, "    ret\n}\n");
+    } else {
+        // Only reachable by falling off a function that returned on every path
+        emit_literal(e, "    ret 0\n}\n");
+    }
 }
 
-void compile_module_to_file(const char *file_path, Evaluated_Module *module)
+// QBE and the assembler, shards also have the process writing their IR
+#define QBE_PIPELINE_MAX_STAGES 3
+
+// QBE (and the assembler after it for objects) run as children connected by pipes. The IR is
+// written into QBE's standard input so nothing but the final output touches the disk
+typedef struct {
+    int input;
+    pid_t stages[QBE_PIPELINE_MAX_STAGES];
+    size_t stages_count;
+} Qbe_Pipeline;
+
+static void spawn_pipeline_stage(Qbe_Pipeline *pipeline, const char **argv, int input, int output,
+        const int *pipes, size_t pipes_count)
 {
-    FILE *f = fopen(file_path, "w");
-    if(!f) {
-        fatal("Failed to open file file %s", file_path);
+    pid_t pid = fork();
+    if(pid < 0) {
+        fatal("Failed to start %s: %s", argv[0], strerror(errno));
     }
+    if(pid == 0) {
+        dup2(input, STDIN_FILENO);
+        if(output >= 0) dup2(output, STDOUT_FILENO);
+        for(size_t i = 0; i < pipes_count; ++i) close(pipes[i]);
+        execvp(argv[0], (char *const *)argv);
+        fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    pipeline->stages[pipeline->stages_count++] = pid;
+}
 
+static void open_qbe_pipeline(Qbe_Pipeline *pipeline, const char *file_path, const Compile_Options *options)
+{
+    int pipes[4];
+    size_t pipes_count = 2;
+    if(pipe(&pipes[0]) != 0) {
+        fatal("Failed to create a pipe: %s", strerror(errno));
+    }
+    pipeline->stages_count = 0;
+    if(options->output_kind == OUTPUT_KIND_ASM) {
+        const char *qbe[] = { options->qbe_path, "-o", file_path, "-", NULL };
+        spawn_pipeline_stage(pipeline, qbe, pipes[0], -1, pipes, pipes_count);
+    } else {
+        if(pipe(&pipes[2]) != 0) {
+            fatal("Failed to create a pipe: %s", strerror(errno));
+        }
+        pipes_count = 4;
+        const char *qbe[] = { options->qbe_path, "-", NULL };
+        const char *assembler[] = { options->assembler, "-x", "assembler", "-o", file_path, "-", NULL, NULL };
+        // Without `-c` the driver links the program against the system C library
+        if(options->output_kind == OUTPUT_KIND_OBJ) {
+            assembler[6] = "-c";
+        }
+        spawn_pipeline_stage(pipeline, qbe, pipes[0], pipes[3], pipes, pipes_count);
+        spawn_pipeline_stage(pipeline, assembler, pipes[2], -1, pipes, pipes_count);
+    }
+    for(size_t i = 0; i < pipes_count; ++i) {
+        if(i != 1) close(pipes[i]);
+    }
+
+    // A stage dying early shows up in its exit status, not as SIGPIPE killing the compiler
+    signal(SIGPIPE, SIG_IGN);
+    pipeline->input = pipes[1];
+}
+
+static bool close_qbe_pipeline(Qbe_Pipeline *pipeline)
+{
+    bool ok = pipeline->input < 0 || close(pipeline->input) == 0;
+    for(size_t i = 0; i < pipeline->stages_count; ++i) {
+        int status = 0;
+        if(waitpid(pipeline->stages[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+    return ok;
+}
+
+// Feeds the IR of `functions` (indices in module order) into the pipeline from a child of its own
+// so no pipeline waits for another one to be fed
+static void spawn_qbe_writer(Qbe_Pipeline *pipeline, const Emitter *e, const size_t *ends,
+        const size_t *functions, size_t functions_count)
+{
+    pid_t writer = fork();
+    if(writer < 0) {
+        fatal("Failed to start writing the IR of a shard: %s", strerror(errno));
+    }
+    if(writer == 0) {
+        bool ok = true;
+        for(size_t i = 0; i < functions_count && ok; ++i) {
+            size_t f = functions[i];
+            ok = write_emitter_range(e, pipeline->input, f == 0 ? 0 : ends[f - 1], ends[f]);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    pipeline->stages[pipeline->stages_count++] = writer;
+    close(pipeline->input);
+    pipeline->input = -1;
+}
+
+// Combines the objects in the given order: partially linked into a single object or linked into
+// the executable
+static bool link_qbe_objects(const char *file_path, Arena *arena, char **objects, size_t objects_count,
+        const Compile_Options *options)
+{
+    const char **linker = arena_alloc(arena, (objects_count + 6)*sizeof(char *));
+    assert(linker && "buy more ram lol!");
+    size_t argc = 0;
+    linker[argc++] = options->assembler;
+    if(options->output_kind == OUTPUT_KIND_OBJ) {
+        linker[argc++] = "-r";
+        linker[argc++] = "-nostdlib";
+    }
+    linker[argc++] = "-o";
+    linker[argc++] = file_path;
+    for(size_t i = 0; i < objects_count; ++i) linker[argc++] = objects[i];
+    linker[argc] = NULL;
+    Qbe_Pipeline link = { .input = -1 };
+    spawn_pipeline_stage(&link, linker, STDIN_FILENO, -1, NULL, 0);
+    return close_qbe_pipeline(&link);
+}
+
+// The objects of a sharded or cached build export every function to call each other, once partially linked
+// only the `pub` functions and `main` stay global so the object matches a single pipeline build
+static bool localize_qbe_symbols(const char *file_path, Arena *arena, const Evaluated_Module *module)
+{
+    const char **objcopy = arena_alloc(arena, (module->functions.count + 3)*sizeof(char *));
+    assert(objcopy && "buy more ram lol!");
+    size_t argc = 0;
+    objcopy[argc++] = ELYSIA_OBJCOPY;
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        const Func_Def *def = &module->functions.data[i].def;
+        if(!def->is_pub && !sv_eq(def->name, SV("main"))) continue;
+        size_t length = snprintf(NULL, 0, "--keep-global-symbol="SV_FMT, SV_ARGV(def->name));
+        char *flag = arena_alloc(arena, length + 1);
+        assert(flag && "buy more ram lol!");
+        snprintf(flag, length + 1, "--keep-global-symbol="SV_FMT, SV_ARGV(def->name));
+        objcopy[argc++] = flag;
+    }
+    objcopy[argc++] = file_path;
+    objcopy[argc] = NULL;
+    Qbe_Pipeline localize = { .input = -1 };
+    spawn_pipeline_stage(&localize, objcopy, STDIN_FILENO, -1, NULL, 0);
+    return close_qbe_pipeline(&localize);
+}
+
+static char *arena_sprintf_path(Arena *arena, const char *format, const char *dir, uint64_t id)
+{
+    size_t length = snprintf(NULL, 0, format, dir, (unsigned long long)id);
+    char *path = arena_alloc(arena, length + 1);
+    assert(path && "buy more ram lol!");
+    snprintf(path, length + 1, format, dir, (unsigned long long)id);
+    return path;
+}
+
+// Each shard is compiled into an object of its own by a QBE pipeline, every pipeline runs at once.
+// Functions are dealt to the shards biggest first, each going to the shard with the least IR so far.
+// QBE numbers its local labels from zero in every process so the assembly of the shards can't be
+// concatenated, the objects are linked together in shard order instead
+static void compile_qbe_shards(const char *file_path, Arena *arena, const Emitter *e, const size_t *ends,
+        size_t functions_count, const Compile_Options *options)
+{
+    size_t shards_count = options->jobs;
+    if(shards_count > ELYSIA_QBE_MAX_JOBS) shards_count = ELYSIA_QBE_MAX_JOBS;
+    if(shards_count > functions_count) shards_count = functions_count;
+
+    size_t *sizes = arena_alloc(arena, functions_count*sizeof(size_t));
+    size_t *order = arena_alloc(arena, functions_count*sizeof(size_t));
+    size_t *shard_of = arena_alloc(arena, functions_count*sizeof(size_t));
+    size_t *functions = arena_alloc(arena, functions_count*sizeof(size_t));
+    assert(sizes && order && shard_of && functions && "buy more ram lol!");
+    for(size_t i = 0; i < functions_count; ++i) {
+        sizes[i] = ends[i] - (i == 0 ? 0 : ends[i - 1]);
+        // Insertion sort by size, ties keep the order of the module so the shards are deterministic
+        size_t j = i;
+        for(; j > 0 && sizes[order[j - 1]] < sizes[i]; --j) order[j] = order[j - 1];
+        order[j] = i;
+    }
+    size_t loads[ELYSIA_QBE_MAX_JOBS] = {0};
+    for(size_t i = 0; i < functions_count; ++i) {
+        size_t lightest = 0;
+        for(size_t s = 1; s < shards_count; ++s) {
+            if(loads[s] < loads[lightest]) lightest = s;
+        }
+        shard_of[order[i]] = lightest;
+        loads[lightest] += sizes[order[i]];
+    }
+
+    char dir[] = "/tmp/elysia-XXXXXX";
+    if(!mkdtemp(dir)) {
+        fatal("Failed to create a temporary directory: %s", strerror(errno));
+    }
+    Compile_Options shard_options = *options;
+    shard_options.output_kind = OUTPUT_KIND_OBJ;
+    Qbe_Pipeline pipelines[ELYSIA_QBE_MAX_JOBS] = {0};
+    char *objects[ELYSIA_QBE_MAX_JOBS];
+    // The functions of every shard are stored one shard after another in module order
+    size_t functions_end = 0;
+    for(size_t s = 0; s < shards_count; ++s) {
+        size_t functions_begin = functions_end;
+        for(size_t i = 0; i < functions_count; ++i) {
+            if(shard_of[i] == s) functions[functions_end++] = i;
+        }
+        objects[s] = arena_sprintf_path(arena, "%s/shard%llu.o", dir, s);
+        open_qbe_pipeline(&pipelines[s], objects[s], &shard_options);
+        spawn_qbe_writer(&pipelines[s], e, ends, &functions[functions_begin], functions_end - functions_begin);
+    }
+
+    bool ok = true;
+    for(size_t s = 0; s < shards_count; ++s) {
+        if(!close_qbe_pipeline(&pipelines[s])) ok = false;
+    }
+    if(ok) ok = link_qbe_objects(file_path, arena, objects, shards_count, options);
+
+    for(size_t s = 0; s < shards_count; ++s) unlink(objects[s]);
+    rmdir(dir);
+    if(!ok) {
+        fatal("Failed to compile the module into %s", file_path);
+    }
+}
+
+// Moves the object of a finished pipeline into the cache, broken objects are thrown away
+static bool finish_cached_object(Qbe_Pipeline *pipeline, const char *temporary, const char *object)
+{
+    if(close_qbe_pipeline(pipeline) && rename(temporary, object) == 0) return true;
+    unlink(temporary);
+    return false;
+}
+
+// Every function is compiled into an object of its own named after the hash of its IR, the compiler
+// version and the tools compiling it. Objects already in the cache are linked as they are, the
+// others are compiled by up to `jobs` QBE pipelines at once. An object is written under a name
+// private to the process and renamed once it is complete, so builds sharing the cache never see
+// half written objects
+static void compile_qbe_cached(const char *file_path, Arena *arena, const Emitter *e, const size_t *ends,
+        size_t functions_count, const Compile_Options *options)
+{
+    if(mkdir(options->cache_dir, 0755) != 0 && errno != EEXIST) {
+        fatal("Failed to create the cache directory %s: %s", options->cache_dir, strerror(errno));
+    }
+    uint64_t seed = ELYSIA_EMITTER_HASH_SEED;
+    const char *key_parts[] = { ELYSIA_VERSION, options->qbe_path, options->assembler };
+    for(size_t i = 0; i < sizeof(key_parts)/sizeof(key_parts[0]); ++i) {
+        // The terminator separates the parts
+        seed = hash_bytes(seed, key_parts[i], strlen(key_parts[i]) + 1);
+    }
+
+    Compile_Options function_options = *options;
+    function_options.output_kind = OUTPUT_KIND_OBJ;
+    size_t jobs = options->jobs > ELYSIA_QBE_MAX_JOBS ? ELYSIA_QBE_MAX_JOBS : options->jobs;
+    Qbe_Pipeline pipelines[ELYSIA_QBE_MAX_JOBS] = {0};
+    char *temporaries[ELYSIA_QBE_MAX_JOBS] = {0};
+    char *finals[ELYSIA_QBE_MAX_JOBS] = {0};
+    size_t *functions = arena_alloc(arena, functions_count*sizeof(size_t));
+    char **objects = arena_alloc(arena, functions_count*sizeof(char *));
+    assert(functions && objects && "buy more ram lol!");
+    bool ok = true;
+    size_t misses_count = 0;
+    for(size_t i = 0; i < functions_count; ++i) {
+        uint64_t key = hash_emitter_range(e, seed, i == 0 ? 0 : ends[i - 1], ends[i]);
+        objects[i] = arena_sprintf_path(arena, "%s/%016llx.o", options->cache_dir, key);
+        if(access(objects[i], R_OK) == 0) continue;
+
+        // Waits for the pipeline compiled `jobs` misses ago to free its slot
+        size_t slot = misses_count++ % jobs;
+        if(temporaries[slot] && !finish_cached_object(&pipelines[slot], temporaries[slot], finals[slot])) ok = false;
+        functions[i] = i;
+        temporaries[slot] = arena_sprintf_path(arena, "%s.%llu", objects[i], (uint64_t)getpid());
+        finals[slot] = objects[i];
+        open_qbe_pipeline(&pipelines[slot], temporaries[slot], &function_options);
+        spawn_qbe_writer(&pipelines[slot], e, ends, &functions[i], 1);
+    }
+    for(size_t slot = 0; slot < jobs && slot < misses_count; ++slot) {
+        if(!finish_cached_object(&pipelines[slot], temporaries[slot], finals[slot])) ok = false;
+    }
+    if(options->report_cache) {
+        fprintf(stderr, "Reused %zu of %zu functions from %s, compiled %zu\n", functions_count - misses_count,
+                functions_count, options->cache_dir, misses_count);
+    }
+    if(ok) ok = link_qbe_objects(file_path, arena, objects, functions_count, options);
+    if(!ok) {
+        fatal("Failed to compile the module into %s", file_path);
+    }
+}
+
+void compile_module_to_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options)
+{
+    Arena arena = {0};
+    Emitter e = { .arena = &arena, .annotate_source_lines = options->annotate_ir };
+    bool linked = options->output_kind == OUTPUT_KIND_OBJ || options->output_kind == OUTPUT_KIND_EXE;
+    bool cached = linked && options->cache_dir && module->functions.count > 0;
+    bool sharded = linked && !cached && options->jobs > 1 && module->functions.count > 1;
+    // Where the IR of every function ends
+    size_t *ends = arena_alloc(&arena, module->functions.count*sizeof(size_t));
+    assert(ends && "buy more ram lol!");
     for(uint32_t i = 0; i < module->functions.count; ++i) {
-        compile_func_def_into_qbe(module, f, &module->functions.data[i]);
+        // Functions that aren't `pub` stay private to the object file unless other objects call them
+        const Func_Def *def = &module->functions.data[i].def;
+        bool exported = sharded || cached || def->is_pub || sv_eq(def->name, SV("main"));
+        compile_func_def_into_qbe(module, &e, &module->functions.data[i], exported);
+        ends[i] = e.size;
     }
+
+    if(options->output_kind == OUTPUT_KIND_IR) {
+        write_emitter_to_file(&e, file_path);
+    } else if(cached || sharded) {
+        if(cached) {
+            compile_qbe_cached(file_path, &arena, &e, ends, module->functions.count, options);
+        } else {
+            compile_qbe_shards(file_path, &arena, &e, ends, module->functions.count, options);
+        }
+        if(options->output_kind == OUTPUT_KIND_OBJ && !localize_qbe_symbols(file_path, &arena, module)) {
+            fatal("Failed to localize the private symbols of %s", file_path);
+        }
+    } else {
+        Qbe_Pipeline pipeline = {0};
+        open_qbe_pipeline(&pipeline, file_path, options);
+        bool written = flush_emitter(&e, pipeline.input);
+        if(!close_qbe_pipeline(&pipeline) || !written) {
+            fatal("Failed to compile the module into %s", file_path);
+        }
+    }
+    arena_free(&arena);
+}
+
+int run_module(Evaluated_Module *module, const Compile_Options *options, int argc, char **argv)
+{
+    (void)module;
+    (void)options;
+    (void)argc;
+    (void)argv;
+    fatal("The QBE backend can't run programs in-process, `run` needs the x86-64 backend");
+    return 1;
 }
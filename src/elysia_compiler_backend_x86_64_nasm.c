@@ -1,35 +1,1018 @@
 #include "elysia.h"
 #include "elysia_ast.h"
 #include "elysia_compiler.h"
+#include "elysia_emitter.h"
 #include "elysia_types.h"
+#include "elysia_x86_64.h"
+#include <assert.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static void compile_expr_into_x86_64_nasm(Evaluated_Module *module, FILE *f, Scope *scope, const Expr expr)
+#define X86_64_VECTOR_MAX_VARS 8
+#define X86_64_VECTOR_REGISTERS 16
+// The last vector register is kept free as a scratch register
+#define X86_64_VECTOR_SCRATCH (X86_64_VECTOR_REGISTERS - 1)
+
+// Bytes below rsp that leaf functions may use without reserving them (System V ABI)
+#define X86_64_RED_ZONE_SIZE 128
+// Vectors are accessed with unaligned moves, nothing needs more than the alignment of rsp
+#define X86_64_MAX_SLOT_ALIGNMENT 16
+
+static X86_64_Inst *push_inst(X86_64_Code *code, X86_64_Inst_Kind kind)
+{
+    if(code->count >= code->capacity) {
+        size_t new_capacity = code->capacity * 2;
+        if(new_capacity == 0) new_capacity = 256;
+        void *new_data = arena_alloc(code->arena, new_capacity * sizeof(*code->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, code->data, code->count * sizeof(*code->data));
+        code->data = new_data;
+        code->capacity = new_capacity;
+    }
+
+    X86_64_Inst *inst = &code->data[code->count++];
+    memset(inst, 0, sizeof(*inst));
+    inst->kind = kind;
+    return inst;
+}
+
+// Pushing and popping rbp only ever sets up or tears down the frame itself
+static void track_stack_depth(X86_64_Code *code, const X86_64_Inst *inst)
+{
+    if(inst->operands_count == 0 || strcmp(inst->operands[0], "rbp") == 0) return;
+    if(strcmp(inst->opcode, "push") == 0) {
+        code->stack_depth += 8;
+    } else if(strcmp(inst->opcode, "pop") == 0) {
+        code->stack_depth -= 8;
+    } else if(strcmp(inst->operands[0], "rsp") == 0 && inst->operands_count == 2) {
+        if(strcmp(inst->opcode, "sub") == 0) code->stack_depth += strtoull(inst->operands[1], NULL, 10);
+        if(strcmp(inst->opcode, "add") == 0) code->stack_depth -= strtoull(inst->operands[1], NULL, 10);
+    }
+}
+
+static void emit_inst(X86_64_Code *code, const char *fmt, ...)
+{
+    char text[X86_64_INST_TEXT_CAPACITY];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    X86_64_Inst *inst = push_inst(code, X86_64_INST_OP);
+    const char *it = text;
+    size_t len = 0;
+    while(*it && *it != ' ' && len + 1 < sizeof(inst->opcode)) inst->opcode[len++] = *it++;
+
+    // Operands are separated by commas outside of memory references
+    while(*it && inst->operands_count < X86_64_INST_MAX_OPERANDS) {
+        while(*it == ' ' || *it == ',') ++it;
+        if(!*it) break;
+        char *operand = inst->operands[inst->operands_count++];
+        int depth = 0;
+        len = 0;
+        while(*it && !(*it == ',' && depth == 0)) {
+            if(*it == '[') depth += 1;
+            if(*it == ']') depth -= 1;
+            if(len + 1 < sizeof(inst->operands[0])) operand[len++] = *it;
+            ++it;
+        }
+    }
+    track_stack_depth(code, inst);
+}
+
+static void emit_label(X86_64_Code *code, const char *fmt, ...)
+{
+    X86_64_Inst *inst = push_inst(code, X86_64_INST_LABEL);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(inst->opcode, sizeof(inst->opcode), fmt, args);
+    va_end(args);
+}
+
+static void emit_directive(X86_64_Code *code, const char *fmt, ...)
+{
+    X86_64_Inst *inst = push_inst(code, X86_64_INST_DIRECTIVE);
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(inst->opcode, sizeof(inst->opcode), fmt, args);
+    va_end(args);
+}
+
+static void render_x86_64_code(Emitter *e, const X86_64_Code *code)
+{
+    for(size_t i = 0; i < code->count; ++i) {
+        const X86_64_Inst *inst = &code->data[i];
+        switch(inst->kind) {
+            case X86_64_INST_OP:
+                {
+                    emit_literal(e, "    ");
+                    emit_cstr(e, inst->opcode);
+                    for(size_t j = 0; j < inst->operands_count; ++j) {
+                        emit_cstr(e, j == 0 ? " " : ", ");
+                        emit_cstr(e, inst->operands[j]);
+                    }
+                    emit_char(e, '\n');
+                } break;
+            case X86_64_INST_LABEL:
+                {
+                    emit_cstr(e, inst->opcode);
+                    emit_literal(e, ":\n");
+                } break;
+            case X86_64_INST_DIRECTIVE:
+                {
+                    emit_literal(e, "    ");
+                    emit_cstr(e, inst->opcode);
+                    emit_char(e, '\n');
+                } break;
+            case X86_64_INST_NOP:
+                break;
+        }
+    }
+}
+
+static bool inst_is(const X86_64_Inst *inst, const char *opcode)
+{
+    return inst->kind == X86_64_INST_OP && strcmp(inst->opcode, opcode) == 0;
+}
+
+static bool inst_is_move(const X86_64_Inst *inst)
+{
+    return inst_is(inst, "mov") || inst_is(inst, "movdqa") || inst_is(inst, "movdqu")
+        || inst_is(inst, "vmovdqa") || inst_is(inst, "vmovdqu");
+}
+
+static bool is_register32(const char *operand)
+{
+    static const char *registers[] = { "eax", "ebx", "ecx", "edx", "esi", "edi", "esp", "ebp" };
+    for(size_t i = 0; i < sizeof(registers)/sizeof(registers[0]); ++i) {
+        if(strcmp(operand, registers[i]) == 0) return true;
+    }
+    size_t len = strlen(operand);
+    return operand[0] == 'r' && len > 1 && operand[len - 1] == 'd';
+}
+
+// `mov [m], eax` followed by `mov eax, [m]`, the second move changes nothing
+static bool peephole_redundant_reload(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0], *b = window[1];
+    if(!inst_is_move(a) || strcmp(a->opcode, b->opcode) != 0) return false;
+    if(strcmp(a->operands[0], b->operands[1]) != 0 || strcmp(a->operands[1], b->operands[0]) != 0) return false;
+    b->kind = X86_64_INST_NOP;
+    return true;
+}
+
+// `mov rax, rax`, a 32-bit move onto itself is kept since it clears the upper half of the register
+static bool peephole_self_move(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0];
+    if(!inst_is_move(a) || strcmp(a->operands[0], a->operands[1]) != 0) return false;
+    if(inst_is(a, "mov") && is_register32(a->operands[0])) return false;
+    a->kind = X86_64_INST_NOP;
+    return true;
+}
+
+static bool peephole_jump_to_next(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0], *b = window[1];
+    if(a->kind != X86_64_INST_OP || a->opcode[0] != 'j' || b->kind != X86_64_INST_LABEL) return false;
+    if(strcmp(a->operands[0], b->opcode) != 0) return false;
+    a->kind = X86_64_INST_NOP;
+    return true;
+}
+
+static bool inst_overwrites_accumulator(const X86_64_Inst *inst)
+{
+    if(!inst_is(inst, "mov") && !inst_is(inst, "movzx") && !inst_is(inst, "movsx")) return false;
+    if(strcmp(inst->operands[0], "eax") != 0 && strcmp(inst->operands[0], "rax") != 0) return false;
+    return strstr(inst->operands[1], "ax") == NULL;
+}
+
+// `push rax; mov eax, x; pop rcx` keeps the saved value in a register instead of the stack
+static bool peephole_push_pop(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0], *b = window[1], *c = window[2];
+    if(!inst_is(a, "push") || strcmp(a->operands[0], "rax") != 0) return false;
+    if(!inst_is(c, "pop") || strcmp(c->operands[0], "rcx") != 0) return false;
+    if(!inst_overwrites_accumulator(b) || strstr(b->operands[1], "rsp") || strstr(b->operands[1], "cx")) return false;
+    snprintf(a->opcode, sizeof(a->opcode), "mov");
+    snprintf(a->operands[0], sizeof(a->operands[0]), "rcx");
+    snprintf(a->operands[1], sizeof(a->operands[1]), "rax");
+    a->operands_count = 2;
+    c->kind = X86_64_INST_NOP;
+    return true;
+}
+
+// `mov eax, x; mov rcx, rax; mov eax, y` loads x straight into rcx when eax is overwritten right after
+static bool peephole_forward_move(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0], *b = window[1], *c = window[2];
+    if(!inst_is(a, "mov") || !inst_is(b, "mov") || !inst_overwrites_accumulator(c)) return false;
+    bool wide = strcmp(a->operands[0], "rax") == 0;
+    if(!wide && strcmp(a->operands[0], "eax") != 0) return false;
+    if(strcmp(b->operands[0], "rcx") != 0 || strcmp(b->operands[1], "rax") != 0) return false;
+    if(strstr(a->operands[1], "cx") || strstr(a->operands[1], "ax")) return false;
+    snprintf(a->operands[0], sizeof(a->operands[0]), "%s", wide ? "rcx" : "ecx");
+    b->kind = X86_64_INST_NOP;
+    return true;
+}
+
+// `push rax; pop rdi` is just a move
+static bool peephole_push_pop_pair(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0], *b = window[1];
+    if(!inst_is(a, "push") || !inst_is(b, "pop")) return false;
+    if(strcmp(a->operands[0], b->operands[0]) == 0) {
+        a->kind = X86_64_INST_NOP;
+    } else {
+        snprintf(a->opcode, sizeof(a->opcode), "mov");
+        snprintf(a->operands[1], sizeof(a->operands[1]), "%s", a->operands[0]);
+        snprintf(a->operands[0], sizeof(a->operands[0]), "%s", b->operands[0]);
+        a->operands_count = 2;
+    }
+    b->kind = X86_64_INST_NOP;
+    return true;
+}
+
+static bool peephole_stack_adjust(X86_64_Inst **window)
+{
+    X86_64_Inst *a = window[0], *b = window[1];
+    if(!inst_is(a, "add") || !inst_is(b, "sub")) return false;
+    if(strcmp(a->operands[0], "rsp") != 0 || strcmp(b->operands[0], "rsp") != 0) return false;
+    if(strcmp(a->operands[1], b->operands[1]) != 0) return false;
+    a->kind = X86_64_INST_NOP;
+    b->kind = X86_64_INST_NOP;
+    return true;
+}
+
+// `cmp; setl al; movzx eax, al; test eax, eax; jz L` branches on the flags directly. The boolean in
+// eax is dead after the branch since conditions are only ever materialized to be tested
+static bool peephole_branch_on_flags(X86_64_Inst **window)
+{
+    static const struct { const char *setcc; const char *jcc; const char *inverse; } conditions[] = {
+        { "sete", "je", "jne" }, { "setne", "jne", "je" },
+        { "setl", "jl", "jge" }, { "setle", "jle", "jg" },
+        { "setg", "jg", "jle" }, { "setge", "jge", "jl" },
+    };
+    X86_64_Inst *cmp = window[0], *set = window[1], *ext = window[2], *test = window[3], *jump = window[4];
+    if(!inst_is(cmp, "cmp") || !inst_is(ext, "movzx") || !inst_is(test, "test")) return false;
+    if(strcmp(ext->operands[0], "eax") != 0 || strcmp(ext->operands[1], "al") != 0) return false;
+    if(strcmp(test->operands[0], "eax") != 0 || strcmp(test->operands[1], "eax") != 0) return false;
+    bool on_true = inst_is(jump, "jnz");
+    if(!on_true && !inst_is(jump, "jz")) return false;
+    for(size_t i = 0; i < sizeof(conditions)/sizeof(conditions[0]); ++i) {
+        if(!inst_is(set, conditions[i].setcc)) continue;
+        snprintf(jump->opcode, sizeof(jump->opcode), "%s", on_true ? conditions[i].jcc : conditions[i].inverse);
+        set->kind = X86_64_INST_NOP;
+        ext->kind = X86_64_INST_NOP;
+        test->kind = X86_64_INST_NOP;
+        return true;
+    }
+    return false;
+}
+
+typedef struct {
+    const char *name;
+    size_t window;
+    bool (*apply)(X86_64_Inst **window);
+} X86_64_Peephole;
+
+static const X86_64_Peephole x86_64_peepholes[] = {
+    { "redundant-reload", 2, peephole_redundant_reload },
+    { "self-move",        1, peephole_self_move },
+    { "jump-to-next",     2, peephole_jump_to_next },
+    { "push-pop",         3, peephole_push_pop },
+    { "forward-move",     3, peephole_forward_move },
+    { "push-pop-pair",    2, peephole_push_pop_pair },
+    { "stack-adjust",     2, peephole_stack_adjust },
+    { "branch-on-flags",  5, peephole_branch_on_flags },
+};
+
+#define X86_64_PEEPHOLE_MAX_WINDOW 5
+
+// Slides every pattern over the live instructions until none of them matches anymore
+static void optimize_x86_64_code(X86_64_Code *code)
+{
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t i = 0; i < code->count; ++i) {
+            for(size_t p = 0; p < sizeof(x86_64_peepholes)/sizeof(x86_64_peepholes[0]); ++p) {
+                const X86_64_Peephole *peephole = &x86_64_peepholes[p];
+                X86_64_Inst *window[X86_64_PEEPHOLE_MAX_WINDOW];
+                size_t filled = 0;
+                for(size_t j = i; j < code->count && filled < peephole->window; ++j) {
+                    if(code->data[j].kind != X86_64_INST_NOP) window[filled++] = &code->data[j];
+                }
+                if(filled == peephole->window && window[0] == &code->data[i] && peephole->apply(window)) {
+                    changed = true;
+                }
+            }
+        }
+
+        size_t count = 0;
+        for(size_t i = 0; i < code->count; ++i) {
+            if(code->data[i].kind != X86_64_INST_NOP) code->data[count++] = code->data[i];
+        }
+        code->count = count;
+    }
+}
+
+static size_t get_var_stack_offset(const Evaluated_Var *var)
+{
+    Data_Type type = var->type;
+    return var->address + get_data_type_size(&type);
+}
+
+static const char *get_scalar_register(size_t size)
+{
+    switch(size) {
+        case 1: return "al";
+        case 2: return "ax";
+        case 8: return "rax";
+        default: return "eax";
+    }
+}
+
+static const char *get_memory_size_prefix(size_t size)
+{
+    switch(size) {
+        case 1: return "BYTE";
+        case 2: return "WORD";
+        case 8: return "QWORD";
+        default: return "DWORD";
+    }
+}
+
+#define X86_64_ARG_REGISTERS_COUNT 6
+#define X86_64_VECTOR_ARG_REGISTERS_COUNT 8
+// Functions private to the module also get r10 and r11, which the generated code never uses
+// otherwise, and every vector register except the scratch one
+#define X86_64_INTERNAL_ARG_REGISTERS_COUNT 8
+#define X86_64_INTERNAL_VECTOR_ARG_REGISTERS_COUNT X86_64_VECTOR_SCRATCH
+
+// Arguments are passed in registers, indexed by argument position and then by 1, 2, 4 or 8 bytes
+static const char *x86_64_arg_registers[X86_64_INTERNAL_ARG_REGISTERS_COUNT][4] = {
+    { "dil", "di", "edi", "rdi" },
+    { "sil", "si", "esi", "rsi" },
+    { "dl",  "dx", "edx", "rdx" },
+    { "cl",  "cx", "ecx", "rcx" },
+    { "r8b", "r8w", "r8d", "r8" },
+    { "r9b", "r9w", "r9d", "r9" },
+    { "r10b", "r10w", "r10d", "r10" },
+    { "r11b", "r11w", "r11d", "r11" },
+};
+
+static const char *get_arg_register(size_t index, size_t size)
+{
+    switch(size) {
+        case 1: return x86_64_arg_registers[index][0];
+        case 2: return x86_64_arg_registers[index][1];
+        case 8: return x86_64_arg_registers[index][3];
+        default: return x86_64_arg_registers[index][2];
+    }
+}
+
+static bool is_signed_native_type(Native_Type type)
+{
+    return type == NATIVE_TYPE_I8 || type == NATIVE_TYPE_I16 || type == NATIVE_TYPE_I32 || type == NATIVE_TYPE_I64;
+}
+
+static bool uses_avx(const Compile_Options *options)
+{
+    return options->target_features >= TARGET_FEATURES_AVX2;
+}
+
+// Vector values live in xmm0 (ymm0 for 256-bit vectors), scalars in eax/rax
+static const char *get_vector_register(Native_Type_Info info)
+{
+    return info.size == 32 ? "ymm" : "xmm";
+}
+
+static char get_lane_suffix(Native_Type_Info info)
+{
+    switch(get_native_type_info(info.lane_type).size) {
+        case 1: return 'b';
+        case 8: return 'q';
+        default: return 'd';
+    }
+}
+
+static void emit_vector_instruction(X86_64_Code *code, const Compile_Options *options, const char *instruction,
+        const char *reg, size_t dst, size_t src)
+{
+    if(uses_avx(options)) {
+        emit_inst(code, "v%s %s%zu, %s%zu, %s%zu", instruction, reg, dst, reg, dst, reg, src);
+    } else {
+        emit_inst(code, "%s %s%zu, %s%zu", instruction, reg, dst, reg, src);
+    }
+}
+
+static Native_Type_Info expect_vector_support(Location loc, const Data_Type *type, const Compile_Options *options)
+{
+    Native_Type_Info info = get_native_type_info(type->as.native);
+    if(info.size == 32 && !uses_avx(options)) {
+        compilation_error(loc, "`"SV_FMT"` requires `--target-features avx2`\n", SV_ARGV(info.name));
+        compilation_failure();
+    }
+    return info;
+}
+
+static void compile_load_var(X86_64_Code *code, const Compile_Options *options, const Evaluated_Var *var)
+{
+    Data_Type type = var->type;
+    size_t size = get_data_type_size(&type);
+    size_t offset = get_var_stack_offset(var);
+    if(is_vector_data_type(&type)) {
+        Native_Type_Info info = get_native_type_info(type.as.native);
+        emit_inst(code, "%smovdqu %s0, [rbp-%zu]", uses_avx(options) ? "v" : "", get_vector_register(info), offset);
+    } else if(size == 1 || size == 2) {
+        bool is_signed = type.is_native && is_signed_native_type(type.as.native);
+        emit_inst(code, "%s eax, %s[rbp-%zu]", is_signed ? "movsx" : "movzx", get_memory_size_prefix(size), offset);
+    } else {
+        emit_inst(code, "mov %s, %s[rbp-%zu]", get_scalar_register(size), get_memory_size_prefix(size), offset);
+    }
+}
+
+static void compile_store_var(X86_64_Code *code, const Compile_Options *options, const Evaluated_Var *var)
+{
+    Data_Type type = var->type;
+    size_t size = get_data_type_size(&type);
+    size_t offset = get_var_stack_offset(var);
+    if(is_vector_data_type(&type)) {
+        Native_Type_Info info = get_native_type_info(type.as.native);
+        emit_inst(code, "%smovdqu [rbp-%zu], %s0", uses_avx(options) ? "v" : "", offset, get_vector_register(info));
+    } else {
+        emit_inst(code, "mov %s[rbp-%zu], %s", get_memory_size_prefix(size), offset, get_scalar_register(size));
+    }
+}
+
+static void compile_expr_into_x86_64_nasm(Evaluated_Module *module, X86_64_Code *code, Scope *scope,
+        const Compile_Options *options, const Expr expr);
+
+// Every call to a function that isn't `pub` is known, so they don't have to follow the System V ABI
+static bool uses_internal_convention(const Func_Def *fdef)
+{
+    return !fdef->is_pub && !sv_eq(fdef->name, SV("main"));
+}
+
+static void get_arg_registers_count(const Func_Def *fdef, size_t *integers, size_t *vectors)
+{
+    bool internal = uses_internal_convention(fdef);
+    *integers = internal ? X86_64_INTERNAL_ARG_REGISTERS_COUNT : X86_64_ARG_REGISTERS_COUNT;
+    *vectors = internal ? X86_64_INTERNAL_VECTOR_ARG_REGISTERS_COUNT : X86_64_VECTOR_ARG_REGISTERS_COUNT;
+}
+
+typedef struct {
+    bool on_stack;
+    bool is_vector;
+    // Index of the integer or vector register, or the offset into the stack arguments
+    size_t index;
+} X86_64_Arg_Location;
+
+// Places parameters the way the System V ABI does: integers, booleans and pointers in rdi, rsi,
+// rdx, rcx, r8, r9, vectors in xmm0-xmm7 (ymm0-ymm7 for 256-bit vectors) and whatever doesn't fit
+// in 8 byte (16 byte for vectors) aligned stack slots, the first one at the lowest address. The
+// internal convention only differs by having more registers. Returns the size of the stack
+// arguments rounded up to 16 bytes
+static size_t classify_x86_64_params(Location loc, const Func_Def *fdef, X86_64_Arg_Location *locations)
+{
+    size_t max_integers, max_vectors;
+    get_arg_registers_count(fdef, &max_integers, &max_vectors);
+    size_t integers = 0;
+    size_t vectors = 0;
+    size_t stack_size = 0;
+    for(size_t i = 0; i < fdef->params.count; ++i) {
+        Data_Type type = fdef->params.data[i].type;
+        X86_64_Arg_Location *location = &locations[i];
+        location->is_vector = is_vector_data_type(&type);
+        size_t size = get_data_type_size(&type);
+        if(location->is_vector && vectors < max_vectors) {
+            location->on_stack = false;
+            location->index = vectors++;
+        } else if(!location->is_vector && integers < max_integers) {
+            location->on_stack = false;
+            location->index = integers++;
+        } else {
+            if(size > 16) {
+                // Would need a 32 byte aligned stack which the frames don't guarantee
+                compilation_error(loc, "Passing more than %zu vectors to function `"SV_FMT"` is not supported yet\n",
+                        max_vectors, SV_ARGV(fdef->name));
+                compilation_failure();
+            }
+            size_t slot = location->is_vector ? 16 : 8;
+            location->on_stack = true;
+            location->index = (stack_size + slot - 1) & ~(slot - 1);
+            stack_size = location->index + slot;
+        }
+    }
+    return (stack_size + 15) & ~(size_t)15;
+}
+
+// Keeps the value in eax/rax (xmm0/ymm0 for vectors) on the stack, balanced by compile_pop_value
+static void compile_push_value(X86_64_Code *code, const Compile_Options *options, const Data_Type *type)
+{
+    if(is_vector_data_type(type)) {
+        Native_Type_Info info = get_native_type_info(type->as.native);
+        emit_inst(code, "sub rsp, 32");
+        emit_inst(code, "%s [rsp], %s0", uses_avx(options) ? "vmovdqu" : "movdqu", get_vector_register(info));
+    } else {
+        emit_inst(code, "push rax");
+    }
+}
+
+static void compile_pop_value(X86_64_Code *code, const Compile_Options *options, const Data_Type *type, size_t reg)
+{
+    if(is_vector_data_type(type)) {
+        Native_Type_Info info = get_native_type_info(type->as.native);
+        emit_inst(code, "%s %s%zu, [rsp]", uses_avx(options) ? "vmovdqu" : "movdqu", get_vector_register(info), reg);
+        emit_inst(code, "add rsp, 32");
+    } else {
+        emit_inst(code, "pop %s", get_arg_register(reg, 8));
+    }
+}
+
+// Arguments passed in registers are evaluated onto the stack first and only then popped into
+// their registers since evaluating an argument may clobber the registers of the others. Stack
+// arguments are written straight into the area reserved for them, padded when `aligned` so rsp
+// is aligned to 16 bytes at the call. Returns how much has to be released after the call
+static size_t compile_call_args(Evaluated_Module *module, X86_64_Code *code, Scope *scope, const Compile_Options *options,
+        const Expr *expr, bool aligned)
+{
+    const Func_Def *fdef = find_func_def(module, expr->as.func_call.name);
+    const Expr_List *args = &expr->as.func_call.args;
+    X86_64_Arg_Location *locations = arena_alloc(code->arena, (args->count + 1)*sizeof(X86_64_Arg_Location));
+    assert(locations && "buy more ram lol!");
+    size_t stack_size = classify_x86_64_params(expr->loc, fdef, locations);
+    size_t reserved = stack_size;
+    if(aligned) reserved += (16 - (code->stack_depth + stack_size) % 16) % 16;
+    if(reserved > 0) {
+        emit_inst(code, "sub rsp, %zu", reserved);
+    }
+
+    size_t pushed = 0;
+    for(size_t i = 0; i < args->count; ++i) {
+        Data_Type type = fdef->params.data[i].type;
+        compile_expr_into_x86_64_nasm(module, code, scope, options, args->data[i]);
+        if(!locations[i].on_stack) {
+            compile_push_value(code, options, &type);
+            pushed += locations[i].is_vector ? 32 : 8;
+        } else if(locations[i].is_vector) {
+            emit_inst(code, "%s [rsp+%zu], xmm0", uses_avx(options) ? "vmovdqu" : "movdqu", pushed + locations[i].index);
+        } else {
+            emit_inst(code, "mov QWORD[rsp+%zu], rax", pushed + locations[i].index);
+        }
+    }
+    for(size_t i = args->count; i > 0; --i) {
+        if(locations[i - 1].on_stack) continue;
+        Data_Type type = fdef->params.data[i - 1].type;
+        compile_pop_value(code, options, &type, locations[i - 1].index);
+    }
+    return reserved;
+}
+
+// Only the low bits of small return values are defined by the ABI
+static void compile_call_result(X86_64_Code *code, const Data_Type *type)
+{
+    if(is_vector_data_type(type)) return;
+    Data_Type result = *type;
+    size_t size = get_data_type_size(&result);
+    if(size == 1 || size == 2) {
+        bool is_signed = type->is_native && is_signed_native_type(type->as.native);
+        emit_inst(code, "%s eax, %s", is_signed ? "movsx" : "movzx", size == 1 ? "al" : "ax");
+    }
+}
+
+// Evaluates `value` and writes it into the lane `lane` of the vector being built at [rsp]
+static void compile_lane_store(Evaluated_Module *module, X86_64_Code *code, Scope *scope, const Compile_Options *options,
+        Native_Type_Info info, size_t lane, const Expr *value)
+{
+    size_t lane_size = get_native_type_info(info.lane_type).size;
+    if(value->type == EXPR_INTEGER_LITERAL) {
+        int64_t literal = lane_size == 1 ? (value->as.literal_int & 0xFF) : value->as.literal_int;
+        emit_inst(code, "mov %s[rsp+%zu], %ld", get_memory_size_prefix(lane_size), lane*lane_size, literal);
+    } else {
+        compile_expr_into_x86_64_nasm(module, code, scope, options, *value);
+        emit_inst(code, "mov %s[rsp+%zu], %s", get_memory_size_prefix(lane_size), lane*lane_size, get_scalar_register(lane_size));
+    }
+}
+
+// Evaluates `right` and then `left`, leaving left in register 0 and right in register 1
+static void compile_vector_operands(Evaluated_Module *module, X86_64_Code *code, Scope *scope, const Compile_Options *options,
+        Native_Type_Info info, const Expr *left, const Expr *right)
+{
+    const char *mov = uses_avx(options) ? "vmovdqu" : "movdqu";
+    const char *reg = get_vector_register(info);
+    compile_expr_into_x86_64_nasm(module, code, scope, options, *right);
+    emit_inst(code, "sub rsp, 32");
+    emit_inst(code, "%s [rsp], %s0", mov, reg);
+    compile_expr_into_x86_64_nasm(module, code, scope, options, *left);
+    emit_inst(code, "%s %s1, [rsp]", mov, reg);
+    emit_inst(code, "add rsp, 32");
+}
+
+static void compile_vector_mul(X86_64_Code *code, const Compile_Options *options, Native_Type_Info info)
+{
+    if(uses_avx(options)) {
+        emit_inst(code, "vpmulld %s0, %s0, %s1", get_vector_register(info), get_vector_register(info), get_vector_register(info));
+        return;
+    }
+    // SSE2 only multiplies the even lanes into 64-bit products, so the odd lanes get their own pass
+    emit_inst(code, "movdqa xmm2, xmm0");
+    emit_inst(code, "pmuludq xmm0, xmm1");
+    emit_inst(code, "psrlq xmm2, 32");
+    emit_inst(code, "psrlq xmm1, 32");
+    emit_inst(code, "pmuludq xmm2, xmm1");
+    emit_inst(code, "pshufd xmm0, xmm0, 0x08");
+    emit_inst(code, "pshufd xmm2, xmm2, 0x08");
+    emit_inst(code, "punpckldq xmm0, xmm2");
+}
+
+static void compile_vector_func_call(Evaluated_Module *module, X86_64_Code *code, Scope *scope, const Compile_Options *options,
+        const Expr *expr, Data_Type result_type)
+{
+    const Expr_Func_Call *call = &expr->as.func_call;
+    const Expr *args = call->args.data;
+    const char *v = uses_avx(options) ? "v" : "";
+    const char *mov = uses_avx(options) ? "vmovdqu" : "movdqu";
+
+    Native_Type_Info *constructor = find_native_type_info_by_name(call->name);
+    if(constructor && constructor->lanes > 0) {
+        Native_Type_Info info = expect_vector_support(expr->loc, &result_type, options);
+        size_t lane_size = get_native_type_info(info.lane_type).size;
+        emit_inst(code, "sub rsp, 32");
+        if(call->args.count == 1) {
+            compile_lane_store(module, code, scope, options, info, 0, &args[0]);
+            emit_inst(code, "mov %s, %s[rsp]", get_scalar_register(lane_size), get_memory_size_prefix(lane_size));
+            for(size_t lane = 1; lane < info.lanes; ++lane)
+                emit_inst(code, "mov %s[rsp+%zu], %s", get_memory_size_prefix(lane_size), lane*lane_size, get_scalar_register(lane_size));
+        } else {
+            for(size_t lane = 0; lane < info.lanes; ++lane)
+                compile_lane_store(module, code, scope, options, info, lane, &args[lane]);
+        }
+        emit_inst(code, "%s %s0, [rsp]", mov, get_vector_register(info));
+        emit_inst(code, "add rsp, 32");
+        return;
+    }
+
+    Data_Type vector_type = eval_expr(module, scope, &args[0]);
+    Native_Type_Info info = expect_vector_support(expr->loc, &vector_type, options);
+    const char *reg = get_vector_register(info);
+    char suffix = get_lane_suffix(info);
+    switch(find_builtin_fn(call->name)) {
+        case BUILTIN_VEXTRACT:
+            {
+                size_t lane = args[1].as.literal_int;
+                compile_expr_into_x86_64_nasm(module, code, scope, options, args[0]);
+                if(suffix == 'b') {
+                    emit_inst(code, "%spextrw eax, xmm0, %zu", v, lane / 2);
+                    if(lane % 2) emit_inst(code, "shr eax, 8");
+                    emit_inst(code, "movzx eax, al");
+                } else if(suffix == 'q') {
+                    if(lane == 1) emit_inst(code, "%spshufd xmm0, xmm0, 0x4E", v);
+                    emit_inst(code, "%smovq rax, xmm0", v);
+                } else {
+                    if(lane >= 4) emit_inst(code, "vextracti128 xmm0, ymm0, 1");
+                    if(lane % 4) emit_inst(code, "%spshufd xmm0, xmm0, %zu", v, lane % 4);
+                    emit_inst(code, "%smovd eax, xmm0", v);
+                }
+            } break;
+        case BUILTIN_VINSERT:
+            {
+                size_t lane = args[1].as.literal_int;
+                compile_expr_into_x86_64_nasm(module, code, scope, options, args[0]);
+                emit_inst(code, "sub rsp, 32");
+                emit_inst(code, "%s [rsp], %s0", mov, reg);
+                compile_lane_store(module, code, scope, options, info, lane, &args[2]);
+                emit_inst(code, "%s %s0, [rsp]", mov, reg);
+                emit_inst(code, "add rsp, 32");
+            } break;
+        case BUILTIN_VSHUFFLE:
+            {
+                compile_expr_into_x86_64_nasm(module, code, scope, options, args[0]);
+                if(suffix == 'q') {
+                    size_t low = args[1].as.literal_int, high = args[2].as.literal_int;
+                    size_t imm = (low*2) | ((low*2 + 1) << 2) | ((high*2) << 4) | ((high*2 + 1) << 6);
+                    emit_inst(code, "%spshufd xmm0, xmm0, 0x%02zX", v, imm);
+                } else if(info.size == 16 && suffix == 'd') {
+                    size_t imm = 0;
+                    for(size_t lane = 0; lane < 4; ++lane) imm |= (size_t)args[lane + 1].as.literal_int << (lane*2);
+                    emit_inst(code, "%spshufd xmm0, xmm0, 0x%02zX", v, imm);
+                } else if(uses_avx(options)) {
+                    // The lane indices become the control vector of vpermd or vpshufb
+                    size_t lane_size = get_native_type_info(info.lane_type).size;
+                    emit_inst(code, "sub rsp, 32");
+                    for(size_t lane = 0; lane < info.lanes; ++lane)
+                        emit_inst(code, "mov %s[rsp+%zu], %ld", get_memory_size_prefix(lane_size), lane*lane_size, args[lane + 1].as.literal_int);
+                    emit_inst(code, "vmovdqu %s1, [rsp]", reg);
+                    emit_inst(code, "add rsp, 32");
+                    if(suffix == 'b') emit_inst(code, "vpshufb xmm0, xmm0, xmm1");
+                    else emit_inst(code, "vpermd ymm0, ymm1, ymm0");
+                } else {
+                    // No byte shuffle before SSSE3, lanes are moved through memory one by one
+                    emit_inst(code, "sub rsp, 32");
+                    emit_inst(code, "movdqu [rsp+16], xmm0");
+                    for(size_t lane = 0; lane < info.lanes; ++lane) {
+                        emit_inst(code, "mov al, BYTE[rsp+%ld]", 16 + args[lane + 1].as.literal_int);
+                        emit_inst(code, "mov BYTE[rsp+%zu], al", lane);
+                    }
+                    emit_inst(code, "movdqu xmm0, [rsp]");
+                    emit_inst(code, "add rsp, 32");
+                }
+            } break;
+        case BUILTIN_VCMPEQ:
+            {
+                compile_vector_operands(module, code, scope, options, info, &args[0], &args[1]);
+                if(suffix == 'q' && !uses_avx(options)) {
+                    // pcmpeqq is SSE4.1, both halves of a quadword have to be equal instead
+                    emit_inst(code, "pcmpeqd xmm0, xmm1");
+                    emit_inst(code, "pshufd xmm1, xmm0, 0xB1");
+                    emit_inst(code, "pand xmm0, xmm1");
+                } else {
+                    char instruction[16];
+                    snprintf(instruction, sizeof(instruction), "pcmpeq%c", suffix);
+                    emit_vector_instruction(code, options, instruction, reg, 0, 1);
+                }
+            } break;
+        case BUILTIN_VCMPGT:
+            {
+                if(suffix == 'q' && !uses_avx(options)) {
+                    compilation_error(expr->loc, "vcmpgt on `"SV_FMT"` requires `--target-features avx2`\n", SV_ARGV(info.name));
+                    compilation_failure();
+                }
+                compile_vector_operands(module, code, scope, options, info, &args[0], &args[1]);
+                if(suffix == 'b') {
+                    // pcmpgtb is signed, flipping the sign bits turns it into an unsigned comparison
+                    emit_inst(code, "mov eax, 0x80808080");
+                    emit_inst(code, "%smovd xmm2, eax", v);
+                    emit_inst(code, "%spshufd xmm2, xmm2, 0", v);
+                    emit_vector_instruction(code, options, "pxor", reg, 0, 2);
+                    emit_vector_instruction(code, options, "pxor", reg, 1, 2);
+                }
+                char instruction[16];
+                snprintf(instruction, sizeof(instruction), "pcmpgt%c", suffix);
+                emit_vector_instruction(code, options, instruction, reg, 0, 1);
+            } break;
+        case BUILTIN_VREDUCE_ADD:
+            {
+                compile_expr_into_x86_64_nasm(module, code, scope, options, args[0]);
+                if(info.size == 32) {
+                    emit_inst(code, "vextracti128 xmm1, ymm0, 1");
+                    emit_inst(code, "vpaddd xmm0, xmm0, xmm1");
+                }
+                if(suffix == 'b') {
+                    // psadbw against zero sums each half of the bytes into a quadword
+                    emit_vector_instruction(code, options, "pxor", "xmm", 1, 1);
+                    emit_vector_instruction(code, options, "psadbw", "xmm", 0, 1);
+                    suffix = 'q';
+                }
+                char instruction[16];
+                snprintf(instruction, sizeof(instruction), "padd%c", suffix);
+                emit_inst(code, "%spshufd xmm1, xmm0, 0x4E", v);
+                emit_vector_instruction(code, options, instruction, "xmm", 0, 1);
+                if(suffix == 'd') {
+                    emit_inst(code, "%spshufd xmm1, xmm0, 0xB1", v);
+                    emit_vector_instruction(code, options, instruction, "xmm", 0, 1);
+                }
+                if(info.lane_type == NATIVE_TYPE_I64) {
+                    emit_inst(code, "%smovq rax, xmm0", v);
+                } else {
+                    emit_inst(code, "%smovd eax, xmm0", v);
+                    if(info.lane_type == NATIVE_TYPE_U8) emit_inst(code, "movzx eax, al");
+                }
+            } break;
+        default:
+            {
+                compilation_error(expr->loc, "Unreachable builtin function");
+                compilation_failure();
+            } break;
+    }
+}
+
+typedef struct {
+    Binary_Op_Type op;
+    const char *signed_cc;
+    const char *unsigned_cc;
+    // Condition code of the opposite comparison, taken when a branch jumps on false
+    Binary_Op_Type inverse;
+} X86_64_Condition;
+
+static const X86_64_Condition x86_64_conditions[] = {
+    { BINARY_OP_EQ, "e",  "e",  BINARY_OP_NE },
+    { BINARY_OP_NE, "ne", "ne", BINARY_OP_EQ },
+    { BINARY_OP_LT, "l",  "b",  BINARY_OP_GE },
+    { BINARY_OP_LE, "le", "be", BINARY_OP_GT },
+    { BINARY_OP_GT, "g",  "a",  BINARY_OP_LE },
+    { BINARY_OP_GE, "ge", "ae", BINARY_OP_LT },
+};
+
+static const X86_64_Condition *find_x86_64_condition(Binary_Op_Type op)
+{
+    for(size_t i = 0; i < sizeof(x86_64_conditions)/sizeof(x86_64_conditions[0]); ++i) {
+        if(x86_64_conditions[i].op == op) return &x86_64_conditions[i];
+    }
+    return NULL;
+}
+
+// Sets the flags for comparing the operands of `binop`, returns whether the comparison is signed.
+// Integer literals on the right are folded into the `cmp` itself
+static bool compile_compare(Evaluated_Module *module, X86_64_Code *code, Scope *scope, const Compile_Options *options,
+        const Expr_Binary_Op *binop)
+{
+    Data_Type type = eval_expr(module, scope, &binop->left);
+    bool is_signed = !type.is_native || is_signed_native_type(type.as.native);
+    bool wide = get_data_type_size(&type) == 8;
+    const char *a = wide ? "rax" : "eax";
+    const char *c = wide ? "rcx" : "ecx";
+    if(binop->right.type == EXPR_INTEGER_LITERAL && binop->right.as.literal_int == (int32_t)binop->right.as.literal_int) {
+        compile_expr_into_x86_64_nasm(module, code, scope, options, binop->left);
+        emit_inst(code, "cmp %s, %ld", a, binop->right.as.literal_int);
+        return is_signed;
+    }
+    compile_expr_into_x86_64_nasm(module, code, scope, options, binop->right);
+    emit_inst(code, "push rax");
+    compile_expr_into_x86_64_nasm(module, code, scope, options, binop->left);
+    emit_inst(code, "pop rcx");
+    emit_inst(code, "cmp %s, %s", a, c);
+    return is_signed;
+}
+
+// Jumps to `.L<target>` when `expr` is `jump_if` and falls through otherwise. `&&` and `||` are
+// lowered into chains of compare-and-branch so no boolean is ever materialized for a condition
+// and the right operand is only evaluated when the left one didn't decide the result
+static void compile_cond_into_x86_64_nasm(Evaluated_Module *module, X86_64_Code *code, Scope *scope,
+        const Compile_Options *options, const Expr *expr, bool jump_if, size_t target)
+{
+    if(expr->type == EXPR_BOOL_LITERAL) {
+        if(expr->as.literal_bool == jump_if) emit_inst(code, "jmp .L%zu", target);
+        return;
+    }
+
+    if(expr->type == EXPR_BINARY_OP && (expr->as.binop->type == BINARY_OP_AND || expr->as.binop->type == BINARY_OP_OR)) {
+        bool is_and = expr->as.binop->type == BINARY_OP_AND;
+        if(is_and != jump_if) {
+            // `a && b` is false as soon as `a` is, `a || b` is true as soon as `a` is
+            compile_cond_into_x86_64_nasm(module, code, scope, options, &expr->as.binop->left, jump_if, target);
+            compile_cond_into_x86_64_nasm(module, code, scope, options, &expr->as.binop->right, jump_if, target);
+        } else {
+            size_t skip = (*code->labels_count)++;
+            compile_cond_into_x86_64_nasm(module, code, scope, options, &expr->as.binop->left, !jump_if, skip);
+            compile_cond_into_x86_64_nasm(module, code, scope, options, &expr->as.binop->right, jump_if, target);
+            emit_label(code, ".L%zu", skip);
+        }
+        return;
+    }
+
+    if(expr->type == EXPR_BINARY_OP) {
+        const X86_64_Condition *condition = find_x86_64_condition(expr->as.binop->type);
+        if(condition) {
+            bool is_signed = compile_compare(module, code, scope, options, expr->as.binop);
+            if(!jump_if) condition = find_x86_64_condition(condition->inverse);
+            emit_inst(code, "j%s .L%zu", is_signed ? condition->signed_cc : condition->unsigned_cc, target);
+            return;
+        }
+    }
+
+    compile_expr_into_x86_64_nasm(module, code, scope, options, *expr);
+    emit_inst(code, "test eax, eax");
+    emit_inst(code, "%s .L%zu", jump_if ? "jnz" : "jz", target);
+}
+
+static bool expr_has_call(const Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_FUNCALL: return true;
+        case EXPR_BINARY_OP: return expr_has_call(&expr->as.binop->left) || expr_has_call(&expr->as.binop->right);
+        default: return false;
+    }
+}
+
+// `&&` and `||` used as values. When evaluating the right operand has no side effects both sides
+// are computed with `setcc` and combined without a branch, otherwise it short-circuits
+static void compile_logical_value(Evaluated_Module *module, X86_64_Code *code, Scope *scope,
+        const Compile_Options *options, const Expr *expr)
+{
+    bool is_and = expr->as.binop->type == BINARY_OP_AND;
+    if(!expr_has_call(&expr->as.binop->right)) {
+        compile_expr_into_x86_64_nasm(module, code, scope, options, expr->as.binop->right);
+        emit_inst(code, "push rax");
+        compile_expr_into_x86_64_nasm(module, code, scope, options, expr->as.binop->left);
+        emit_inst(code, "pop rcx");
+        emit_inst(code, "%s eax, ecx", is_and ? "and" : "or");
+        return;
+    }
+
+    size_t decided = (*code->labels_count)++;
+    size_t end = (*code->labels_count)++;
+    compile_cond_into_x86_64_nasm(module, code, scope, options, expr, !is_and, decided);
+    emit_inst(code, "mov eax, %d", is_and ? 1 : 0);
+    emit_inst(code, "jmp .L%zu", end);
+    emit_label(code, ".L%zu", decided);
+    emit_inst(code, "mov eax, %d", is_and ? 0 : 1);
+    emit_label(code, ".L%zu", end);
+}
+
+static void compile_expr_into_x86_64_nasm(Evaluated_Module *module, X86_64_Code *code, Scope *scope,
+        const Compile_Options *options, const Expr expr)
 {
     switch(expr.type) {
         case EXPR_INTEGER_LITERAL:
             {
-                fprintf(f, "    mov eax, %ld\n", expr.as.literal_int);
+                emit_inst(code, "mov eax, %ld", expr.as.literal_int);
+            } break;
+        case EXPR_BOOL_LITERAL:
+            {
+                emit_inst(code, "mov eax, %d", expr.as.literal_bool ? 1 : 0);
             } break;
         case EXPR_FUNCALL:
             {
-                fprintf(f, "    call "SV_FMT"\n", SV_ARGV(expr.as.func_call.name));
+                if(find_builtin_fn(expr.as.func_call.name) != BUILTIN_UNKNOWN) {
+                    compile_vector_func_call(module, code, scope, options, &expr, eval_expr(module, scope, &expr));
+                    break;
+                }
+                Native_Type_Info *constructor = find_native_type_info_by_name(expr.as.func_call.name);
+                if(constructor && constructor->lanes > 0) {
+                    compile_vector_func_call(module, code, scope, options, &expr, eval_expr(module, scope, &expr));
+                    break;
+                }
+                const Func_Def *fdef = find_func_def(module, expr.as.func_call.name);
+                size_t reserved = compile_call_args(module, code, scope, options, &expr, true);
+                emit_inst(code, "call "SV_FMT, SV_ARGV(expr.as.func_call.name));
+                if(reserved > 0) {
+                    emit_inst(code, "add rsp, %zu", reserved);
+                }
+                compile_call_result(code, &fdef->return_type);
             } break;
         case EXPR_VAR_READ:
             {
-                const Evaluated_Var *var = get_var_from_scope(scope, expr.as.var_read.name);
-                fprintf(f, "    mov eax, DWORD[rbp-%zu]\n", var->address);
+                compile_load_var(code, options, get_var_from_scope(scope, expr.as.var_read.name));
             } break;
         case EXPR_BINARY_OP:
             {
-                compile_expr_into_x86_64_nasm(module, f, scope, expr.as.binop->right);
-                fprintf(f, "    mov ebx, eax\n");
-                compile_expr_into_x86_64_nasm(module, f, scope, expr.as.binop->left);
+                Data_Type type = eval_expr(module, scope, &expr.as.binop->left);
+                if(is_vector_data_type(&type)) {
+                    Native_Type_Info info = expect_vector_support(expr.loc, &type, options);
+                    compile_vector_operands(module, code, scope, options, info, &expr.as.binop->left, &expr.as.binop->right);
+                    char instruction[16];
+                    switch(expr.as.binop->type) {
+                        case BINARY_OP_ADD:
+                            {
+                                snprintf(instruction, sizeof(instruction), "padd%c", get_lane_suffix(info));
+                                emit_vector_instruction(code, options, instruction, get_vector_register(info), 0, 1);
+                            } break;
+                        case BINARY_OP_SUB:
+                            {
+                                snprintf(instruction, sizeof(instruction), "psub%c", get_lane_suffix(info));
+                                emit_vector_instruction(code, options, instruction, get_vector_register(info), 0, 1);
+                            } break;
+                        case BINARY_OP_MUL:
+                            {
+                                compile_vector_mul(code, options, info);
+                            } break;
+                        default:
+                            {
+                                compilation_error(expr.loc, "Parsed but not implemented expression\n");
+                                compilation_failure();
+                            } break;
+                    }
+                    break;
+                }
+
+                const X86_64_Condition *condition = find_x86_64_condition(expr.as.binop->type);
+                if(condition) {
+                    // Comparisons used as values, conditions of branches never get here
+                    bool is_signed = compile_compare(module, code, scope, options, expr.as.binop);
+                    emit_inst(code, "set%s al", is_signed ? condition->signed_cc : condition->unsigned_cc);
+                    emit_inst(code, "movzx eax, al");
+                    break;
+                }
+                if(expr.as.binop->type == BINARY_OP_AND || expr.as.binop->type == BINARY_OP_OR) {
+                    compile_logical_value(module, code, scope, options, &expr);
+                    break;
+                }
+
+                // The right operand is saved on the stack so nested operations can't clobber it
+                bool wide = get_data_type_size(&type) == 8;
+                const char *a = wide ? "rax" : "eax";
+                const char *c = wide ? "rcx" : "ecx";
+                compile_expr_into_x86_64_nasm(module, code, scope, options, expr.as.binop->right);
+                emit_inst(code, "push rax");
+                compile_expr_into_x86_64_nasm(module, code, scope, options, expr.as.binop->left);
+                emit_inst(code, "pop rcx");
                 switch(expr.as.binop->type) {
                     case BINARY_OP_ADD:
                         {
-                            fprintf(f, "    add eax, ebx\n");
+                            emit_inst(code, "add %s, %s", a, c);
+                        } break;
+                    case BINARY_OP_SUB:
+                        {
+                            emit_inst(code, "sub %s, %s", a, c);
+                        } break;
+                    case BINARY_OP_MUL:
+                        {
+                            emit_inst(code, "imul %s, %s", a, c);
                         } break;
                     default:
                         {
@@ -46,50 +1029,550 @@ static void compile_expr_into_x86_64_nasm(Evaluated_Module *module, FILE *f, Sco
     }
 }
 
-static void compile_stmt_into_x86_64_nasm(Evaluated_Module *module, FILE *f, Scope *scope, const Stmt stmt)
+typedef enum {
+    VECTOR_VAR_INDUCTION = 0,
+    VECTOR_VAR_TEMP,
+    VECTOR_VAR_REDUCTION,
+} Vector_Var_Kind;
+
+typedef struct {
+    Vector_Var_Kind kind;
+    const Evaluated_Var *var;
+    // Induction variables are advanced by `step` every iteration
+    int64_t step;
+    // Temporaries and reductions are computed from `value`, reductions either add or subtract it
+    const Expr *value;
+    bool subtract;
+} Vector_Var;
+
+// A counted loop `while i < n { ... i = i + 1; }` whose body only consists of lane-wise arithmetic
+// over induction variables, loop-invariant variables and literals, folded into temporaries or
+// accumulated into reductions. Every induction variable update has to come last in the body.
+typedef struct {
+    const Evaluated_Var *counter;
+    const Expr *bound;
+    bool inclusive;
+    Vector_Var vars[X86_64_VECTOR_MAX_VARS];
+    size_t vars_count;
+} Vector_Loop;
+
+static bool is_i32_var(const Evaluated_Var *var)
+{
+    return var && var->type.is_native && !var->type.is_ptr && !var->type.is_array && var->type.as.native == NATIVE_TYPE_I32;
+}
+
+static Vector_Var *find_vector_var(Vector_Loop *loop, String_View name)
+{
+    for(size_t i = 0; i < loop->vars_count; ++i) {
+        if(sv_eq(loop->vars[i].var->name, name)) return &loop->vars[i];
+    }
+    return NULL;
+}
+
+static bool match_vector_step(const Stmt *stmt, int64_t *step)
+{
+    const Expr *value = &stmt->as.var_assign.value;
+    if(value->type != EXPR_BINARY_OP) return false;
+    const Expr *left = &value->as.binop->left;
+    const Expr *right = &value->as.binop->right;
+    if(value->as.binop->type == BINARY_OP_ADD && left->type == EXPR_INTEGER_LITERAL) SWAP(const Expr *, left, right);
+    if(value->as.binop->type != BINARY_OP_ADD && value->as.binop->type != BINARY_OP_SUB) return false;
+    if(left->type != EXPR_VAR_READ || !sv_eq(left->as.var_read.name, stmt->as.var_assign.name)) return false;
+    if(right->type != EXPR_INTEGER_LITERAL) return false;
+    *step = value->as.binop->type == BINARY_OP_ADD ? right->as.literal_int : -right->as.literal_int;
+    return true;
+}
+
+static bool match_vector_reduction(const Stmt *stmt, const Expr **value, bool *subtract)
+{
+    const Expr *expr = &stmt->as.var_assign.value;
+    if(expr->type != EXPR_BINARY_OP) return false;
+    Binary_Op_Type type = expr->as.binop->type;
+    const Expr *left = &expr->as.binop->left;
+    const Expr *right = &expr->as.binop->right;
+    if(type == BINARY_OP_ADD && right->type == EXPR_VAR_READ && sv_eq(right->as.var_read.name, stmt->as.var_assign.name)) {
+        SWAP(const Expr *, left, right);
+    }
+    if(type != BINARY_OP_ADD && type != BINARY_OP_SUB) return false;
+    if(left->type != EXPR_VAR_READ || !sv_eq(left->as.var_read.name, stmt->as.var_assign.name)) return false;
+    *value = right;
+    *subtract = type == BINARY_OP_SUB;
+    return true;
+}
+
+// Returns the number of vector registers needed to evaluate `expr` or 0 if it can't be vectorized.
+// `defined` is the amount of loop variables that already have a value when `expr` is evaluated.
+static size_t vector_expr_depth(Vector_Loop *loop, Scope *scope, const Expr *expr, size_t defined, Target_Features features)
+{
+    switch(expr->type) {
+        case EXPR_INTEGER_LITERAL:
+            return 1;
+        case EXPR_VAR_READ:
+            {
+                Vector_Var *vvar = find_vector_var(loop, expr->as.var_read.name);
+                if(vvar) {
+                    if(vvar->kind == VECTOR_VAR_REDUCTION) return 0;
+                    if(vvar->kind == VECTOR_VAR_TEMP && (size_t)(vvar - loop->vars) >= defined) return 0;
+                    return 1;
+                }
+                return is_i32_var(get_var_from_scope(scope, expr->as.var_read.name)) ? 1 : 0;
+            }
+        case EXPR_BINARY_OP:
+            {
+                Binary_Op_Type type = expr->as.binop->type;
+                // There's no lane-wise 32-bit multiplication before SSE4.1
+                if(type == BINARY_OP_MUL && features < TARGET_FEATURES_AVX2) return 0;
+                if(type != BINARY_OP_ADD && type != BINARY_OP_SUB && type != BINARY_OP_MUL) return 0;
+                size_t left = vector_expr_depth(loop, scope, &expr->as.binop->left, defined, features);
+                size_t right = vector_expr_depth(loop, scope, &expr->as.binop->right, defined, features);
+                if(left == 0 || right == 0) return 0;
+                return left > right + 1 ? left : right + 1;
+            }
+        default:
+            return 0;
+    }
+}
+
+static bool match_vector_loop(Scope *scope, const Stmt_While *loop, Target_Features features, Vector_Loop *result)
+{
+    if(features == TARGET_FEATURES_SCALAR) return false;
+
+    const Expr *condition = &loop->condition;
+    if(condition->type != EXPR_BINARY_OP) return false;
+    if(condition->as.binop->type != BINARY_OP_LT && condition->as.binop->type != BINARY_OP_LE) return false;
+    if(condition->as.binop->left.type != EXPR_VAR_READ) return false;
+    result->bound = &condition->as.binop->right;
+    result->inclusive = condition->as.binop->type == BINARY_OP_LE;
+    result->vars_count = 0;
+
+    bool updating = false;
+    for(size_t i = 0; i < loop->todo.count; ++i) {
+        const Stmt *stmt = &loop->todo.data[i];
+        if(result->vars_count >= X86_64_VECTOR_MAX_VARS) return false;
+        Vector_Var *vvar = &result->vars[result->vars_count];
+        String_View name = {0};
+        if(stmt->type == STMT_VAR_ASSIGN) {
+            name = stmt->as.var_assign.name;
+            if(match_vector_step(stmt, &vvar->step)) {
+                vvar->kind = VECTOR_VAR_INDUCTION;
+                updating = true;
+            } else if(updating) {
+                return false;
+            } else if(match_vector_reduction(stmt, &vvar->value, &vvar->subtract)) {
+                vvar->kind = VECTOR_VAR_REDUCTION;
+            } else {
+                vvar->kind = VECTOR_VAR_TEMP;
+                vvar->value = &stmt->as.var_assign.value;
+            }
+        } else if(stmt->type == STMT_VAR_INIT && !updating) {
+            name = stmt->as.var_init.name;
+            vvar->kind = VECTOR_VAR_TEMP;
+            vvar->value = &stmt->as.var_init.value;
+        } else {
+            return false;
+        }
+
+        if(find_vector_var(result, name)) return false;
+        vvar->var = get_var_from_scope(scope, name);
+        if(!is_i32_var(vvar->var)) return false;
+        result->vars_count += 1;
+    }
+
+    Vector_Var *counter = find_vector_var(result, condition->as.binop->left.as.var_read.name);
+    if(!counter || counter->kind != VECTOR_VAR_INDUCTION || counter->step != 1) return false;
+    result->counter = counter->var;
+
+    if(result->bound->type == EXPR_VAR_READ) {
+        if(find_vector_var(result, result->bound->as.var_read.name)) return false;
+        if(!is_i32_var(get_var_from_scope(scope, result->bound->as.var_read.name))) return false;
+    } else if(result->bound->type != EXPR_INTEGER_LITERAL) {
+        return false;
+    }
+
+    for(size_t i = 0; i < result->vars_count; ++i) {
+        Vector_Var *vvar = &result->vars[i];
+        if(vvar->kind == VECTOR_VAR_INDUCTION) continue;
+        size_t depth = vector_expr_depth(result, scope, vvar->value, i, features);
+        if(depth == 0 || result->vars_count + depth > X86_64_VECTOR_SCRATCH) return false;
+    }
+    return true;
+}
+
+static void compile_vector_expr(X86_64_Code *code, Vector_Loop *loop, Scope *scope, const Expr *expr, size_t reg, Target_Features features)
+{
+    bool avx = features >= TARGET_FEATURES_AVX2;
+    switch(expr->type) {
+        case EXPR_INTEGER_LITERAL:
+            {
+                emit_inst(code, "mov eax, %ld", expr->as.literal_int);
+                if(avx) {
+                    emit_inst(code, "vmovd xmm%zu, eax", reg);
+                    emit_inst(code, "vpbroadcastd ymm%zu, xmm%zu", reg, reg);
+                } else {
+                    emit_inst(code, "movd xmm%zu, eax", reg);
+                    emit_inst(code, "pshufd xmm%zu, xmm%zu, 0", reg, reg);
+                }
+            } break;
+        case EXPR_VAR_READ:
+            {
+                Vector_Var *vvar = find_vector_var(loop, expr->as.var_read.name);
+                if(vvar) {
+                    size_t src = vvar - loop->vars;
+                    if(avx) emit_inst(code, "vmovdqa ymm%zu, ymm%zu", reg, src);
+                    else emit_inst(code, "movdqa xmm%zu, xmm%zu", reg, src);
+                    break;
+                }
+                const Evaluated_Var *var = get_var_from_scope(scope, expr->as.var_read.name);
+                if(avx) {
+                    emit_inst(code, "vpbroadcastd ymm%zu, DWORD[rbp-%zu]", reg, get_var_stack_offset(var));
+                } else {
+                    emit_inst(code, "movd xmm%zu, DWORD[rbp-%zu]", reg, get_var_stack_offset(var));
+                    emit_inst(code, "pshufd xmm%zu, xmm%zu, 0", reg, reg);
+                }
+            } break;
+        case EXPR_BINARY_OP:
+            {
+                compile_vector_expr(code, loop, scope, &expr->as.binop->left, reg, features);
+                compile_vector_expr(code, loop, scope, &expr->as.binop->right, reg + 1, features);
+                const char *instruction = NULL;
+                switch(expr->as.binop->type) {
+                    case BINARY_OP_ADD: instruction = "paddd"; break;
+                    case BINARY_OP_SUB: instruction = "psubd"; break;
+                    case BINARY_OP_MUL: instruction = "pmulld"; break;
+                    default: break;
+                }
+                if(avx) emit_inst(code, "v%s ymm%zu, ymm%zu, ymm%zu", instruction, reg, reg, reg + 1);
+                else emit_inst(code, "%s xmm%zu, xmm%zu", instruction, reg, reg + 1);
+            } break;
+        default:
+            break;
+    }
+}
+
+static void compile_vector_loop(X86_64_Code *code, Evaluated_Fn *fn, Vector_Loop *loop, Scope *scope, Target_Features features)
+{
+    bool avx = features >= TARGET_FEATURES_AVX2;
+    size_t lanes = avx ? 8 : 4;
+    size_t scratch = X86_64_VECTOR_SCRATCH;
+    size_t head = fn->labels_count++;
+    size_t done = fn->labels_count++;
+    size_t constants = fn->labels_count++;
+
+    // Lane i of an induction variable starts at `var + i*step`
+    for(size_t i = 0; i < loop->vars_count; ++i) {
+        Vector_Var *vvar = &loop->vars[i];
+        size_t offset = get_var_stack_offset(vvar->var);
+        if(vvar->kind == VECTOR_VAR_INDUCTION) {
+            if(avx) {
+                emit_inst(code, "vpbroadcastd ymm%zu, DWORD[rbp-%zu]", i, offset);
+                emit_inst(code, "vpaddd ymm%zu, ymm%zu, [rel .L%zu+%zu]", i, i, constants, i*64);
+            } else {
+                emit_inst(code, "movd xmm%zu, DWORD[rbp-%zu]", i, offset);
+                emit_inst(code, "pshufd xmm%zu, xmm%zu, 0", i, i);
+                emit_inst(code, "paddd xmm%zu, [rel .L%zu+%zu]", i, constants, i*64);
+            }
+        } else if(vvar->kind == VECTOR_VAR_REDUCTION) {
+            if(avx) emit_inst(code, "vpxor ymm%zu, ymm%zu, ymm%zu", i, i, i);
+            else emit_inst(code, "pxor xmm%zu, xmm%zu", i, i);
+        }
+    }
+
+    emit_label(code, ".L%zu", head);
+    emit_inst(code, "movsxd rax, DWORD[rbp-%zu]", get_var_stack_offset(loop->counter));
+    if(loop->bound->type == EXPR_INTEGER_LITERAL) {
+        emit_inst(code, "mov rcx, %ld", loop->bound->as.literal_int);
+    } else {
+        const Evaluated_Var *bound = get_var_from_scope(scope, loop->bound->as.var_read.name);
+        emit_inst(code, "movsxd rcx, DWORD[rbp-%zu]", get_var_stack_offset(bound));
+    }
+    emit_inst(code, "add rax, %zu", loop->inclusive ? lanes - 1 : lanes);
+    emit_inst(code, "cmp rax, rcx");
+    // Leaves once a whole vector iteration would run past the bound
+    emit_inst(code, "jg .L%zu", done);
+    for(size_t i = 0; i < loop->vars_count; ++i) {
+        Vector_Var *vvar = &loop->vars[i];
+        size_t offset = get_var_stack_offset(vvar->var);
+        switch(vvar->kind) {
+            case VECTOR_VAR_TEMP:
+                {
+                    compile_vector_expr(code, loop, scope, vvar->value, loop->vars_count, features);
+                    if(avx) {
+                        emit_inst(code, "vmovdqa ymm%zu, ymm%zu", i, loop->vars_count);
+                        emit_inst(code, "vextracti128 xmm%zu, ymm%zu, 1", scratch, i);
+                        emit_inst(code, "vpshufd xmm%zu, xmm%zu, 0xFF", scratch, scratch);
+                        emit_inst(code, "vmovd DWORD[rbp-%zu], xmm%zu", offset, scratch);
+                    } else {
+                        emit_inst(code, "movdqa xmm%zu, xmm%zu", i, loop->vars_count);
+                        emit_inst(code, "pshufd xmm%zu, xmm%zu, 0xFF", scratch, i);
+                        emit_inst(code, "movd DWORD[rbp-%zu], xmm%zu", offset, scratch);
+                    }
+                } break;
+            case VECTOR_VAR_REDUCTION:
+                {
+                    compile_vector_expr(code, loop, scope, vvar->value, loop->vars_count, features);
+                    const char *instruction = vvar->subtract ? "psubd" : "paddd";
+                    if(avx) emit_inst(code, "v%s ymm%zu, ymm%zu, ymm%zu", instruction, i, i, loop->vars_count);
+                    else emit_inst(code, "%s xmm%zu, xmm%zu", instruction, i, loop->vars_count);
+                } break;
+            case VECTOR_VAR_INDUCTION:
+                {
+                    if(avx) emit_inst(code, "vpaddd ymm%zu, ymm%zu, [rel .L%zu+%zu]", i, i, constants, i*64 + 32);
+                    else emit_inst(code, "paddd xmm%zu, [rel .L%zu+%zu]", i, constants, i*64 + 32);
+                    emit_inst(code, "add DWORD[rbp-%zu], %ld", offset, vvar->step * (int64_t)lanes);
+                } break;
+        }
+    }
+    emit_inst(code, "jmp .L%zu", head);
+
+    emit_label(code, ".L%zu", done);
+    for(size_t i = 0; i < loop->vars_count; ++i) {
+        Vector_Var *vvar = &loop->vars[i];
+        if(vvar->kind != VECTOR_VAR_REDUCTION) continue;
+        if(avx) {
+            emit_inst(code, "vextracti128 xmm%zu, ymm%zu, 1", scratch, i);
+            emit_inst(code, "vpaddd xmm%zu, xmm%zu, xmm%zu", i, i, scratch);
+        }
+        emit_inst(code, "%spshufd xmm%zu, xmm%zu, 0x4E", avx ? "v" : "", scratch, i);
+        if(avx) emit_inst(code, "vpaddd xmm%zu, xmm%zu, xmm%zu", i, i, scratch);
+        else emit_inst(code, "paddd xmm%zu, xmm%zu", i, scratch);
+        emit_inst(code, "%spshufd xmm%zu, xmm%zu, 0xB1", avx ? "v" : "", scratch, i);
+        if(avx) emit_inst(code, "vpaddd xmm%zu, xmm%zu, xmm%zu", i, i, scratch);
+        else emit_inst(code, "paddd xmm%zu, xmm%zu", i, scratch);
+        emit_inst(code, "%smovd eax, xmm%zu", avx ? "v" : "", i);
+        // Subtracting reductions already accumulated the negated lanes
+        emit_inst(code, "add DWORD[rbp-%zu], eax", get_var_stack_offset(vvar->var));
+    }
+    if(avx) emit_inst(code, "vzeroupper");
+
+    // Per induction variable: the lane offsets followed by the per-iteration step, both 32 bytes wide.
+    // The remaining iterations run through the scalar loop the caller emits right after this.
+    size_t skip = fn->labels_count++;
+    emit_inst(code, "jmp .L%zu", skip);
+    emit_directive(code, "align 32");
+    emit_label(code, ".L%zu", constants);
+    for(size_t i = 0; i < loop->vars_count; ++i) {
+        int64_t step = loop->vars[i].kind == VECTOR_VAR_INDUCTION ? loop->vars[i].step : 0;
+        emit_directive(code, "dd %ld, %ld, %ld, %ld, %ld, %ld, %ld, %ld", 0*step, 1*step, 2*step, 3*step, 4*step, 5*step, 6*step, 7*step);
+        int64_t stride = step * (int64_t)lanes;
+        emit_directive(code, "dd %ld, %ld, %ld, %ld, %ld, %ld, %ld, %ld", stride, stride, stride, stride, stride, stride, stride, stride);
+    }
+    emit_label(code, ".L%zu", skip);
+}
+
+// A call whose result is returned right away, the callee can return straight to our caller
+static bool is_tail_call(Evaluated_Module *module, Evaluated_Fn *fn, const Expr *value)
+{
+    if(value->type != EXPR_FUNCALL) return false;
+    const Func_Def *callee = find_func_def(module, value->as.func_call.name);
+    if(callee == NULL) return false;
+    if(compare_data_type(&callee->return_type, &fn->def.return_type) != DATA_TYPE_CMP_EQUAL) return false;
+    if(callee == &fn->def || sv_eq(callee->name, fn->def.name)) return true;
+    // Stack arguments of a sibling call would have to overwrite our own incoming arguments
+    size_t max_integers, max_vectors;
+    get_arg_registers_count(callee, &max_integers, &max_vectors);
+    size_t integers = 0, vectors = 0;
+    for(size_t i = 0; i < callee->params.count; ++i) {
+        if(is_vector_data_type(&callee->params.data[i].type)) vectors += 1;
+        else integers += 1;
+    }
+    return integers <= max_integers && vectors <= max_vectors;
+}
+
+static void compile_tail_call(Evaluated_Module *module, X86_64_Code *code, Evaluated_Fn *fn, Scope *scope,
+        const Compile_Options *options, const Expr *call)
+{
+    if(sv_eq(call->as.func_call.name, fn->def.name)) {
+        // Self recursion becomes a loop, the new arguments overwrite the parameters in place
+        for(size_t i = 0; i < call->as.func_call.args.count; ++i) {
+            compile_expr_into_x86_64_nasm(module, code, scope, options, call->as.func_call.args.data[i]);
+            compile_push_value(code, options, &fn->def.params.data[i].type);
+        }
+        for(size_t i = call->as.func_call.args.count; i > 0; --i) {
+            const Evaluated_Var *param = get_var_from_scope(scope, fn->def.params.data[i - 1].name);
+            if(is_vector_data_type(&param->type)) {
+                compile_pop_value(code, options, &param->type, 0);
+            } else {
+                emit_inst(code, "pop rax");
+            }
+            compile_store_var(code, options, param);
+        }
+        emit_inst(code, "jmp .body");
+        return;
+    }
+
+    // Sibling call, our frame is torn down and the callee reuses our return address. Arguments
+    // only live in registers so every callee is compatible regardless of its parameters
+    compile_call_args(module, code, scope, options, call, false);
+    if(options->target_features >= TARGET_FEATURES_AVX2) {
+        emit_inst(code, "vzeroupper");
+    }
+    emit_inst(code, "mov rsp, rbp");
+    emit_inst(code, "pop rbp");
+    emit_inst(code, "jmp "SV_FMT, SV_ARGV(call->as.func_call.name));
+}
+
+// The switch value stays in eax (rax) while the ranges are searched, a handful of ranges at the
+// leaves are tested one after another before giving up to the default
+static void compile_switch_search(X86_64_Code *code, const Switch_Lowering *lowering, size_t begin, size_t end,
+        const size_t *cases, size_t _default, bool wide, bool is_signed)
+{
+    const char *a = wide ? "rax" : "eax";
+    const char *c = wide ? "rcx" : "ecx";
+    if(end - begin <= ELYSIA_SWITCH_LINEAR_RANGES) {
+        for(size_t i = begin; i < end; ++i) {
+            const Switch_Range *range = &lowering->ranges[i];
+            if(range->low == range->high) {
+                emit_inst(code, "cmp %s, %ld", a, range->low);
+                emit_inst(code, "je .L%zu", cases[range->target]);
+            } else if(range->low == 0) {
+                emit_inst(code, "cmp %s, %ld", a, range->high);
+                emit_inst(code, "jbe .L%zu", cases[range->target]);
+            } else {
+                // A single unsigned comparison checks both bounds of the range
+                emit_inst(code, "mov %s, %s", c, a);
+                emit_inst(code, "sub %s, %ld", c, range->low);
+                emit_inst(code, "cmp %s, %ld", c, range->high - range->low);
+                emit_inst(code, "jbe .L%zu", cases[range->target]);
+            }
+        }
+        emit_inst(code, "jmp .L%zu", _default);
+        return;
+    }
+
+    size_t mid = begin + (end - begin)/2;
+    size_t left = (*code->labels_count)++;
+    emit_inst(code, "cmp %s, %ld", a, lowering->ranges[mid].low);
+    emit_inst(code, "%s .L%zu", is_signed ? "jl" : "jb", left);
+    compile_switch_search(code, lowering, mid, end, cases, _default, wide, is_signed);
+    emit_label(code, ".L%zu", left);
+    compile_switch_search(code, lowering, begin, mid, cases, _default, wide, is_signed);
+}
+
+// Dense switches index a table of 32-bit offsets relative to the table itself with
+// `value - lowest`, a single unsigned comparison sends everything out of the table to the default
+static void compile_switch_jump_table(X86_64_Code *code, const Switch_Lowering *lowering, const size_t *cases,
+        size_t _default, bool wide)
+{
+    const char *c = wide ? "rcx" : "ecx";
+    int64_t lowest = lowering->ranges[0].low;
+    int64_t entries = lowering->ranges[lowering->count - 1].high - lowest + 1;
+    size_t table = (*code->labels_count)++;
+    emit_inst(code, "mov %s, %s", c, wide ? "rax" : "eax");
+    if(lowest != 0) {
+        emit_inst(code, "sub %s, %ld", c, lowest);
+    }
+    emit_inst(code, "cmp %s, %ld", c, entries - 1);
+    emit_inst(code, "ja .L%zu", _default);
+    emit_inst(code, "lea rdx, [rel .L%zu]", table);
+    emit_inst(code, "movsxd rcx, DWORD[rdx+rcx*4]");
+    emit_inst(code, "add rcx, rdx");
+    emit_inst(code, "jmp rcx");
+    emit_directive(code, "align 4");
+    emit_label(code, ".L%zu", table);
+    size_t range = 0;
+    for(int64_t value = lowest; value < lowest + entries; ++value) {
+        if(value > lowering->ranges[range].high) range += 1;
+        size_t target = value < lowering->ranges[range].low ? _default : cases[lowering->ranges[range].target];
+        emit_directive(code, "dd .L%zu - .L%zu", target, table);
+    }
+}
+
+static void compile_stmt_into_x86_64_nasm(Evaluated_Module *module, X86_64_Code *code, Evaluated_Fn *fn, Scope *scope,
+        const Compile_Options *options, const Stmt stmt)
 {
     switch(stmt.type) {
         case STMT_VAR_DEF:
             {
-                Data_Type data_type = stmt.as.var_def.type;
-                emplace_var_to_scope(scope, stmt.as.var_def.name, data_type, scope->stack_usage);
-                scope->stack_usage += get_data_type_size(&data_type);
             } break;
         case STMT_VAR_INIT:
             {
-                size_t addr = scope->stack_usage;
-                Data_Type variable_type = eval_expr(scope, &stmt.as.var_init.value);
-                if(!stmt.as.var_init.infer_type) {
-                    if(compare_data_type(&variable_type, &stmt.as.var_init.type) != DATA_TYPE_CMP_EQUAL) {
-                        compilation_type_error(stmt.loc, &variable_type, &stmt.as.var_init.type, 
-                                " while assigning value to variable "SV_FMT, SV_ARGV(stmt.as.var_init.name));
-                    }
+                compile_expr_into_x86_64_nasm(module, code, scope, options, stmt.as.var_init.value);
+                compile_store_var(code, options, get_var_from_scope(scope, stmt.as.var_init.name));
+            } break;
+        case STMT_VAR_ASSIGN:
+            {
+                compile_expr_into_x86_64_nasm(module, code, scope, options, stmt.as.var_assign.value);
+                compile_store_var(code, options, get_var_from_scope(scope, stmt.as.var_assign.name));
+            } break;
+        case STMT_RETURN:
+            {
+                if(options->tail_calls && is_tail_call(module, fn, &stmt.as._return.value)) {
+                    compile_tail_call(module, code, fn, scope, options, &stmt.as._return.value);
+                    break;
+                }
+                compile_expr_into_x86_64_nasm(module, code, scope, options, stmt.as._return.value);
+                emit_inst(code, "jmp .return");
+            } break;
+        case STMT_WHILE:
+            {
+                // Whole vector iterations go first, whatever is left is handled by the scalar loop
+                Vector_Loop vector_loop = {0};
+                if(match_vector_loop(scope, &stmt.as._while, options->target_features, &vector_loop)) {
+                    compile_vector_loop(code, fn, &vector_loop, scope, options->target_features);
                 }
-                size_t variable_size = 0;
-                variable_size = get_data_type_size(&variable_type);
-                scope->stack_usage += variable_size;
-                printf("Variable "SV_FMT" with %s type "SV_FMT" with size %zu\n", 
-                        SV_ARGV(stmt.as.var_init.name), variable_type.is_native ? "native" : "non-native", 
-                        SV_ARGV(variable_type.name), variable_size);
-                emplace_var_to_scope(scope, stmt.as.var_init.name, variable_type, addr);
 
-                compile_expr_into_x86_64_nasm(module, f, scope, stmt.as.var_init.value);
-                fprintf(f, "    mov DWORD[rbp-%zu], eax\n", addr);
+                // Rotated into a guarded do-while loop so every iteration takes a single conditional jump
+                size_t body = fn->labels_count++;
+                size_t end = fn->labels_count++;
+                compile_cond_into_x86_64_nasm(module, code, scope, options, &stmt.as._while.condition, false, end);
+                emit_label(code, ".L%zu", body);
+                for(size_t i = 0; i < stmt.as._while.todo.count; ++i)
+                    compile_stmt_into_x86_64_nasm(module, code, fn, scope, options, stmt.as._while.todo.data[i]);
+                compile_cond_into_x86_64_nasm(module, code, scope, options, &stmt.as._while.condition, true, body);
+                emit_label(code, ".L%zu", end);
             } break;
-        case STMT_VAR_ASSIGN:
+        case STMT_IF:
             {
-                const Evaluated_Var *var = get_var_from_scope(scope, stmt.as.var_assign.name);
-                Data_Type variable_type = eval_expr(scope, &stmt.as.var_assign.value);
-                if(compare_data_type(&variable_type, &stmt.as.var_init.type) != DATA_TYPE_CMP_EQUAL) {
-                    compilation_type_error(stmt.loc, &variable_type, &var->type, " while assigning value to variable "SV_FMT, 
-                            SV_ARGV(stmt.as.var_assign.name));
+                size_t end = fn->labels_count++;
+                for(const Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif) {
+                    size_t next = fn->labels_count++;
+                    compile_cond_into_x86_64_nasm(module, code, scope, options, &branch->condition, false, next);
+                    for(size_t i = 0; i < branch->todo.count; ++i)
+                        compile_stmt_into_x86_64_nasm(module, code, fn, scope, options, branch->todo.data[i]);
+                    if(branch->elif != NULL || stmt.as._if._else.count > 0) {
+                        emit_inst(code, "jmp .L%zu", end);
+                    }
+                    emit_label(code, ".L%zu", next);
                 }
-                compile_expr_into_x86_64_nasm(module, f, scope, stmt.as.var_assign.value);
-                fprintf(f, "    mov DWORD[rbp-%zu], eax\n", var->address);
+                for(size_t i = 0; i < stmt.as._if._else.count; ++i)
+                    compile_stmt_into_x86_64_nasm(module, code, fn, scope, options, stmt.as._if._else.data[i]);
+                emit_label(code, ".L%zu", end);
             } break;
-        case STMT_RETURN:
+        case STMT_EXPR:
             {
-                // Nothing will be handled by compile_func_def_into_x86_64_nasm
+                compile_expr_into_x86_64_nasm(module, code, scope, options, stmt.as.expr);
+            } break;
+        case STMT_SWITCH:
+            {
+                const Stmt_Switch *_switch = &stmt.as._switch;
+                Data_Type type = eval_expr(module, scope, &_switch->value);
+                bool wide = get_data_type_size(&type) == 8;
+                Switch_Lowering lowering;
+                lower_switch(_switch, &lowering);
+
+                size_t cases[ELYSIA_SWITCH_RANGES_CAPACITY];
+                for(size_t i = 0; i < _switch->cases.count; ++i) cases[i] = fn->labels_count++;
+                size_t _default = fn->labels_count++;
+                size_t end = fn->labels_count++;
+                compile_expr_into_x86_64_nasm(module, code, scope, options, _switch->value);
+                if(lowering.use_jump_table) {
+                    compile_switch_jump_table(code, &lowering, cases, _default, wide);
+                } else {
+                    compile_switch_search(code, &lowering, 0, lowering.count, cases, _default, wide,
+                            is_signed_native_type(type.as.native));
+                }
+
+                // The default comes first so the search can fall through into it
+                emit_label(code, ".L%zu", _default);
+                for(size_t i = 0; i < _switch->_default.count; ++i)
+                    compile_stmt_into_x86_64_nasm(module, code, fn, scope, options, _switch->_default.data[i]);
+                for(size_t i = 0; i < _switch->cases.count; ++i) {
+                    emit_inst(code, "jmp .L%zu", end);
+                    emit_label(code, ".L%zu", cases[i]);
+                    for(size_t j = 0; j < _switch->cases.data[i].todo.count; ++j)
+                        compile_stmt_into_x86_64_nasm(module, code, fn, scope, options, _switch->cases.data[i].todo.data[j]);
+                }
+                emit_label(code, ".L%zu", end);
             } break;
         default:
             {
@@ -98,40 +1581,428 @@ static void compile_stmt_into_x86_64_nasm(Evaluated_Module *module, FILE *f, Sco
     }
 }
 
-static void compile_func_def_into_x86_64_nasm(Evaluated_Module *module, FILE *f, Evaluated_Fn *fn)
+typedef struct {
+    size_t start, end;
+    bool seen;
+} X86_64_Lifetime;
+
+// Live ranges of the variables of a function in statement positions, indexed like the scope
+typedef struct {
+    const Scope *scope;
+    X86_64_Lifetime vars[ELYSIA_SCOPE_VARS_CAPACITY];
+    size_t position;
+} X86_64_Lifetimes;
+
+static X86_64_Lifetime *touch_var(X86_64_Lifetimes *lifetimes, String_View name)
+{
+    const Evaluated_Var *var = get_var_from_scope(lifetimes->scope, name);
+    if(var == NULL) return NULL;
+    X86_64_Lifetime *lifetime = &lifetimes->vars[var - lifetimes->scope->vars.data];
+    if(!lifetime->seen) {
+        lifetime->seen = true;
+        lifetime->start = lifetimes->position;
+    }
+    lifetime->end = lifetimes->position;
+    return lifetime;
+}
+
+static void collect_expr_lifetimes(X86_64_Lifetimes *lifetimes, const Expr *expr)
 {
-    fprintf(f, SV_FMT":\n", SV_ARGV(fn->def.name));
-    fprintf(f, "    push rbp\n");
-    fprintf(f, "    mov rbp, rsp\n");
-    fn->scope.stack_usage += 8;
-    for(size_t i = 0; i < fn->def.body.count; ++i) {
-        Stmt stmt = fn->def.body.data[i];
-        compile_stmt_into_x86_64_nasm(module, f, &fn->scope, stmt);
-        if(fn->def.body.data[i].type == STMT_RETURN) {
-            Data_Type return_type = eval_expr(&fn->scope, &stmt.as._return.value);
-            Data_Type_Cmp_Result comparison = compare_data_type(&return_type, &fn->def.return_type);
-            if(comparison != DATA_TYPE_CMP_EQUAL) {
-                compilation_type_error(stmt.loc, &return_type, &fn->def.return_type, 
-                        " Function "SV_FMT" expecting return type of `", SV_ARGV(fn->def.name));
-            }
-            compile_expr_into_x86_64_nasm(module, f, &fn->scope, stmt.as._return.value);
+    switch(expr->type) {
+        case EXPR_VAR_READ: touch_var(lifetimes, expr->as.var_read.name); break;
+        case EXPR_BINARY_OP:
+            {
+                collect_expr_lifetimes(lifetimes, &expr->as.binop->left);
+                collect_expr_lifetimes(lifetimes, &expr->as.binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    collect_expr_lifetimes(lifetimes, &expr->as.func_call.args.data[i]);
+            } break;
+        default:
             break;
+    }
+}
+
+static void collect_block_lifetimes(X86_64_Lifetimes *lifetimes, const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        lifetimes->position += 1;
+        switch(stmt->type) {
+            case STMT_RETURN: collect_expr_lifetimes(lifetimes, &stmt->as._return.value); break;
+            case STMT_EXPR: collect_expr_lifetimes(lifetimes, &stmt->as.expr); break;
+            case STMT_VAR_DEF: touch_var(lifetimes, stmt->as.var_def.name); break;
+            case STMT_VAR_INIT:
+                {
+                    collect_expr_lifetimes(lifetimes, &stmt->as.var_init.value);
+                    touch_var(lifetimes, stmt->as.var_init.name);
+                } break;
+            case STMT_VAR_ASSIGN:
+                {
+                    collect_expr_lifetimes(lifetimes, &stmt->as.var_assign.value);
+                    touch_var(lifetimes, stmt->as.var_assign.name);
+                } break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        collect_expr_lifetimes(lifetimes, &branch->condition);
+                        collect_block_lifetimes(lifetimes, &branch->todo);
+                    }
+                    collect_block_lifetimes(lifetimes, &stmt->as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    collect_expr_lifetimes(lifetimes, &stmt->as._switch.value);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        collect_block_lifetimes(lifetimes, &stmt->as._switch.cases.data[j].todo);
+                    collect_block_lifetimes(lifetimes, &stmt->as._switch._default);
+                } break;
+            case STMT_WHILE:
+                {
+                    size_t begin = lifetimes->position;
+                    collect_expr_lifetimes(lifetimes, &stmt->as._while.condition);
+                    collect_block_lifetimes(lifetimes, &stmt->as._while.todo);
+                    // The back edge re-evaluates the condition
+                    size_t end = ++lifetimes->position;
+                    // Anything touched by the loop stays live for every iteration, a variable first
+                    // written inside the body may still be read by a later iteration before the next
+                    // write (e.g. written in one arm of an if and read in the other)
+                    for(size_t j = 0; j < lifetimes->scope->vars.count; ++j) {
+                        X86_64_Lifetime *lifetime = &lifetimes->vars[j];
+                        if(!lifetime->seen || lifetime->end < begin) continue;
+                        if(lifetime->start > begin) lifetime->start = begin;
+                        if(lifetime->end < end) lifetime->end = end;
+                    }
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+typedef struct {
+    size_t index;
+    size_t start, end;
+    size_t size;
+} X86_64_Slot_Request;
+
+typedef struct {
+    size_t offset;
+    size_t size;
+    // Position of the last statement using the variable currently in this slot
+    size_t busy_until;
+} X86_64_Stack_Slot;
+
+static int compare_slot_requests(const void *a, const void *b)
+{
+    const X86_64_Slot_Request *x = a;
+    const X86_64_Slot_Request *y = b;
+    if(x->start != y->start) return x->start < y->start ? -1 : 1;
+    if(x->index != y->index) return x->index < y->index ? -1 : 1;
+    return 0;
+}
+
+// Reassigns the address of every variable so variables whose live ranges don't overlap share a
+// slot. Every slot is aligned to its size so `[rbp-offset]` is naturally aligned for the access
+static void layout_x86_64_frame(Evaluated_Fn *fn, const Compile_Options *options)
+{
+    Scope *scope = &fn->scope;
+    X86_64_Lifetimes *lifetimes = calloc(1, sizeof(X86_64_Lifetimes));
+    assert(lifetimes && "buy more ram lol!");
+    lifetimes->scope = scope;
+    // Self tail calls overwrite the parameters at the very end so they are never given up
+    for(size_t i = 0; i < fn->def.params.count; ++i) {
+        X86_64_Lifetime *lifetime = touch_var(lifetimes, fn->def.params.data[i].name);
+        if(lifetime) lifetime->end = SIZE_MAX;
+    }
+    collect_block_lifetimes(lifetimes, &fn->def.body);
+
+    X86_64_Slot_Request *requests = calloc(scope->vars.count + 1, sizeof(X86_64_Slot_Request));
+    X86_64_Stack_Slot *slots = calloc(scope->vars.count + 1, sizeof(X86_64_Stack_Slot));
+    assert(requests && slots && "buy more ram lol!");
+    size_t requests_count = 0;
+    for(size_t i = 0; i < scope->vars.count; ++i) {
+        const X86_64_Lifetime *lifetime = &lifetimes->vars[i];
+        Data_Type type = scope->vars.data[i].type;
+        // Shadowed by an earlier variable of the same name, nothing ever addresses it
+        scope->vars.data[i].address = 0;
+        if(!lifetime->seen) continue;
+        X86_64_Slot_Request *request = &requests[requests_count++];
+        request->index = i;
+        request->start = options->color_stack_slots ? lifetime->start : 0;
+        request->end = options->color_stack_slots ? lifetime->end : SIZE_MAX;
+        request->size = get_data_type_size(&type);
+    }
+    qsort(requests, requests_count, sizeof(requests[0]), compare_slot_requests);
+
+    size_t frame = 0;
+    size_t slots_count = 0;
+    for(size_t i = 0; i < requests_count; ++i) {
+        const X86_64_Slot_Request *request = &requests[i];
+        X86_64_Stack_Slot *slot = NULL;
+        // The tightest free slot, a smaller variable reuses the lower bytes of a bigger one
+        for(size_t j = 0; j < slots_count; ++j) {
+            X86_64_Stack_Slot *candidate = &slots[j];
+            if(candidate->busy_until >= request->start || candidate->size < request->size) continue;
+            if(slot == NULL || candidate->size < slot->size) slot = candidate;
+        }
+        if(slot == NULL) {
+            size_t alignment = 1;
+            while(alignment < request->size && alignment < X86_64_MAX_SLOT_ALIGNMENT) alignment *= 2;
+            slot = &slots[slots_count++];
+            slot->size = request->size;
+            slot->offset = (frame + request->size + alignment - 1) & ~(alignment - 1);
+            frame = slot->offset;
+        }
+        slot->busy_until = request->end;
+        scope->vars.data[request->index].address = slot->offset - request->size;
+    }
+    scope->stack_usage = frame;
+
+    free(slots);
+    free(requests);
+    free(lifetimes);
+}
+
+// `[rbp-8]` becomes `[rsp-16]`, rsp stays where the caller left it since rbp is never pushed
+static void rebase_frame_operand(char *operand, size_t size)
+{
+    char *base = strstr(operand, "[rbp");
+    if(base == NULL) return;
+    long displacement = strtol(base + 4, NULL, 10) - 8;
+    char prefix[X86_64_INST_TEXT_CAPACITY];
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)(base - operand), operand);
+    snprintf(operand, size, "%s[rsp%+ld]", prefix, displacement);
+}
+
+// Leaf functions that never move rsp after the prologue keep their frame in the red zone
+// instead of reserving it. Internal ones go further and drop the frame pointer, addressing
+// their frame relative to rsp
+static void finish_x86_64_frame(X86_64_Code *code, size_t frame_size, bool omit_frame_pointer)
+{
+    if(frame_size > X86_64_RED_ZONE_SIZE) return;
+    X86_64_Inst *reserve = NULL;
+    for(size_t i = 0; i < code->count; ++i) {
+        X86_64_Inst *inst = &code->data[i];
+        if(inst->kind != X86_64_INST_OP) continue;
+        if(reserve == NULL && inst_is(inst, "sub") && strcmp(inst->operands[0], "rsp") == 0) {
+            reserve = inst;
+            continue;
+        }
+        // Setting up and tearing down the frame
+        if(inst_is(inst, "push") && strcmp(inst->operands[0], "rbp") == 0) continue;
+        if(inst_is(inst, "pop") && strcmp(inst->operands[0], "rbp") == 0) continue;
+        if(inst_is(inst, "mov") && strcmp(inst->operands[0], "rbp") == 0 && strcmp(inst->operands[1], "rsp") == 0) continue;
+        if(inst_is(inst, "mov") && strcmp(inst->operands[0], "rsp") == 0 && strcmp(inst->operands[1], "rbp") == 0) continue;
+
+        if(inst_is(inst, "call") || inst_is(inst, "push") || inst_is(inst, "pop")) return;
+        for(size_t j = 0; j < inst->operands_count; ++j) {
+            if(strstr(inst->operands[j], "rsp")) return;
+        }
+    }
+    if(reserve) reserve->kind = X86_64_INST_NOP;
+
+    // Without the pushed rbp the frame sits 8 bytes deeper into the red zone
+    if(!omit_frame_pointer || frame_size + 8 > X86_64_RED_ZONE_SIZE) return;
+    for(size_t i = 0; i < code->count; ++i) {
+        X86_64_Inst *inst = &code->data[i];
+        if(inst->kind != X86_64_INST_OP) continue;
+        bool frame_setup = (inst_is(inst, "push") || inst_is(inst, "pop")) && strcmp(inst->operands[0], "rbp") == 0;
+        if(inst_is(inst, "mov") && (strcmp(inst->operands[0], "rbp") == 0 || strcmp(inst->operands[0], "rsp") == 0)
+                && (strcmp(inst->operands[1], "rbp") == 0 || strcmp(inst->operands[1], "rsp") == 0)) {
+            frame_setup = true;
+        }
+        if(frame_setup) {
+            inst->kind = X86_64_INST_NOP;
+            continue;
+        }
+        for(size_t j = 0; j < inst->operands_count; ++j)
+            rebase_frame_operand(inst->operands[j], sizeof(inst->operands[j]));
+    }
+}
+
+static void compile_func_def_into_x86_64_code(Evaluated_Module *module, Arena *arena, X86_64_Code *code,
+        Evaluated_Fn *fn, const Compile_Options *options)
+{
+    memset(code, 0, sizeof(*code));
+    code->arena = arena;
+    code->labels_count = &fn->labels_count;
+
+    layout_x86_64_frame(fn, options);
+    emit_label(code, SV_FMT, SV_ARGV(fn->def.name));
+    emit_inst(code, "push rbp");
+    emit_inst(code, "mov rbp, rsp");
+    size_t frame_size = (fn->scope.stack_usage + 15) & ~(size_t)15;
+    if(frame_size > 0) {
+        emit_inst(code, "sub rsp, %zu", frame_size);
+    }
+    code->stack_depth = 0;
+    // Every parameter gets copied into its slot, stack arguments start right above the return address
+    X86_64_Arg_Location *locations = arena_alloc(arena, (fn->def.params.count + 1)*sizeof(X86_64_Arg_Location));
+    assert(locations && "buy more ram lol!");
+    classify_x86_64_params(fn->def.loc, &fn->def, locations);
+    for(size_t i = 0; i < fn->def.params.count; ++i) {
+        const Evaluated_Var *param = get_var_from_scope(&fn->scope, fn->def.params.data[i].name);
+        Data_Type type = param->type;
+        size_t size = get_data_type_size(&type);
+        if(locations[i].is_vector) {
+            Native_Type_Info info = get_native_type_info(type.as.native);
+            const char *mov = uses_avx(options) ? "vmovdqu" : "movdqu";
+            if(locations[i].on_stack) {
+                emit_inst(code, "%s xmm0, [rbp+%zu]", mov, 16 + locations[i].index);
+                emit_inst(code, "%s [rbp-%zu], xmm0", mov, get_var_stack_offset(param));
+            } else {
+                emit_inst(code, "%s [rbp-%zu], %s%zu", mov, get_var_stack_offset(param), get_vector_register(info), locations[i].index);
+            }
+        } else if(locations[i].on_stack) {
+            emit_inst(code, "mov %s, %s[rbp+%zu]", get_scalar_register(size), get_memory_size_prefix(size), 16 + locations[i].index);
+            emit_inst(code, "mov %s[rbp-%zu], %s", get_memory_size_prefix(size), get_var_stack_offset(param), get_scalar_register(size));
+        } else {
+            emit_inst(code, "mov %s[rbp-%zu], %s", get_memory_size_prefix(size), get_var_stack_offset(param),
+                    get_arg_register(locations[i].index, size));
         }
     }
-    fprintf(f, "    pop rbp\n");
-    fprintf(f, "    ret\n");
+    // Self tail calls jump back here once they have replaced the parameters
+    emit_label(code, ".body");
+    for(size_t i = 0; i < fn->def.body.count; ++i) {
+        compile_stmt_into_x86_64_nasm(module, code, fn, &fn->scope, options, fn->def.body.data[i]);
+    }
+    emit_label(code, ".return");
+    // Dirty upper halves of the ymm registers would make any SSE code in the caller pay for a transition
+    if(options->target_features >= TARGET_FEATURES_AVX2) {
+        emit_inst(code, "vzeroupper");
+    }
+    emit_inst(code, "mov rsp, rbp");
+    emit_inst(code, "pop rbp");
+    emit_inst(code, "ret");
+
+    if(options->peephole) {
+        optimize_x86_64_code(code);
+    }
+    finish_x86_64_frame(code, frame_size, uses_internal_convention(&fn->def));
+}
+
+static bool is_exported(const Func_Def *fdef)
+{
+    return fdef->is_pub || sv_eq(fdef->name, SV("main"));
 }
 
-void compile_module_to_file(const char *file_path, Evaluated_Module *module)
+// The instructions are encoded right away, no assembler is involved
+static void compile_module_to_object(X86_64_Object *object, Evaluated_Module *module, const Compile_Options *options)
 {
-    FILE *f = fopen(file_path, "w");
-    if(!f) {
-        fatal("Failed to open file file %s", file_path);
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        Evaluated_Fn *fn = &module->functions.data[i];
+        Arena code_arena = {0};
+        X86_64_Code code;
+        compile_func_def_into_x86_64_code(module, &code_arena, &code, fn, options);
+        encode_x86_64_function(object, fn->def.name, is_exported(&fn->def), &code);
+        arena_free(&code_arena);
     }
+}
 
-    fprintf(f, "section .text\n");
-    fprintf(f, "global main\n");
+void compile_module_to_file(const char *file_path, Evaluated_Module *module, const Compile_Options *options)
+{
+    if(options->output_kind == OUTPUT_KIND_OBJ || options->output_kind == OUTPUT_KIND_EXE) {
+        Arena arena = {0};
+        X86_64_Object objects[2] = {0};
+        objects[0].arena = &arena;
+        objects[1].arena = &arena;
+        compile_module_to_object(&objects[0], module, options);
+        if(options->output_kind == OUTPUT_KIND_OBJ) {
+            write_elf64_object(file_path, &objects[0]);
+        } else {
+            add_x86_64_runtime(&objects[1]);
+            link_x86_64_executable(file_path, objects, 2, X86_64_ENTRY_SYMBOL);
+        }
+        arena_free(&arena);
+        return;
+    }
+    Arena arena = {0};
+    Emitter e = { .arena = &arena };
+    emit_literal(&e, "section .text\n");
     for(uint32_t i = 0; i < module->functions.count; ++i) {
-        compile_func_def_into_x86_64_nasm(module, f, &module->functions.data[i]);
+        const Func_Def *fdef = &module->functions.data[i].def;
+        if(is_exported(fdef)) {
+            emit_literal(&e, "global ");
+            emit_sv(&e, fdef->name);
+            emit_char(&e, '\n');
+        }
+    }
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        Evaluated_Fn *fn = &module->functions.data[i];
+        Arena code_arena = {0};
+        X86_64_Code code;
+        compile_func_def_into_x86_64_code(module, &code_arena, &code, fn, options);
+        render_x86_64_code(&e, &code);
+        arena_free(&code_arena);
+    }
+    write_emitter_to_file(&e, file_path);
+    arena_free(&arena);
+}
+
+typedef struct {
+    Evaluated_Module *module;
+    const Compile_Options *options;
+} X86_64_Jit_Context;
+
+static void compile_jit_function(void *context, size_t index, X86_64_Object *object)
+{
+    X86_64_Jit_Context *jit_context = context;
+    Evaluated_Fn *fn = &jit_context->module->functions.data[index];
+    Arena code_arena = {0};
+    X86_64_Code code;
+    compile_func_def_into_x86_64_code(jit_context->module, &code_arena, &code, fn, jit_context->options);
+    encode_x86_64_function(object, fn->def.name, is_exported(&fn->def), &code);
+    arena_free(&code_arena);
+}
+
+int run_module(Evaluated_Module *module, const Compile_Options *options, int argc, char **argv)
+{
+    Arena arena = {0};
+    const char **names = arena_alloc(&arena, (module->functions.count + 1)*sizeof(const char *));
+    assert(names && "buy more ram lol!");
+    for(uint32_t i = 0; i < module->functions.count; ++i) {
+        String_View name = module->functions.data[i].def.name;
+        char *data = arena_alloc(&arena, name.count + 1);
+        assert(data && "buy more ram lol!");
+        memcpy(data, name.data, name.count);
+        data[name.count] = '\0';
+        names[i] = data;
+    }
+
+    // The runtime functions are served by the C library of the compiler itself
+    X86_64_Host_Symbol host_symbols[] = {
+        { "write", (void (*)(void))write },
+        { "exit", (void (*)(void))exit },
+    };
+    // Functions are only compiled once they get called
+    X86_64_Jit_Context context = { .module = module, .options = options };
+    X86_64_Jit_Program program = {
+        .names = names,
+        .functions_count = module->functions.count,
+        .compile = compile_jit_function,
+        .context = &context,
+        .host_symbols = host_symbols,
+        .host_symbols_count = sizeof(host_symbols)/sizeof(host_symbols[0]),
+        .preserve_ymm = uses_avx(options),
+    };
+    X86_64_Jit jit;
+    load_x86_64_jit(&jit, &arena, &program);
+    void *address = find_x86_64_jit_function(&jit, "main");
+    if(address == NULL) {
+        fatal("The program has no `main` function");
+    }
+    int (*entry)(int, char **);
+    memcpy(&entry, &address, sizeof(entry));
+    int result = entry(argc, argv);
+
+    if(options->report_jit) {
+        fprintf(stderr, "Compiled %zu of %zu functions, %zu never called\n", jit.compiled_count,
+                program.functions_count, program.functions_count - jit.compiled_count);
     }
+    unload_x86_64_jit(&jit);
+    arena_free(&arena);
+    return result;
 }
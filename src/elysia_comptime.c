@@ -0,0 +1,330 @@
+#include "elysia.h"
+#include "elysia_ast.h"
+#include "elysia_optimizer.h"
+#include "elysia_types.h"
+#include <stdint.h>
+
+typedef enum {
+    COMPTIME_NEXT = 0,
+    COMPTIME_RETURNED,
+    COMPTIME_FAILED,
+} Comptime_Flow;
+
+static bool comptime_eval_expr(Comptime *ct, const Expr *expr, Comptime_Value *result);
+static Comptime_Flow comptime_exec_block(Comptime *ct, const Block *block);
+
+static bool comptime_fail(Comptime *ct, const char *error)
+{
+    ct->error = error;
+    return false;
+}
+
+static bool comptime_step(Comptime *ct)
+{
+    if(++ct->steps > ELYSIA_COMPTIME_MAX_STEPS) return comptime_fail(ct, "it runs for too many steps");
+    return true;
+}
+
+static bool get_comptime_type(const Data_Type *type, Native_Type *result)
+{
+    if(!type->is_native || type->is_ptr || type->is_array) return false;
+    switch(type->as.native) {
+        case NATIVE_TYPE_U8:
+        case NATIVE_TYPE_U16:
+        case NATIVE_TYPE_U32:
+        case NATIVE_TYPE_U64:
+        case NATIVE_TYPE_I8:
+        case NATIVE_TYPE_I16:
+        case NATIVE_TYPE_I32:
+        case NATIVE_TYPE_I64:
+        case NATIVE_TYPE_BOOL:
+        case NATIVE_TYPE_CHAR:
+            {
+                *result = type->as.native;
+                return true;
+            }
+        default: return false;
+    }
+}
+
+// Wraps the bits around the width of the type like the generated code does
+static Comptime_Value make_comptime_value(Native_Type type, uint64_t bits)
+{
+    Comptime_Value result = { .type = type };
+    switch(type) {
+        case NATIVE_TYPE_BOOL: result.value = bits != 0; break;
+        case NATIVE_TYPE_U8: result.value = (uint8_t)bits; break;
+        case NATIVE_TYPE_U16: result.value = (uint16_t)bits; break;
+        case NATIVE_TYPE_U32: result.value = (uint32_t)bits; break;
+        case NATIVE_TYPE_I8:
+        case NATIVE_TYPE_CHAR: result.value = (int8_t)bits; break;
+        case NATIVE_TYPE_I16: result.value = (int16_t)bits; break;
+        case NATIVE_TYPE_I32: result.value = (int32_t)bits; break;
+        default: result.value = (int64_t)bits; break;
+    }
+    return result;
+}
+
+static Comptime_Var *find_comptime_var(Comptime *ct, String_View name)
+{
+    for(size_t i = ct->frame; i < ct->vars_count; ++i) {
+        if(sv_eq(ct->vars[i].name, name)) return &ct->vars[i];
+    }
+    return NULL;
+}
+
+static Comptime_Var *push_comptime_var(Comptime *ct, String_View name)
+{
+    if(ct->vars_count >= ELYSIA_COMPTIME_MAX_VARS) {
+        comptime_fail(ct, "it needs too many variables at once");
+        return NULL;
+    }
+    Comptime_Var *var = &ct->vars[ct->vars_count++];
+    var->name = name;
+    var->is_initialized = false;
+    return var;
+}
+
+// Every declaration of a name in a function refers to the same variable
+static bool comptime_store(Comptime *ct, String_View name, const Data_Type *type, Comptime_Value value)
+{
+    Comptime_Var *var = find_comptime_var(ct, name);
+    Native_Type var_type = value.type;
+    if(var) {
+        var_type = var->value.type;
+    } else {
+        if(type && !get_comptime_type(type, &var_type)) return comptime_fail(ct, "it declares a variable that isn't an integer");
+        var = push_comptime_var(ct, name);
+        if(!var) return false;
+    }
+    var->value = make_comptime_value(var_type, value.value);
+    var->is_initialized = true;
+    return true;
+}
+
+static const Func_Def *find_comptime_func_def(const Module *module, String_View name)
+{
+    for(size_t i = 0; i < module->functions.count; ++i) {
+        if(sv_eq(module->functions.data[i].name, name)) return &module->functions.data[i];
+    }
+    return NULL;
+}
+
+static bool comptime_call(Comptime *ct, const Expr *expr, Comptime_Value *result)
+{
+    const Expr_Func_Call *call = &expr->as.func_call;
+    const Func_Def *fdef = find_comptime_func_def(ct->module, call->name);
+    if(!fdef) return comptime_fail(ct, "it calls a builtin or a function outside of the module");
+    if(fdef->params.count != call->args.count) return comptime_fail(ct, "it calls a function with the wrong arguments");
+    if(ct->depth >= ELYSIA_COMPTIME_MAX_DEPTH) return comptime_fail(ct, "its calls nest too deep");
+
+    // The arguments stay nameless until all of them are evaluated in the frame of the caller
+    size_t frame = ct->vars_count;
+    for(size_t i = 0; i < call->args.count; ++i) {
+        Native_Type type;
+        if(!get_comptime_type(&fdef->params.data[i].type, &type)) return comptime_fail(ct, "it passes something else than an integer");
+        Comptime_Value value;
+        if(!comptime_eval_expr(ct, &call->args.data[i], &value)) return false;
+        Comptime_Var *arg = push_comptime_var(ct, SV(""));
+        if(!arg) return false;
+        arg->value = make_comptime_value(type, value.value);
+        arg->is_initialized = true;
+    }
+    for(size_t i = 0; i < call->args.count; ++i)
+        ct->vars[frame + i].name = fdef->params.data[i].name;
+
+    size_t caller_frame = ct->frame;
+    ct->frame = frame;
+    ct->depth += 1;
+    Comptime_Flow flow = comptime_exec_block(ct, &fdef->body);
+    ct->depth -= 1;
+    ct->frame = caller_frame;
+    ct->vars_count = frame;
+    if(flow == COMPTIME_FAILED) return false;
+
+    Native_Type return_type;
+    if(fdef->return_type.is_native && fdef->return_type.as.native == NATIVE_TYPE_VOID) {
+        result->type = NATIVE_TYPE_VOID;
+        result->value = 0;
+        return true;
+    }
+    if(!get_comptime_type(&fdef->return_type, &return_type)) return comptime_fail(ct, "it returns something else than an integer");
+    if(flow != COMPTIME_RETURNED) return comptime_fail(ct, "it reaches the end of a function without returning");
+    *result = make_comptime_value(return_type, ct->returned.value);
+    return true;
+}
+
+static bool comptime_eval_binop(Comptime *ct, const Expr_Binary_Op *binop, Comptime_Value *result)
+{
+    Comptime_Value left, right;
+    if(!comptime_eval_expr(ct, &binop->left, &left)) return false;
+    if(binop->type == BINARY_OP_AND || binop->type == BINARY_OP_OR) {
+        // The right operand is only evaluated when the left one doesn't decide the result
+        if((binop->type == BINARY_OP_AND) != (left.value != 0)) {
+            *result = make_comptime_value(NATIVE_TYPE_BOOL, left.value);
+            return true;
+        }
+        if(!comptime_eval_expr(ct, &binop->right, &right)) return false;
+        *result = make_comptime_value(NATIVE_TYPE_BOOL, right.value);
+        return true;
+    }
+    if(!comptime_eval_expr(ct, &binop->right, &right)) return false;
+    bool is_arithmetic = binop->type == BINARY_OP_ADD || binop->type == BINARY_OP_SUB || binop->type == BINARY_OP_MUL;
+    if(is_arithmetic && left.type == NATIVE_TYPE_BOOL) return comptime_fail(ct, "it does arithmetic on bools");
+
+    // Values wider than 63 bits only exist unsigned
+    bool is_unsigned = left.type == NATIVE_TYPE_U64 || right.type == NATIVE_TYPE_U64;
+    uint64_t x = left.value, y = right.value;
+    bool less = is_unsigned ? x < y : left.value < right.value;
+    switch(binop->type) {
+        case BINARY_OP_ADD: *result = make_comptime_value(left.type, x + y); break;
+        case BINARY_OP_SUB: *result = make_comptime_value(left.type, x - y); break;
+        case BINARY_OP_MUL: *result = make_comptime_value(left.type, x * y); break;
+        case BINARY_OP_EQ: *result = make_comptime_value(NATIVE_TYPE_BOOL, x == y); break;
+        case BINARY_OP_NE: *result = make_comptime_value(NATIVE_TYPE_BOOL, x != y); break;
+        case BINARY_OP_LT: *result = make_comptime_value(NATIVE_TYPE_BOOL, less); break;
+        case BINARY_OP_LE: *result = make_comptime_value(NATIVE_TYPE_BOOL, less || x == y); break;
+        case BINARY_OP_GT: *result = make_comptime_value(NATIVE_TYPE_BOOL, !less && x != y); break;
+        case BINARY_OP_GE: *result = make_comptime_value(NATIVE_TYPE_BOOL, !less); break;
+        default: return comptime_fail(ct, "it uses an operator the backends don't compile");
+    }
+    return true;
+}
+
+static bool comptime_eval_expr(Comptime *ct, const Expr *expr, Comptime_Value *result)
+{
+    if(!comptime_step(ct)) return false;
+    switch(expr->type) {
+        case EXPR_INTEGER_LITERAL:
+            {
+                // Literals are `i32`, bigger ones are truncated differently by every backend
+                if(expr->as.literal_int < INT32_MIN || expr->as.literal_int > INT32_MAX) {
+                    return comptime_fail(ct, "it uses an integer literal that doesn't fit into `i32`");
+                }
+                *result = make_comptime_value(NATIVE_TYPE_I32, expr->as.literal_int);
+            } break;
+        case EXPR_BOOL_LITERAL:
+            {
+                *result = make_comptime_value(NATIVE_TYPE_BOOL, expr->as.literal_bool);
+            } break;
+        case EXPR_VAR_READ:
+            {
+                const Comptime_Var *var = find_comptime_var(ct, expr->as.var_read.name);
+                if(!var || !var->is_initialized) return comptime_fail(ct, "it reads a variable before writing it");
+                *result = var->value;
+            } break;
+        case EXPR_BINARY_OP:
+            {
+                return comptime_eval_binop(ct, expr->as.binop, result);
+            }
+        case EXPR_FUNCALL:
+            {
+                return comptime_call(ct, expr, result);
+            }
+        default:
+            {
+                return comptime_fail(ct, "it uses something else than integers");
+            }
+    }
+    return true;
+}
+
+static Comptime_Flow comptime_exec_stmt(Comptime *ct, const Stmt *stmt)
+{
+    if(!comptime_step(ct)) return COMPTIME_FAILED;
+    Comptime_Value value;
+    switch(stmt->type) {
+        case STMT_VAR_DEF:
+            {
+                Native_Type type;
+                if(!get_comptime_type(&stmt->as.var_def.type, &type)) {
+                    comptime_fail(ct, "it declares a variable that isn't an integer");
+                    return COMPTIME_FAILED;
+                }
+                if(find_comptime_var(ct, stmt->as.var_def.name)) break;
+                Comptime_Var *var = push_comptime_var(ct, stmt->as.var_def.name);
+                if(!var) return COMPTIME_FAILED;
+                var->value.type = type;
+            } break;
+        case STMT_VAR_INIT:
+            {
+                const Stmt_Var_Init *init = &stmt->as.var_init;
+                if(!comptime_eval_expr(ct, &init->value, &value)) return COMPTIME_FAILED;
+                if(!comptime_store(ct, init->name, init->infer_type ? NULL : &init->type, value)) return COMPTIME_FAILED;
+            } break;
+        case STMT_VAR_ASSIGN:
+            {
+                if(!comptime_eval_expr(ct, &stmt->as.var_assign.value, &value)) return COMPTIME_FAILED;
+                if(!find_comptime_var(ct, stmt->as.var_assign.name)) {
+                    comptime_fail(ct, "it assigns to an unknown variable");
+                    return COMPTIME_FAILED;
+                }
+                if(!comptime_store(ct, stmt->as.var_assign.name, NULL, value)) return COMPTIME_FAILED;
+            } break;
+        case STMT_EXPR:
+            {
+                if(!comptime_eval_expr(ct, &stmt->as.expr, &value)) return COMPTIME_FAILED;
+            } break;
+        case STMT_RETURN:
+            {
+                if(!comptime_eval_expr(ct, &stmt->as._return.value, &ct->returned)) return COMPTIME_FAILED;
+                return COMPTIME_RETURNED;
+            }
+        case STMT_WHILE:
+            {
+                while(true) {
+                    if(!comptime_eval_expr(ct, &stmt->as._while.condition, &value)) return COMPTIME_FAILED;
+                    if(!value.value) break;
+                    Comptime_Flow flow = comptime_exec_block(ct, &stmt->as._while.todo);
+                    if(flow != COMPTIME_NEXT) return flow;
+                }
+            } break;
+        case STMT_IF:
+            {
+                for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                    if(!comptime_eval_expr(ct, &branch->condition, &value)) return COMPTIME_FAILED;
+                    if(value.value) return comptime_exec_block(ct, &branch->todo);
+                }
+                return comptime_exec_block(ct, &stmt->as._if._else);
+            }
+        case STMT_SWITCH:
+            {
+                const Stmt_Switch *_switch = &stmt->as._switch;
+                if(!comptime_eval_expr(ct, &_switch->value, &value)) return COMPTIME_FAILED;
+                for(size_t i = 0; i < _switch->cases.count; ++i) {
+                    const Switch_Case *_case = &_switch->cases.data[i];
+                    for(size_t j = 0; j < _case->ranges.count; ++j) {
+                        if(_case->ranges.data[j].low <= value.value && value.value <= _case->ranges.data[j].high) {
+                            return comptime_exec_block(ct, &_case->todo);
+                        }
+                    }
+                }
+                return comptime_exec_block(ct, &_switch->_default);
+            }
+        default:
+            {
+                comptime_fail(ct, "it runs a statement the interpreter doesn't know");
+                return COMPTIME_FAILED;
+            }
+    }
+    return COMPTIME_NEXT;
+}
+
+static Comptime_Flow comptime_exec_block(Comptime *ct, const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        Comptime_Flow flow = comptime_exec_stmt(ct, &block->data[i]);
+        if(flow != COMPTIME_NEXT) return flow;
+    }
+    return COMPTIME_NEXT;
+}
+
+bool comptime_eval_call(Comptime *ct, const Expr *call, Comptime_Value *result)
+{
+    ct->vars_count = 0;
+    ct->frame = 0;
+    ct->steps = 0;
+    ct->depth = 0;
+    ct->error = NULL;
+    return comptime_call(ct, call, result);
+}
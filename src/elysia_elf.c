@@ -0,0 +1,227 @@
+#include "elysia.h"
+#include "elysia_x86_64.h"
+#include <assert.h>
+#include <elf.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    Arena *arena;
+    uint8_t *data;
+    size_t count, capacity;
+} Elf_Buffer;
+
+static size_t push_elf_bytes(Elf_Buffer *buffer, const void *data, size_t size)
+{
+    if(buffer->count + size > buffer->capacity) {
+        size_t new_capacity = buffer->capacity == 0 ? 4096 : buffer->capacity * 2;
+        while(new_capacity < buffer->count + size) new_capacity *= 2;
+        void *new_data = arena_alloc(buffer->arena, new_capacity);
+        assert(new_data && "buy more ram lol!");
+        if(buffer->count > 0) memcpy(new_data, buffer->data, buffer->count);
+        buffer->data = new_data;
+        buffer->capacity = new_capacity;
+    }
+    size_t offset = buffer->count;
+    if(data) memcpy(buffer->data + offset, data, size);
+    else memset(buffer->data + offset, 0, size);
+    buffer->count += size;
+    return offset;
+}
+
+static void align_elf_buffer(Elf_Buffer *buffer, size_t alignment)
+{
+    if(buffer->count % alignment != 0) push_elf_bytes(buffer, NULL, alignment - buffer->count % alignment);
+}
+
+static size_t push_elf_string(Elf_Buffer *strings, const char *prefix, const char *string)
+{
+    size_t offset = push_elf_bytes(strings, prefix, strlen(prefix));
+    push_elf_bytes(strings, string, strlen(string) + 1);
+    return offset;
+}
+
+// Symbols referenced by relocations but not defined by any function of the object
+typedef struct {
+    const char **data;
+    size_t count;
+} Elf_Undefined_Symbols;
+
+static size_t find_elf_symbol(const X86_64_Object *object, const Elf_Undefined_Symbols *undefined,
+        const size_t *function_symbols, size_t first_undefined, const char *name)
+{
+    for(size_t i = 0; i < object->functions.count; ++i) {
+        if(strcmp(object->functions.data[i].name, name) == 0) return function_symbols[i];
+    }
+    for(size_t i = 0; i < undefined->count; ++i) {
+        if(strcmp(undefined->data[i], name) == 0) return first_undefined + i;
+    }
+    return 0;
+}
+
+void write_elf64_object(const char *file_path, const X86_64_Object *object)
+{
+    Arena arena = {0};
+    Elf_Buffer file = { .arena = &arena };
+    Elf_Buffer strings = { .arena = &arena };
+    Elf_Buffer section_names = { .arena = &arena };
+    Elf_Buffer symbols = { .arena = &arena };
+    push_elf_bytes(&strings, "", 1);
+    push_elf_bytes(&section_names, "", 1);
+
+    size_t functions_count = object->functions.count;
+    size_t rela_sections_count = 0;
+    size_t max_relocations = 0;
+    for(size_t i = 0; i < functions_count; ++i) max_relocations += object->functions.data[i].relocations.count;
+    Elf_Undefined_Symbols undefined = { .data = arena_alloc(&arena, (max_relocations + 1)*sizeof(const char *)) };
+    size_t *function_symbols = arena_alloc(&arena, (functions_count + 1)*sizeof(size_t));
+    assert(undefined.data && function_symbols && "buy more ram lol!");
+    for(size_t i = 0; i < functions_count; ++i) {
+        const X86_64_Function *function = &object->functions.data[i];
+        for(size_t j = 0; j < function->relocations.count; ++j) {
+            const char *symbol = function->relocations.data[j].symbol;
+            if(find_x86_64_function(object, symbol)) continue;
+            bool known = false;
+            for(size_t k = 0; k < undefined.count && !known; ++k) known = strcmp(undefined.data[k], symbol) == 0;
+            if(!known) undefined.data[undefined.count++] = symbol;
+        }
+        if(function->relocations.count > 0) rela_sections_count += 1;
+    }
+
+    // Sections: null, a .text.<name> per function, a .rela.text.<name> per function with relocations,
+    // then the symbol table, its strings, the section names and the non-executable stack note
+    size_t sections_count = 1 + functions_count + rela_sections_count + 4;
+    size_t symtab_index = 1 + functions_count + rela_sections_count;
+    size_t strtab_index = symtab_index + 1;
+    size_t shstrtab_index = symtab_index + 2;
+    size_t note_index = symtab_index + 3;
+    Elf64_Shdr *sections = arena_alloc(&arena, sections_count*sizeof(Elf64_Shdr));
+    assert(sections && "buy more ram lol!");
+    memset(sections, 0, sections_count*sizeof(Elf64_Shdr));
+
+    // Local symbols have to come before the global ones
+    size_t symbols_count = 1;
+    push_elf_bytes(&symbols, NULL, sizeof(Elf64_Sym));
+    for(int pass = 0; pass < 2; ++pass) {
+        for(size_t i = 0; i < functions_count; ++i) {
+            const X86_64_Function *function = &object->functions.data[i];
+            if(function->is_global != (pass == 1)) continue;
+            Elf64_Sym sym = {0};
+            sym.st_name = push_elf_string(&strings, "", function->name);
+            sym.st_info = ELF64_ST_INFO(function->is_global ? STB_GLOBAL : STB_LOCAL, STT_FUNC);
+            sym.st_shndx = 1 + i;
+            sym.st_size = function->code.count;
+            push_elf_bytes(&symbols, &sym, sizeof(sym));
+            function_symbols[i] = symbols_count++;
+        }
+        if(pass == 0) {
+            sections[symtab_index].sh_info = symbols_count;
+        }
+    }
+    size_t first_undefined = symbols_count;
+    for(size_t i = 0; i < undefined.count; ++i) {
+        Elf64_Sym sym = {0};
+        sym.st_name = push_elf_string(&strings, "", undefined.data[i]);
+        sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        sym.st_shndx = SHN_UNDEF;
+        push_elf_bytes(&symbols, &sym, sizeof(sym));
+        symbols_count++;
+    }
+
+    push_elf_bytes(&file, NULL, sizeof(Elf64_Ehdr));
+    size_t rela_index = 1 + functions_count;
+    for(size_t i = 0; i < functions_count; ++i) {
+        const X86_64_Function *function = &object->functions.data[i];
+        Elf64_Shdr *text = &sections[1 + i];
+        align_elf_buffer(&file, function->alignment);
+        text->sh_name = push_elf_string(&section_names, ".text.", function->name);
+        text->sh_type = SHT_PROGBITS;
+        text->sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+        text->sh_offset = push_elf_bytes(&file, function->code.data, function->code.count);
+        text->sh_size = function->code.count;
+        text->sh_addralign = function->alignment;
+
+        if(function->relocations.count == 0) continue;
+        // Calls and jumps to other functions, R_X86_64_PLT32 lets the linker go through a PLT if it has to
+        Elf64_Shdr *rela = &sections[rela_index];
+        rela_index += 1;
+        align_elf_buffer(&file, 8);
+        rela->sh_name = push_elf_string(&section_names, ".rela.text.", function->name);
+        rela->sh_type = SHT_RELA;
+        rela->sh_flags = SHF_INFO_LINK;
+        rela->sh_offset = file.count;
+        rela->sh_link = symtab_index;
+        rela->sh_info = 1 + i;
+        rela->sh_addralign = 8;
+        rela->sh_entsize = sizeof(Elf64_Rela);
+        for(size_t j = 0; j < function->relocations.count; ++j) {
+            const X86_64_Relocation *relocation = &function->relocations.data[j];
+            size_t symbol = find_elf_symbol(object, &undefined, function_symbols, first_undefined, relocation->symbol);
+            Elf64_Rela entry = {0};
+            entry.r_offset = relocation->offset;
+            entry.r_info = ELF64_R_INFO(symbol, R_X86_64_PLT32);
+            entry.r_addend = relocation->addend;
+            push_elf_bytes(&file, &entry, sizeof(entry));
+        }
+        rela->sh_size = file.count - rela->sh_offset;
+    }
+
+    Elf64_Shdr *symtab = &sections[symtab_index];
+    align_elf_buffer(&file, 8);
+    symtab->sh_name = push_elf_string(&section_names, "", ".symtab");
+    symtab->sh_type = SHT_SYMTAB;
+    symtab->sh_offset = push_elf_bytes(&file, symbols.data, symbols.count);
+    symtab->sh_size = symbols.count;
+    symtab->sh_link = strtab_index;
+    symtab->sh_addralign = 8;
+    symtab->sh_entsize = sizeof(Elf64_Sym);
+
+    Elf64_Shdr *strtab = &sections[strtab_index];
+    strtab->sh_name = push_elf_string(&section_names, "", ".strtab");
+    strtab->sh_type = SHT_STRTAB;
+    strtab->sh_offset = push_elf_bytes(&file, strings.data, strings.count);
+    strtab->sh_size = strings.count;
+    strtab->sh_addralign = 1;
+
+    Elf64_Shdr *note = &sections[note_index];
+    note->sh_name = push_elf_string(&section_names, "", ".note.GNU-stack");
+    note->sh_type = SHT_PROGBITS;
+    note->sh_offset = file.count;
+    note->sh_addralign = 1;
+
+    Elf64_Shdr *shstrtab = &sections[shstrtab_index];
+    shstrtab->sh_name = push_elf_string(&section_names, "", ".shstrtab");
+    shstrtab->sh_type = SHT_STRTAB;
+    shstrtab->sh_offset = push_elf_bytes(&file, section_names.data, section_names.count);
+    shstrtab->sh_size = section_names.count;
+    shstrtab->sh_addralign = 1;
+
+    align_elf_buffer(&file, 8);
+    size_t section_headers = push_elf_bytes(&file, sections, sections_count*sizeof(Elf64_Shdr));
+
+    Elf64_Ehdr header = {0};
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = section_headers;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = sections_count;
+    header.e_shstrndx = shstrtab_index;
+    memcpy(file.data, &header, sizeof(header));
+
+    FILE *f = fopen(file_path, "wb");
+    if(!f) {
+        fatal("Failed to open file file %s", file_path);
+    }
+    if(fwrite(file.data, 1, file.count, f) != file.count) {
+        fatal("Failed to write object file %s", file_path);
+    }
+    fclose(f);
+    arena_free(&arena);
+}
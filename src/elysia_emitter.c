@@ -0,0 +1,181 @@
+#include "elysia.h"
+#include "elysia_emitter.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static Emitter_Chunk *push_emitter_chunk(Emitter *e)
+{
+    Emitter_Chunk *chunk = arena_alloc(e->arena, sizeof(Emitter_Chunk));
+    assert(chunk && "buy more ram lol!");
+    chunk->next = NULL;
+    chunk->count = 0;
+    if(e->last) e->last->next = chunk;
+    else e->first = chunk;
+    e->last = chunk;
+    return chunk;
+}
+
+void emit_bytes(Emitter *e, const char *data, size_t count)
+{
+    e->size += count;
+    while(count > 0) {
+        Emitter_Chunk *chunk = e->last;
+        if(!chunk || chunk->count == ELYSIA_EMITTER_CHUNK_SIZE) chunk = push_emitter_chunk(e);
+        size_t n = ELYSIA_EMITTER_CHUNK_SIZE - chunk->count;
+        if(n > count) n = count;
+        memcpy(&chunk->data[chunk->count], data, n);
+        chunk->count += n;
+        data += n;
+        count -= n;
+    }
+}
+
+void emit_char(Emitter *e, char c)
+{
+    Emitter_Chunk *chunk = e->last;
+    if(!chunk || chunk->count == ELYSIA_EMITTER_CHUNK_SIZE) chunk = push_emitter_chunk(e);
+    chunk->data[chunk->count++] = c;
+    e->size += 1;
+}
+
+void emit_cstr(Emitter *e, const char *cstr)
+{
+    emit_bytes(e, cstr, strlen(cstr));
+}
+
+void emit_uint(Emitter *e, uint64_t value)
+{
+    // Digits are rendered backwards from the end of the buffer
+    char digits[20];
+    size_t start = sizeof(digits);
+    do {
+        digits[--start] = '0' + value%10;
+        value /= 10;
+    } while(value > 0);
+    emit_bytes(e, &digits[start], sizeof(digits) - start);
+}
+
+void emit_int(Emitter *e, int64_t value)
+{
+    if(value < 0) {
+        emit_char(e, '-');
+        // Negated as unsigned so INT64_MIN doesn't overflow
+        emit_uint(e, -(uint64_t)value);
+        return;
+    }
+    emit_uint(e, value);
+}
+
+void emit_symbol(Emitter *e, const char *prefix, size_t id)
+{
+    emit_cstr(e, prefix);
+    emit_uint(e, id);
+}
+
+void emit_line_end(Emitter *e, const char *comment, const char *file, int line)
+{
+    if(e->annotate_source_lines) {
+        emit_char(e, ' ');
+        emit_cstr(e, comment);
+        emit_char(e, ' ');
+        emit_cstr(e, file);
+        emit_char(e, ':');
+        emit_int(e, line);
+    }
+    emit_char(e, '\n');
+}
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t count)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < count; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t hash_emitter_range(const Emitter *e, uint64_t hash, size_t begin, size_t end)
+{
+    const Emitter_Chunk *chunk = e->first;
+    for(; chunk && begin >= ELYSIA_EMITTER_CHUNK_SIZE; chunk = chunk->next) {
+        begin -= ELYSIA_EMITTER_CHUNK_SIZE;
+        end -= ELYSIA_EMITTER_CHUNK_SIZE;
+    }
+    for(; chunk && begin < end; chunk = chunk->next) {
+        size_t n = end < chunk->count ? end : chunk->count;
+        hash = hash_bytes(hash, chunk->data + begin, n - begin);
+        begin = 0;
+        end = end > chunk->count ? end - chunk->count : 0;
+    }
+    return hash;
+}
+
+bool write_emitter_range(const Emitter *e, int fd, size_t begin, size_t end)
+{
+    struct iovec iovecs[ELYSIA_EMITTER_MAX_IOVECS];
+    const Emitter_Chunk *chunk = e->first;
+    // Every chunk but the last one is full
+    for(; chunk && begin >= ELYSIA_EMITTER_CHUNK_SIZE; chunk = chunk->next) {
+        begin -= ELYSIA_EMITTER_CHUNK_SIZE;
+        end -= ELYSIA_EMITTER_CHUNK_SIZE;
+    }
+    while(chunk && begin < end) {
+        int count = 0;
+        for(; chunk && begin < end && count < ELYSIA_EMITTER_MAX_IOVECS; chunk = chunk->next) {
+            size_t n = end < chunk->count ? end : chunk->count;
+            iovecs[count].iov_base = (char *)chunk->data + begin;
+            iovecs[count].iov_len = n - begin;
+            ++count;
+            // Both ends are relative to the next chunk from now on
+            begin = 0;
+            end = end > chunk->count ? end - chunk->count : 0;
+        }
+
+        // Short writes leave the rest of the vectors to the next call
+        struct iovec *it = iovecs;
+        while(count > 0) {
+            ssize_t written = writev(fd, it, count);
+            if(written < 0) {
+                if(errno == EINTR) continue;
+                return false;
+            }
+            while(count > 0 && (size_t)written >= it->iov_len) {
+                written -= it->iov_len;
+                ++it;
+                --count;
+            }
+            if(count > 0) {
+                it->iov_base = (char *)it->iov_base + written;
+                it->iov_len -= written;
+            }
+        }
+    }
+    return true;
+}
+
+bool flush_emitter(Emitter *e, int fd)
+{
+    if(!write_emitter_range(e, fd, 0, e->size)) return false;
+    // The chunks stay in the arena, they are freed along with it
+    e->first = NULL;
+    e->last = NULL;
+    e->size = 0;
+    return true;
+}
+
+void write_emitter_to_file(Emitter *e, const char *file_path)
+{
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        fatal("Failed to open file %s: %s", file_path, strerror(errno));
+    }
+    bool ok = flush_emitter(e, fd);
+    if(close(fd) != 0 || !ok) {
+        fatal("Failed to write file %s: %s", file_path, strerror(errno));
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef ELYSIA_EMITTER_H_
+#define ELYSIA_EMITTER_H_
+
+#include "elysia.h"
+
+// Text is rendered into chunks of this size, the whole output is written with as few `writev`
+// calls as the chunks allow
+#define ELYSIA_EMITTER_CHUNK_SIZE (64*1024)
+#define ELYSIA_EMITTER_MAX_IOVECS 1024
+
+typedef struct Emitter_Chunk Emitter_Chunk;
+struct Emitter_Chunk {
+    Emitter_Chunk *next;
+    size_t count;
+    char data[ELYSIA_EMITTER_CHUNK_SIZE];
+};
+
+// Appends text without any format parsing, backends build their output out of literals, integers
+// and symbols
+typedef struct {
+    Arena *arena;
+    Emitter_Chunk *first;
+    Emitter_Chunk *last;
+    size_t size;
+    // Backends end their lines with the place in the compiler they were emitted from
+    bool annotate_source_lines;
+} Emitter;
+
+// The length of literals is known at compile time, anything but a string literal fails to compile
+#define emit_literal(e, lit) emit_bytes(e, "" lit, sizeof(lit) - 1)
+#define emit_sv(e, sv) emit_bytes(e, (sv).data, (sv).count)
+
+void emit_bytes(Emitter *e, const char *data, size_t count);
+void emit_char(Emitter *e, char c);
+void emit_cstr(Emitter *e, const char *cstr);
+void emit_int(Emitter *e, int64_t value);
+void emit_uint(Emitter *e, uint64_t value);
+// `prefix` followed by a number e.g. labels `@L12` or temporaries `%_t3`
+void emit_symbol(Emitter *e, const char *prefix, size_t id);
+// Ends the line, annotated with `comment` `file:line` when `annotate_source_lines` is set
+void emit_line_end(Emitter *e, const char *comment, const char *file, int line);
+
+// 64-bit FNV-1a of the bytes in [begin, end) of the output continuing from `hash`, use
+// ELYSIA_EMITTER_HASH_SEED to start a new one
+#define ELYSIA_EMITTER_HASH_SEED 0xcbf29ce484222325ull
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t count);
+uint64_t hash_emitter_range(const Emitter *e, uint64_t hash, size_t begin, size_t end);
+
+// Writes the bytes in [begin, end) of the output into `fd`, false if writing failed
+bool write_emitter_range(const Emitter *e, int fd, size_t begin, size_t end);
+// Writes everything emitted so far into `fd` and starts over, false if writing failed
+bool flush_emitter(Emitter *e, int fd);
+// Writes the output into a new file at `file_path`
+void write_emitter_to_file(Emitter *e, const char *file_path);
+
+#endif // ELYSIA_EMITTER_H_
@@ -0,0 +1,239 @@
+#include "elysia.h"
+#include "elysia_x86_64.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Address space reserved for the generated code, pages are only backed once code lands on them
+#define X86_64_JIT_CODE_CAPACITY (256*1024*1024)
+// `push index` and `jmp resolver`, patched into `jmp code` once the function is compiled
+#define X86_64_STUB_SIZE 16
+// `jmp [rip+0]` followed by the 64-bit address of the host function
+#define X86_64_TRAMPOLINE_SIZE 16
+#define X86_64_RESOLVER_CAPACITY 512
+#define X86_64_VECTOR_REGISTERS 16
+// rdi, rsi, rdx, rcx, r8, r9, r10 and r11 may all carry arguments
+#define X86_64_RESOLVER_SAVED_REGISTERS 8
+// The resolver stays clear of the 128 bytes below the stack pointer of the caller, the SysV red zone.
+// Tail calls of the baseline backend leave the arguments there
+#define X86_64_RED_ZONE_SIZE 128
+
+typedef struct {
+    uint8_t data[X86_64_RESOLVER_CAPACITY];
+    size_t count;
+} Jit_Buffer;
+
+static void put_jit_bytes(Jit_Buffer *buffer, const void *data, size_t size)
+{
+    assert(buffer->count + size <= sizeof(buffer->data));
+    memcpy(buffer->data + buffer->count, data, size);
+    buffer->count += size;
+}
+
+static void put_jit_byte(Jit_Buffer *buffer, uint8_t byte)
+{
+    put_jit_bytes(buffer, &byte, 1);
+}
+
+static void put_jit_value(Jit_Buffer *buffer, uint64_t value, size_t size)
+{
+    for(size_t i = 0; i < size; ++i) put_jit_byte(buffer, (uint8_t)(value >> (8*i)));
+}
+
+// `movdqu`/`vmovdqu` between vector register `reg` and [rsp+offset]
+static void put_vector_move(Jit_Buffer *buffer, bool ymm, bool load, size_t reg, size_t offset)
+{
+    if(ymm) {
+        put_jit_byte(buffer, 0xC5);
+        put_jit_byte(buffer, (reg < 8 ? 0x80 : 0x00) | 0x78 | 0x04 | 0x02);
+    } else {
+        put_jit_byte(buffer, 0xF3);
+        if(reg >= 8) put_jit_byte(buffer, 0x44);
+        put_jit_byte(buffer, 0x0F);
+    }
+    put_jit_byte(buffer, load ? 0x6F : 0x7F);
+    put_jit_byte(buffer, 0x80 | ((reg & 7) << 3) | 0x04);
+    put_jit_byte(buffer, 0x24);
+    put_jit_value(buffer, offset, 4);
+}
+
+static uint8_t *compile_x86_64_jit_function(X86_64_Jit *jit, uint64_t index);
+
+// Shared by every stub: the stub pushed the index of the function, the resolver keeps every register
+// that may hold an argument, compiles the function and jumps to it in place of the stub
+static void write_x86_64_resolver(Jit_Buffer *buffer, X86_64_Jit *jit)
+{
+    static const uint8_t prologue[] = {
+        0x48, 0x8D, 0x64, 0x24, (uint8_t)-X86_64_RED_ZONE_SIZE, // lea rsp, [rsp-128]
+        0x55,                   // push rbp
+        0x48, 0x89, 0xE5,       // mov rbp, rsp
+        0x57, 0x56, 0x52, 0x51, // push rdi, rsi, rdx, rcx
+        0x41, 0x50, 0x41, 0x51, // push r8, r9
+        0x41, 0x52, 0x41, 0x53, // push r10, r11
+        0x48, 0x83, 0xE4, 0xE0, // and rsp, -32
+        0x48, 0x81, 0xEC,       // sub rsp, imm32
+    };
+    static const uint8_t epilogue[] = {
+        0x48, 0x8D, 0x65, (uint8_t)-(X86_64_RESOLVER_SAVED_REGISTERS*8), // lea rsp, [rbp-64]
+        0x41, 0x5B, 0x41, 0x5A, // pop r11, r10
+        0x41, 0x59, 0x41, 0x58, // pop r9, r8
+        0x59, 0x5A, 0x5E, 0x5F, // pop rcx, rdx, rsi, rdi
+        0x5D,                   // pop rbp
+        0x48, 0x8D, 0xA4, 0x24, X86_64_RED_ZONE_SIZE, 0x00, 0x00, 0x00, // lea rsp, [rsp+128]
+        0xC3,                   // ret, into the function since its address replaced the index
+    };
+    bool ymm = jit->program.preserve_ymm;
+    size_t vector_size = ymm ? 32 : 16;
+
+    put_jit_bytes(buffer, prologue, sizeof(prologue));
+    put_jit_value(buffer, X86_64_VECTOR_REGISTERS*vector_size, 4);
+    for(size_t i = 0; i < X86_64_VECTOR_REGISTERS; ++i) put_vector_move(buffer, ymm, false, i, i*vector_size);
+    put_jit_bytes(buffer, (uint8_t[]){ 0x48, 0xBF }, 2); // mov rdi, jit
+    put_jit_value(buffer, (uint64_t)(uintptr_t)jit, 8);
+    put_jit_bytes(buffer, (uint8_t[]){ 0x48, 0x8B, 0xB5 }, 3); // mov rsi, [rbp+136]
+    put_jit_value(buffer, 8 + X86_64_RED_ZONE_SIZE, 4);
+    put_jit_bytes(buffer, (uint8_t[]){ 0x48, 0xB8 }, 2); // mov rax, compile_x86_64_jit_function
+    put_jit_value(buffer, (uint64_t)(uintptr_t)compile_x86_64_jit_function, 8);
+    put_jit_bytes(buffer, (uint8_t[]){ 0xFF, 0xD0 }, 2); // call rax
+    put_jit_bytes(buffer, (uint8_t[]){ 0x48, 0x89, 0x85 }, 3); // mov [rbp+136], rax
+    put_jit_value(buffer, 8 + X86_64_RED_ZONE_SIZE, 4);
+    for(size_t i = 0; i < X86_64_VECTOR_REGISTERS; ++i) put_vector_move(buffer, ymm, true, i, i*vector_size);
+    put_jit_bytes(buffer, epilogue, sizeof(epilogue));
+}
+
+static void write_x86_64_trampoline(uint8_t *at, void (*address)(void))
+{
+    static const uint8_t jump[] = { 0xFF, 0x25, 0x00, 0x00, 0x00, 0x00 };
+    uint64_t target = (uint64_t)(uintptr_t)address;
+    memcpy(at, jump, sizeof(jump));
+    memcpy(at + sizeof(jump), &target, sizeof(target));
+}
+
+static void write_x86_64_jump(uint8_t *at, const uint8_t *target)
+{
+    int32_t displacement = (int32_t)(target - (at + 5));
+    at[0] = 0xE9;
+    memcpy(at + 1, &displacement, sizeof(displacement));
+}
+
+// Pages of the generated code are either writable or executable, never both at once
+static void protect_jit_memory(X86_64_Jit *jit, size_t begin, size_t end, bool writable)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    begin &= ~(page_size - 1);
+    end = (end + page_size - 1) & ~(page_size - 1);
+    if(mprotect(jit->memory + begin, end - begin, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0) {
+        fatal("Failed to change the protection of the generated code: %s", strerror(errno));
+    }
+}
+
+static size_t find_jit_function_index(const X86_64_Jit *jit, const char *name)
+{
+    for(size_t i = 0; i < jit->program.functions_count; ++i) {
+        if(strcmp(jit->program.names[i], name) == 0) return i;
+    }
+    return jit->program.functions_count;
+}
+
+// Calls to functions that aren't compiled yet go through their stub
+static const uint8_t *resolve_jit_symbol(const X86_64_Jit *jit, const char *name)
+{
+    size_t index = find_jit_function_index(jit, name);
+    if(index < jit->program.functions_count) {
+        return jit->addresses[index] ? jit->addresses[index] : jit->stubs[index];
+    }
+    for(size_t i = 0; i < jit->program.host_symbols_count; ++i) {
+        if(strcmp(jit->program.host_symbols[i].name, name) == 0) return jit->trampolines + i*X86_64_TRAMPOLINE_SIZE;
+    }
+    fatal("Undefined reference to `%s`", name);
+    return NULL;
+}
+
+static uint8_t *compile_x86_64_jit_function(X86_64_Jit *jit, uint64_t index)
+{
+    size_t first = jit->object.functions.count;
+    jit->program.compile(jit->program.context, index, &jit->object);
+    assert(jit->object.functions.count == first + 1);
+    const X86_64_Function *function = &jit->object.functions.data[first];
+
+    size_t offset = (jit->used + function->alignment - 1) & ~(function->alignment - 1);
+    if(offset + function->code.count > jit->size) {
+        fatal("Out of memory for the generated code while compiling `%s`", function->name);
+    }
+    uint8_t *code = jit->memory + offset;
+    protect_jit_memory(jit, offset, offset + function->code.count, true);
+    memcpy(code, function->code.data, function->code.count);
+    for(size_t i = 0; i < function->relocations.count; ++i) {
+        const X86_64_Relocation *relocation = &function->relocations.data[i];
+        uint8_t *field = code + relocation->offset;
+        int32_t displacement = (int32_t)((int64_t)(resolve_jit_symbol(jit, relocation->symbol) - field) + relocation->addend);
+        memcpy(field, &displacement, sizeof(displacement));
+    }
+    protect_jit_memory(jit, offset, offset + function->code.count, false);
+    jit->used = offset + function->code.count;
+    jit->addresses[index] = code;
+    jit->compiled_count += 1;
+
+    size_t stub = jit->stubs[index] - jit->memory;
+    protect_jit_memory(jit, stub, stub + X86_64_STUB_SIZE, true);
+    write_x86_64_jump(jit->stubs[index], code);
+    protect_jit_memory(jit, stub, stub + X86_64_STUB_SIZE, false);
+    return code;
+}
+
+void load_x86_64_jit(X86_64_Jit *jit, Arena *arena, const X86_64_Jit_Program *program)
+{
+    memset(jit, 0, sizeof(*jit));
+    jit->program = *program;
+    jit->object.arena = arena;
+    jit->stubs = arena_alloc(arena, (program->functions_count + 1)*sizeof(uint8_t *));
+    jit->addresses = arena_alloc(arena, (program->functions_count + 1)*sizeof(uint8_t *));
+    assert(jit->stubs && jit->addresses && "buy more ram lol!");
+    memset(jit->addresses, 0, (program->functions_count + 1)*sizeof(uint8_t *));
+
+    // A stub per function, a trampoline per host symbol and the resolver, then the compiled functions
+    size_t trampolines = program->functions_count*X86_64_STUB_SIZE;
+    size_t resolver = trampolines + program->host_symbols_count*X86_64_TRAMPOLINE_SIZE;
+    size_t header_size = resolver + X86_64_RESOLVER_CAPACITY;
+    jit->size = header_size + X86_64_JIT_CODE_CAPACITY;
+    void *memory = mmap(NULL, jit->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(memory == MAP_FAILED) {
+        fatal("Failed to reserve memory for the generated code: %s", strerror(errno));
+    }
+    jit->memory = memory;
+    jit->trampolines = jit->memory + trampolines;
+    jit->used = header_size;
+
+    protect_jit_memory(jit, 0, header_size, true);
+    Jit_Buffer buffer = {0};
+    write_x86_64_resolver(&buffer, jit);
+    memcpy(jit->memory + resolver, buffer.data, buffer.count);
+    for(size_t i = 0; i < program->functions_count; ++i) {
+        uint8_t *stub = jit->memory + i*X86_64_STUB_SIZE;
+        memset(stub, 0xCC, X86_64_STUB_SIZE);
+        stub[0] = 0x68; // push imm32
+        uint32_t stub_index = (uint32_t)i;
+        memcpy(stub + 1, &stub_index, sizeof(stub_index));
+        write_x86_64_jump(stub + 5, jit->memory + resolver);
+        jit->stubs[i] = stub;
+    }
+    for(size_t i = 0; i < program->host_symbols_count; ++i) {
+        write_x86_64_trampoline(jit->trampolines + i*X86_64_TRAMPOLINE_SIZE, program->host_symbols[i].address);
+    }
+    protect_jit_memory(jit, 0, header_size, false);
+}
+
+void *find_x86_64_jit_function(const X86_64_Jit *jit, const char *name)
+{
+    size_t index = find_jit_function_index(jit, name);
+    if(index == jit->program.functions_count) return NULL;
+    return jit->stubs[index];
+}
+
+void unload_x86_64_jit(X86_64_Jit *jit)
+{
+    if(jit->memory) munmap(jit->memory, jit->size);
+    memset(jit, 0, sizeof(*jit));
+}
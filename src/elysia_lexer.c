@@ -18,6 +18,7 @@ static Token_Info _token_info[] = {
     [TOKEN_SEMICOLON] = { .type = TOKEN_SEMICOLON, .name = "semicolon", .hardcode = ";", .is_binary_op_token = false },
     [TOKEN_COMMA] = { .type = TOKEN_COMMA, . name = "comma", .hardcode = ",", .is_binary_op_token = false },
     [TOKEN_DOT] = { .type = TOKEN_DOT, . name = "dot", .hardcode = ".", .is_binary_op_token = false },
+    [TOKEN_DOTDOT] = { .type = TOKEN_DOTDOT, . name = "dotdot", .hardcode = "..", .is_binary_op_token = false },
     [TOKEN_LPAREN] = { .type = TOKEN_LPAREN, . name = "left paren", .hardcode = "(", .is_binary_op_token = false },
     [TOKEN_RPAREN] = { .type = TOKEN_RPAREN, . name = "right paren", .hardcode = ")", .is_binary_op_token = false },
     [TOKEN_LCURLY] = { .type = TOKEN_LCURLY, . name = "left curly", .hardcode = "{", .is_binary_op_token = false },
@@ -53,6 +54,12 @@ static Token_Info _token_info[] = {
     [TOKEN_WHILE] = { .type = TOKEN_WHILE, .name = "while", .hardcode = "while", .is_binary_op_token = false }, 
     [TOKEN_BREAK] = { .type = TOKEN_BREAK, .name = "break", .hardcode = "break", .is_binary_op_token = false }, 
     [TOKEN_CONTINUE] = { .type = TOKEN_CONTINUE, .name = "continue", .hardcode = "continue", .is_binary_op_token = false },
+    [TOKEN_INLINE] = { .type = TOKEN_INLINE, .name = "inline", .hardcode = "inline", .is_binary_op_token = false },
+    [TOKEN_NOINLINE] = { .type = TOKEN_NOINLINE, .name = "noinline", .hardcode = "noinline", .is_binary_op_token = false },
+    [TOKEN_SWITCH] = { .type = TOKEN_SWITCH, .name = "switch", .hardcode = "switch", .is_binary_op_token = false },
+    [TOKEN_CASE] = { .type = TOKEN_CASE, .name = "case", .hardcode = "case", .is_binary_op_token = false },
+    [TOKEN_PUB] = { .type = TOKEN_PUB, .name = "pub", .hardcode = "pub", .is_binary_op_token = false },
+    [TOKEN_COMPTIME] = { .type = TOKEN_COMPTIME, .name = "comptime", .hardcode = "comptime", .is_binary_op_token = false },
 };
 
 static const String_View FUNCTION_KEYWORD = SV_STATIC("fn");
@@ -63,6 +70,12 @@ static const String_View WHILE_KEYWORD = SV_STATIC("while");
 static const String_View BREAK_KEYWORD = SV_STATIC("break");
 static const String_View CONTINUE_KEYWORD = SV_STATIC("continue");
 static const String_View VAR_KEYWORD = SV_STATIC("var");
+static const String_View INLINE_KEYWORD = SV_STATIC("inline");
+static const String_View NOINLINE_KEYWORD = SV_STATIC("noinline");
+static const String_View SWITCH_KEYWORD = SV_STATIC("switch");
+static const String_View CASE_KEYWORD = SV_STATIC("case");
+static const String_View PUB_KEYWORD = SV_STATIC("pub");
+static const String_View COMPTIME_KEYWORD = SV_STATIC("comptime");
 
 bool is_token_binops(Token_Type type)
 {
@@ -85,7 +98,7 @@ bool lexer_cache_get(Lexer *lex, size_t i, Token *result)
         return false;
     }
 
-    *result = lex->cache.data[lex->cache.tail + i % MAXIMUM_LEXER_CACHE_DATA];
+    *result = lex->cache.data[(lex->cache.tail + i) % MAXIMUM_LEXER_CACHE_DATA];
     return true;
 }
 
@@ -166,6 +179,12 @@ bool cache_next_token(Lexer *lex)
 
     switch(lex->cc) {
         case '.':
+            if(lex->i + 1 < lex->source.count && lex->source.data[lex->i + 1] == '.') {
+                cache_token(lex, TOKEN_DOTDOT, sv_slice(lex->source, lex->i, lex->i + 2));
+                advance_lexer(lex);
+                advance_lexer(lex);
+                break;
+            }
             cache_token(lex, TOKEN_DOT, sv_slice(lex->source, lex->i, lex->i + 1));
             advance_lexer(lex);
             break;
@@ -336,6 +355,18 @@ bool cache_next_token(Lexer *lex)
                         cache_token(lex, TOKEN_CONTINUE, result);
                     } else if(sv_eq(result, VAR_KEYWORD)) {
                         cache_token(lex, TOKEN_VAR, result);
+                    } else if(sv_eq(result, INLINE_KEYWORD)) {
+                        cache_token(lex, TOKEN_INLINE, result);
+                    } else if(sv_eq(result, NOINLINE_KEYWORD)) {
+                        cache_token(lex, TOKEN_NOINLINE, result);
+                    } else if(sv_eq(result, SWITCH_KEYWORD)) {
+                        cache_token(lex, TOKEN_SWITCH, result);
+                    } else if(sv_eq(result, CASE_KEYWORD)) {
+                        cache_token(lex, TOKEN_CASE, result);
+                    } else if(sv_eq(result, PUB_KEYWORD)) {
+                        cache_token(lex, TOKEN_PUB, result);
+                    } else if(sv_eq(result, COMPTIME_KEYWORD)) {
+                        cache_token(lex, TOKEN_COMPTIME, result);
                     } else {
                         cache_token(lex, TOKEN_NAME, result);
                     }
@@ -343,6 +374,8 @@ bool cache_next_token(Lexer *lex)
                     size_t start = lex->i;
                     bool is_float = false;
                     while(char_isdigit(lex->cc) || lex->cc == '.') {
+                        // `1..5` is a range between two integers
+                        if(lex->cc == '.' && lex->i + 1 < lex->source.count && lex->source.data[lex->i + 1] == '.') break;
                         if(lex->cc == '.') {
                             if(is_float) {
                                 compilation_error(lex->loc, "Invalid syntax another '.' in a float number literal\n");
@@ -13,12 +13,13 @@ typedef enum {
     TOKEN_ADD, TOKEN_SUB, TOKEN_ASTERISK, TOKEN_DIV, TOKEN_MOD,
     TOKEN_ASSIGN, TOKEN_NOT, TOKEN_EQ, TOKEN_NE, TOKEN_GT, TOKEN_GE, TOKEN_LT, TOKEN_LE,
     TOKEN_AND, TOKEN_OR, TOKEN_BAND, TOKEN_BOR, TOKEN_XOR, TOKEN_SHL, TOKEN_SHR,
-    TOKEN_COMMA, TOKEN_DOT, TOKEN_COLON, TOKEN_SEMICOLON, TOKEN_LPAREN, TOKEN_RPAREN, 
+    TOKEN_COMMA, TOKEN_DOT, TOKEN_DOTDOT, TOKEN_COLON, TOKEN_SEMICOLON, TOKEN_LPAREN, TOKEN_RPAREN, 
     TOKEN_LCURLY, TOKEN_RCURLY, TOKEN_LBRACK, TOKEN_RBRACK,
 
     // Keywords
     TOKEN_FUNCTION, TOKEN_RETURN, TOKEN_VAR, TOKEN_IF, TOKEN_ELSE,
-    TOKEN_WHILE, TOKEN_BREAK, TOKEN_CONTINUE,
+    TOKEN_WHILE, TOKEN_BREAK, TOKEN_CONTINUE, TOKEN_INLINE, TOKEN_NOINLINE, TOKEN_SWITCH, TOKEN_CASE,
+    TOKEN_PUB, TOKEN_COMPTIME,
 } Token_Type;
 
 typedef struct {
@@ -0,0 +1,193 @@
+#include "elysia.h"
+#include "elysia_x86_64.h"
+#include <assert.h>
+#include <elf.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Executables are loaded at the traditional non-PIE address, headers included
+#define X86_64_EXECUTABLE_BASE_ADDRESS 0x400000
+#define X86_64_PAGE_SIZE 0x1000
+#define X86_64_PROGRAM_HEADERS_COUNT 2
+
+// Machine code of runtime/elysiart_x86-64.asm, the arguments are already where the syscalls want them
+static const uint8_t x86_64_runtime_write[] = {
+    0x48, 0xC7, 0xC0, 0x01, 0x00, 0x00, 0x00, // mov rax, 1
+    0x0F, 0x05,                               // syscall
+    0xC3,                                     // ret
+};
+
+static const uint8_t x86_64_runtime_exit[] = {
+    0x48, 0xC7, 0xC0, 0x3C, 0x00, 0x00, 0x00, // mov rax, 60
+    0x0F, 0x05,                               // syscall
+    0xC3,                                     // ret
+};
+
+static const uint8_t x86_64_runtime_start[] = {
+    0x8B, 0x3C, 0x24,                         // mov edi, [rsp]
+    0x48, 0x8D, 0x74, 0x24, 0x08,             // lea rsi, [rsp+8]
+    0xE8, 0x00, 0x00, 0x00, 0x00,             // call main
+    0x48, 0x89, 0xC7,                         // mov rdi, rax
+    0xE8, 0x00, 0x00, 0x00, 0x00,             // call exit
+    0xC3,                                     // ret
+};
+
+static const X86_64_Relocation x86_64_runtime_start_relocations[] = {
+    { .offset = 9, .symbol = "main", .addend = -4 },
+    { .offset = 17, .symbol = "exit", .addend = -4 },
+};
+
+void add_x86_64_runtime(X86_64_Object *object)
+{
+    add_x86_64_function(object, "write", true, x86_64_runtime_write, sizeof(x86_64_runtime_write), NULL, 0);
+    add_x86_64_function(object, "exit", true, x86_64_runtime_exit, sizeof(x86_64_runtime_exit), NULL, 0);
+    add_x86_64_function(object, X86_64_ENTRY_SYMBOL, true, x86_64_runtime_start, sizeof(x86_64_runtime_start),
+            x86_64_runtime_start_relocations, sizeof(x86_64_runtime_start_relocations)/sizeof(x86_64_runtime_start_relocations[0]));
+}
+
+typedef struct {
+    size_t object;
+    const X86_64_Function *function;
+    bool reachable;
+    uint64_t address;
+} Linker_Function;
+
+typedef struct {
+    Linker_Function *data;
+    size_t count;
+} Linker_Functions;
+
+static size_t find_global_function(const Linker_Functions *functions, const char *name)
+{
+    for(size_t i = 0; i < functions->count; ++i) {
+        const X86_64_Function *function = functions->data[i].function;
+        if(function->is_global && strcmp(function->name, name) == 0) return i;
+    }
+    return functions->count;
+}
+
+// Functions of the referring object win over the global functions of the others
+static size_t resolve_symbol(const Linker_Functions *functions, size_t object, const char *name)
+{
+    for(size_t i = 0; i < functions->count; ++i) {
+        if(functions->data[i].object == object && strcmp(functions->data[i].function->name, name) == 0) return i;
+    }
+    size_t result = find_global_function(functions, name);
+    if(result == functions->count) {
+        fatal("Undefined reference to `%s`", name);
+    }
+    return result;
+}
+
+void link_x86_64_executable(const char *file_path, const X86_64_Object *objects, size_t objects_count, const char *entry)
+{
+    Arena arena = {0};
+    Linker_Functions functions = {0};
+    size_t capacity = 1;
+    for(size_t i = 0; i < objects_count; ++i) capacity += objects[i].functions.count;
+    functions.data = arena_alloc(&arena, capacity*sizeof(Linker_Function));
+    size_t *worklist = arena_alloc(&arena, capacity*sizeof(size_t));
+    assert(functions.data && worklist && "buy more ram lol!");
+    for(size_t i = 0; i < objects_count; ++i) {
+        for(size_t j = 0; j < objects[i].functions.count; ++j) {
+            const X86_64_Function *function = &objects[i].functions.data[j];
+            if(function->is_global && find_global_function(&functions, function->name) != functions.count) {
+                fatal("Multiple definitions of `%s`", function->name);
+            }
+            functions.data[functions.count++] = (Linker_Function){ .object = i, .function = function };
+        }
+    }
+
+    // Only what the entry reaches through relocations makes it into the executable
+    size_t entry_index = find_global_function(&functions, entry);
+    if(entry_index == functions.count) {
+        fatal("Undefined entry symbol `%s`", entry);
+    }
+    size_t worklist_count = 0;
+    functions.data[entry_index].reachable = true;
+    worklist[worklist_count++] = entry_index;
+    while(worklist_count > 0) {
+        const Linker_Function *current = &functions.data[worklist[--worklist_count]];
+        for(size_t i = 0; i < current->function->relocations.count; ++i) {
+            size_t target = resolve_symbol(&functions, current->object, current->function->relocations.data[i].symbol);
+            if(functions.data[target].reachable) continue;
+            functions.data[target].reachable = true;
+            worklist[worklist_count++] = target;
+        }
+    }
+
+    // A single read-only executable segment holding the headers followed by the code
+    uint64_t offset = sizeof(Elf64_Ehdr) + X86_64_PROGRAM_HEADERS_COUNT*sizeof(Elf64_Phdr);
+    for(size_t i = 0; i < functions.count; ++i) {
+        Linker_Function *function = &functions.data[i];
+        if(!function->reachable) continue;
+        size_t alignment = function->function->alignment;
+        offset = (offset + alignment - 1) & ~(uint64_t)(alignment - 1);
+        function->address = X86_64_EXECUTABLE_BASE_ADDRESS + offset;
+        offset += function->function->code.count;
+    }
+    size_t file_size = offset;
+    uint8_t *image = arena_alloc(&arena, file_size);
+    assert(image && "buy more ram lol!");
+    memset(image, 0x90, file_size);
+
+    for(size_t i = 0; i < functions.count; ++i) {
+        const Linker_Function *function = &functions.data[i];
+        if(!function->reachable) continue;
+        uint8_t *code = image + (function->address - X86_64_EXECUTABLE_BASE_ADDRESS);
+        memcpy(code, function->function->code.data, function->function->code.count);
+        for(size_t j = 0; j < function->function->relocations.count; ++j) {
+            const X86_64_Relocation *relocation = &function->function->relocations.data[j];
+            const Linker_Function *target = &functions.data[resolve_symbol(&functions, function->object, relocation->symbol)];
+            int64_t value = (int64_t)target->address + relocation->addend - (int64_t)(function->address + relocation->offset);
+            if(value < INT32_MIN || value > INT32_MAX) {
+                fatal("Relocation against `%s` in `%s` is out of range", relocation->symbol, function->function->name);
+            }
+            for(size_t k = 0; k < 4; ++k) code[relocation->offset + k] = (uint8_t)((uint64_t)value >> (8*k));
+        }
+    }
+
+    Elf64_Ehdr header = {0};
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_entry = functions.data[entry_index].address;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = X86_64_PROGRAM_HEADERS_COUNT;
+    memcpy(image, &header, sizeof(header));
+
+    Elf64_Phdr segments[X86_64_PROGRAM_HEADERS_COUNT] = {0};
+    segments[0].p_type = PT_LOAD;
+    segments[0].p_flags = PF_R | PF_X;
+    segments[0].p_vaddr = X86_64_EXECUTABLE_BASE_ADDRESS;
+    segments[0].p_paddr = X86_64_EXECUTABLE_BASE_ADDRESS;
+    segments[0].p_filesz = file_size;
+    segments[0].p_memsz = file_size;
+    segments[0].p_align = X86_64_PAGE_SIZE;
+    // Without it the kernel would map the stack executable
+    segments[1].p_type = PT_GNU_STACK;
+    segments[1].p_flags = PF_R | PF_W;
+    segments[1].p_align = 16;
+    memcpy(image + sizeof(Elf64_Ehdr), segments, sizeof(segments));
+
+    FILE *f = fopen(file_path, "wb");
+    if(!f) {
+        fatal("Failed to open file file %s", file_path);
+    }
+    if(fwrite(image, 1, file_size, f) != file_size) {
+        fatal("Failed to write executable %s", file_path);
+    }
+    fclose(f);
+    if(chmod(file_path, 0755) != 0) {
+        fatal("Failed to make %s executable", file_path);
+    }
+    arena_free(&arena);
+}
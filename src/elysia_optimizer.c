@@ -0,0 +1,1914 @@
+#include "elysia.h"
+#include "elysia_ast.h"
+#include "elysia_compiler.h"
+#include "elysia_optimizer.h"
+#include "sv.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    String_View name;
+    Expr value;
+} Substitution;
+
+typedef struct {
+    Substitution *data;
+    size_t count, capacity;
+} Substitution_List;
+
+typedef enum {
+    CALL_GRAPH_UNVISITED = 0,
+    CALL_GRAPH_VISITING,
+    CALL_GRAPH_VISITED,
+} Call_Graph_State;
+
+typedef struct {
+    Func_Def *fdef;
+    Call_Graph_State state;
+    bool is_recursive;
+    bool is_leaf;
+    bool is_pure;
+    size_t size;
+} Call_Graph_Node;
+
+typedef struct {
+    Arena *arena;
+    const Optimizer_Options *options;
+    Module *module;
+    Call_Graph_Node *nodes;
+    size_t inline_count;
+    size_t cse_count;
+    size_t temp_count;
+    Comptime *comptime;
+    size_t comptime_count;
+    size_t dead_functions_count;
+    size_t dead_functions_size;
+} Optimizer;
+
+typedef struct {
+    String_View *data;
+    size_t count, capacity;
+} Name_List;
+
+static void push_substitution(Arena *arena, Substitution_List *list, String_View name, Expr value)
+{
+    if(list->count >= list->capacity) {
+        size_t new_capacity = list->capacity * 2;
+        if(new_capacity == 0) new_capacity = 32;
+        void *new_data = arena_alloc(arena, new_capacity * sizeof(*list->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, list->data, list->count * sizeof(*list->data));
+        list->data = new_data;
+        list->capacity = new_capacity;
+    }
+
+    list->data[list->count].name = name;
+    list->data[list->count].value = value;
+    list->count += 1;
+}
+
+static const Expr *find_substitution(const Substitution_List *list, String_View name)
+{
+    if(!list) return NULL;
+    for(size_t i = 0; i < list->count; ++i) {
+        if(sv_eq(list->data[i].name, name)) {
+            return &list->data[i].value;
+        }
+    }
+    return NULL;
+}
+
+static String_View rename_var(const Substitution_List *list, String_View name)
+{
+    const Expr *value = find_substitution(list, name);
+    if(value && value->type == EXPR_VAR_READ) {
+        return value->as.var_read.name;
+    }
+    return name;
+}
+
+static String_View make_inline_var_name(Arena *arena, String_View name, size_t id)
+{
+    int length = snprintf(NULL, 0, SV_FMT"__inl%zu", SV_ARGV(name), id);
+    char *data = arena_alloc(arena, length + 1);
+    snprintf(data, length + 1, SV_FMT"__inl%zu", SV_ARGV(name), id);
+    return sv_from_parts(data, length);
+}
+
+static void push_name(Arena *arena, Name_List *list, String_View name)
+{
+    if(list->count >= list->capacity) {
+        size_t new_capacity = list->capacity * 2;
+        if(new_capacity == 0) new_capacity = 32;
+        void *new_data = arena_alloc(arena, new_capacity * sizeof(*list->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, list->data, list->count * sizeof(*list->data));
+        list->data = new_data;
+        list->capacity = new_capacity;
+    }
+
+    list->data[list->count++] = name;
+}
+
+static bool has_name(const Name_List *list, String_View name)
+{
+    for(size_t i = 0; i < list->count; ++i) {
+        if(sv_eq(list->data[i], name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static String_View make_temp_var_name(Arena *arena, const char *prefix, size_t id)
+{
+    int length = snprintf(NULL, 0, "__%s%zu", prefix, id);
+    char *data = arena_alloc(arena, length + 1);
+    snprintf(data, length + 1, "__%s%zu", prefix, id);
+    return sv_from_parts(data, length);
+}
+
+static Expr make_var_read(Location loc, String_View name)
+{
+    Expr result = {0};
+    result.loc = loc;
+    result.type = EXPR_VAR_READ;
+    result.as.var_read.loc = loc;
+    result.as.var_read.name = name;
+    return result;
+}
+
+static Expr make_integer_literal(Location loc, int64_t value)
+{
+    Expr result = {0};
+    result.loc = loc;
+    result.type = EXPR_INTEGER_LITERAL;
+    result.as.literal_int = value;
+    return result;
+}
+
+static Expr make_bool_literal(Location loc, bool value)
+{
+    Expr result = {0};
+    result.loc = loc;
+    result.type = EXPR_BOOL_LITERAL;
+    result.as.literal_bool = value;
+    return result;
+}
+
+static Stmt make_var_init(Location loc, String_View name, Expr value)
+{
+    Stmt result = {0};
+    result.loc = loc;
+    result.type = STMT_VAR_INIT;
+    result.as.var_init.name = name;
+    result.as.var_init.infer_type = true;
+    result.as.var_init.value = value;
+    return result;
+}
+
+static Call_Graph_Node *find_call_graph_node(Optimizer *opt, String_View name)
+{
+    for(size_t i = 0; i < opt->module->functions.count; ++i) {
+        if(sv_eq(opt->nodes[i].fdef->name, name)) {
+            return &opt->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static size_t block_size(const Block *block);
+
+static size_t expr_size(const Expr *expr)
+{
+    size_t result = 1;
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                result += expr_size(&expr->as.binop->left);
+                result += expr_size(&expr->as.binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    result += expr_size(&expr->as.func_call.args.data[i]);
+            } break;
+        default:
+            break;
+    }
+    return result;
+}
+
+static size_t stmt_size(const Stmt *stmt)
+{
+    size_t result = 1;
+    switch(stmt->type) {
+        case STMT_RETURN: result += expr_size(&stmt->as._return.value); break;
+        case STMT_VAR_INIT: result += expr_size(&stmt->as.var_init.value); break;
+        case STMT_VAR_ASSIGN: result += expr_size(&stmt->as.var_assign.value); break;
+        case STMT_EXPR: result += expr_size(&stmt->as.expr); break;
+        case STMT_WHILE:
+            {
+                result += expr_size(&stmt->as._while.condition);
+                result += block_size(&stmt->as._while.todo);
+            } break;
+        case STMT_IF:
+            {
+                for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                    result += expr_size(&branch->condition);
+                    result += block_size(&branch->todo);
+                }
+                result += block_size(&stmt->as._if._else);
+            } break;
+        case STMT_SWITCH:
+            {
+                result += expr_size(&stmt->as._switch.value);
+                for(size_t i = 0; i < stmt->as._switch.cases.count; ++i)
+                    result += stmt->as._switch.cases.data[i].ranges.count + block_size(&stmt->as._switch.cases.data[i].todo);
+                result += block_size(&stmt->as._switch._default);
+            } break;
+        default:
+            break;
+    }
+    return result;
+}
+
+static size_t block_size(const Block *block)
+{
+    size_t result = 0;
+    for(size_t i = 0; i < block->count; ++i)
+        result += stmt_size(&block->data[i]);
+    return result;
+}
+
+static bool expr_has_call(const Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_FUNCALL: return true;
+        case EXPR_BINARY_OP: return expr_has_call(&expr->as.binop->left) || expr_has_call(&expr->as.binop->right);
+        default: return false;
+    }
+}
+
+static bool block_has_call(const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: if(expr_has_call(&stmt->as._return.value)) return true; break;
+            case STMT_VAR_INIT: if(expr_has_call(&stmt->as.var_init.value)) return true; break;
+            case STMT_VAR_ASSIGN: if(expr_has_call(&stmt->as.var_assign.value)) return true; break;
+            case STMT_EXPR: if(expr_has_call(&stmt->as.expr)) return true; break;
+            case STMT_WHILE:
+                {
+                    if(expr_has_call(&stmt->as._while.condition)) return true;
+                    if(block_has_call(&stmt->as._while.todo)) return true;
+                } break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        if(expr_has_call(&branch->condition)) return true;
+                        if(block_has_call(&branch->todo)) return true;
+                    }
+                    if(block_has_call(&stmt->as._if._else)) return true;
+                } break;
+            case STMT_SWITCH:
+                {
+                    if(expr_has_call(&stmt->as._switch.value)) return true;
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j) {
+                        if(block_has_call(&stmt->as._switch.cases.data[j].todo)) return true;
+                    }
+                    if(block_has_call(&stmt->as._switch._default)) return true;
+                } break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static bool block_has_return(const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: return true;
+            case STMT_WHILE: if(block_has_return(&stmt->as._while.todo)) return true; break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        if(block_has_return(&branch->todo)) return true;
+                    }
+                    if(block_has_return(&stmt->as._if._else)) return true;
+                } break;
+            case STMT_SWITCH:
+                {
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j) {
+                        if(block_has_return(&stmt->as._switch.cases.data[j].todo)) return true;
+                    }
+                    if(block_has_return(&stmt->as._switch._default)) return true;
+                } break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static size_t count_var_reads(const Expr *expr, String_View name)
+{
+    switch(expr->type) {
+        case EXPR_VAR_READ: return sv_eq(expr->as.var_read.name, name) ? 1 : 0;
+        case EXPR_BINARY_OP: return count_var_reads(&expr->as.binop->left, name) + count_var_reads(&expr->as.binop->right, name);
+        case EXPR_FUNCALL:
+            {
+                size_t result = 0;
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    result += count_var_reads(&expr->as.func_call.args.data[i], name);
+                return result;
+            }
+        default: return 0;
+    }
+}
+
+static bool expr_is_trivial(const Expr *expr)
+{
+    return expr->type == EXPR_INTEGER_LITERAL || expr->type == EXPR_BOOL_LITERAL || expr->type == EXPR_VAR_READ;
+}
+
+static Expr clone_expr(Arena *arena, const Expr *expr, const Substitution_List *subst)
+{
+    Expr result = *expr;
+    switch(expr->type) {
+        case EXPR_VAR_READ:
+            {
+                const Expr *value = find_substitution(subst, expr->as.var_read.name);
+                if(value) return clone_expr(arena, value, NULL);
+            } break;
+        case EXPR_BINARY_OP:
+            {
+                result.as.binop = arena_alloc(arena, sizeof(Expr_Binary_Op));
+                if(!result.as.binop) {
+                    fatal("Failed to allocate for expression: Buy more RAM LOL");
+                }
+                *result.as.binop = *expr->as.binop;
+                result.as.binop->left = clone_expr(arena, &expr->as.binop->left, subst);
+                result.as.binop->right = clone_expr(arena, &expr->as.binop->right, subst);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                Expr_List args = {0};
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    push_expr_to_expr_list(arena, &args, clone_expr(arena, &expr->as.func_call.args.data[i], subst));
+                result.as.func_call.args = args;
+            } break;
+        default:
+            break;
+    }
+    return result;
+}
+
+static Block clone_block(Arena *arena, const Block *block, const Substitution_List *subst);
+
+static Stmt clone_stmt(Arena *arena, const Stmt *stmt, const Substitution_List *subst)
+{
+    Stmt result = *stmt;
+    switch(stmt->type) {
+        case STMT_RETURN:
+            {
+                result.as._return.value = clone_expr(arena, &stmt->as._return.value, subst);
+            } break;
+        case STMT_VAR_DEF:
+            {
+                result.as.var_def.name = rename_var(subst, stmt->as.var_def.name);
+            } break;
+        case STMT_VAR_INIT:
+            {
+                result.as.var_init.name = rename_var(subst, stmt->as.var_init.name);
+                result.as.var_init.value = clone_expr(arena, &stmt->as.var_init.value, subst);
+            } break;
+        case STMT_VAR_ASSIGN:
+            {
+                result.as.var_assign.name = rename_var(subst, stmt->as.var_assign.name);
+                result.as.var_assign.value = clone_expr(arena, &stmt->as.var_assign.value, subst);
+            } break;
+        case STMT_EXPR:
+            {
+                result.as.expr = clone_expr(arena, &stmt->as.expr, subst);
+            } break;
+        case STMT_WHILE:
+            {
+                result.as._while.condition = clone_expr(arena, &stmt->as._while.condition, subst);
+                result.as._while.todo = clone_block(arena, &stmt->as._while.todo, subst);
+            } break;
+        case STMT_IF:
+            {
+                Stmt_If *prev = &result.as._if;
+                prev->condition = clone_expr(arena, &stmt->as._if.condition, subst);
+                prev->todo = clone_block(arena, &stmt->as._if.todo, subst);
+                for(const Stmt_If *branch = stmt->as._if.elif; branch != NULL; branch = branch->elif) {
+                    Stmt_If *elif = arena_alloc(arena, sizeof(Stmt_If));
+                    *elif = *branch;
+                    elif->condition = clone_expr(arena, &branch->condition, subst);
+                    elif->todo = clone_block(arena, &branch->todo, subst);
+                    prev->elif = elif;
+                    prev = elif;
+                }
+                result.as._if._else = clone_block(arena, &stmt->as._if._else, subst);
+            } break;
+        case STMT_SWITCH:
+            {
+                result.as._switch.value = clone_expr(arena, &stmt->as._switch.value, subst);
+                result.as._switch.cases = (Switch_Case_List){0};
+                for(size_t i = 0; i < stmt->as._switch.cases.count; ++i) {
+                    Switch_Case _case = stmt->as._switch.cases.data[i];
+                    _case.todo = clone_block(arena, &_case.todo, subst);
+                    push_case_to_switch_case_list(arena, &result.as._switch.cases, _case);
+                }
+                result.as._switch._default = clone_block(arena, &stmt->as._switch._default, subst);
+            } break;
+        default:
+            break;
+    }
+    return result;
+}
+
+static Block clone_block(Arena *arena, const Block *block, const Substitution_List *subst)
+{
+    Block result = {0};
+    for(size_t i = 0; i < block->count; ++i)
+        push_stmt_to_block(arena, &result, clone_stmt(arena, &block->data[i], subst));
+    return result;
+}
+
+static void rename_block_locals(Optimizer *opt, const Block *block, Substitution_List *subst, size_t id)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        String_View name = {0};
+        switch(stmt->type) {
+            case STMT_VAR_DEF: name = stmt->as.var_def.name; break;
+            case STMT_VAR_INIT: name = stmt->as.var_init.name; break;
+            case STMT_WHILE: rename_block_locals(opt, &stmt->as._while.todo, subst, id); break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif)
+                        rename_block_locals(opt, &branch->todo, subst, id);
+                    rename_block_locals(opt, &stmt->as._if._else, subst, id);
+                } break;
+            case STMT_SWITCH:
+                {
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        rename_block_locals(opt, &stmt->as._switch.cases.data[j].todo, subst, id);
+                    rename_block_locals(opt, &stmt->as._switch._default, subst, id);
+                } break;
+            default:
+                break;
+        }
+
+        if(name.count > 0 && find_substitution(subst, name) == NULL) {
+            Expr renamed = {0};
+            renamed.loc = stmt->loc;
+            renamed.type = EXPR_VAR_READ;
+            renamed.as.var_read.loc = stmt->loc;
+            renamed.as.var_read.name = make_inline_var_name(opt->arena, name, id);
+            push_substitution(opt->arena, subst, name, renamed);
+        }
+    }
+}
+
+static bool should_inline(Optimizer *opt, const Call_Graph_Node *callee, size_t loop_depth)
+{
+    if(!opt->options->inline_functions) return false;
+    if(callee->state != CALL_GRAPH_VISITED || callee->is_recursive) return false;
+
+    switch(callee->fdef->inline_hint) {
+        case FUNC_INLINE_NEVER: return false;
+        case FUNC_INLINE_ALWAYS: return true;
+        default: break;
+    }
+
+    if(callee->is_leaf && callee->size <= opt->options->inline_leaf_size) return true;
+    size_t budget = opt->options->inline_threshold << (loop_depth < 2 ? loop_depth : 2);
+    return callee->size <= budget;
+}
+
+// Replace the call with the callee's returned expression. Only possible when the callee is a single
+// `return` and every argument can be substituted without duplicating or reordering side effects.
+static bool inline_call_as_expr(Optimizer *opt, const Call_Graph_Node *callee, const Expr *call, Expr *result)
+{
+    const Func_Def *fdef = callee->fdef;
+    if(fdef->body.count != 1 || fdef->body.data[0].type != STMT_RETURN) return false;
+    if(fdef->params.count != call->as.func_call.args.count) return false;
+
+    const Expr *value = &fdef->body.data[0].as._return.value;
+    Substitution_List subst = {0};
+    for(size_t i = 0; i < fdef->params.count; ++i) {
+        const Expr *arg = &call->as.func_call.args.data[i];
+        size_t uses = count_var_reads(value, fdef->params.data[i].name);
+        if(!expr_is_trivial(arg) && !(uses == 1 && !expr_has_call(arg))) return false;
+        push_substitution(opt->arena, &subst, fdef->params.data[i].name, *arg);
+    }
+
+    *result = clone_expr(opt->arena, value, &subst);
+    return true;
+}
+
+// Splice the callee's body in front of the statement containing the call. Parameters become local
+// variables initialized by the arguments and every local of the callee gets a unique name. The value
+// of the trailing `return` (if any) is given back so the caller statement can use it instead of the call.
+static bool inline_call_as_stmts(Optimizer *opt, const Call_Graph_Node *callee, const Expr *call, Block *out, Expr *value)
+{
+    const Func_Def *fdef = callee->fdef;
+    if(fdef->params.count != call->as.func_call.args.count) return false;
+
+    Block body = fdef->body;
+    Expr returned = {0};
+    if(body.count > 0 && body.data[body.count - 1].type == STMT_RETURN) {
+        returned = body.data[body.count - 1].as._return.value;
+        body.count -= 1;
+    }
+    if(block_has_return(&body)) return false;
+
+    size_t id = opt->inline_count++;
+    Substitution_List subst = {0};
+    for(size_t i = 0; i < fdef->params.count; ++i) {
+        const Func_Param *param = &fdef->params.data[i];
+        Stmt init = {0};
+        init.loc = call->loc;
+        init.type = STMT_VAR_INIT;
+        init.as.var_init.name = make_inline_var_name(opt->arena, param->name, id);
+        init.as.var_init.type = param->type;
+        init.as.var_init.infer_type = false;
+        init.as.var_init.value = call->as.func_call.args.data[i];
+        push_stmt_to_block(opt->arena, out, init);
+
+        Expr renamed = {0};
+        renamed.loc = param->loc;
+        renamed.type = EXPR_VAR_READ;
+        renamed.as.var_read.loc = param->loc;
+        renamed.as.var_read.name = init.as.var_init.name;
+        push_substitution(opt->arena, &subst, param->name, renamed);
+    }
+    rename_block_locals(opt, &body, &subst, id);
+
+    for(size_t i = 0; i < body.count; ++i)
+        push_stmt_to_block(opt->arena, out, clone_stmt(opt->arena, &body.data[i], &subst));
+
+    if(returned.type != EXPR_UNKNOWN) {
+        *value = clone_expr(opt->arena, &returned, &subst);
+    } else {
+        value->type = EXPR_UNKNOWN;
+    }
+    return true;
+}
+
+static Expr inline_expr(Optimizer *opt, const Expr *expr, size_t loop_depth)
+{
+    Expr result = *expr;
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                result.as.binop = arena_alloc(opt->arena, sizeof(Expr_Binary_Op));
+                if(!result.as.binop) {
+                    fatal("Failed to allocate for expression: Buy more RAM LOL");
+                }
+                *result.as.binop = *expr->as.binop;
+                result.as.binop->left = inline_expr(opt, &expr->as.binop->left, loop_depth);
+                result.as.binop->right = inline_expr(opt, &expr->as.binop->right, loop_depth);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                Expr_List args = {0};
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    push_expr_to_expr_list(opt->arena, &args, inline_expr(opt, &expr->as.func_call.args.data[i], loop_depth));
+                result.as.func_call.args = args;
+
+                Call_Graph_Node *callee = find_call_graph_node(opt, expr->as.func_call.name);
+                Expr inlined = {0};
+                if(callee && should_inline(opt, callee, loop_depth) && inline_call_as_expr(opt, callee, &result, &inlined)) {
+                    return inlined;
+                }
+            } break;
+        default:
+            break;
+    }
+    return result;
+}
+
+static Expr inline_stmt_value(Optimizer *opt, Block *out, const Expr *expr, size_t loop_depth)
+{
+    Expr result = inline_expr(opt, expr, loop_depth);
+    if(result.type == EXPR_FUNCALL) {
+        Call_Graph_Node *callee = find_call_graph_node(opt, result.as.func_call.name);
+        Expr value = {0};
+        if(callee && should_inline(opt, callee, loop_depth) && inline_call_as_stmts(opt, callee, &result, out, &value)) {
+            return value;
+        }
+    }
+    return result;
+}
+
+static Block inline_block(Optimizer *opt, const Block *block, size_t loop_depth)
+{
+    Block result = {0};
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt stmt = block->data[i];
+        switch(stmt.type) {
+            case STMT_RETURN:
+                {
+                    stmt.as._return.value = inline_stmt_value(opt, &result, &stmt.as._return.value, loop_depth);
+                } break;
+            case STMT_VAR_INIT:
+                {
+                    stmt.as.var_init.value = inline_stmt_value(opt, &result, &stmt.as.var_init.value, loop_depth);
+                } break;
+            case STMT_VAR_ASSIGN:
+                {
+                    stmt.as.var_assign.value = inline_stmt_value(opt, &result, &stmt.as.var_assign.value, loop_depth);
+                } break;
+            case STMT_EXPR:
+                {
+                    stmt.as.expr = inline_stmt_value(opt, &result, &stmt.as.expr, loop_depth);
+                    // A void function has been inlined completely, nothing is left of the call
+                    if(stmt.as.expr.type == EXPR_UNKNOWN) continue;
+                } break;
+            case STMT_WHILE:
+                {
+                    stmt.as._while.condition = inline_expr(opt, &stmt.as._while.condition, loop_depth + 1);
+                    stmt.as._while.todo = inline_block(opt, &stmt.as._while.todo, loop_depth + 1);
+                } break;
+            case STMT_IF:
+                {
+                    Stmt_If *prev = &stmt.as._if;
+                    prev->condition = inline_expr(opt, &prev->condition, loop_depth);
+                    prev->todo = inline_block(opt, &prev->todo, loop_depth);
+                    for(const Stmt_If *branch = block->data[i].as._if.elif; branch != NULL; branch = branch->elif) {
+                        Stmt_If *elif = arena_alloc(opt->arena, sizeof(Stmt_If));
+                        *elif = *branch;
+                        elif->condition = inline_expr(opt, &branch->condition, loop_depth);
+                        elif->todo = inline_block(opt, &branch->todo, loop_depth);
+                        prev->elif = elif;
+                        prev = elif;
+                    }
+                    stmt.as._if._else = inline_block(opt, &stmt.as._if._else, loop_depth);
+                } break;
+            case STMT_SWITCH:
+                {
+                    stmt.as._switch.value = inline_expr(opt, &stmt.as._switch.value, loop_depth);
+                    stmt.as._switch.cases = (Switch_Case_List){0};
+                    for(size_t j = 0; j < block->data[i].as._switch.cases.count; ++j) {
+                        Switch_Case _case = block->data[i].as._switch.cases.data[j];
+                        _case.todo = inline_block(opt, &_case.todo, loop_depth);
+                        push_case_to_switch_case_list(opt->arena, &stmt.as._switch.cases, _case);
+                    }
+                    stmt.as._switch._default = inline_block(opt, &stmt.as._switch._default, loop_depth);
+                } break;
+            default:
+                break;
+        }
+        push_stmt_to_block(opt->arena, &result, stmt);
+    }
+    return result;
+}
+
+// Calls whose arguments are all literals are evaluated when the callee is `comptime`, or pure and
+// folding is enabled. The result replaces the call as long as it can be written as a literal, which
+// only `i32` and `bool` values can be. Arguments are folded first so nested calls fold bottom-up
+static void fold_comptime_calls(Optimizer *opt, Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                fold_comptime_calls(opt, &expr->as.binop->left);
+                fold_comptime_calls(opt, &expr->as.binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                bool constant = true;
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i) {
+                    Expr *arg = &expr->as.func_call.args.data[i];
+                    fold_comptime_calls(opt, arg);
+                    if(arg->type != EXPR_INTEGER_LITERAL && arg->type != EXPR_BOOL_LITERAL) constant = false;
+                }
+                Call_Graph_Node *callee = find_call_graph_node(opt, expr->as.func_call.name);
+                if(!constant || !callee) break;
+                bool required = callee->fdef->is_comptime;
+                if(!required && !(opt->options->fold_comptime_calls && callee->is_pure)) break;
+
+                Comptime_Value value;
+                if(!comptime_eval_call(opt->comptime, expr, &value)) {
+                    if(!required) break;
+                    compilation_error(expr->loc, "Failed to evaluate `"SV_FMT"` at compile time, %s\n",
+                            SV_ARGV(expr->as.func_call.name), opt->comptime->error);
+                    compilation_failure();
+                }
+                if(value.type == NATIVE_TYPE_I32) {
+                    *expr = make_integer_literal(expr->loc, value.value);
+                } else if(value.type == NATIVE_TYPE_BOOL) {
+                    *expr = make_bool_literal(expr->loc, value.value);
+                } else {
+                    if(!required) break;
+                    compilation_error(expr->loc, "Only `i32` and `bool` results of `"SV_FMT"` can be folded into literals\n",
+                            SV_ARGV(expr->as.func_call.name));
+                    compilation_failure();
+                }
+                opt->comptime_count += 1;
+            } break;
+        default:
+            break;
+    }
+}
+
+static void fold_comptime_calls_in_block(Optimizer *opt, Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: fold_comptime_calls(opt, &stmt->as._return.value); break;
+            case STMT_VAR_INIT: fold_comptime_calls(opt, &stmt->as.var_init.value); break;
+            case STMT_VAR_ASSIGN: fold_comptime_calls(opt, &stmt->as.var_assign.value); break;
+            case STMT_EXPR: fold_comptime_calls(opt, &stmt->as.expr); break;
+            case STMT_WHILE:
+                {
+                    fold_comptime_calls(opt, &stmt->as._while.condition);
+                    fold_comptime_calls_in_block(opt, &stmt->as._while.todo);
+                } break;
+            case STMT_IF:
+                {
+                    for(Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        fold_comptime_calls(opt, &branch->condition);
+                        fold_comptime_calls_in_block(opt, &branch->todo);
+                    }
+                    fold_comptime_calls_in_block(opt, &stmt->as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    fold_comptime_calls(opt, &stmt->as._switch.value);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        fold_comptime_calls_in_block(opt, &stmt->as._switch.cases.data[j].todo);
+                    fold_comptime_calls_in_block(opt, &stmt->as._switch._default);
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+static void visit_function(Optimizer *opt, Call_Graph_Node *node);
+
+static void visit_expr_callees(Optimizer *opt, const Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                visit_expr_callees(opt, &expr->as.binop->left);
+                visit_expr_callees(opt, &expr->as.binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    visit_expr_callees(opt, &expr->as.func_call.args.data[i]);
+                Call_Graph_Node *callee = find_call_graph_node(opt, expr->as.func_call.name);
+                if(!callee) break;
+                if(callee->state == CALL_GRAPH_VISITING) {
+                    callee->is_recursive = true;
+                } else if(callee->state == CALL_GRAPH_UNVISITED) {
+                    visit_function(opt, callee);
+                }
+            } break;
+        default:
+            break;
+    }
+}
+
+static void visit_block_callees(Optimizer *opt, const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: visit_expr_callees(opt, &stmt->as._return.value); break;
+            case STMT_VAR_INIT: visit_expr_callees(opt, &stmt->as.var_init.value); break;
+            case STMT_VAR_ASSIGN: visit_expr_callees(opt, &stmt->as.var_assign.value); break;
+            case STMT_EXPR: visit_expr_callees(opt, &stmt->as.expr); break;
+            case STMT_WHILE:
+                {
+                    visit_expr_callees(opt, &stmt->as._while.condition);
+                    visit_block_callees(opt, &stmt->as._while.todo);
+                } break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        visit_expr_callees(opt, &branch->condition);
+                        visit_block_callees(opt, &branch->todo);
+                    }
+                    visit_block_callees(opt, &stmt->as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    visit_expr_callees(opt, &stmt->as._switch.value);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        visit_block_callees(opt, &stmt->as._switch.cases.data[j].todo);
+                    visit_block_callees(opt, &stmt->as._switch._default);
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+// Callees are optimized before their callers (post-order over the call graph) so that what gets
+// inlined is already flattened. A callee that is still being visited means a call cycle. Calls are
+// folded before inlining takes them apart and once more for the constant calls inlining exposed
+static void visit_function(Optimizer *opt, Call_Graph_Node *node)
+{
+    node->state = CALL_GRAPH_VISITING;
+    visit_block_callees(opt, &node->fdef->body);
+    fold_comptime_calls_in_block(opt, &node->fdef->body);
+    node->fdef->body = inline_block(opt, &node->fdef->body, 0);
+    fold_comptime_calls_in_block(opt, &node->fdef->body);
+    node->size = block_size(&node->fdef->body);
+    node->is_leaf = !block_has_call(&node->fdef->body);
+    node->state = CALL_GRAPH_VISITED;
+}
+
+static void collect_written_vars(Arena *arena, const Block *block, Name_List *names)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_VAR_DEF: push_name(arena, names, stmt->as.var_def.name); break;
+            case STMT_VAR_INIT: push_name(arena, names, stmt->as.var_init.name); break;
+            case STMT_VAR_ASSIGN: push_name(arena, names, stmt->as.var_assign.name); break;
+            case STMT_WHILE: collect_written_vars(arena, &stmt->as._while.todo, names); break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif)
+                        collect_written_vars(arena, &branch->todo, names);
+                    collect_written_vars(arena, &stmt->as._if._else, names);
+                } break;
+            case STMT_SWITCH:
+                {
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        collect_written_vars(arena, &stmt->as._switch.cases.data[j].todo, names);
+                    collect_written_vars(arena, &stmt->as._switch._default, names);
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+static size_t count_var_writes(const Block *block, String_View name)
+{
+    size_t result = 0;
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_VAR_DEF: result += sv_eq(stmt->as.var_def.name, name); break;
+            case STMT_VAR_INIT: result += sv_eq(stmt->as.var_init.name, name); break;
+            case STMT_VAR_ASSIGN: result += sv_eq(stmt->as.var_assign.name, name); break;
+            case STMT_WHILE: result += count_var_writes(&stmt->as._while.todo, name); break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif)
+                        result += count_var_writes(&branch->todo, name);
+                    result += count_var_writes(&stmt->as._if._else, name);
+                } break;
+            case STMT_SWITCH:
+                {
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        result += count_var_writes(&stmt->as._switch.cases.data[j].todo, name);
+                    result += count_var_writes(&stmt->as._switch._default, name);
+                } break;
+            default:
+                break;
+        }
+    }
+    return result;
+}
+
+static size_t count_block_var_reads(const Block *block, size_t end, String_View name)
+{
+    size_t result = 0;
+    for(size_t i = 0; i < block->count && i < end; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: result += count_var_reads(&stmt->as._return.value, name); break;
+            case STMT_VAR_INIT: result += count_var_reads(&stmt->as.var_init.value, name); break;
+            case STMT_VAR_ASSIGN: result += count_var_reads(&stmt->as.var_assign.value, name); break;
+            case STMT_EXPR: result += count_var_reads(&stmt->as.expr, name); break;
+            case STMT_WHILE:
+                {
+                    result += count_var_reads(&stmt->as._while.condition, name);
+                    result += count_block_var_reads(&stmt->as._while.todo, SIZE_MAX, name);
+                } break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        result += count_var_reads(&branch->condition, name);
+                        result += count_block_var_reads(&branch->todo, SIZE_MAX, name);
+                    }
+                    result += count_block_var_reads(&stmt->as._if._else, SIZE_MAX, name);
+                } break;
+            case STMT_SWITCH:
+                {
+                    result += count_var_reads(&stmt->as._switch.value, name);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        result += count_block_var_reads(&stmt->as._switch.cases.data[j].todo, SIZE_MAX, name);
+                    result += count_block_var_reads(&stmt->as._switch._default, SIZE_MAX, name);
+                } break;
+            default:
+                break;
+        }
+    }
+    return result;
+}
+
+// Division is left in place since hoisting it out of a loop that never runs could introduce a trap
+static bool expr_is_loop_invariant(const Expr *expr, const Name_List *written)
+{
+    switch(expr->type) {
+        case EXPR_INTEGER_LITERAL:
+        case EXPR_BOOL_LITERAL:
+            return true;
+        case EXPR_VAR_READ:
+            return !has_name(written, expr->as.var_read.name);
+        case EXPR_BINARY_OP:
+            {
+                Binary_Op_Type type = expr->as.binop->type;
+                if(type == BINARY_OP_DIV || type == BINARY_OP_MOD) return false;
+                return expr_is_loop_invariant(&expr->as.binop->left, written) 
+                    && expr_is_loop_invariant(&expr->as.binop->right, written);
+            }
+        default:
+            return false;
+    }
+}
+
+typedef struct {
+    Optimizer *opt;
+    const Name_List *written;
+    Block *preheader;
+} Loop_Hoist;
+
+static void hoist_invariant_exprs(Loop_Hoist *hoist, Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                if(expr_is_loop_invariant(expr, hoist->written)) {
+                    String_View name = make_temp_var_name(hoist->opt->arena, "licm", hoist->opt->temp_count++);
+                    push_stmt_to_block(hoist->opt->arena, hoist->preheader, make_var_init(expr->loc, name, *expr));
+                    *expr = make_var_read(expr->loc, name);
+                    return;
+                }
+                hoist_invariant_exprs(hoist, &expr->as.binop->left);
+                hoist_invariant_exprs(hoist, &expr->as.binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    hoist_invariant_exprs(hoist, &expr->as.func_call.args.data[i]);
+            } break;
+        default:
+            break;
+    }
+}
+
+static void hoist_invariant_exprs_in_block(Loop_Hoist *hoist, Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: hoist_invariant_exprs(hoist, &stmt->as._return.value); break;
+            case STMT_VAR_INIT: hoist_invariant_exprs(hoist, &stmt->as.var_init.value); break;
+            case STMT_VAR_ASSIGN: hoist_invariant_exprs(hoist, &stmt->as.var_assign.value); break;
+            case STMT_EXPR: hoist_invariant_exprs(hoist, &stmt->as.expr); break;
+            case STMT_WHILE:
+                {
+                    hoist_invariant_exprs(hoist, &stmt->as._while.condition);
+                    hoist_invariant_exprs_in_block(hoist, &stmt->as._while.todo);
+                } break;
+            case STMT_IF:
+                {
+                    for(Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        hoist_invariant_exprs(hoist, &branch->condition);
+                        hoist_invariant_exprs_in_block(hoist, &branch->todo);
+                    }
+                    hoist_invariant_exprs_in_block(hoist, &stmt->as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    hoist_invariant_exprs(hoist, &stmt->as._switch.value);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        hoist_invariant_exprs_in_block(hoist, &stmt->as._switch.cases.data[j].todo);
+                    hoist_invariant_exprs_in_block(hoist, &stmt->as._switch._default);
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+// Move `var x = <invariant>` out of the loop as long as `x` is written only there and nothing in the
+// loop reads it before. Every hoisted variable may make more of the loop invariant, so repeat until
+// nothing moves.
+static void hoist_invariant_var_inits(Optimizer *opt, Stmt_While *loop, Block *preheader)
+{
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        Name_List written = {0};
+        collect_written_vars(opt->arena, &loop->todo, &written);
+
+        Block body = {0};
+        for(size_t i = 0; i < loop->todo.count; ++i) {
+            const Stmt *stmt = &loop->todo.data[i];
+            if(stmt->type == STMT_VAR_INIT 
+                    && count_var_writes(&loop->todo, stmt->as.var_init.name) == 1
+                    && count_var_reads(&loop->condition, stmt->as.var_init.name) == 0
+                    && count_block_var_reads(&loop->todo, i, stmt->as.var_init.name) == 0
+                    && expr_is_loop_invariant(&stmt->as.var_init.value, &written)) {
+                push_stmt_to_block(opt->arena, preheader, *stmt);
+                changed = true;
+            } else {
+                push_stmt_to_block(opt->arena, &body, *stmt);
+            }
+        }
+        loop->todo = body;
+    }
+}
+
+typedef struct {
+    int64_t factor;
+    String_View name;
+} Reduced_Product;
+
+typedef struct {
+    Optimizer *opt;
+    String_View var;
+    Block *preheader;
+    Reduced_Product products[16];
+    size_t products_count;
+} Induction_Var;
+
+static bool match_induction_step(const Stmt *stmt, String_View *var, int64_t *step)
+{
+    if(stmt->type != STMT_VAR_ASSIGN) return false;
+    const Expr *value = &stmt->as.var_assign.value;
+    if(value->type != EXPR_BINARY_OP) return false;
+
+    const Expr_Binary_Op *binop = value->as.binop;
+    const Expr *left = &binop->left;
+    const Expr *right = &binop->right;
+    if(binop->type == BINARY_OP_ADD && left->type == EXPR_INTEGER_LITERAL) {
+        SWAP(const Expr *, left, right);
+    }
+    if(binop->type != BINARY_OP_ADD && binop->type != BINARY_OP_SUB) return false;
+    if(left->type != EXPR_VAR_READ || !sv_eq(left->as.var_read.name, stmt->as.var_assign.name)) return false;
+    if(right->type != EXPR_INTEGER_LITERAL) return false;
+
+    *var = stmt->as.var_assign.name;
+    *step = binop->type == BINARY_OP_ADD ? right->as.literal_int : -right->as.literal_int;
+    return true;
+}
+
+// Replace every `iv * c` by a variable that is kept equal to it, so the loop only has to add to it
+static void reduce_induction_products(Induction_Var *iv, Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                Expr_Binary_Op *binop = expr->as.binop;
+                const Expr *var = &binop->left;
+                const Expr *factor = &binop->right;
+                if(var->type == EXPR_INTEGER_LITERAL) SWAP(const Expr *, var, factor);
+                if(binop->type == BINARY_OP_MUL && var->type == EXPR_VAR_READ && sv_eq(var->as.var_read.name, iv->var)
+                        && factor->type == EXPR_INTEGER_LITERAL) {
+                    Reduced_Product *product = NULL;
+                    for(size_t i = 0; i < iv->products_count; ++i) {
+                        if(iv->products[i].factor == factor->as.literal_int) product = &iv->products[i];
+                    }
+                    if(!product) {
+                        if(iv->products_count >= sizeof(iv->products)/sizeof(iv->products[0])) return;
+                        product = &iv->products[iv->products_count++];
+                        product->factor = factor->as.literal_int;
+                        product->name = make_temp_var_name(iv->opt->arena, "iv", iv->opt->temp_count++);
+                        push_stmt_to_block(iv->opt->arena, iv->preheader, make_var_init(expr->loc, product->name, *expr));
+                    }
+                    *expr = make_var_read(expr->loc, product->name);
+                    return;
+                }
+                reduce_induction_products(iv, &binop->left);
+                reduce_induction_products(iv, &binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    reduce_induction_products(iv, &expr->as.func_call.args.data[i]);
+            } break;
+        default:
+            break;
+    }
+}
+
+static void reduce_induction_products_in_block(Induction_Var *iv, Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: reduce_induction_products(iv, &stmt->as._return.value); break;
+            case STMT_VAR_INIT: reduce_induction_products(iv, &stmt->as.var_init.value); break;
+            case STMT_VAR_ASSIGN: reduce_induction_products(iv, &stmt->as.var_assign.value); break;
+            case STMT_EXPR: reduce_induction_products(iv, &stmt->as.expr); break;
+            case STMT_WHILE:
+                {
+                    reduce_induction_products(iv, &stmt->as._while.condition);
+                    reduce_induction_products_in_block(iv, &stmt->as._while.todo);
+                } break;
+            case STMT_IF:
+                {
+                    for(Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        reduce_induction_products(iv, &branch->condition);
+                        reduce_induction_products_in_block(iv, &branch->todo);
+                    }
+                    reduce_induction_products_in_block(iv, &stmt->as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    reduce_induction_products(iv, &stmt->as._switch.value);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        reduce_induction_products_in_block(iv, &stmt->as._switch.cases.data[j].todo);
+                    reduce_induction_products_in_block(iv, &stmt->as._switch._default);
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+// A basic induction variable is declared outside of the loop and written exactly once, by a
+// `iv = iv +/- c` statement at the top level of the loop body
+static void reduce_induction_vars(Optimizer *opt, Stmt_While *loop, Block *preheader)
+{
+    for(size_t i = 0; i < loop->todo.count; ++i) {
+        Induction_Var iv = {0};
+        int64_t step = 0;
+        if(!match_induction_step(&loop->todo.data[i], &iv.var, &step)) continue;
+        if(count_var_writes(&loop->todo, iv.var) != 1) continue;
+
+        iv.opt = opt;
+        iv.preheader = preheader;
+        reduce_induction_products(&iv, &loop->condition);
+        reduce_induction_products_in_block(&iv, &loop->todo);
+        if(iv.products_count == 0) continue;
+
+        Block body = {0};
+        for(size_t j = 0; j < loop->todo.count; ++j) {
+            push_stmt_to_block(opt->arena, &body, loop->todo.data[j]);
+            if(j != i) continue;
+            for(size_t k = 0; k < iv.products_count; ++k) {
+                Location loc = loop->todo.data[j].loc;
+                Stmt update = {0};
+                update.loc = loc;
+                update.type = STMT_VAR_ASSIGN;
+                update.as.var_assign.name = iv.products[k].name;
+                update.as.var_assign.value.loc = loc;
+                update.as.var_assign.value.type = EXPR_BINARY_OP;
+                update.as.var_assign.value.as.binop = arena_alloc(opt->arena, sizeof(Expr_Binary_Op));
+                update.as.var_assign.value.as.binop->loc = loc;
+                update.as.var_assign.value.as.binop->type = BINARY_OP_ADD;
+                update.as.var_assign.value.as.binop->left = make_var_read(loc, iv.products[k].name);
+                update.as.var_assign.value.as.binop->right = make_integer_literal(loc, step * iv.products[k].factor);
+                push_stmt_to_block(opt->arena, &body, update);
+            }
+        }
+        loop->todo = body;
+    }
+}
+
+static Block optimize_loops_in_block(Optimizer *opt, const Block *block)
+{
+    Block result = {0};
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt stmt = block->data[i];
+        switch(stmt.type) {
+            case STMT_WHILE:
+                {
+                    // Inner loops first, whatever they hoist may be invariant in this loop as well
+                    Stmt_While *loop = &stmt.as._while;
+                    loop->todo = optimize_loops_in_block(opt, &loop->todo);
+
+                    Block preheader = {0};
+                    hoist_invariant_var_inits(opt, loop, &preheader);
+
+                    Name_List written = {0};
+                    collect_written_vars(opt->arena, &loop->todo, &written);
+                    Loop_Hoist hoist = { .opt = opt, .written = &written, .preheader = &preheader };
+                    hoist_invariant_exprs(&hoist, &loop->condition);
+                    hoist_invariant_exprs_in_block(&hoist, &loop->todo);
+
+                    reduce_induction_vars(opt, loop, &preheader);
+
+                    for(size_t j = 0; j < preheader.count; ++j)
+                        push_stmt_to_block(opt->arena, &result, preheader.data[j]);
+                } break;
+            case STMT_IF:
+                {
+                    for(Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif)
+                        branch->todo = optimize_loops_in_block(opt, &branch->todo);
+                    stmt.as._if._else = optimize_loops_in_block(opt, &stmt.as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    for(size_t j = 0; j < stmt.as._switch.cases.count; ++j) {
+                        Switch_Case *_case = &stmt.as._switch.cases.data[j];
+                        _case->todo = optimize_loops_in_block(opt, &_case->todo);
+                    }
+                    stmt.as._switch._default = optimize_loops_in_block(opt, &stmt.as._switch._default);
+                } break;
+            default:
+                break;
+        }
+        push_stmt_to_block(opt->arena, &result, stmt);
+    }
+    return result;
+}
+
+// Narrows [low, high] with a comparison of `var` against an integer literal, in either order
+static bool match_ladder_bound(const Expr *expr, String_View *var, int64_t *low, int64_t *high)
+{
+    if(expr->type != EXPR_BINARY_OP) return false;
+    const Expr_Binary_Op *binop = expr->as.binop;
+    Binary_Op_Type type = binop->type;
+    const Expr *left = &binop->left;
+    const Expr *right = &binop->right;
+    if(left->type == EXPR_INTEGER_LITERAL) {
+        // `c < v` is `v > c`
+        SWAP(const Expr *, left, right);
+        switch(type) {
+            case BINARY_OP_LT: type = BINARY_OP_GT; break;
+            case BINARY_OP_LE: type = BINARY_OP_GE; break;
+            case BINARY_OP_GT: type = BINARY_OP_LT; break;
+            case BINARY_OP_GE: type = BINARY_OP_LE; break;
+            default: break;
+        }
+    }
+    if(left->type != EXPR_VAR_READ || right->type != EXPR_INTEGER_LITERAL) return false;
+    if(var->count > 0 && !sv_eq(*var, left->as.var_read.name)) return false;
+    *var = left->as.var_read.name;
+
+    int64_t value = right->as.literal_int;
+    switch(type) {
+        case BINARY_OP_EQ:
+            {
+                if(value > *low) *low = value;
+                if(value < *high) *high = value;
+            } break;
+        case BINARY_OP_GT: value += 1; // fallthrough
+        case BINARY_OP_GE:
+            {
+                if(value > *low) *low = value;
+            } break;
+        case BINARY_OP_LT: value -= 1; // fallthrough
+        case BINARY_OP_LE:
+            {
+                if(value < *high) *high = value;
+            } break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+static bool match_ladder_conjunction(const Expr *expr, String_View *var, int64_t *low, int64_t *high)
+{
+    if(expr->type == EXPR_BINARY_OP && expr->as.binop->type == BINARY_OP_AND) {
+        return match_ladder_conjunction(&expr->as.binop->left, var, low, high)
+            && match_ladder_conjunction(&expr->as.binop->right, var, low, high);
+    }
+    return match_ladder_bound(expr, var, low, high);
+}
+
+// A condition of a ladder arm is a disjunction of bounded ranges of the same variable such as
+// `v == 1 || v == 2 || (10 <= v && v < 20)`
+static bool match_ladder_ranges(Optimizer *opt, const Expr *expr, String_View *var, Case_Range_List *ranges)
+{
+    if(expr->type == EXPR_BINARY_OP && expr->as.binop->type == BINARY_OP_OR) {
+        return match_ladder_ranges(opt, &expr->as.binop->left, var, ranges)
+            && match_ladder_ranges(opt, &expr->as.binop->right, var, ranges);
+    }
+    Case_Range range = { .low = INT64_MIN, .high = INT64_MAX };
+    if(!match_ladder_conjunction(expr, var, &range.low, &range.high)) return false;
+    if(range.low == INT64_MIN || range.high == INT64_MAX || range.low > range.high) return false;
+    push_range_to_case_range_list(opt->arena, ranges, range);
+    return true;
+}
+
+// An if/else-if ladder testing one variable against disjoint constant ranges is a switch, the
+// arms can be tested in any order so the backends are free to use a jump table or a binary search
+static bool convert_if_ladder(Optimizer *opt, const Stmt *stmt, Stmt_Switch *result)
+{
+    size_t arms = 0;
+    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) arms += 1;
+    if(arms < ELYSIA_IF_LADDER_MIN_ARMS) return false;
+
+    String_View var = {0};
+    Stmt_Switch _switch = {0};
+    _switch.loc = stmt->as._if.loc;
+    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+        Switch_Case _case = {0};
+        _case.loc = branch->loc;
+        _case.todo = branch->todo;
+        if(!match_ladder_ranges(opt, &branch->condition, &var, &_case.ranges)) return false;
+        for(size_t i = 0; i < _case.ranges.count; ++i) {
+            const Case_Range *range = &_case.ranges.data[i];
+            for(size_t j = 0; j < _switch.cases.count; ++j) {
+                for(size_t k = 0; k < _switch.cases.data[j].ranges.count; ++k) {
+                    const Case_Range *other = &_switch.cases.data[j].ranges.data[k];
+                    if(range->low <= other->high && other->low <= range->high) return false;
+                }
+            }
+            for(size_t k = 0; k < i; ++k) {
+                const Case_Range *other = &_case.ranges.data[k];
+                if(range->low <= other->high && other->low <= range->high) return false;
+            }
+        }
+        push_case_to_switch_case_list(opt->arena, &_switch.cases, _case);
+    }
+
+    _switch.value = make_var_read(stmt->loc, var);
+    _switch._default = stmt->as._if._else;
+    *result = _switch;
+    return true;
+}
+
+static Block convert_if_ladders_in_block(Optimizer *opt, const Block *block)
+{
+    Block result = {0};
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt stmt = block->data[i];
+        switch(stmt.type) {
+            case STMT_WHILE:
+                {
+                    stmt.as._while.todo = convert_if_ladders_in_block(opt, &stmt.as._while.todo);
+                } break;
+            case STMT_IF:
+                {
+                    for(Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif)
+                        branch->todo = convert_if_ladders_in_block(opt, &branch->todo);
+                    stmt.as._if._else = convert_if_ladders_in_block(opt, &stmt.as._if._else);
+
+                    Stmt_Switch _switch = {0};
+                    if(convert_if_ladder(opt, &stmt, &_switch)) {
+                        stmt.type = STMT_SWITCH;
+                        stmt.as._switch = _switch;
+                    }
+                } break;
+            case STMT_SWITCH:
+                {
+                    for(size_t j = 0; j < stmt.as._switch.cases.count; ++j) {
+                        Switch_Case *_case = &stmt.as._switch.cases.data[j];
+                        _case->todo = convert_if_ladders_in_block(opt, &_case->todo);
+                    }
+                    stmt.as._switch._default = convert_if_ladders_in_block(opt, &stmt.as._switch._default);
+                } break;
+            default:
+                break;
+        }
+        push_stmt_to_block(opt->arena, &result, stmt);
+    }
+    return result;
+}
+
+// A function is pure when it only calls pure functions and builtins, starting from every function
+// being pure until the call graph stops proving otherwise. Elysia has no globals nor stores
+// through pointers so calls are the only way a function could have an effect
+static bool expr_calls_impure(Optimizer *opt, const Expr *expr);
+
+static bool block_calls_impure(Optimizer *opt, const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: if(expr_calls_impure(opt, &stmt->as._return.value)) return true; break;
+            case STMT_VAR_INIT: if(expr_calls_impure(opt, &stmt->as.var_init.value)) return true; break;
+            case STMT_VAR_ASSIGN: if(expr_calls_impure(opt, &stmt->as.var_assign.value)) return true; break;
+            case STMT_EXPR: if(expr_calls_impure(opt, &stmt->as.expr)) return true; break;
+            case STMT_WHILE:
+                {
+                    if(expr_calls_impure(opt, &stmt->as._while.condition)) return true;
+                    if(block_calls_impure(opt, &stmt->as._while.todo)) return true;
+                } break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        if(expr_calls_impure(opt, &branch->condition)) return true;
+                        if(block_calls_impure(opt, &branch->todo)) return true;
+                    }
+                    if(block_calls_impure(opt, &stmt->as._if._else)) return true;
+                } break;
+            case STMT_SWITCH:
+                {
+                    if(expr_calls_impure(opt, &stmt->as._switch.value)) return true;
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j) {
+                        if(block_calls_impure(opt, &stmt->as._switch.cases.data[j].todo)) return true;
+                    }
+                    if(block_calls_impure(opt, &stmt->as._switch._default)) return true;
+                } break;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+static bool is_pure_call(Optimizer *opt, String_View name)
+{
+    if(find_builtin_fn(name) != BUILTIN_UNKNOWN) return true;
+    Native_Type_Info *constructor = find_native_type_info_by_name(name);
+    if(constructor && constructor->lanes > 0) return true;
+    Call_Graph_Node *callee = find_call_graph_node(opt, name);
+    return callee && callee->is_pure;
+}
+
+static bool expr_calls_impure(Optimizer *opt, const Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP: return expr_calls_impure(opt, &expr->as.binop->left) || expr_calls_impure(opt, &expr->as.binop->right);
+        case EXPR_FUNCALL:
+            {
+                if(!is_pure_call(opt, expr->as.func_call.name)) return true;
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i) {
+                    if(expr_calls_impure(opt, &expr->as.func_call.args.data[i])) return true;
+                }
+                return false;
+            }
+        default: return false;
+    }
+}
+
+static void find_pure_functions(Optimizer *opt)
+{
+    for(size_t i = 0; i < opt->module->functions.count; ++i)
+        opt->nodes[i].is_pure = true;
+
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(size_t i = 0; i < opt->module->functions.count; ++i) {
+            Call_Graph_Node *node = &opt->nodes[i];
+            if(node->is_pure && block_calls_impure(opt, &node->fdef->body)) {
+                node->is_pure = false;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool exprs_equal(const Expr *a, const Expr *b)
+{
+    if(a->type != b->type) return false;
+    switch(a->type) {
+        case EXPR_INTEGER_LITERAL: return a->as.literal_int == b->as.literal_int;
+        case EXPR_BOOL_LITERAL: return a->as.literal_bool == b->as.literal_bool;
+        case EXPR_VAR_READ: return sv_eq(a->as.var_read.name, b->as.var_read.name);
+        case EXPR_BINARY_OP:
+            {
+                const Expr_Binary_Op *x = a->as.binop, *y = b->as.binop;
+                if(x->type != y->type) return false;
+                if(exprs_equal(&x->left, &y->left) && exprs_equal(&x->right, &y->right)) return true;
+                bool commutative = x->type == BINARY_OP_ADD || x->type == BINARY_OP_MUL || x->type == BINARY_OP_EQ
+                    || x->type == BINARY_OP_NE || x->type == BINARY_OP_AND || x->type == BINARY_OP_OR || x->type == BINARY_OP_XOR;
+                return commutative && exprs_equal(&x->left, &y->right) && exprs_equal(&x->right, &y->left);
+            }
+        case EXPR_FUNCALL:
+            {
+                if(!sv_eq(a->as.func_call.name, b->as.func_call.name)) return false;
+                if(a->as.func_call.args.count != b->as.func_call.args.count) return false;
+                for(size_t i = 0; i < a->as.func_call.args.count; ++i) {
+                    if(!exprs_equal(&a->as.func_call.args.data[i], &b->as.func_call.args.data[i])) return false;
+                }
+                return true;
+            }
+        default: return false;
+    }
+}
+
+typedef struct {
+    size_t index;
+    Stmt stmt;
+    bool merged;
+} Cse_Insertion;
+
+typedef struct {
+    Cse_Insertion *data;
+    size_t count, capacity;
+} Cse_Insertion_List;
+
+// A value computed earlier that dominates the statements still to be visited. Its holder is the
+// variable the value can be read from, a value first seen inside a bigger expression has no holder
+// until it is needed again and gets a temporary declared right before the statement computing it
+typedef struct {
+    Expr value;
+    String_View holder;
+    Expr *slot;
+    Cse_Insertion_List *insertions;
+    size_t index;
+    bool killed;
+} Cse_Entry;
+
+typedef struct {
+    Optimizer *opt;
+    Cse_Entry *data;
+    size_t count, capacity;
+} Cse;
+
+static void push_cse_insertion(Arena *arena, Cse_Insertion_List *list, size_t index, Stmt stmt)
+{
+    if(list->count >= list->capacity) {
+        size_t new_capacity = list->capacity * 2;
+        if(new_capacity == 0) new_capacity = 32;
+        void *new_data = arena_alloc(arena, new_capacity * sizeof(*list->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, list->data, list->count * sizeof(*list->data));
+        list->data = new_data;
+        list->capacity = new_capacity;
+    }
+
+    list->data[list->count].index = index;
+    list->data[list->count].stmt = stmt;
+    list->data[list->count].merged = false;
+    list->count += 1;
+}
+
+static Cse_Entry *push_cse_entry(Cse *cse, Expr value)
+{
+    if(cse->count >= cse->capacity) {
+        size_t new_capacity = cse->capacity * 2;
+        if(new_capacity == 0) new_capacity = 32;
+        void *new_data = arena_alloc(cse->opt->arena, new_capacity * sizeof(*cse->data));
+        assert(new_data && "buy more ram lol!");
+        memcpy(new_data, cse->data, cse->count * sizeof(*cse->data));
+        cse->data = new_data;
+        cse->capacity = new_capacity;
+    }
+
+    Cse_Entry *entry = &cse->data[cse->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->value = value;
+    return entry;
+}
+
+static void kill_cse_entries(Cse *cse, String_View name)
+{
+    for(size_t i = 0; i < cse->count; ++i) {
+        Cse_Entry *entry = &cse->data[i];
+        if(entry->killed) continue;
+        if((entry->holder.count > 0 && sv_eq(entry->holder, name)) || count_var_reads(&entry->value, name) > 0) {
+            entry->killed = true;
+        }
+    }
+}
+
+static void kill_cse_entries_written_in(Cse *cse, const Block *block)
+{
+    Name_List written = {0};
+    collect_written_vars(cse->opt->arena, block, &written);
+    for(size_t i = 0; i < written.count; ++i)
+        kill_cse_entries(cse, written.data[i]);
+}
+
+// Values are numbered bottom-up so operands already refer to the variables holding them, which
+// makes `(x + y) * 2` match `a * 2` once `a = x + y` is known. Values are only recorded when
+// `record` is set, conditions evaluated more than once never record theirs
+static void eliminate_common_subexprs(Cse *cse, Expr *expr, Cse_Insertion_List *insertions, size_t index, bool record, bool top)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                // The right operand of `&&` and `||` may never run, its values can't be materialized
+                // ahead of the statement
+                Binary_Op_Type type = expr->as.binop->type;
+                bool short_circuit = type == BINARY_OP_AND || type == BINARY_OP_OR;
+                eliminate_common_subexprs(cse, &expr->as.binop->left, insertions, index, record, false);
+                eliminate_common_subexprs(cse, &expr->as.binop->right, insertions, index, record && !short_circuit, false);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    eliminate_common_subexprs(cse, &expr->as.func_call.args.data[i], insertions, index, record, false);
+                if(!is_pure_call(cse->opt, expr->as.func_call.name)) return;
+            } break;
+        default:
+            return;
+    }
+
+    for(size_t i = cse->count; i > 0; --i) {
+        Cse_Entry *entry = &cse->data[i - 1];
+        if(entry->killed || !exprs_equal(&entry->value, expr)) continue;
+        if(entry->holder.count == 0) {
+            entry->holder = make_temp_var_name(cse->opt->arena, "cse", cse->opt->temp_count++);
+            push_cse_insertion(cse->opt->arena, entry->insertions, entry->index,
+                    make_var_init(entry->value.loc, entry->holder, entry->value));
+            *entry->slot = make_var_read(entry->value.loc, entry->holder);
+        }
+        if(cse->opt->options->report_cse) {
+            compilation_note(expr->loc, "Reusing the value of `"SV_FMT"` instead of recomputing it\n", SV_ARGV(entry->holder));
+        }
+        *expr = make_var_read(expr->loc, entry->holder);
+        cse->opt->cse_count += 1;
+        return;
+    }
+
+    // The value of a whole statement is held by the variable it is assigned to
+    if(record && !top) {
+        Cse_Entry *entry = push_cse_entry(cse, *expr);
+        entry->slot = expr;
+        entry->insertions = insertions;
+        entry->index = index;
+    }
+}
+
+static void record_assigned_value(Cse *cse, String_View name, const Expr *value)
+{
+    kill_cse_entries(cse, name);
+    if(expr_is_trivial(value) || count_var_reads(value, name) > 0) return;
+    if(value->type == EXPR_FUNCALL && !is_pure_call(cse->opt, value->as.func_call.name)) return;
+    Cse_Entry *entry = push_cse_entry(cse, *value);
+    entry->holder = name;
+}
+
+static Block eliminate_common_subexprs_in_block(Cse *cse, const Block *block)
+{
+    Block result = {0};
+    Cse_Insertion_List insertions = {0};
+    for(size_t i = 0; i < block->count; ++i) {
+        Stmt stmt = block->data[i];
+        size_t index = result.count;
+        switch(stmt.type) {
+            case STMT_VAR_DEF:
+                {
+                    kill_cse_entries(cse, stmt.as.var_def.name);
+                } break;
+            case STMT_VAR_INIT:
+                {
+                    eliminate_common_subexprs(cse, &stmt.as.var_init.value, &insertions, index, true, true);
+                    record_assigned_value(cse, stmt.as.var_init.name, &stmt.as.var_init.value);
+                } break;
+            case STMT_VAR_ASSIGN:
+                {
+                    eliminate_common_subexprs(cse, &stmt.as.var_assign.value, &insertions, index, true, true);
+                    record_assigned_value(cse, stmt.as.var_assign.name, &stmt.as.var_assign.value);
+                } break;
+            case STMT_RETURN:
+                {
+                    eliminate_common_subexprs(cse, &stmt.as._return.value, &insertions, index, true, true);
+                } break;
+            case STMT_EXPR:
+                {
+                    eliminate_common_subexprs(cse, &stmt.as.expr, &insertions, index, true, true);
+                } break;
+            case STMT_WHILE:
+                {
+                    // Only values that survive every iteration are available inside and after the loop
+                    kill_cse_entries_written_in(cse, &stmt.as._while.todo);
+                    eliminate_common_subexprs(cse, &stmt.as._while.condition, &insertions, index, false, true);
+                    size_t available = cse->count;
+                    stmt.as._while.todo = eliminate_common_subexprs_in_block(cse, &stmt.as._while.todo);
+                    cse->count = available;
+                } break;
+            case STMT_IF:
+                {
+                    eliminate_common_subexprs(cse, &stmt.as._if.condition, &insertions, index, true, true);
+                    size_t available = cse->count;
+                    for(Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif) {
+                        if(branch != &stmt.as._if)
+                            eliminate_common_subexprs(cse, &branch->condition, &insertions, index, false, true);
+                        branch->todo = eliminate_common_subexprs_in_block(cse, &branch->todo);
+                        cse->count = available;
+                    }
+                    stmt.as._if._else = eliminate_common_subexprs_in_block(cse, &stmt.as._if._else);
+                    cse->count = available;
+                    for(Stmt_If *branch = &stmt.as._if; branch != NULL; branch = branch->elif)
+                        kill_cse_entries_written_in(cse, &branch->todo);
+                    kill_cse_entries_written_in(cse, &stmt.as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    eliminate_common_subexprs(cse, &stmt.as._switch.value, &insertions, index, true, true);
+                    size_t available = cse->count;
+                    for(size_t j = 0; j < stmt.as._switch.cases.count; ++j) {
+                        Switch_Case *_case = &stmt.as._switch.cases.data[j];
+                        _case->todo = eliminate_common_subexprs_in_block(cse, &_case->todo);
+                        cse->count = available;
+                    }
+                    stmt.as._switch._default = eliminate_common_subexprs_in_block(cse, &stmt.as._switch._default);
+                    cse->count = available;
+                    for(size_t j = 0; j < stmt.as._switch.cases.count; ++j)
+                        kill_cse_entries_written_in(cse, &stmt.as._switch.cases.data[j].todo);
+                    kill_cse_entries_written_in(cse, &stmt.as._switch._default);
+                } break;
+            default:
+                break;
+        }
+        push_stmt_to_block(cse->opt->arena, &result, stmt);
+    }
+
+    if(insertions.count == 0) return result;
+
+    // Temporaries go right before the statement that first computed their value. A temporary may be
+    // part of the value of another one declared for the same statement so those are ordered first
+    Block merged = {0};
+    for(size_t i = 0; i <= result.count; ++i) {
+        bool progress = true;
+        while(progress) {
+            progress = false;
+            for(size_t j = 0; j < insertions.count; ++j) {
+                Cse_Insertion *insertion = &insertions.data[j];
+                if(insertion->index != i || insertion->merged) continue;
+                bool ready = true;
+                for(size_t k = 0; k < insertions.count && ready; ++k) {
+                    const Cse_Insertion *other = &insertions.data[k];
+                    if(k == j || other->index != i || other->merged) continue;
+                    ready = count_var_reads(&insertion->stmt.as.var_init.value, other->stmt.as.var_init.name) == 0;
+                }
+                if(!ready) continue;
+                push_stmt_to_block(cse->opt->arena, &merged, insertion->stmt);
+                insertion->merged = true;
+                progress = true;
+            }
+        }
+        if(i < result.count) push_stmt_to_block(cse->opt->arena, &merged, result.data[i]);
+    }
+    return merged;
+}
+
+// Functions reachable from `main` and the `pub` functions, found with a worklist over the calls
+typedef struct {
+    const Module *module;
+    bool *reachable;
+    size_t *pending;
+    size_t pending_count;
+} Reachability;
+
+static void mark_reachable_callees(Reachability *r, const Expr *expr)
+{
+    switch(expr->type) {
+        case EXPR_BINARY_OP:
+            {
+                mark_reachable_callees(r, &expr->as.binop->left);
+                mark_reachable_callees(r, &expr->as.binop->right);
+            } break;
+        case EXPR_FUNCALL:
+            {
+                for(size_t i = 0; i < expr->as.func_call.args.count; ++i)
+                    mark_reachable_callees(r, &expr->as.func_call.args.data[i]);
+                for(size_t i = 0; i < r->module->functions.count; ++i) {
+                    if(!r->reachable[i] && sv_eq(r->module->functions.data[i].name, expr->as.func_call.name)) {
+                        r->reachable[i] = true;
+                        r->pending[r->pending_count++] = i;
+                    }
+                }
+            } break;
+        default:
+            break;
+    }
+}
+
+static void mark_reachable_callees_in_block(Reachability *r, const Block *block)
+{
+    for(size_t i = 0; i < block->count; ++i) {
+        const Stmt *stmt = &block->data[i];
+        switch(stmt->type) {
+            case STMT_RETURN: mark_reachable_callees(r, &stmt->as._return.value); break;
+            case STMT_VAR_INIT: mark_reachable_callees(r, &stmt->as.var_init.value); break;
+            case STMT_VAR_ASSIGN: mark_reachable_callees(r, &stmt->as.var_assign.value); break;
+            case STMT_EXPR: mark_reachable_callees(r, &stmt->as.expr); break;
+            case STMT_WHILE:
+                {
+                    mark_reachable_callees(r, &stmt->as._while.condition);
+                    mark_reachable_callees_in_block(r, &stmt->as._while.todo);
+                } break;
+            case STMT_IF:
+                {
+                    for(const Stmt_If *branch = &stmt->as._if; branch != NULL; branch = branch->elif) {
+                        mark_reachable_callees(r, &branch->condition);
+                        mark_reachable_callees_in_block(r, &branch->todo);
+                    }
+                    mark_reachable_callees_in_block(r, &stmt->as._if._else);
+                } break;
+            case STMT_SWITCH:
+                {
+                    mark_reachable_callees(r, &stmt->as._switch.value);
+                    for(size_t j = 0; j < stmt->as._switch.cases.count; ++j)
+                        mark_reachable_callees_in_block(r, &stmt->as._switch.cases.data[j].todo);
+                    mark_reachable_callees_in_block(r, &stmt->as._switch._default);
+                } break;
+            default:
+                break;
+        }
+    }
+}
+
+// Drops every function no call path from `main` or a `pub` function leads to, the ones left keep
+// their order
+static void eliminate_dead_functions(Optimizer *opt)
+{
+    Module *module = opt->module;
+    Reachability r = { .module = module };
+    r.reachable = arena_alloc(opt->arena, module->functions.count*sizeof(bool));
+    r.pending = arena_alloc(opt->arena, module->functions.count*sizeof(size_t));
+    assert(r.reachable && r.pending && "buy more ram lol!");
+    for(size_t i = 0; i < module->functions.count; ++i) {
+        const Func_Def *fdef = &module->functions.data[i];
+        r.reachable[i] = fdef == module->main || fdef->is_pub;
+        if(r.reachable[i]) r.pending[r.pending_count++] = i;
+    }
+    while(r.pending_count > 0) {
+        size_t i = r.pending[--r.pending_count];
+        mark_reachable_callees_in_block(&r, &module->functions.data[i].body);
+    }
+
+    size_t count = 0;
+    for(size_t i = 0; i < module->functions.count; ++i) {
+        if(!r.reachable[i]) {
+            opt->dead_functions_count += 1;
+            opt->dead_functions_size += module->functions.data[i].source_size;
+            continue;
+        }
+        if(&module->functions.data[i] == module->main) module->main = &module->functions.data[count];
+        module->functions.data[count++] = module->functions.data[i];
+    }
+    module->functions.count = count;
+}
+
+void optimize_module(Arena *arena, Module *module, const Optimizer_Options *options)
+{
+    Optimizer opt = {0};
+    opt.arena = arena;
+    opt.options = options;
+    opt.module = module;
+    // Dead functions aren't worth optimizing, the ones inlining and folding leave dead are dropped
+    // once more at the end
+    if(options->eliminate_dead_functions) eliminate_dead_functions(&opt);
+    opt.nodes = arena_alloc(arena, module->functions.count * sizeof(Call_Graph_Node));
+    for(size_t i = 0; i < module->functions.count; ++i) {
+        opt.nodes[i].fdef = &module->functions.data[i];
+        opt.nodes[i].state = CALL_GRAPH_UNVISITED;
+        opt.nodes[i].is_recursive = false;
+        opt.nodes[i].is_leaf = false;
+        opt.nodes[i].is_pure = false;
+        opt.nodes[i].size = 0;
+    }
+
+    opt.comptime = arena_alloc(arena, sizeof(Comptime));
+    assert(opt.comptime && "buy more ram lol!");
+    opt.comptime->module = module;
+    if(options->fold_comptime_calls) find_pure_functions(&opt);
+
+    for(size_t i = 0; i < module->functions.count; ++i) {
+        if(opt.nodes[i].state == CALL_GRAPH_UNVISITED)
+            visit_function(&opt, &opt.nodes[i]);
+    }
+    if(options->report_comptime) {
+        fprintf(stderr, "Evaluated %zu call%s at compile time\n", opt.comptime_count, opt.comptime_count == 1 ? "" : "s");
+    }
+
+    if(options->convert_if_ladders) {
+        for(size_t i = 0; i < module->functions.count; ++i) {
+            Func_Def *fdef = &module->functions.data[i];
+            fdef->body = convert_if_ladders_in_block(&opt, &fdef->body);
+        }
+    }
+
+    if(options->optimize_loops) {
+        for(size_t i = 0; i < module->functions.count; ++i) {
+            Func_Def *fdef = &module->functions.data[i];
+            fdef->body = optimize_loops_in_block(&opt, &fdef->body);
+        }
+    }
+
+    if(options->eliminate_common_subexprs) {
+        find_pure_functions(&opt);
+        for(size_t i = 0; i < module->functions.count; ++i) {
+            Func_Def *fdef = &module->functions.data[i];
+            Cse cse = { .opt = &opt };
+            fdef->body = eliminate_common_subexprs_in_block(&cse, &fdef->body);
+        }
+        if(options->report_cse) {
+            fprintf(stderr, "Eliminated %zu common subexpression%s\n", opt.cse_count, opt.cse_count == 1 ? "" : "s");
+        }
+    }
+
+    if(options->eliminate_dead_functions) {
+        eliminate_dead_functions(&opt);
+        if(options->report_dead_functions) {
+            fprintf(stderr, "Removed %zu function%s unreachable from `main` and `pub` functions (%zu bytes of source)\n",
+                    opt.dead_functions_count, opt.dead_functions_count == 1 ? "" : "s", opt.dead_functions_size);
+        }
+    }
+}
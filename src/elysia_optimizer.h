@@ -0,0 +1,78 @@
+#ifndef ELYSIA_OPTIMIZER_H_
+#define ELYSIA_OPTIMIZER_H_
+
+#include "elysia.h"
+#include "arena.h"
+#include "elysia_ast.h"
+
+#define ELYSIA_DEFAULT_INLINE_THRESHOLD 24
+#define ELYSIA_DEFAULT_INLINE_LEAF_SIZE 8
+// If/else-if ladders with fewer arms are cheaper to test one after another
+#define ELYSIA_IF_LADDER_MIN_ARMS 4
+// Budget of a single call evaluated at compile time: statements and expressions it may evaluate,
+// variables alive at once across every frame and calls nested in each other
+#define ELYSIA_COMPTIME_MAX_STEPS (1 << 20)
+#define ELYSIA_COMPTIME_MAX_VARS 4096
+#define ELYSIA_COMPTIME_MAX_DEPTH 256
+
+typedef struct {
+    bool inline_functions;
+    // Maximum size (in AST nodes) of a callee that may be inlined. Call sites inside loops get this
+    // budget doubled for every loop level up to two levels deep
+    size_t inline_threshold;
+    // Leaf functions (functions that don't call anything) under this size are always inlined
+    size_t inline_leaf_size;
+    // Turn if/else-if ladders comparing one variable against constants into switch statements
+    bool convert_if_ladders;
+    // Loop-invariant code motion and strength reduction of induction variable products
+    bool optimize_loops;
+    // Reuse values already computed by a dominating statement instead of recomputing them
+    bool eliminate_common_subexprs;
+    // Print a note for every eliminated expression
+    bool report_cse;
+    // Evaluate calls to pure functions with constant arguments at compile time and replace them with
+    // their result, calls to `comptime` functions are evaluated either way
+    bool fold_comptime_calls;
+    // Report how many calls were evaluated at compile time
+    bool report_comptime;
+    // Remove functions that can't be called from `main` nor from a `pub` function
+    bool eliminate_dead_functions;
+    // Report how many functions were removed and how much source they took
+    bool report_dead_functions;
+} Optimizer_Options;
+
+typedef struct {
+    // Integers are kept sign or zero extended from the width of their type, bools are 0 or 1
+    Native_Type type;
+    int64_t value;
+} Comptime_Value;
+
+typedef struct {
+    String_View name;
+    Comptime_Value value;
+    bool is_initialized;
+} Comptime_Var;
+
+// Interpreter of calls with constant arguments. Only integers and bools exist at compile time,
+// anything else (pointers, vectors, calls outside of the module) makes the evaluation fail
+typedef struct {
+    const Module *module;
+    // Variables of every frame, the running call owns the ones from `frame` on
+    Comptime_Var vars[ELYSIA_COMPTIME_MAX_VARS];
+    size_t vars_count;
+    size_t frame;
+    size_t steps;
+    size_t depth;
+    // Value of the last `return`
+    Comptime_Value returned;
+    // Why the last evaluation failed
+    const char *error;
+} Comptime;
+
+// Evaluates `call` whose arguments are literals, false with `error` set when it can't be done
+// within the budget
+bool comptime_eval_call(Comptime *ct, const Expr *call, Comptime_Value *result);
+
+void optimize_module(Arena *arena, Module *module, const Optimizer_Options *options);
+
+#endif // ELYSIA_OPTIMIZER_H_
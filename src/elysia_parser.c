@@ -16,17 +16,23 @@ Module parse_module(Arena *arena, Lexer *lex)
     Module module = {0};
     Token token = {0};
     while(peek_token(lex, &token, 0)) {
-        if(token.type == TOKEN_FUNCTION) {
+        if(token.type == TOKEN_FUNCTION || token.type == TOKEN_INLINE || token.type == TOKEN_NOINLINE || token.type == TOKEN_PUB
+                || token.type == TOKEN_COMPTIME) {
+            const char *begin = token.value.data;
             Func_Def fdef = parse_func_def(arena, lex);
+            fdef.source_size = (peek_token(lex, &token, 0) ? token.value.data : lex->source.data + lex->source.count) - begin;
             push_fdef_to_module(arena, &module, fdef);
-            if(sv_eq(fdef.name, SV("main"))) {
-                module.main = &module.functions.data[module.functions.count - 1];
-            }
         } else {
             compilation_error(token.loc, "Expecting function definition found `"SV_FMT"`\n", SV_ARGV(token.value));
             compilation_failure();
         }
     }
+    // Only once every function is pushed, growing the list moves them
+    for(size_t i = 0; i < module.functions.count; ++i) {
+        if(sv_eq(module.functions.data[i].name, SV("main"))) {
+            module.main = &module.functions.data[i];
+        }
+    }
 
     return module;
 }
@@ -34,11 +40,27 @@ Module parse_module(Arena *arena, Lexer *lex)
 Func_Def parse_func_def(Arena *arena, Lexer *lex)
 {
     Func_Def result = {0};
+    Token token = {0};
+    if(peek_token(lex, &token, 0) && token.type == TOKEN_PUB) {
+        expect_token(lex, TOKEN_PUB);
+        result.is_pub = true;
+    }
+    if(peek_token(lex, &token, 0) && token.type == TOKEN_INLINE) {
+        expect_token(lex, TOKEN_INLINE);
+        result.inline_hint = FUNC_INLINE_ALWAYS;
+    } else if(peek_token(lex, &token, 0) && token.type == TOKEN_NOINLINE) {
+        expect_token(lex, TOKEN_NOINLINE);
+        result.inline_hint = FUNC_INLINE_NEVER;
+    }
+    if(peek_token(lex, &token, 0) && token.type == TOKEN_COMPTIME) {
+        expect_token(lex, TOKEN_COMPTIME);
+        result.is_comptime = true;
+    }
+
     result.loc = expect_token(lex, TOKEN_FUNCTION).loc;
     result.name = expect_token(lex, TOKEN_NAME).value;
     result.params = parse_func_params(arena, lex);
 
-    Token token = {0};
     if(!peek_token(lex, &token, 0)) {
         compilation_error(token.loc, "Expecting function body or return type of the function but found end of file\n");
         compilation_failure();
@@ -188,6 +210,8 @@ Stmt parse_stmt(Arena *arena, Lexer *lex)
                         // TODO (bagasjs): Maybe other methods other than linked list?
                         Stmt_If *elif = arena_alloc(arena, sizeof(Stmt_If));
                         elif->loc = token.loc;
+                        elif->elif = NULL;
+                        elif->_else = (Block){0};
                         elif->condition = parse_expr(arena, lex);
                         elif->todo = parse_block(arena, lex);
                         prev->elif = elif;
@@ -198,6 +222,41 @@ Stmt parse_stmt(Arena *arena, Lexer *lex)
                     }
                 }
             } break;
+        case TOKEN_SWITCH:
+            {
+                expect_token(lex, TOKEN_SWITCH);
+                result.loc = token.loc;
+                result.type = STMT_SWITCH;
+                result.as._switch.loc = token.loc;
+                result.as._switch.value = parse_expr(arena, lex);
+                expect_token(lex, TOKEN_LCURLY);
+                while(peek_token(lex, &token, 0) && token.type == TOKEN_CASE) {
+                    Switch_Case _case = {0};
+                    _case.loc = expect_token(lex, TOKEN_CASE).loc;
+                    do {
+                        Case_Range range = {0};
+                        range.low = sv_to_int(expect_token(lex, TOKEN_INTEGER).value);
+                        range.high = range.low;
+                        if(peek_token(lex, &token, 0) && token.type == TOKEN_DOTDOT) {
+                            expect_token(lex, TOKEN_DOTDOT);
+                            range.high = sv_to_int(expect_token(lex, TOKEN_INTEGER).value);
+                        }
+                        push_range_to_case_range_list(arena, &_case.ranges, range);
+                    } while(peek_token(lex, &token, 0) && token.type == TOKEN_COMMA && next_token(lex, &token));
+                    _case.todo = parse_block(arena, lex);
+                    push_case_to_switch_case_list(arena, &result.as._switch.cases, _case);
+                }
+                if(peek_token(lex, &token, 0) && token.type == TOKEN_ELSE) {
+                    expect_token(lex, TOKEN_ELSE);
+                    result.as._switch._default = parse_block(arena, lex);
+                }
+                expect_token(lex, TOKEN_RCURLY);
+            } break;
+        case TOKEN_CASE:
+            {
+                compilation_error(token.loc, "`case` outside of a `switch` is invalid");
+                compilation_failure();
+            } break;
         case TOKEN_ELSE:
             {
                 compilation_error(token.loc, "`else` in here is invalid");
@@ -256,15 +315,16 @@ Stmt parse_stmt(Arena *arena, Lexer *lex)
             } break;
         case TOKEN_NAME:
             {
-                String_View name = expect_token(lex, TOKEN_NAME).value;
                 Token token0 = {0};
-                if(!peek_token(lex, &token0, 0)) {
+                if(!peek_token(lex, &token0, 1)) {
                     compilation_error(lex->loc, "Expecting something after variable name but found end of file\n");
                     compilation_failure();
                 }
 
                 if(token0.type == TOKEN_ASSIGN) {
+                    String_View name = expect_token(lex, TOKEN_NAME).value;
                     token0 = expect_token(lex, TOKEN_ASSIGN);
+                    result.loc = token.loc;
                     result.type = STMT_VAR_ASSIGN;
                     result.as.var_assign.name = name;
                     result.as.var_assign.value = parse_expr(arena, lex);
@@ -309,14 +369,14 @@ Expr_List parse_func_args(Arena *arena, Lexer *lex)
     Token token = {0};
     while(peek_token(lex, &token, 0) && token.type != TOKEN_RPAREN) {
         push_expr_to_expr_list(arena, &list, parse_expr(arena, lex));
+        if(peek_token(lex, &token, 0) && token.type == TOKEN_RPAREN) break;
         expect_token(lex, TOKEN_COMMA);
     }
     expect_token(lex, TOKEN_RPAREN);
     return list;
 }
 
-// TODO: Generalize the binary op parsing of the expression
-Expr parse_expr(Arena *arena, Lexer *lex)
+static Expr parse_primary_expr(Arena *arena, Lexer *lex)
 {
     Token token = {0};
     if(!peek_token(lex, &token, 0)) {
@@ -335,7 +395,6 @@ Expr parse_expr(Arena *arena, Lexer *lex)
                     result.as.literal_bool = true;
                 } else if(sv_eq(token.value, FALSE_KEYWORD)) {
                     token = expect_keyword(lex, FALSE_KEYWORD);
-                    next_token(lex, &token);
                     result.loc = token.loc;
                     result.as.literal_bool = false;
                     result.type = EXPR_BOOL_LITERAL;
@@ -351,6 +410,7 @@ Expr parse_expr(Arena *arena, Lexer *lex)
                         result.as.func_call.args = parse_func_args(arena, lex);
                     } else {
                         result.type = EXPR_VAR_READ;
+                        result.loc = token.loc;
                         result.as.var_read.name = token.value;
                         result.as.var_read.loc = token.loc;
                     }
@@ -371,16 +431,57 @@ Expr parse_expr(Arena *arena, Lexer *lex)
                 result.type = EXPR_INTEGER_LITERAL;
                 result.as.literal_str = token.value;
             } break;
+        case TOKEN_LPAREN:
+            {
+                expect_token(lex, TOKEN_LPAREN);
+                result = parse_expr(arena, lex);
+                expect_token(lex, TOKEN_RPAREN);
+            } break;
         default:
             {
                 fatal("Token: "SV_FMT"\n", SV_ARGV(token.value));
                 assert(0 && "Unreachable: THIS IS IN DEVELOPMENT MODE");
             } break;
     }
+    return result;
+}
+
+// Binding power of every binary operator, higher binds tighter. Follows C except that `^` binds
+// tighter than the comparisons
+static int get_binary_op_precedence(Binary_Op_Type type)
+{
+    switch(type) {
+        case BINARY_OP_OR: return 1;
+        case BINARY_OP_AND: return 2;
+        case BINARY_OP_EQ:
+        case BINARY_OP_NE: return 3;
+        case BINARY_OP_LT:
+        case BINARY_OP_LE:
+        case BINARY_OP_GT:
+        case BINARY_OP_GE: return 4;
+        case BINARY_OP_XOR: return 5;
+        case BINARY_OP_SHL:
+        case BINARY_OP_SHR: return 6;
+        case BINARY_OP_ADD:
+        case BINARY_OP_SUB: return 7;
+        case BINARY_OP_MUL:
+        case BINARY_OP_DIV:
+        case BINARY_OP_MOD: return 8;
+        default: return 0;
+    }
+}
+
+// Precedence climbing, operators of the same precedence associate to the left
+static Expr parse_binary_expr(Arena *arena, Lexer *lex, int min_precedence)
+{
+    Expr result = parse_primary_expr(arena, lex);
 
     Token ntoken = {0};
-    peek_token(lex, &ntoken, 0);
-    if(binary_op_type_from_token_type(ntoken.type) != BINARY_OP_UNKNOWN) {
+    while(peek_token(lex, &ntoken, 0)) {
+        Binary_Op_Type type = binary_op_type_from_token_type(ntoken.type);
+        int precedence = get_binary_op_precedence(type);
+        if(type == BINARY_OP_UNKNOWN || precedence < min_precedence) break;
+
         Expr left = result;
         next_token(lex, &ntoken);
         result.type = EXPR_BINARY_OP;
@@ -389,12 +490,16 @@ Expr parse_expr(Arena *arena, Lexer *lex)
             fatal("Failed to allocate for expression: Buy more RAM LOL");
         }
         result.loc = ntoken.loc;
-        result.as.binop->type = binary_op_type_from_token_type(ntoken.type);
+        result.as.binop->type = type;
         result.as.binop->loc = ntoken.loc;
         result.as.binop->left = left;
-        result.as.binop->right = parse_expr(arena, lex);
+        result.as.binop->right = parse_binary_expr(arena, lex, precedence + 1);
     }
 
     return result;
 }
 
+Expr parse_expr(Arena *arena, Lexer *lex)
+{
+    return parse_binary_expr(arena, lex, 1);
+}
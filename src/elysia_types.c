@@ -16,6 +16,10 @@ static Native_Type_Info native_type_infos[COUNT_NATIVE_TYPES] = {
     [NATIVE_TYPE_I16] = { .type = NATIVE_TYPE_I16, .name = SV_STATIC("i16"), .size = 2 },
     [NATIVE_TYPE_I32] = { .type = NATIVE_TYPE_I32, .name = SV_STATIC("i32"), .size = 4 },
     [NATIVE_TYPE_I64] = { .type = NATIVE_TYPE_I64, .name = SV_STATIC("i64"), .size = 8 },
+    [NATIVE_TYPE_V4I32] = { .type = NATIVE_TYPE_V4I32, .name = SV_STATIC("v4i32"), .size = 16, .lane_type = NATIVE_TYPE_I32, .lanes = 4 },
+    [NATIVE_TYPE_V8I32] = { .type = NATIVE_TYPE_V8I32, .name = SV_STATIC("v8i32"), .size = 32, .lane_type = NATIVE_TYPE_I32, .lanes = 8 },
+    [NATIVE_TYPE_V16U8] = { .type = NATIVE_TYPE_V16U8, .name = SV_STATIC("v16u8"), .size = 16, .lane_type = NATIVE_TYPE_U8, .lanes = 16 },
+    [NATIVE_TYPE_V2I64] = { .type = NATIVE_TYPE_V2I64, .name = SV_STATIC("v2i64"), .size = 16, .lane_type = NATIVE_TYPE_I64, .lanes = 2 },
 };
 
 Native_Type_Info get_native_type_info(Native_Type type)
@@ -63,6 +67,12 @@ size_t get_data_type_size(Data_Type *data_type) {
     return data_type->bytesize;
 }
 
+bool is_vector_data_type(const Data_Type *data_type)
+{
+    if(!data_type->is_native || data_type->is_ptr || data_type->is_array) return false;
+    return get_native_type_info(data_type->as.native).lanes > 0;
+}
+
 Data_Type_Cmp_Result compare_data_type(const Data_Type *a, const Data_Type *b)
 {
     if(!sv_eq(a->name, b->name))  {
@@ -17,6 +17,10 @@ typedef enum {
     NATIVE_TYPE_I64,
     NATIVE_TYPE_BOOL,
     NATIVE_TYPE_CHAR,
+    NATIVE_TYPE_V4I32,
+    NATIVE_TYPE_V8I32,
+    NATIVE_TYPE_V16U8,
+    NATIVE_TYPE_V2I64,
     COUNT_NATIVE_TYPES,
 } Native_Type;
 
@@ -24,6 +28,9 @@ typedef struct {
     Native_Type type;
     String_View name;
     size_t size;
+    // Only set for SIMD vector types, scalar types have no lanes
+    Native_Type lane_type;
+    size_t lanes;
 } Native_Type_Info;
 
 typedef struct Data_Type Data_Type;
@@ -73,5 +80,6 @@ void dump_data_type(FILE *f, const Data_Type *type);
 void dump_parsed_type(const Data_Type *type);
 Data_Type_Cmp_Result compare_data_type(const Data_Type *a, const Data_Type *b);
 size_t get_data_type_size(Data_Type *data_type);
+bool is_vector_data_type(const Data_Type *data_type);
 
 #endif // ELYSIA_TYPES_H_
@@ -0,0 +1,289 @@
+#include "elysia.h"
+#include "elysia_bytecode.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    // Instruction after the CALL and the caller's registers
+    const Bytecode_Inst *ip;
+    int64_t *registers;
+    size_t dst;
+} Vm_Frame;
+
+// Lanes of 8 bits are unsigned, the wider ones signed: v16u8 is the only vector of unsigned lanes
+static int64_t get_vector_lane(const int64_t *vector, size_t lane_size, size_t lane)
+{
+    const uint8_t *at = (const uint8_t *)vector + lane*lane_size;
+    switch(lane_size) {
+        case 1: return *at;
+        case 2: { int16_t value; memcpy(&value, at, 2); return value; }
+        case 4: { int32_t value; memcpy(&value, at, 4); return value; }
+        default: { int64_t value; memcpy(&value, at, 8); return value; }
+    }
+}
+
+static void set_vector_lane(int64_t *vector, size_t lane_size, size_t lane, int64_t value)
+{
+    memcpy((uint8_t *)vector + lane*lane_size, &value, lane_size);
+}
+
+static size_t find_switch_case(const Bytecode_Switch *_switch, int64_t value)
+{
+    if(_switch->is_unsigned) value = (uint32_t)value;
+    if(_switch->table) {
+        int64_t index = value - _switch->ranges[0].low;
+        if(index < 0 || (size_t)index >= _switch->table_count) return _switch->cases_count;
+        return _switch->table[index];
+    }
+    size_t low = 0, high = _switch->ranges_count;
+    while(low < high) {
+        size_t middle = low + (high - low)/2;
+        const Switch_Range *range = &_switch->ranges[middle];
+        if(value < range->low) high = middle;
+        else if(value > range->high) low = middle + 1;
+        else return range->target;
+    }
+    return _switch->cases_count;
+}
+
+// Dispatch jumps straight from the end of one handler to the next through a table of label
+// addresses, a GNU C extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+int interpret_bytecode_module(const Bytecode_Module *bytecode, int argc, char **argv)
+{
+    static void *dispatch[COUNT_BYTECODE_OPS] = {
+        [BYTECODE_OP_MOVI] = &&op_movi,
+        [BYTECODE_OP_MOV] = &&op_mov,
+        [BYTECODE_OP_MOVV] = &&op_movv,
+        [BYTECODE_OP_TRUNC_U8] = &&op_trunc_u8,
+        [BYTECODE_OP_TRUNC_I8] = &&op_trunc_i8,
+        [BYTECODE_OP_TRUNC_U16] = &&op_trunc_u16,
+        [BYTECODE_OP_TRUNC_I16] = &&op_trunc_i16,
+        [BYTECODE_OP_ADD32] = &&op_add32,
+        [BYTECODE_OP_SUB32] = &&op_sub32,
+        [BYTECODE_OP_MUL32] = &&op_mul32,
+        [BYTECODE_OP_ADD64] = &&op_add64,
+        [BYTECODE_OP_SUB64] = &&op_sub64,
+        [BYTECODE_OP_MUL64] = &&op_mul64,
+        [BYTECODE_OP_ADDI32] = &&op_addi32,
+        [BYTECODE_OP_ADDI64] = &&op_addi64,
+        [BYTECODE_OP_EQ] = &&op_eq,
+        [BYTECODE_OP_NE] = &&op_ne,
+        [BYTECODE_OP_LT] = &&op_lt,
+        [BYTECODE_OP_LE] = &&op_le,
+        [BYTECODE_OP_LTU32] = &&op_ltu32,
+        [BYTECODE_OP_LEU32] = &&op_leu32,
+        [BYTECODE_OP_LTU64] = &&op_ltu64,
+        [BYTECODE_OP_LEU64] = &&op_leu64,
+        [BYTECODE_OP_VADD] = &&op_vadd,
+        [BYTECODE_OP_VSUB] = &&op_vsub,
+        [BYTECODE_OP_VMUL] = &&op_vmul,
+        [BYTECODE_OP_VCMPEQ] = &&op_vcmpeq,
+        [BYTECODE_OP_VCMPGT] = &&op_vcmpgt,
+        [BYTECODE_OP_VSPLAT] = &&op_vsplat,
+        [BYTECODE_OP_VINSERT] = &&op_vinsert,
+        [BYTECODE_OP_VLANE] = &&op_vlane,
+        [BYTECODE_OP_VEXTRACT] = &&op_vextract,
+        [BYTECODE_OP_VREDUCE] = &&op_vreduce,
+        [BYTECODE_OP_CALL] = &&op_call,
+        [BYTECODE_OP_TAILCALL] = &&op_tailcall,
+        [BYTECODE_OP_RET] = &&op_ret,
+        [BYTECODE_OP_SWITCH] = &&op_switch,
+        [BYTECODE_OP_JMP] = &&op_jmp,
+        [BYTECODE_OP_JZ] = &&op_jz,
+        [BYTECODE_OP_JNZ] = &&op_jnz,
+        [BYTECODE_OP_JEQ] = &&op_jeq,
+        [BYTECODE_OP_JNE] = &&op_jne,
+        [BYTECODE_OP_JLT] = &&op_jlt,
+        [BYTECODE_OP_JLE] = &&op_jle,
+        [BYTECODE_OP_JLTU32] = &&op_jltu32,
+        [BYTECODE_OP_JLEU32] = &&op_jleu32,
+        [BYTECODE_OP_JLTU64] = &&op_jltu64,
+        [BYTECODE_OP_JLEU64] = &&op_jleu64,
+        [BYTECODE_OP_JEQI] = &&op_jeqi,
+        [BYTECODE_OP_JNEI] = &&op_jnei,
+        [BYTECODE_OP_JLTI] = &&op_jlti,
+        [BYTECODE_OP_JLEI] = &&op_jlei,
+        [BYTECODE_OP_JGTI] = &&op_jgti,
+        [BYTECODE_OP_JGEI] = &&op_jgei,
+    };
+
+    const Bytecode_Fn *main_fn = NULL;
+    for(size_t i = 0; i < bytecode->functions.count; ++i) {
+        if(sv_eq(bytecode->functions.data[i].name, SV("main"))) main_fn = &bytecode->functions.data[i];
+    }
+    if(main_fn == NULL) {
+        fatal("The module has no `main` function to interpret");
+    }
+
+    int64_t *stack = calloc(ELYSIA_VM_STACK_REGISTERS, sizeof(int64_t));
+    Vm_Frame *frames = malloc(ELYSIA_VM_MAX_FRAMES*sizeof(Vm_Frame));
+    assert(stack && frames && "buy more ram lol!");
+    if(main_fn->registers_count > ELYSIA_VM_STACK_REGISTERS) {
+        fatal("Stack overflow while calling `"SV_FMT"`", SV_ARGV(main_fn->name));
+    }
+    const int64_t *stack_end = stack + ELYSIA_VM_STACK_REGISTERS;
+    size_t frames_count = 0;
+    int64_t *r = stack;
+    if(main_fn->params_count > 0) r[0] = argc;
+    if(main_fn->params_count > 1) r[1] = (int64_t)(intptr_t)argv;
+    const Bytecode_Inst *ip = main_fn->code.data;
+    int result = 0;
+
+#define VM_NEXT() do { ip += 1; goto *dispatch[ip->op]; } while(0)
+#define VM_JUMP_IF(condition) do { ip += (condition) ? ip->offset : 1; goto *dispatch[ip->op]; } while(0)
+#define VM_LANE_SIZE() ((size_t)(ip->imm & 0xFF))
+#define VM_LANES() ((size_t)((ip->imm >> 8) & 0xFF))
+#define VM_LANE() ((size_t)((ip->imm >> 16) & 0xFF))
+
+    goto *dispatch[ip->op];
+
+op_movi: r[ip->a] = ip->imm; VM_NEXT();
+op_mov: r[ip->a] = r[ip->b]; VM_NEXT();
+op_movv: memmove(&r[ip->a], &r[ip->b], ip->c*sizeof(int64_t)); VM_NEXT();
+op_trunc_u8: r[ip->a] = (uint8_t)r[ip->b]; VM_NEXT();
+op_trunc_i8: r[ip->a] = (int8_t)r[ip->b]; VM_NEXT();
+op_trunc_u16: r[ip->a] = (uint16_t)r[ip->b]; VM_NEXT();
+op_trunc_i16: r[ip->a] = (int16_t)r[ip->b]; VM_NEXT();
+op_add32: r[ip->a] = (int32_t)((uint32_t)r[ip->b] + (uint32_t)r[ip->c]); VM_NEXT();
+op_sub32: r[ip->a] = (int32_t)((uint32_t)r[ip->b] - (uint32_t)r[ip->c]); VM_NEXT();
+op_mul32: r[ip->a] = (int32_t)((uint32_t)r[ip->b] * (uint32_t)r[ip->c]); VM_NEXT();
+op_add64: r[ip->a] = (int64_t)((uint64_t)r[ip->b] + (uint64_t)r[ip->c]); VM_NEXT();
+op_sub64: r[ip->a] = (int64_t)((uint64_t)r[ip->b] - (uint64_t)r[ip->c]); VM_NEXT();
+op_mul64: r[ip->a] = (int64_t)((uint64_t)r[ip->b] * (uint64_t)r[ip->c]); VM_NEXT();
+op_addi32: r[ip->a] = (int32_t)((uint32_t)r[ip->b] + (uint32_t)ip->imm); VM_NEXT();
+op_addi64: r[ip->a] = (int64_t)((uint64_t)r[ip->b] + (uint64_t)(int64_t)ip->imm); VM_NEXT();
+op_eq: r[ip->a] = r[ip->b] == r[ip->c]; VM_NEXT();
+op_ne: r[ip->a] = r[ip->b] != r[ip->c]; VM_NEXT();
+op_lt: r[ip->a] = r[ip->b] < r[ip->c]; VM_NEXT();
+op_le: r[ip->a] = r[ip->b] <= r[ip->c]; VM_NEXT();
+op_ltu32: r[ip->a] = (uint32_t)r[ip->b] < (uint32_t)r[ip->c]; VM_NEXT();
+op_leu32: r[ip->a] = (uint32_t)r[ip->b] <= (uint32_t)r[ip->c]; VM_NEXT();
+op_ltu64: r[ip->a] = (uint64_t)r[ip->b] < (uint64_t)r[ip->c]; VM_NEXT();
+op_leu64: r[ip->a] = (uint64_t)r[ip->b] <= (uint64_t)r[ip->c]; VM_NEXT();
+
+op_vadd:
+op_vsub:
+op_vmul:
+op_vcmpeq:
+op_vcmpgt:
+    {
+        // Computed into a copy since the destination may be one of the operands
+        int64_t vector[32/sizeof(int64_t)];
+        size_t lane_size = VM_LANE_SIZE();
+        for(size_t lane = 0; lane < VM_LANES(); ++lane) {
+            int64_t x = get_vector_lane(&r[ip->b], lane_size, lane);
+            int64_t y = get_vector_lane(&r[ip->c], lane_size, lane);
+            int64_t value = 0;
+            switch(ip->op) {
+                case BYTECODE_OP_VADD: value = (int64_t)((uint64_t)x + (uint64_t)y); break;
+                case BYTECODE_OP_VSUB: value = (int64_t)((uint64_t)x - (uint64_t)y); break;
+                case BYTECODE_OP_VMUL: value = (int64_t)((uint64_t)x * (uint64_t)y); break;
+                case BYTECODE_OP_VCMPEQ: value = x == y ? -1 : 0; break;
+                default: value = x > y ? -1 : 0; break;
+            }
+            set_vector_lane(vector, lane_size, lane, value);
+        }
+        memcpy(&r[ip->a], vector, lane_size*VM_LANES());
+    }
+    VM_NEXT();
+op_vsplat:
+    {
+        int64_t value = r[ip->b];
+        for(size_t lane = 0; lane < VM_LANES(); ++lane) set_vector_lane(&r[ip->a], VM_LANE_SIZE(), lane, value);
+    }
+    VM_NEXT();
+op_vinsert:
+    {
+        int64_t value = r[ip->c];
+        memmove(&r[ip->a], &r[ip->b], VM_LANE_SIZE()*VM_LANES());
+        set_vector_lane(&r[ip->a], VM_LANE_SIZE(), VM_LANE(), value);
+    }
+    VM_NEXT();
+op_vlane: set_vector_lane(&r[ip->a], VM_LANE_SIZE(), VM_LANE(), get_vector_lane(&r[ip->b], VM_LANE_SIZE(), (size_t)((ip->imm >> 24) & 0xFF))); VM_NEXT();
+op_vextract: r[ip->a] = get_vector_lane(&r[ip->b], VM_LANE_SIZE(), VM_LANE()); VM_NEXT();
+op_vreduce:
+    {
+        int64_t sum = 0;
+        for(size_t lane = 0; lane < VM_LANES(); ++lane) sum = (int64_t)((uint64_t)sum + (uint64_t)get_vector_lane(&r[ip->b], VM_LANE_SIZE(), lane));
+        int64_t result = 0;
+        set_vector_lane(&result, VM_LANE_SIZE(), 0, sum);
+        r[ip->a] = get_vector_lane(&result, VM_LANE_SIZE(), 0);
+    }
+    VM_NEXT();
+
+op_call:
+    {
+        const Bytecode_Fn *callee = &bytecode->functions.data[ip->imm];
+        int64_t *registers = r + ip->c;
+        if(frames_count >= ELYSIA_VM_MAX_FRAMES || registers + callee->registers_count > stack_end) {
+            fatal("Stack overflow while calling `"SV_FMT"`", SV_ARGV(callee->name));
+        }
+        frames[frames_count++] = (Vm_Frame){ .ip = ip + 1, .registers = r, .dst = ip->a };
+        r = registers;
+        ip = callee->code.data;
+    }
+    goto *dispatch[ip->op];
+op_tailcall:
+    {
+        const Bytecode_Fn *callee = &bytecode->functions.data[ip->imm];
+        if(r + callee->registers_count > stack_end) {
+            fatal("Stack overflow while calling `"SV_FMT"`", SV_ARGV(callee->name));
+        }
+        memmove(r, &r[ip->b], ip->c*sizeof(int64_t));
+        ip = callee->code.data;
+    }
+    goto *dispatch[ip->op];
+op_ret:
+    {
+        if(frames_count == 0) {
+            result = ip->c > 0 ? (int)(int32_t)r[ip->a] : 0;
+            goto done;
+        }
+        Vm_Frame *frame = &frames[--frames_count];
+        memmove(&frame->registers[frame->dst], &r[ip->a], ip->c*sizeof(int64_t));
+        r = frame->registers;
+        ip = frame->ip;
+    }
+    goto *dispatch[ip->op];
+op_switch:
+    {
+        const Bytecode_Switch *_switch = &bytecode->switches.data[ip->imm];
+        ip += _switch->offsets[find_switch_case(_switch, r[ip->a])];
+    }
+    goto *dispatch[ip->op];
+
+op_jmp: VM_JUMP_IF(true);
+op_jz: VM_JUMP_IF(r[ip->a] == 0);
+op_jnz: VM_JUMP_IF(r[ip->a] != 0);
+op_jeq: VM_JUMP_IF(r[ip->a] == r[ip->b]);
+op_jne: VM_JUMP_IF(r[ip->a] != r[ip->b]);
+op_jlt: VM_JUMP_IF(r[ip->a] < r[ip->b]);
+op_jle: VM_JUMP_IF(r[ip->a] <= r[ip->b]);
+op_jltu32: VM_JUMP_IF((uint32_t)r[ip->a] < (uint32_t)r[ip->b]);
+op_jleu32: VM_JUMP_IF((uint32_t)r[ip->a] <= (uint32_t)r[ip->b]);
+op_jltu64: VM_JUMP_IF((uint64_t)r[ip->a] < (uint64_t)r[ip->b]);
+op_jleu64: VM_JUMP_IF((uint64_t)r[ip->a] <= (uint64_t)r[ip->b]);
+op_jeqi: VM_JUMP_IF(r[ip->a] == ip->imm);
+op_jnei: VM_JUMP_IF(r[ip->a] != ip->imm);
+op_jlti: VM_JUMP_IF(r[ip->a] < ip->imm);
+op_jlei: VM_JUMP_IF(r[ip->a] <= ip->imm);
+op_jgti: VM_JUMP_IF(r[ip->a] > ip->imm);
+op_jgei: VM_JUMP_IF(r[ip->a] >= ip->imm);
+
+#undef VM_NEXT
+#undef VM_JUMP_IF
+#undef VM_LANE_SIZE
+#undef VM_LANES
+#undef VM_LANE
+
+done:
+    free(stack);
+    free(frames);
+    return result;
+}
+
+#pragma GCC diagnostic pop
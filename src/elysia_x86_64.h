@@ -0,0 +1,138 @@
+#ifndef ELYSIA_X86_64_H_
+#define ELYSIA_X86_64_H_
+
+#include "elysia.h"
+
+#define X86_64_INST_MAX_OPERANDS 3
+#define X86_64_INST_TEXT_CAPACITY 128
+#define X86_64_OPERAND_CAPACITY 48
+
+typedef enum {
+    X86_64_INST_OP = 0,
+    X86_64_INST_LABEL,
+    // Rendered verbatim, used for data (`align`, `dd`) living in the middle of the code
+    X86_64_INST_DIRECTIVE,
+    // Deleted by the peephole optimizer
+    X86_64_INST_NOP,
+} X86_64_Inst_Kind;
+
+// Instructions are kept in NASM syntax, the same text is rendered into assembly or encoded
+typedef struct {
+    X86_64_Inst_Kind kind;
+    // The opcode for instructions, the whole text for labels and directives
+    char opcode[X86_64_INST_TEXT_CAPACITY];
+    char operands[X86_64_INST_MAX_OPERANDS][X86_64_OPERAND_CAPACITY];
+    size_t operands_count;
+} X86_64_Inst;
+
+// Instructions of the function being compiled, they are only rendered into NASM once the
+// whole function is done so the peephole optimizer can rewrite them first
+typedef struct {
+    Arena *arena;
+    X86_64_Inst *data;
+    size_t count, capacity;
+    // Label counter of the function, shared with expressions that need control flow of their own
+    size_t *labels_count;
+    // Bytes pushed below the frame by the code emitted so far, calls pad the stack with it in mind
+    // so rsp is aligned to 16 bytes at every call
+    size_t stack_depth;
+} X86_64_Code;
+
+// A 32-bit pc-relative field in the code of a function holding `symbol + addend - field`
+typedef struct {
+    size_t offset;
+    const char *symbol;
+    int64_t addend;
+} X86_64_Relocation;
+
+// Every function is encoded on its own so unused ones can be dropped and the others placed anywhere,
+// calls and jumps to other functions are left to relocations
+typedef struct {
+    const char *name;
+    bool is_global;
+    // Required alignment of the start of the code
+    size_t alignment;
+    struct {
+        uint8_t *data;
+        size_t count, capacity;
+    } code;
+    struct {
+        X86_64_Relocation *data;
+        size_t count, capacity;
+    } relocations;
+} X86_64_Function;
+
+typedef struct {
+    Arena *arena;
+    struct {
+        X86_64_Function *data;
+        size_t count, capacity;
+    } functions;
+} X86_64_Object;
+
+// Encodes the instructions of a function into machine code, labels starting with `.` are local to the function
+void encode_x86_64_function(X86_64_Object *object, String_View name, bool is_global, const X86_64_Code *code);
+// Adds a function whose machine code is already known, relocations are copied
+void add_x86_64_function(X86_64_Object *object, const char *name, bool is_global, const uint8_t *code, size_t size,
+        const X86_64_Relocation *relocations, size_t relocations_count);
+const X86_64_Function *find_x86_64_function(const X86_64_Object *object, const char *name);
+
+// Writes the object as an ELF64 relocatable file with a `.text.<name>` section per function
+void write_elf64_object(const char *file_path, const X86_64_Object *object);
+
+// Symbol the executables start at, provided by the runtime
+#define X86_64_ENTRY_SYMBOL "_start"
+
+// Adds the functions of runtime/elysiart_x86-64.asm: `_start`, `write` and `exit`
+void add_x86_64_runtime(X86_64_Object *object);
+
+// Links the objects into a static executable starting at `entry`. Symbols are looked up in the
+// referring object first and then among the global symbols of every object, functions that
+// can't be reached from the entry are dropped
+void link_x86_64_executable(const char *file_path, const X86_64_Object *objects, size_t objects_count, const char *entry);
+
+// A function of the compiler process the generated code may call, e.g. `write` from libc
+typedef struct {
+    const char *name;
+    void (*address)(void);
+} X86_64_Host_Symbol;
+
+// Compiles the function at `index` of the program into `object`
+typedef void (*X86_64_Jit_Compile_Fn)(void *context, size_t index, X86_64_Object *object);
+
+// Everything the JIT may compile, nothing is compiled before it gets called
+typedef struct {
+    const char **names;
+    size_t functions_count;
+    X86_64_Jit_Compile_Fn compile;
+    void *context;
+    const X86_64_Host_Symbol *host_symbols;
+    size_t host_symbols_count;
+    // Arguments may be passed in the upper halves of ymm registers, the compile stub has to keep them
+    bool preserve_ymm;
+} X86_64_Jit_Program;
+
+// Code of a program compiled on demand into executable memory of the compiler process. Every
+// function starts as a stub calling into the compiler, once compiled the stub is patched into a
+// jump to the generated code
+typedef struct {
+    X86_64_Jit_Program program;
+    uint8_t *memory;
+    // Bytes reserved and bytes handed out to stubs, trampolines and compiled functions
+    size_t size, used;
+    // Indexed like `program.names`, addresses stay NULL until the function is compiled
+    uint8_t **stubs;
+    uint8_t **addresses;
+    uint8_t *trampolines;
+    X86_64_Object object;
+    size_t compiled_count;
+} X86_64_Jit;
+
+// Symbols the program doesn't define are resolved against the host symbols through trampolines
+// since the host may live further away than a 32-bit displacement reaches
+void load_x86_64_jit(X86_64_Jit *jit, Arena *arena, const X86_64_Jit_Program *program);
+// Returns the stub of the function, calling it compiles the function first if it has to
+void *find_x86_64_jit_function(const X86_64_Jit *jit, const char *name);
+void unload_x86_64_jit(X86_64_Jit *jit);
+
+#endif // ELYSIA_X86_64_H_
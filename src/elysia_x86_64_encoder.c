@@ -0,0 +1,926 @@
+#include "elysia.h"
+#include "elysia_x86_64.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Functions start at 16 byte boundaries like they would with any C compiler
+#define X86_64_FUNCTION_ALIGNMENT 16
+#define X86_64_MAX_INST_SIZE 32
+
+typedef enum {
+    X86_64_OPERAND_REGISTER = 0,
+    X86_64_OPERAND_VECTOR,
+    X86_64_OPERAND_IMMEDIATE,
+    X86_64_OPERAND_MEMORY,
+    X86_64_OPERAND_LABEL,
+} X86_64_Operand_Kind;
+
+typedef struct {
+    X86_64_Operand_Kind kind;
+    // Bytes accessed, 0 for memory operands without a size prefix
+    size_t size;
+    // Register number of registers, base and index registers of memory operands (-1 when absent)
+    int reg;
+    int base, index, scale;
+    // Immediate value or displacement of memory operands
+    int64_t value;
+    // spl, bpl, sil and dil are only reachable with a REX prefix
+    bool needs_rex;
+    // Target of labels and of `[rel label+disp]` memory operands
+    char label[X86_64_OPERAND_CAPACITY];
+} X86_64_Operand;
+
+// A single encoded instruction, it may refer to a label with a 32-bit field relative to its end
+typedef struct {
+    uint8_t bytes[X86_64_MAX_INST_SIZE];
+    size_t count;
+    bool has_fixup;
+    size_t fixup_at;
+    int64_t fixup_addend;
+    char fixup_label[X86_64_OPERAND_CAPACITY];
+} X86_64_Encoding;
+
+typedef struct {
+    char name[X86_64_OPERAND_CAPACITY];
+    size_t offset;
+} X86_64_Label;
+
+// A 32-bit field holding `target + addend - base`, base being either an offset or another label
+typedef struct {
+    size_t offset;
+    char target[X86_64_OPERAND_CAPACITY];
+    char base_label[X86_64_OPERAND_CAPACITY];
+    size_t base;
+    int64_t addend;
+} X86_64_Fixup;
+
+typedef struct {
+    Arena *arena;
+    X86_64_Function *function;
+    struct {
+        X86_64_Label *data;
+        size_t count, capacity;
+    } labels;
+    struct {
+        X86_64_Fixup *data;
+        size_t count, capacity;
+    } fixups;
+} X86_64_Encoder;
+
+static void *grow_items(Arena *arena, void *data, size_t count, size_t *capacity, size_t item_size)
+{
+    if(count < *capacity) return data;
+    size_t new_capacity = *capacity * 2;
+    if(new_capacity == 0) new_capacity = 64;
+    void *new_data = arena_alloc(arena, new_capacity * item_size);
+    assert(new_data && "buy more ram lol!");
+    if(count > 0) memcpy(new_data, data, count * item_size);
+    *capacity = new_capacity;
+    return new_data;
+}
+
+static void push_code_byte(Arena *arena, X86_64_Function *function, uint8_t byte)
+{
+    function->code.data = grow_items(arena, function->code.data, function->code.count, &function->code.capacity, sizeof(uint8_t));
+    function->code.data[function->code.count++] = byte;
+}
+
+static void push_relocation(Arena *arena, X86_64_Function *function, X86_64_Relocation relocation)
+{
+    function->relocations.data = grow_items(arena, function->relocations.data, function->relocations.count,
+            &function->relocations.capacity, sizeof(X86_64_Relocation));
+    function->relocations.data[function->relocations.count++] = relocation;
+}
+
+static X86_64_Function *push_function(X86_64_Object *object)
+{
+    object->functions.data = grow_items(object->arena, object->functions.data, object->functions.count,
+            &object->functions.capacity, sizeof(X86_64_Function));
+    X86_64_Function *function = &object->functions.data[object->functions.count++];
+    memset(function, 0, sizeof(*function));
+    return function;
+}
+
+static void push_label(X86_64_Encoder *encoder, const char *name, size_t offset)
+{
+    encoder->labels.data = grow_items(encoder->arena, encoder->labels.data, encoder->labels.count,
+            &encoder->labels.capacity, sizeof(X86_64_Label));
+    X86_64_Label *label = &encoder->labels.data[encoder->labels.count++];
+    snprintf(label->name, sizeof(label->name), "%s", name);
+    label->offset = offset;
+}
+
+static X86_64_Fixup *push_fixup(X86_64_Encoder *encoder)
+{
+    encoder->fixups.data = grow_items(encoder->arena, encoder->fixups.data, encoder->fixups.count,
+            &encoder->fixups.capacity, sizeof(X86_64_Fixup));
+    X86_64_Fixup *fixup = &encoder->fixups.data[encoder->fixups.count++];
+    memset(fixup, 0, sizeof(*fixup));
+    return fixup;
+}
+
+static const X86_64_Label *find_label(const X86_64_Encoder *encoder, const char *name)
+{
+    for(size_t i = 0; i < encoder->labels.count; ++i) {
+        if(strcmp(encoder->labels.data[i].name, name) == 0) return &encoder->labels.data[i];
+    }
+    return NULL;
+}
+
+// General purpose registers indexed by 1, 2, 4 or 8 bytes and then by register number
+static const char *x86_64_registers[4][16] = {
+    { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" },
+    { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" },
+    { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" },
+    { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" },
+};
+
+static bool parse_register(const char *text, size_t len, X86_64_Operand *result)
+{
+    for(size_t i = 0; i < 4; ++i) {
+        for(int reg = 0; reg < 16; ++reg) {
+            const char *name = x86_64_registers[i][reg];
+            if(strlen(name) != len || strncmp(name, text, len) != 0) continue;
+            result->kind = X86_64_OPERAND_REGISTER;
+            result->size = (size_t)1 << i;
+            result->reg = reg;
+            result->needs_rex = i == 0 && reg >= 4 && reg < 8;
+            return true;
+        }
+    }
+
+    if(len < 4 || len > 5 || (strncmp(text, "xmm", 3) != 0 && strncmp(text, "ymm", 3) != 0)) return false;
+    int reg = 0;
+    for(size_t i = 3; i < len; ++i) {
+        if(text[i] < '0' || text[i] > '9') return false;
+        reg = reg*10 + (text[i] - '0');
+    }
+    if(reg >= 16) return false;
+    result->kind = X86_64_OPERAND_VECTOR;
+    result->size = text[0] == 'y' ? 32 : 16;
+    result->reg = reg;
+    return true;
+}
+
+static bool parse_number(const char *text, size_t len, int64_t *result)
+{
+    char buffer[X86_64_OPERAND_CAPACITY];
+    if(len == 0 || len >= sizeof(buffer)) return false;
+    memcpy(buffer, text, len);
+    buffer[len] = '\0';
+    char *end = NULL;
+    // Unsigned parsing keeps immediates like 0x80808080 and 0xFFFFFFFFFFFFFFFF intact
+    if(buffer[0] == '-') *result = strtoll(buffer, &end, 0);
+    else *result = (int64_t)strtoull(buffer, &end, 0);
+    return end != buffer && *end == '\0';
+}
+
+static size_t parse_size_prefix(const char **text)
+{
+    static const struct { const char *name; size_t size; } prefixes[] = {
+        { "BYTE", 1 }, { "WORD", 2 }, { "DWORD", 4 }, { "QWORD", 8 }, { "OWORD", 16 }, { "YWORD", 32 },
+    };
+    for(size_t i = 0; i < sizeof(prefixes)/sizeof(prefixes[0]); ++i) {
+        size_t len = strlen(prefixes[i].name);
+        if(strncmp(*text, prefixes[i].name, len) == 0 && ((*text)[len] == '[' || (*text)[len] == ' ')) {
+            *text += len;
+            while(**text == ' ') *text += 1;
+            return prefixes[i].size;
+        }
+    }
+    return 0;
+}
+
+// `[rel label+disp]` or any sum of a base register, an index register scaled by 1, 2, 4 or 8 and displacements
+static bool parse_memory(const char *text, X86_64_Operand *result)
+{
+    result->kind = X86_64_OPERAND_MEMORY;
+    result->base = -1;
+    result->index = -1;
+    result->scale = 1;
+    const char *it = text + 1;
+    const char *end = strchr(it, ']');
+    if(end == NULL || end[1] != '\0') return false;
+
+    if(strncmp(it, "rel ", 4) == 0) {
+        it += 4;
+        const char *sign = it;
+        while(sign < end && *sign != '+' && *sign != '-') ++sign;
+        if(sign == it || (size_t)(sign - it) >= sizeof(result->label)) return false;
+        snprintf(result->label, sizeof(result->label), "%.*s", (int)(sign - it), it);
+        if(sign < end) {
+            int64_t disp = 0;
+            if(!parse_number(sign + 1, end - sign - 1, &disp)) return false;
+            result->value = *sign == '-' ? -disp : disp;
+        }
+        return true;
+    }
+
+    bool negative = false;
+    while(it < end) {
+        const char *term = it;
+        while(it < end && *it != '+' && *it != '-') ++it;
+        size_t len = it - term;
+        X86_64_Operand reg = {0};
+        const char *star = memchr(term, '*', len);
+        int64_t value = 0;
+        if(star) {
+            int64_t scale = 0;
+            if(!parse_register(term, star - term, &reg) || reg.kind != X86_64_OPERAND_REGISTER || reg.size != 8) return false;
+            if(!parse_number(star + 1, term + len - star - 1, &scale)) return false;
+            if(result->index != -1 || reg.reg == 4 || (scale != 1 && scale != 2 && scale != 4 && scale != 8)) return false;
+            result->index = reg.reg;
+            result->scale = (int)scale;
+        } else if(parse_register(term, len, &reg)) {
+            if(reg.kind != X86_64_OPERAND_REGISTER || reg.size != 8 || negative) return false;
+            if(result->base == -1) {
+                result->base = reg.reg;
+            } else if(result->index == -1 && reg.reg != 4) {
+                result->index = reg.reg;
+            } else {
+                return false;
+            }
+        } else if(parse_number(term, len, &value)) {
+            result->value += negative ? -value : value;
+        } else {
+            return false;
+        }
+        if(it < end) {
+            negative = *it == '-';
+            ++it;
+        }
+    }
+    return result->value >= INT32_MIN && result->value <= INT32_MAX;
+}
+
+static bool parse_operand(const char *text, X86_64_Operand *result)
+{
+    memset(result, 0, sizeof(*result));
+    while(*text == ' ') ++text;
+    size_t size = parse_size_prefix(&text);
+    if(*text == '[') {
+        if(!parse_memory(text, result)) return false;
+        result->size = size;
+        return true;
+    }
+    if(size != 0) return false;
+    size_t len = strlen(text);
+    while(len > 0 && text[len - 1] == ' ') --len;
+    if(parse_register(text, len, result)) return true;
+    if(parse_number(text, len, &result->value)) {
+        result->kind = X86_64_OPERAND_IMMEDIATE;
+        return true;
+    }
+    if(len == 0 || len >= sizeof(result->label)) return false;
+    result->kind = X86_64_OPERAND_LABEL;
+    snprintf(result->label, sizeof(result->label), "%.*s", (int)len, text);
+    return true;
+}
+
+static void put_byte(X86_64_Encoding *enc, uint8_t byte)
+{
+    assert(enc->count < sizeof(enc->bytes));
+    enc->bytes[enc->count++] = byte;
+}
+
+static void put_value(X86_64_Encoding *enc, int64_t value, size_t size)
+{
+    for(size_t i = 0; i < size; ++i) put_byte(enc, (uint8_t)((uint64_t)value >> (8*i)));
+}
+
+static void put_label_field(X86_64_Encoding *enc, const char *label, int64_t addend)
+{
+    enc->has_fixup = true;
+    enc->fixup_at = enc->count;
+    enc->fixup_addend = addend;
+    snprintf(enc->fixup_label, sizeof(enc->fixup_label), "%s", label);
+    put_value(enc, 0, 4);
+}
+
+static bool is_rip_relative(const X86_64_Operand *rm)
+{
+    return rm->kind == X86_64_OPERAND_MEMORY && rm->label[0] != '\0';
+}
+
+// REX.R, REX.X and REX.B extend the ModRM.reg field, the SIB index and the ModRM.rm or SIB base fields
+static uint8_t get_rex_bits(int reg, const X86_64_Operand *rm)
+{
+    uint8_t bits = (reg & 8) ? 4 : 0;
+    if(rm->kind == X86_64_OPERAND_MEMORY) {
+        if(rm->index >= 8) bits |= 2;
+        if(rm->base >= 8) bits |= 1;
+    } else if(rm->reg & 8) {
+        bits |= 1;
+    }
+    return bits;
+}
+
+static void put_modrm(X86_64_Encoding *enc, int reg, const X86_64_Operand *rm)
+{
+    if(rm->kind != X86_64_OPERAND_MEMORY) {
+        put_byte(enc, 0xC0 | (reg & 7) << 3 | (rm->reg & 7));
+        return;
+    }
+    if(is_rip_relative(rm)) {
+        put_byte(enc, 0x05 | (reg & 7) << 3);
+        put_label_field(enc, rm->label, rm->value);
+        return;
+    }
+
+    // rsp and r12 as a base always need a SIB byte, rbp and r13 always need a displacement
+    bool needs_sib = rm->index != -1 || rm->base == -1 || (rm->base & 7) == 4;
+    int mod = 2;
+    if(rm->base == -1) mod = 0;
+    else if(rm->value == 0 && (rm->base & 7) != 5) mod = 0;
+    else if(rm->value >= INT8_MIN && rm->value <= INT8_MAX) mod = 1;
+
+    put_byte(enc, mod << 6 | (reg & 7) << 3 | (needs_sib ? 4 : (rm->base & 7)));
+    if(needs_sib) {
+        int scale = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+        int index = rm->index == -1 ? 4 : (rm->index & 7);
+        int base = rm->base == -1 ? 5 : (rm->base & 7);
+        put_byte(enc, scale << 6 | index << 3 | base);
+    }
+    if(mod == 1) put_value(enc, rm->value, 1);
+    else if(mod == 2 || rm->base == -1) put_value(enc, rm->value, 4);
+}
+
+// Multi-byte opcodes are given most significant byte first, e.g. 0x0FAF for `0F AF`
+static void put_opcode(X86_64_Encoding *enc, uint32_t opcode, size_t size)
+{
+    for(size_t i = size; i > 0; --i) put_byte(enc, (uint8_t)(opcode >> (8*(i - 1))));
+}
+
+// [prefix] [REX] opcode ModRM [SIB] [disp], `reg` is either a register or an opcode extension
+static void encode_legacy(X86_64_Encoding *enc, uint8_t prefix, bool wide, bool force_rex,
+        uint32_t opcode, size_t opcode_size, int reg, const X86_64_Operand *rm)
+{
+    if(prefix) put_byte(enc, prefix);
+    uint8_t rex = get_rex_bits(reg, rm) | (wide ? 8 : 0);
+    if(rex || force_rex) put_byte(enc, 0x40 | rex);
+    put_opcode(enc, opcode, opcode_size);
+    put_modrm(enc, reg, rm);
+}
+
+// Opcodes of the form `base + register`
+static void encode_with_register(X86_64_Encoding *enc, uint8_t prefix, bool wide, bool force_rex, uint8_t opcode, int reg)
+{
+    if(prefix) put_byte(enc, prefix);
+    uint8_t rex = ((reg & 8) ? 1 : 0) | (wide ? 8 : 0);
+    if(rex || force_rex) put_byte(enc, 0x40 | rex);
+    put_byte(enc, opcode + (reg & 7));
+}
+
+typedef enum {
+    X86_64_VEX_NONE = 0,
+    X86_64_VEX_66,
+    X86_64_VEX_F3,
+    X86_64_VEX_F2,
+} X86_64_Vex_Prefix;
+
+typedef enum {
+    X86_64_MAP_0F = 1,
+    X86_64_MAP_0F38,
+    X86_64_MAP_0F3A,
+} X86_64_Opcode_Map;
+
+// The two byte form is only available for the 0F map without REX.W, REX.X and REX.B
+static void encode_vex(X86_64_Encoding *enc, X86_64_Vex_Prefix pp, X86_64_Opcode_Map map, bool wide, bool wide_vector,
+        uint8_t opcode, int reg, int vvvv, const X86_64_Operand *rm)
+{
+    uint8_t rex = get_rex_bits(reg, rm);
+    uint8_t tail = (~vvvv & 15) << 3 | (wide_vector ? 4 : 0) | pp;
+    if(map == X86_64_MAP_0F && !wide && (rex & 3) == 0) {
+        put_byte(enc, 0xC5);
+        put_byte(enc, ((rex & 4) ? 0 : 0x80) | tail);
+    } else {
+        put_byte(enc, 0xC4);
+        put_byte(enc, (~rex & 7) << 5 | map);
+        put_byte(enc, (wide ? 0x80 : 0) | tail);
+    }
+    put_byte(enc, opcode);
+    put_modrm(enc, reg, rm);
+}
+
+static bool fits_i8(int64_t value)
+{
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+// Immediates of 32-bit operations may be written as unsigned, 64-bit ones are sign extended from 32 bits
+static bool normalize_immediate(int64_t *value, size_t size)
+{
+    switch(size) {
+        case 1: *value = (int8_t)*value; return true;
+        case 2: *value = (int16_t)*value; return true;
+        case 4: *value = (int32_t)*value; return true;
+        default: return *value >= INT32_MIN && *value <= INT32_MAX;
+    }
+}
+
+static bool is_gpr_or_memory(const X86_64_Operand *op)
+{
+    return op->kind == X86_64_OPERAND_REGISTER || op->kind == X86_64_OPERAND_MEMORY;
+}
+
+static bool is_vector_or_memory(const X86_64_Operand *op)
+{
+    return op->kind == X86_64_OPERAND_VECTOR || op->kind == X86_64_OPERAND_MEMORY;
+}
+
+static uint8_t get_size_prefix(size_t size)
+{
+    return size == 2 ? 0x66 : 0;
+}
+
+static const char *x86_64_alu_ops[] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+
+static bool encode_alu(X86_64_Encoding *enc, uint8_t n, const X86_64_Operand *dst, const X86_64_Operand *src)
+{
+    bool force_rex = dst->needs_rex || src->needs_rex;
+    if(is_gpr_or_memory(dst) && src->kind == X86_64_OPERAND_REGISTER) {
+        if(dst->kind == X86_64_OPERAND_REGISTER && dst->size != src->size) return false;
+        uint32_t opcode = n*8 + (src->size == 1 ? 0 : 1);
+        encode_legacy(enc, get_size_prefix(src->size), src->size == 8, force_rex, opcode, 1, src->reg, dst);
+        return true;
+    }
+    if(dst->kind == X86_64_OPERAND_REGISTER && src->kind == X86_64_OPERAND_MEMORY) {
+        uint32_t opcode = n*8 + (dst->size == 1 ? 2 : 3);
+        encode_legacy(enc, get_size_prefix(dst->size), dst->size == 8, force_rex, opcode, 1, dst->reg, src);
+        return true;
+    }
+    if(is_gpr_or_memory(dst) && src->kind == X86_64_OPERAND_IMMEDIATE && dst->size != 0) {
+        int64_t value = src->value;
+        if(!normalize_immediate(&value, dst->size)) return false;
+        if(dst->size == 1) {
+            encode_legacy(enc, 0, false, force_rex, 0x80, 1, n, dst);
+            put_value(enc, value, 1);
+        } else if(fits_i8(value)) {
+            encode_legacy(enc, get_size_prefix(dst->size), dst->size == 8, force_rex, 0x83, 1, n, dst);
+            put_value(enc, value, 1);
+        } else {
+            encode_legacy(enc, get_size_prefix(dst->size), dst->size == 8, force_rex, 0x81, 1, n, dst);
+            put_value(enc, value, dst->size == 2 ? 2 : 4);
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool encode_mov(X86_64_Encoding *enc, const X86_64_Operand *dst, const X86_64_Operand *src)
+{
+    bool force_rex = dst->needs_rex || src->needs_rex;
+    if(is_gpr_or_memory(dst) && src->kind == X86_64_OPERAND_REGISTER) {
+        if(dst->kind == X86_64_OPERAND_REGISTER && dst->size != src->size) return false;
+        encode_legacy(enc, get_size_prefix(src->size), src->size == 8, force_rex, src->size == 1 ? 0x88 : 0x89, 1, src->reg, dst);
+        return true;
+    }
+    if(dst->kind == X86_64_OPERAND_REGISTER && src->kind == X86_64_OPERAND_MEMORY) {
+        encode_legacy(enc, get_size_prefix(dst->size), dst->size == 8, force_rex, dst->size == 1 ? 0x8A : 0x8B, 1, dst->reg, src);
+        return true;
+    }
+    if(src->kind != X86_64_OPERAND_IMMEDIATE || !is_gpr_or_memory(dst) || dst->size == 0) return false;
+
+    int64_t value = src->value;
+    if(dst->kind == X86_64_OPERAND_REGISTER && dst->size == 8 && !normalize_immediate(&value, 8)) {
+        // Only `mov r64, imm64` takes a full 64-bit immediate
+        encode_with_register(enc, 0, true, false, 0xB8, dst->reg);
+        put_value(enc, value, 8);
+        return true;
+    }
+    if(!normalize_immediate(&value, dst->size)) return false;
+    if(dst->kind == X86_64_OPERAND_REGISTER && dst->size != 8) {
+        encode_with_register(enc, get_size_prefix(dst->size), false, force_rex, dst->size == 1 ? 0xB0 : 0xB8, dst->reg);
+        put_value(enc, value, dst->size);
+        return true;
+    }
+    encode_legacy(enc, get_size_prefix(dst->size), dst->size == 8, force_rex, dst->size == 1 ? 0xC6 : 0xC7, 1, 0, dst);
+    put_value(enc, value, dst->size == 8 ? 4 : dst->size);
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    uint8_t code;
+} X86_64_Condition_Code;
+
+static const X86_64_Condition_Code x86_64_condition_codes[] = {
+    { "o", 0x0 }, { "no", 0x1 }, { "b", 0x2 }, { "c", 0x2 }, { "nae", 0x2 }, { "ae", 0x3 }, { "nb", 0x3 },
+    { "nc", 0x3 }, { "e", 0x4 }, { "z", 0x4 }, { "ne", 0x5 }, { "nz", 0x5 }, { "be", 0x6 }, { "na", 0x6 },
+    { "a", 0x7 }, { "nbe", 0x7 }, { "s", 0x8 }, { "ns", 0x9 }, { "p", 0xA }, { "np", 0xB }, { "l", 0xC },
+    { "nge", 0xC }, { "ge", 0xD }, { "nl", 0xD }, { "le", 0xE }, { "ng", 0xE }, { "g", 0xF }, { "nle", 0xF },
+};
+
+static bool find_condition_code(const char *name, uint8_t *code)
+{
+    for(size_t i = 0; i < sizeof(x86_64_condition_codes)/sizeof(x86_64_condition_codes[0]); ++i) {
+        if(strcmp(x86_64_condition_codes[i].name, name) == 0) {
+            *code = x86_64_condition_codes[i].code;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Jumps and calls always take a 32-bit displacement, labels are resolved once the function is done
+static bool encode_branch(X86_64_Encoding *enc, uint32_t opcode, size_t opcode_size, uint8_t ext, const X86_64_Operand *target)
+{
+    if(target->kind == X86_64_OPERAND_LABEL) {
+        put_opcode(enc, opcode, opcode_size);
+        put_label_field(enc, target->label, 0);
+        return true;
+    }
+    if(ext == 0 || !is_gpr_or_memory(target) || (target->kind == X86_64_OPERAND_REGISTER && target->size != 8)) return false;
+    encode_legacy(enc, 0, false, false, 0xFF, 1, ext, target);
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    X86_64_Opcode_Map map;
+    uint8_t opcode;
+} X86_64_Packed_Op;
+
+// Lane-wise operations `op xmm, xmm/m128` (66 prefix) and their `vop xmm/ymm, xmm/ymm, xmm/ymm/m` VEX forms
+static const X86_64_Packed_Op x86_64_packed_ops[] = {
+    { "paddb", X86_64_MAP_0F, 0xFC }, { "paddw", X86_64_MAP_0F, 0xFD }, { "paddd", X86_64_MAP_0F, 0xFE },
+    { "paddq", X86_64_MAP_0F, 0xD4 }, { "psubb", X86_64_MAP_0F, 0xF8 }, { "psubw", X86_64_MAP_0F, 0xF9 },
+    { "psubd", X86_64_MAP_0F, 0xFA }, { "psubq", X86_64_MAP_0F, 0xFB }, { "pmuludq", X86_64_MAP_0F, 0xF4 },
+    { "pmullw", X86_64_MAP_0F, 0xD5 }, { "punpckldq", X86_64_MAP_0F, 0x62 }, { "punpcklqdq", X86_64_MAP_0F, 0x6C },
+    { "pcmpeqb", X86_64_MAP_0F, 0x74 }, { "pcmpeqw", X86_64_MAP_0F, 0x75 }, { "pcmpeqd", X86_64_MAP_0F, 0x76 },
+    { "pcmpgtb", X86_64_MAP_0F, 0x64 }, { "pcmpgtw", X86_64_MAP_0F, 0x65 }, { "pcmpgtd", X86_64_MAP_0F, 0x66 },
+    { "pxor", X86_64_MAP_0F, 0xEF }, { "pand", X86_64_MAP_0F, 0xDB }, { "por", X86_64_MAP_0F, 0xEB },
+    { "psadbw", X86_64_MAP_0F, 0xF6 }, { "pshufb", X86_64_MAP_0F38, 0x00 }, { "pmulld", X86_64_MAP_0F38, 0x40 },
+    { "pcmpeqq", X86_64_MAP_0F38, 0x29 }, { "pcmpgtq", X86_64_MAP_0F38, 0x37 }, { "vpermd", X86_64_MAP_0F38, 0x36 },
+};
+
+static const X86_64_Packed_Op *find_packed_op(const char *name)
+{
+    for(size_t i = 0; i < sizeof(x86_64_packed_ops)/sizeof(x86_64_packed_ops[0]); ++i) {
+        if(strcmp(x86_64_packed_ops[i].name, name) == 0) return &x86_64_packed_ops[i];
+    }
+    return NULL;
+}
+
+// Legacy SSE encoding `prefix [REX] escape opcode ModRM`
+static void encode_sse(X86_64_Encoding *enc, uint8_t prefix, bool wide, X86_64_Opcode_Map map, uint8_t opcode,
+        int reg, const X86_64_Operand *rm)
+{
+    switch(map) {
+        case X86_64_MAP_0F38: encode_legacy(enc, prefix, wide, false, 0x0F3800 | opcode, 3, reg, rm); break;
+        case X86_64_MAP_0F3A: encode_legacy(enc, prefix, wide, false, 0x0F3A00 | opcode, 3, reg, rm); break;
+        default: encode_legacy(enc, prefix, wide, false, 0x0F00 | opcode, 2, reg, rm); break;
+    }
+}
+
+static bool encode_vector_inst(X86_64_Encoding *enc, const char *opcode, const X86_64_Operand *ops, size_t count)
+{
+    bool vex = opcode[0] == 'v' && strcmp(opcode, "vpermd") != 0;
+    const char *name = vex ? opcode + 1 : opcode;
+    const X86_64_Operand *a = &ops[0], *b = &ops[1], *c = &ops[2];
+
+    const X86_64_Packed_Op *packed = find_packed_op(name);
+    if(packed) {
+        if(strcmp(opcode, "vpermd") == 0 || vex) {
+            if(count != 3 || a->kind != X86_64_OPERAND_VECTOR || b->kind != X86_64_OPERAND_VECTOR || !is_vector_or_memory(c)) return false;
+            encode_vex(enc, X86_64_VEX_66, packed->map, false, a->size == 32, packed->opcode, a->reg, b->reg, c);
+            return true;
+        }
+        if(count != 2 || a->kind != X86_64_OPERAND_VECTOR || a->size != 16 || !is_vector_or_memory(b)) return false;
+        encode_sse(enc, 0x66, false, packed->map, packed->opcode, a->reg, b);
+        return true;
+    }
+
+    if(strcmp(name, "movdqu") == 0 || strcmp(name, "movdqa") == 0) {
+        if(count != 2) return false;
+        bool unaligned = name[5] == 'u';
+        bool load = a->kind == X86_64_OPERAND_VECTOR;
+        const X86_64_Operand *reg = load ? a : b;
+        const X86_64_Operand *rm = load ? b : a;
+        if(reg->kind != X86_64_OPERAND_VECTOR || !is_vector_or_memory(rm)) return false;
+        if(vex) encode_vex(enc, unaligned ? X86_64_VEX_F3 : X86_64_VEX_66, X86_64_MAP_0F, false, reg->size == 32, load ? 0x6F : 0x7F, reg->reg, 0, rm);
+        else encode_sse(enc, unaligned ? 0xF3 : 0x66, false, X86_64_MAP_0F, load ? 0x6F : 0x7F, reg->reg, rm);
+        return true;
+    }
+    if(strcmp(name, "movd") == 0 || strcmp(name, "movq") == 0) {
+        if(count != 2) return false;
+        bool wide = name[3] == 'q';
+        bool to_vector = a->kind == X86_64_OPERAND_VECTOR;
+        const X86_64_Operand *reg = to_vector ? a : b;
+        const X86_64_Operand *rm = to_vector ? b : a;
+        if(reg->kind != X86_64_OPERAND_VECTOR || reg->size != 16 || !is_gpr_or_memory(rm)) return false;
+        if(rm->kind == X86_64_OPERAND_REGISTER && rm->size != (wide ? 8 : 4)) return false;
+        if(vex) encode_vex(enc, X86_64_VEX_66, X86_64_MAP_0F, wide, false, to_vector ? 0x6E : 0x7E, reg->reg, 0, rm);
+        else encode_sse(enc, 0x66, wide, X86_64_MAP_0F, to_vector ? 0x6E : 0x7E, reg->reg, rm);
+        return true;
+    }
+    if(strcmp(name, "pshufd") == 0) {
+        if(count != 3 || a->kind != X86_64_OPERAND_VECTOR || !is_vector_or_memory(b) || c->kind != X86_64_OPERAND_IMMEDIATE) return false;
+        if(vex) encode_vex(enc, X86_64_VEX_66, X86_64_MAP_0F, false, a->size == 32, 0x70, a->reg, 0, b);
+        else encode_sse(enc, 0x66, false, X86_64_MAP_0F, 0x70, a->reg, b);
+        put_value(enc, c->value, 1);
+        return true;
+    }
+    if(strcmp(name, "pextrw") == 0) {
+        if(count != 3 || a->kind != X86_64_OPERAND_REGISTER || b->kind != X86_64_OPERAND_VECTOR || c->kind != X86_64_OPERAND_IMMEDIATE) return false;
+        if(vex) encode_vex(enc, X86_64_VEX_66, X86_64_MAP_0F, false, false, 0xC5, a->reg, 0, b);
+        else encode_sse(enc, 0x66, false, X86_64_MAP_0F, 0xC5, a->reg, b);
+        put_value(enc, c->value, 1);
+        return true;
+    }
+
+    // Shifts by an immediate, the shift is an opcode extension and the shifted register goes into ModRM.rm
+    static const struct { const char *name; uint8_t opcode; uint8_t ext; } shifts[] = {
+        { "psrlw", 0x71, 2 }, { "psraw", 0x71, 4 }, { "psllw", 0x71, 6 },
+        { "psrld", 0x72, 2 }, { "psrad", 0x72, 4 }, { "pslld", 0x72, 6 },
+        { "psrlq", 0x73, 2 }, { "psllq", 0x73, 6 },
+    };
+    for(size_t i = 0; i < sizeof(shifts)/sizeof(shifts[0]); ++i) {
+        if(strcmp(name, shifts[i].name) != 0) continue;
+        const X86_64_Operand *imm = vex ? c : b;
+        const X86_64_Operand *src = vex ? b : a;
+        if(count != (vex ? 3u : 2u) || a->kind != X86_64_OPERAND_VECTOR || src->kind != X86_64_OPERAND_VECTOR
+                || imm->kind != X86_64_OPERAND_IMMEDIATE) return false;
+        if(vex) encode_vex(enc, X86_64_VEX_66, X86_64_MAP_0F, false, a->size == 32, shifts[i].opcode, shifts[i].ext, a->reg, src);
+        else encode_sse(enc, 0x66, false, X86_64_MAP_0F, shifts[i].opcode, shifts[i].ext, src);
+        put_value(enc, imm->value, 1);
+        return true;
+    }
+
+    if(strcmp(opcode, "vpbroadcastd") == 0) {
+        if(count != 2 || a->kind != X86_64_OPERAND_VECTOR || !is_vector_or_memory(b)) return false;
+        encode_vex(enc, X86_64_VEX_66, X86_64_MAP_0F38, false, a->size == 32, 0x58, a->reg, 0, b);
+        return true;
+    }
+    if(strcmp(opcode, "vextracti128") == 0) {
+        if(count != 3 || !is_vector_or_memory(a) || b->kind != X86_64_OPERAND_VECTOR || c->kind != X86_64_OPERAND_IMMEDIATE) return false;
+        encode_vex(enc, X86_64_VEX_66, X86_64_MAP_0F3A, false, true, 0x39, b->reg, 0, a);
+        put_value(enc, c->value, 1);
+        return true;
+    }
+    return false;
+}
+
+static bool encode_inst(X86_64_Encoding *enc, const X86_64_Inst *inst)
+{
+    X86_64_Operand ops[X86_64_INST_MAX_OPERANDS] = {0};
+    for(size_t i = 0; i < inst->operands_count; ++i) {
+        if(!parse_operand(inst->operands[i], &ops[i])) return false;
+    }
+    const char *opcode = inst->opcode;
+    size_t count = inst->operands_count;
+    const X86_64_Operand *a = &ops[0], *b = &ops[1];
+    bool force_rex = a->needs_rex || b->needs_rex;
+
+    for(uint8_t n = 0; n < sizeof(x86_64_alu_ops)/sizeof(x86_64_alu_ops[0]); ++n) {
+        if(strcmp(opcode, x86_64_alu_ops[n]) == 0) return count == 2 && encode_alu(enc, n, a, b);
+    }
+    if(strcmp(opcode, "mov") == 0) return count == 2 && encode_mov(enc, a, b);
+
+    if(strcmp(opcode, "movzx") == 0 || strcmp(opcode, "movsx") == 0) {
+        if(count != 2 || a->kind != X86_64_OPERAND_REGISTER || a->size < 2 || !is_gpr_or_memory(b)) return false;
+        if(b->size != 1 && b->size != 2) return false;
+        uint32_t bytes = (opcode[3] == 'z' ? 0x0FB6 : 0x0FBE) + (b->size == 2 ? 1 : 0);
+        encode_legacy(enc, get_size_prefix(a->size), a->size == 8, force_rex, bytes, 2, a->reg, b);
+        return true;
+    }
+    if(strcmp(opcode, "movsxd") == 0) {
+        if(count != 2 || a->kind != X86_64_OPERAND_REGISTER || a->size != 8 || !is_gpr_or_memory(b)) return false;
+        encode_legacy(enc, 0, true, false, 0x63, 1, a->reg, b);
+        return true;
+    }
+    if(strcmp(opcode, "lea") == 0) {
+        if(count != 2 || a->kind != X86_64_OPERAND_REGISTER || a->size < 2 || b->kind != X86_64_OPERAND_MEMORY) return false;
+        encode_legacy(enc, get_size_prefix(a->size), a->size == 8, false, 0x8D, 1, a->reg, b);
+        return true;
+    }
+    if(strcmp(opcode, "test") == 0) {
+        if(count != 2 || !is_gpr_or_memory(a)) return false;
+        if(b->kind == X86_64_OPERAND_REGISTER) {
+            encode_legacy(enc, get_size_prefix(b->size), b->size == 8, force_rex, b->size == 1 ? 0x84 : 0x85, 1, b->reg, a);
+            return true;
+        }
+        int64_t value = b->value;
+        if(b->kind != X86_64_OPERAND_IMMEDIATE || a->size == 0 || !normalize_immediate(&value, a->size)) return false;
+        encode_legacy(enc, get_size_prefix(a->size), a->size == 8, force_rex, a->size == 1 ? 0xF6 : 0xF7, 1, 0, a);
+        put_value(enc, value, a->size == 8 ? 4 : a->size);
+        return true;
+    }
+    if(strcmp(opcode, "imul") == 0) {
+        if(count != 2 || a->kind != X86_64_OPERAND_REGISTER || a->size < 2 || !is_gpr_or_memory(b)) return false;
+        encode_legacy(enc, get_size_prefix(a->size), a->size == 8, false, 0x0FAF, 2, a->reg, b);
+        return true;
+    }
+    if(strcmp(opcode, "shl") == 0 || strcmp(opcode, "shr") == 0 || strcmp(opcode, "sar") == 0) {
+        if(count != 2 || !is_gpr_or_memory(a) || a->size == 0 || b->kind != X86_64_OPERAND_IMMEDIATE) return false;
+        uint8_t ext = opcode[1] == 'h' ? (opcode[2] == 'l' ? 4 : 5) : 7;
+        encode_legacy(enc, get_size_prefix(a->size), a->size == 8, force_rex, a->size == 1 ? 0xC0 : 0xC1, 1, ext, a);
+        put_value(enc, b->value, 1);
+        return true;
+    }
+    if(strcmp(opcode, "push") == 0 || strcmp(opcode, "pop") == 0) {
+        if(count != 1 || a->kind != X86_64_OPERAND_REGISTER || a->size != 8) return false;
+        encode_with_register(enc, 0, false, false, opcode[1] == 'u' ? 0x50 : 0x58, a->reg);
+        return true;
+    }
+    if(strcmp(opcode, "call") == 0) return count == 1 && encode_branch(enc, 0xE8, 1, 2, a);
+    if(strcmp(opcode, "jmp") == 0) return count == 1 && encode_branch(enc, 0xE9, 1, 4, a);
+    if(strcmp(opcode, "ret") == 0) {
+        put_byte(enc, 0xC3);
+        return count == 0;
+    }
+    if(strcmp(opcode, "vzeroupper") == 0) {
+        put_value(enc, 0x77F8C5, 3);
+        return count == 0;
+    }
+    if(strcmp(opcode, "cqo") == 0 || strcmp(opcode, "cdq") == 0) {
+        if(opcode[1] == 'q') put_byte(enc, 0x48);
+        put_byte(enc, 0x99);
+        return count == 0;
+    }
+
+    uint8_t cc = 0;
+    if(opcode[0] == 'j' && find_condition_code(opcode + 1, &cc)) {
+        return count == 1 && a->kind == X86_64_OPERAND_LABEL && encode_branch(enc, 0x0F80 + cc, 2, 0, a);
+    }
+    if(strncmp(opcode, "set", 3) == 0 && find_condition_code(opcode + 3, &cc)) {
+        if(count != 1 || !is_gpr_or_memory(a) || (a->kind == X86_64_OPERAND_REGISTER && a->size != 1)) return false;
+        encode_legacy(enc, 0, false, force_rex, 0x0F90 + cc, 2, 0, a);
+        return true;
+    }
+
+    return encode_vector_inst(enc, opcode, ops, count);
+}
+
+static void render_inst_text(char *buffer, size_t size, const X86_64_Inst *inst)
+{
+    size_t len = snprintf(buffer, size, "%s", inst->opcode);
+    for(size_t i = 0; i < inst->operands_count && len < size; ++i) {
+        len += snprintf(buffer + len, size - len, "%s%s", i == 0 ? " " : ", ", inst->operands[i]);
+    }
+}
+
+static void pad_code(X86_64_Object *object, X86_64_Function *function, size_t alignment)
+{
+    while(function->code.count % alignment != 0) push_code_byte(object->arena, function, 0x90);
+}
+
+// `align n` pads with nops, `dd` takes numbers and differences of two labels
+static void encode_directive(X86_64_Object *object, X86_64_Encoder *encoder, const char *text)
+{
+    X86_64_Function *function = encoder->function;
+    if(strncmp(text, "align ", 6) == 0) {
+        size_t alignment = strtoull(text + 6, NULL, 0);
+        if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+            fatal("Invalid alignment in directive `%s` of function %s", text, function->name);
+        }
+        if(alignment > function->alignment) function->alignment = alignment;
+        pad_code(object, function, alignment);
+        return;
+    }
+    if(strncmp(text, "dd ", 3) != 0) {
+        fatal("Unsupported directive `%s` in function %s", text, function->name);
+    }
+
+    const char *it = text + 3;
+    while(*it) {
+        while(*it == ' ' || *it == ',') ++it;
+        if(!*it) break;
+        const char *item = it;
+        while(*it && *it != ',') ++it;
+        size_t len = it - item;
+        while(len > 0 && item[len - 1] == ' ') --len;
+
+        int64_t value = 0;
+        if(!parse_number(item, len, &value)) {
+            const char *minus = memchr(item, '-', len);
+            if(minus == NULL) fatal("Unsupported data `%.*s` in function %s", (int)len, item, function->name);
+            const char *target_end = minus;
+            while(target_end > item && target_end[-1] == ' ') --target_end;
+            const char *base = minus + 1;
+            while(*base == ' ') ++base;
+            X86_64_Fixup *fixup = push_fixup(encoder);
+            fixup->offset = function->code.count;
+            snprintf(fixup->target, sizeof(fixup->target), "%.*s", (int)(target_end - item), item);
+            snprintf(fixup->base_label, sizeof(fixup->base_label), "%.*s", (int)(item + len - base), base);
+        }
+        for(size_t i = 0; i < 4; ++i) push_code_byte(object->arena, function, (uint8_t)((uint64_t)value >> (8*i)));
+    }
+}
+
+static const char *copy_symbol_name(X86_64_Object *object, String_View name)
+{
+    char *result = arena_alloc(object->arena, name.count + 1);
+    assert(result && "buy more ram lol!");
+    memcpy(result, name.data, name.count);
+    result[name.count] = '\0';
+    return result;
+}
+
+static void append_encoding(X86_64_Object *object, X86_64_Encoder *encoder, const X86_64_Encoding *enc)
+{
+    X86_64_Function *function = encoder->function;
+    size_t begin = function->code.count;
+    for(size_t i = 0; i < enc->count; ++i) push_code_byte(object->arena, function, enc->bytes[i]);
+    if(!enc->has_fixup) return;
+
+    // The field is relative to the end of the instruction, immediates may follow it
+    int64_t addend = enc->fixup_addend - (int64_t)(enc->count - enc->fixup_at);
+    if(enc->fixup_label[0] == '.') {
+        X86_64_Fixup *fixup = push_fixup(encoder);
+        fixup->offset = begin + enc->fixup_at;
+        snprintf(fixup->target, sizeof(fixup->target), "%s", enc->fixup_label);
+        fixup->base = begin + enc->fixup_at;
+        fixup->addend = addend;
+        return;
+    }
+    push_relocation(object->arena, function, (X86_64_Relocation){
+        .offset = begin + enc->fixup_at,
+        .symbol = copy_symbol_name(object, sv_from_cstr(enc->fixup_label)),
+        .addend = addend,
+    });
+}
+
+static void resolve_fixups(X86_64_Encoder *encoder)
+{
+    X86_64_Function *function = encoder->function;
+    for(size_t i = 0; i < encoder->fixups.count; ++i) {
+        const X86_64_Fixup *fixup = &encoder->fixups.data[i];
+        const X86_64_Label *target = find_label(encoder, fixup->target);
+        if(target == NULL) fatal("Undefined label %s in function %s", fixup->target, function->name);
+        int64_t base = (int64_t)fixup->base;
+        if(fixup->base_label[0] != '\0') {
+            const X86_64_Label *label = find_label(encoder, fixup->base_label);
+            if(label == NULL) fatal("Undefined label %s in function %s", fixup->base_label, function->name);
+            base = (int64_t)label->offset;
+        }
+        int64_t value = (int64_t)target->offset + fixup->addend - base;
+        for(size_t j = 0; j < 4; ++j) function->code.data[fixup->offset + j] = (uint8_t)((uint64_t)value >> (8*j));
+    }
+}
+
+void encode_x86_64_function(X86_64_Object *object, String_View name, bool is_global, const X86_64_Code *code)
+{
+    X86_64_Function *function = push_function(object);
+    function->name = copy_symbol_name(object, name);
+    function->is_global = is_global;
+    function->alignment = X86_64_FUNCTION_ALIGNMENT;
+
+    Arena arena = {0};
+    X86_64_Encoder encoder = {0};
+    encoder.arena = &arena;
+    encoder.function = function;
+    for(size_t i = 0; i < code->count; ++i) {
+        const X86_64_Inst *inst = &code->data[i];
+        switch(inst->kind) {
+            case X86_64_INST_OP:
+                {
+                    X86_64_Encoding enc = {0};
+                    if(!encode_inst(&enc, inst)) {
+                        char text[X86_64_INST_TEXT_CAPACITY + X86_64_INST_MAX_OPERANDS*X86_64_OPERAND_CAPACITY];
+                        render_inst_text(text, sizeof(text), inst);
+                        fatal("The x86-64 encoder does not support `%s` in function %s", text, function->name);
+                    }
+                    append_encoding(object, &encoder, &enc);
+                } break;
+            case X86_64_INST_LABEL:
+                {
+                    if(find_label(&encoder, inst->opcode)) fatal("Label %s defined twice in function %s", inst->opcode, function->name);
+                    push_label(&encoder, inst->opcode, function->code.count);
+                } break;
+            case X86_64_INST_DIRECTIVE:
+                {
+                    encode_directive(object, &encoder, inst->opcode);
+                } break;
+            case X86_64_INST_NOP:
+                break;
+        }
+    }
+    resolve_fixups(&encoder);
+    arena_free(&arena);
+}
+
+void add_x86_64_function(X86_64_Object *object, const char *name, bool is_global, const uint8_t *code, size_t size,
+        const X86_64_Relocation *relocations, size_t relocations_count)
+{
+    X86_64_Function *function = push_function(object);
+    function->name = copy_symbol_name(object, sv_from_cstr(name));
+    function->is_global = is_global;
+    function->alignment = X86_64_FUNCTION_ALIGNMENT;
+    for(size_t i = 0; i < size; ++i) push_code_byte(object->arena, function, code[i]);
+    for(size_t i = 0; i < relocations_count; ++i) {
+        X86_64_Relocation relocation = relocations[i];
+        relocation.symbol = copy_symbol_name(object, sv_from_cstr(relocation.symbol));
+        push_relocation(object->arena, function, relocation);
+    }
+}
+
+const X86_64_Function *find_x86_64_function(const X86_64_Object *object, const char *name)
+{
+    for(size_t i = 0; i < object->functions.count; ++i) {
+        if(strcmp(object->functions.data[i].name, name) == 0) return &object->functions.data[i];
+    }
+    return NULL;
+}
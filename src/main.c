@@ -1,7 +1,9 @@
 #include "elysia.h"
 #include "elysia_ast.h"
+#include "elysia_bytecode.h"
 #include "elysia_compiler.h"
 #include "elysia_lexer.h"
+#include "elysia_optimizer.h"
 #include "elysia_parser.h"
 #include "elysia_types.h"
 
@@ -14,10 +16,39 @@ void usage(FILE *f)
     fprintf(f, "USAGE: elysia SUBCOMMAND <ARGS> [KWARGS]\n");
     fprintf(f, "Available subcommands: \n");
     fprintf(f, "    com <file> <output?> [KWARGS]   Compile program\n");
+    fprintf(f, "    run <file> [KWARGS] [-- ARGS]   Compile program into memory and run it (x86-64 or baseline backend)\n");
+    fprintf(f, "    interp <file> [KWARGS] [-- ARGS] Run program on the bytecode interpreter\n");
     fprintf(f, "    tokenize <file>                 Tokenization step\n");
     fprintf(f, "    ast-dump <file>                 Dump the AST Node Tree\n");
     fprintf(f, "    version                         Get the current compiler version\n");
     fprintf(f, "    help                            Get this message\n");
+    fprintf(f, "Available KWARGS for `com`, `run` and `interp`: \n");
+    fprintf(f, "    -o <path>                       Output file path\n");
+    fprintf(f, "    --backend <kind>                Code generator: native, baseline, c (default: native)\n");
+    fprintf(f, "    --emit <kind>                   What to output: ir, asm, obj, exe (default: ir)\n");
+    fprintf(f, "    --qbe <path>                    QBE executable used by `--emit asm|obj` (default: %s)\n", ELYSIA_DEFAULT_QBE_PATH);
+    fprintf(f, "    --assembler <path>              C compiler used to assemble by `--emit obj|exe` (default: %s)\n", ELYSIA_DEFAULT_ASSEMBLER);
+    fprintf(f, "    --c-opt-level <level>           Optimization level of the C backend's output: 0, 1, 2, 3, s (default: 2)\n");
+    fprintf(f, "    --no-inline                     Disable function inlining\n");
+    fprintf(f, "    --inline-threshold <size>       Maximum callee size to inline (default: %d)\n", ELYSIA_DEFAULT_INLINE_THRESHOLD);
+    fprintf(f, "    --inline-leaf-size <size>       Always inline leaf functions up to this size (default: %d)\n", ELYSIA_DEFAULT_INLINE_LEAF_SIZE);
+    fprintf(f, "    --no-if-ladders                 Keep if/else-if ladders over constants as sequential tests\n");
+    fprintf(f, "    --no-loop-opt                   Disable loop-invariant code motion and strength reduction\n");
+    fprintf(f, "    --no-cse                        Disable common subexpression elimination\n");
+    fprintf(f, "    --report-cse                    Report every eliminated common subexpression\n");
+    fprintf(f, "    --no-comptime                   Only evaluate calls to `comptime` functions at compile time\n");
+    fprintf(f, "    --report-comptime               Report how many calls were evaluated at compile time\n");
+    fprintf(f, "    --no-dfe                        Keep functions unreachable from `main` and `pub` functions\n");
+    fprintf(f, "    --report-dfe                    Report how many unreachable functions were removed\n");
+    fprintf(f, "    --no-tail-calls                 Keep calls in tail position as regular calls\n");
+    fprintf(f, "    --no-peephole                   Disable the peephole optimizer of the x86-64 backend\n");
+    fprintf(f, "    --no-slot-coloring              Give every variable a stack slot of its own\n");
+    fprintf(f, "    --report-jit                    Report the functions `run` compiled and the ones never called\n");
+    fprintf(f, "    --annotate-ir                   Annotate the QBE IR with the compiler source lines that emitted it\n");
+    fprintf(f, "    -j <jobs>                       QBE processes compiling shards of the functions at once (default: 1, max: %d)\n", ELYSIA_QBE_MAX_JOBS);
+    fprintf(f, "    --cache-dir <path>              Reuse the objects of functions whose QBE IR didn't change from this directory\n");
+    fprintf(f, "    --report-cache                  Report how many functions were reused from the cache\n");
+    fprintf(f, "    --target-features <features>    Vector extension for loop vectorization: scalar, sse2, avx2 (default: sse2)\n");
 }
 
 String_View shift(int *argc, char ***argv, const char *error)
@@ -32,6 +63,193 @@ String_View shift(int *argc, char ***argv, const char *error)
     return sv_from_parts(result, strlen(result));
 }
 
+typedef struct {
+    String_View source_path;
+    String_View output_path;
+    Optimizer_Options optimizer;
+    Compile_Options compiler;
+    // Whatever follows `--`, passed on to the program by `run`
+    int program_argc;
+    char **program_argv;
+} Command_Options;
+
+void parse_command_options(int argc, char **argv, Command_Options *result)
+{
+    memset(result, 0, sizeof(*result));
+    result->output_path = SV("output.ir");
+    result->optimizer.inline_functions = true;
+    result->optimizer.inline_threshold = ELYSIA_DEFAULT_INLINE_THRESHOLD;
+    result->optimizer.inline_leaf_size = ELYSIA_DEFAULT_INLINE_LEAF_SIZE;
+    result->optimizer.convert_if_ladders = true;
+    result->optimizer.optimize_loops = true;
+    result->optimizer.eliminate_common_subexprs = true;
+    result->optimizer.report_cse = false;
+    result->optimizer.fold_comptime_calls = true;
+    result->optimizer.report_comptime = false;
+    result->optimizer.eliminate_dead_functions = true;
+    result->optimizer.report_dead_functions = false;
+    result->compiler.backend = BACKEND_KIND_NATIVE;
+    result->compiler.output_kind = OUTPUT_KIND_IR;
+    result->compiler.qbe_path = ELYSIA_DEFAULT_QBE_PATH;
+    result->compiler.assembler = ELYSIA_DEFAULT_ASSEMBLER;
+    result->compiler.c_optimization = ELYSIA_DEFAULT_C_OPTIMIZATION;
+    result->compiler.target_features = TARGET_FEATURES_SSE2;
+    result->compiler.peephole = true;
+    result->compiler.tail_calls = true;
+    result->compiler.color_stack_slots = true;
+    result->compiler.report_jit = false;
+    result->compiler.annotate_ir = false;
+    result->compiler.jobs = 1;
+    result->compiler.cache_dir = NULL;
+    result->compiler.report_cache = false;
+    while(argc > 0) {
+        String_View item = shift(&argc, &argv, "Unreachable");
+        if(sv_eq(item, SV("-o"))) {
+            result->output_path = shift(&argc, &argv, "Please provide the argument for `-o` flag");
+        } else if(sv_eq(item, SV("--emit"))) {
+            String_View kind = shift(&argc, &argv, "Please provide the argument for `--emit` flag");
+            if(sv_eq(kind, SV("ir"))) {
+                result->compiler.output_kind = OUTPUT_KIND_IR;
+            } else if(sv_eq(kind, SV("asm"))) {
+                result->compiler.output_kind = OUTPUT_KIND_ASM;
+            } else if(sv_eq(kind, SV("obj"))) {
+                result->compiler.output_kind = OUTPUT_KIND_OBJ;
+            } else if(sv_eq(kind, SV("exe"))) {
+                result->compiler.output_kind = OUTPUT_KIND_EXE;
+            } else {
+                usage(stderr);
+                fatal("Unknown output kind `"SV_FMT"`", SV_ARGV(kind));
+            }
+        } else if(sv_eq(item, SV("--backend")) || sv_has_prefix(item, SV("--backend="))) {
+            String_View kind = sv_eq(item, SV("--backend"))
+                ? shift(&argc, &argv, "Please provide the argument for `--backend` flag")
+                : sv_slice(item, sizeof("--backend=") - 1, item.count);
+            if(sv_eq(kind, SV("native"))) {
+                result->compiler.backend = BACKEND_KIND_NATIVE;
+            } else if(sv_eq(kind, SV("baseline"))) {
+                result->compiler.backend = BACKEND_KIND_BASELINE;
+            } else if(sv_eq(kind, SV("c"))) {
+                result->compiler.backend = BACKEND_KIND_C;
+            } else {
+                usage(stderr);
+                fatal("Unknown backend `"SV_FMT"`", SV_ARGV(kind));
+            }
+        } else if(sv_eq(item, SV("--qbe"))) {
+            result->compiler.qbe_path = shift(&argc, &argv, "Please provide the argument for `--qbe` flag").data;
+        } else if(sv_eq(item, SV("--assembler"))) {
+            result->compiler.assembler = shift(&argc, &argv, "Please provide the argument for `--assembler` flag").data;
+        } else if(sv_eq(item, SV("--c-opt-level"))) {
+            String_View level = shift(&argc, &argv, "Please provide the argument for `--c-opt-level` flag");
+            static const char *c_optimizations[] = { "-O0", "-O1", "-O2", "-O3", "-Os" };
+            result->compiler.c_optimization = NULL;
+            for(size_t i = 0; i < sizeof(c_optimizations)/sizeof(c_optimizations[0]); ++i) {
+                if(sv_eq(level, sv_from_parts(c_optimizations[i] + 2, 1))) result->compiler.c_optimization = c_optimizations[i];
+            }
+            if(!result->compiler.c_optimization) {
+                usage(stderr);
+                fatal("Unknown C optimization level `"SV_FMT"`", SV_ARGV(level));
+            }
+        } else if(sv_eq(item, SV("--no-inline"))) {
+            result->optimizer.inline_functions = false;
+        } else if(sv_eq(item, SV("--no-if-ladders"))) {
+            result->optimizer.convert_if_ladders = false;
+        } else if(sv_eq(item, SV("--no-loop-opt"))) {
+            result->optimizer.optimize_loops = false;
+        } else if(sv_eq(item, SV("--no-cse"))) {
+            result->optimizer.eliminate_common_subexprs = false;
+        } else if(sv_eq(item, SV("--report-cse"))) {
+            result->optimizer.report_cse = true;
+        } else if(sv_eq(item, SV("--no-comptime"))) {
+            result->optimizer.fold_comptime_calls = false;
+        } else if(sv_eq(item, SV("--report-comptime"))) {
+            result->optimizer.report_comptime = true;
+        } else if(sv_eq(item, SV("--no-dfe"))) {
+            result->optimizer.eliminate_dead_functions = false;
+        } else if(sv_eq(item, SV("--report-dfe"))) {
+            result->optimizer.report_dead_functions = true;
+        } else if(sv_eq(item, SV("--inline-threshold"))) {
+            result->optimizer.inline_threshold = sv_to_int(shift(&argc, &argv, "Please provide the argument for `--inline-threshold` flag"));
+        } else if(sv_eq(item, SV("--inline-leaf-size"))) {
+            result->optimizer.inline_leaf_size = sv_to_int(shift(&argc, &argv, "Please provide the argument for `--inline-leaf-size` flag"));
+        } else if(sv_eq(item, SV("--no-tail-calls"))) {
+            result->compiler.tail_calls = false;
+        } else if(sv_eq(item, SV("--no-peephole"))) {
+            result->compiler.peephole = false;
+        } else if(sv_eq(item, SV("--no-slot-coloring"))) {
+            result->compiler.color_stack_slots = false;
+        } else if(sv_eq(item, SV("--report-jit"))) {
+            result->compiler.report_jit = true;
+        } else if(sv_eq(item, SV("--annotate-ir"))) {
+            result->compiler.annotate_ir = true;
+        } else if(sv_eq(item, SV("-j"))) {
+            int jobs = sv_to_int(shift(&argc, &argv, "Please provide the argument for `-j` flag"));
+            if(jobs < 1 || jobs > ELYSIA_QBE_MAX_JOBS) {
+                usage(stderr);
+                fatal("The number of jobs must be between 1 and %d", ELYSIA_QBE_MAX_JOBS);
+            }
+            result->compiler.jobs = jobs;
+        } else if(sv_eq(item, SV("--cache-dir"))) {
+            result->compiler.cache_dir = shift(&argc, &argv, "Please provide the argument for `--cache-dir` flag").data;
+        } else if(sv_eq(item, SV("--report-cache"))) {
+            result->compiler.report_cache = true;
+        } else if(sv_eq(item, SV("--target-features"))) {
+            String_View features = shift(&argc, &argv, "Please provide the argument for `--target-features` flag");
+            if(sv_eq(features, SV("scalar"))) {
+                result->compiler.target_features = TARGET_FEATURES_SCALAR;
+            } else if(sv_eq(features, SV("sse2"))) {
+                result->compiler.target_features = TARGET_FEATURES_SSE2;
+            } else if(sv_eq(features, SV("avx2"))) {
+                result->compiler.target_features = TARGET_FEATURES_AVX2;
+            } else {
+                usage(stderr);
+                fatal("Unknown target features `"SV_FMT"`", SV_ARGV(features));
+            }
+        } else if(sv_eq(item, SV("--"))) {
+            break;
+        } else if(result->source_path.count == 0) {
+            result->source_path = item;
+        }
+    }
+
+    result->program_argc = argc;
+    result->program_argv = argv;
+
+    if(result->source_path.count <= 0) {
+        usage(stderr);
+        fatal("Please provide the source file path");
+    }
+}
+
+// Parses, optimizes and evaluates the source file
+Evaluated_Module *load_module(Arena *arena, Lexer *lex, const Command_Options *options, bool dump_ast)
+{
+    const char *source_data = arena_load_file_data(arena, options->source_path.data);
+    if(!source_data) {
+        fatal("Failed to load source file data");
+    }
+
+    String_View source = sv_from_parts(source_data, strlen(source_data));
+    if(!init_lexer(lex, options->source_path, source)) {
+        fatal("Failed to initialize the lexer");
+    }
+
+    // The evaluated module keeps referring to the parsed one
+    Module *mod = arena_alloc(arena, sizeof(Module));
+    *mod = parse_module(arena, lex);
+    optimize_module(arena, mod, &options->optimizer);
+    if(dump_ast) {
+        for(size_t i = 0; i < mod->functions.count; ++i) {
+            dump_func_def(&mod->functions.data[i], 0);
+        }
+    }
+    Evaluated_Module *module = arena_alloc(arena, sizeof(Evaluated_Module));
+    if(!eval_module(module, mod)) {
+        fprintf(stderr, "Failed to evaluate the program\n");
+        compilation_failure();
+    }
+    return module;
+}
+
 int main(int argc, char **argv)
 {
     shift(&argc, &argv, "Unreachable");
@@ -41,43 +259,45 @@ int main(int argc, char **argv)
     Lexer lex;
     lex.i = 0;
     if(sv_eq(subcommand, SV("com"))) {
-        String_View output_path = SV("output.ir");
-        String_View source_path = {0};
-        while(argc > 0) {
-            String_View item = shift(&argc, &argv, "Unreachable");
-            if(sv_eq(item, SV("-o"))) {
-                output_path = shift(&argc, &argv, "Please provide the argument for `-o` flag");
-            } else if(source_path.count == 0) {
-                source_path = item;
-            }
-        }
-
-        if(source_path.count <= 0) {
-            usage(stderr);
-            fatal("Please provide the source file path");
-        }
-
-        const char *source_data = arena_load_file_data(&arena, source_path.data);
-        if(!source_data) {
-            fatal("Failed to load source file data");
+        Command_Options options;
+        parse_command_options(argc, argv, &options);
+        Evaluated_Module *module = load_module(&arena, &lex, &options, true);
+        if(options.compiler.backend == BACKEND_KIND_BASELINE) {
+            compile_module_to_baseline_file(options.output_path.data, module, &options.compiler);
+        } else if(options.compiler.backend == BACKEND_KIND_C) {
+            compile_module_to_c_file(options.output_path.data, module, &options.compiler);
+        } else {
+            compile_module_to_file(options.output_path.data, module, &options.compiler);
         }
-
-        String_View source = sv_from_parts(source_data, strlen(source_data));
-        if(!init_lexer(&lex, source_path, source)) {
-            fatal("Failed to initialize the lexer");
+    } else if(sv_eq(subcommand, SV("run"))) {
+        Command_Options options;
+        parse_command_options(argc, argv, &options);
+        Evaluated_Module *module = load_module(&arena, &lex, &options, false);
+        // The program sees its own path as argv[0] like it would when started on its own
+        char **program_argv = arena_alloc(&arena, (options.program_argc + 2)*sizeof(char *));
+        program_argv[0] = (char *)options.source_path.data;
+        for(int i = 0; i < options.program_argc; ++i) program_argv[i + 1] = options.program_argv[i];
+        program_argv[options.program_argc + 1] = NULL;
+        if(options.compiler.backend == BACKEND_KIND_BASELINE) {
+            return run_module_baseline(module, &options.compiler, options.program_argc + 1, program_argv);
         }
-
-        Module mod = parse_module(&arena, &lex);
-        for(size_t i = 0; i < mod.functions.count; ++i) {
-            dump_func_def(&mod.functions.data[i], 0);
-        }
-        Evaluated_Module *module = arena_alloc(&arena, sizeof(Evaluated_Module));
-        if(eval_module(module, &mod)) {
-            compile_module_to_file(output_path.data, module);
-        } else {
-            fprintf(stderr, "Failed to evaluate the program\n");
-            compilation_failure();
+        if(options.compiler.backend == BACKEND_KIND_C) {
+            fatal("The C backend can't run programs in-process, build an executable with `com --emit exe`");
         }
+        return run_module(module, &options.compiler, options.program_argc + 1, program_argv);
+    } else if(sv_eq(subcommand, SV("interp"))) {
+        Command_Options options;
+        parse_command_options(argc, argv, &options);
+        Evaluated_Module *module = load_module(&arena, &lex, &options, false);
+        char **program_argv = arena_alloc(&arena, (options.program_argc + 2)*sizeof(char *));
+        program_argv[0] = (char *)options.source_path.data;
+        for(int i = 0; i < options.program_argc; ++i) program_argv[i + 1] = options.program_argv[i];
+        program_argv[options.program_argc + 1] = NULL;
+        Bytecode_Module bytecode = { .arena = &arena };
+        compile_module_to_bytecode(&bytecode, module, &options.compiler);
+        return interpret_bytecode_module(&bytecode, options.program_argc + 1, program_argv);
+    } else if(sv_eq(subcommand, SV("version"))) {
+        printf("elysia %s\n", ELYSIA_VERSION);
     } else if(sv_eq(subcommand, SV("ast-dump"))) {
         String_View source_path = shift(&argc, &argv, "Please provide the source file path");
 
@@ -114,7 +114,7 @@ String_View sv_slice(String_View strv, size_t start, size_t end)
 
 bool sv_eq(String_View a, String_View b)
 {
-    if(a.count < b.count)
+    if(a.count != b.count)
         return false;
     for(size_t i = 0; i < b.count; ++i) {
         if(a.data[i] != b.data[i]) 